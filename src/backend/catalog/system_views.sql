@@ -848,6 +848,23 @@ CREATE VIEW pg_stat_user_functions AS
     WHERE P.prolang != 12  -- fast check to eliminate built-in functions
           AND pg_stat_get_function_calls(P.oid) IS NOT NULL;
 
+CREATE VIEW pg_stat_lambdas AS
+    SELECT
+            L.fingerprint,
+            L.scans,
+            L.compiles,
+            L.interpreted_init_time,
+            L.baseline_compile_time,
+            L.optimized_compile_time,
+            L.evals,
+            L.eval_time,
+            L.derives,
+            L.derive_time,
+            L.derive_time / nullif(L.derives, 0) AS mean_derive_time,
+            L.kernel_time,
+            L.kernel_bytes
+    FROM pg_stat_get_lambdas() AS L;
+
 CREATE VIEW pg_stat_xact_user_functions AS
     SELECT
             P.oid AS funcid,
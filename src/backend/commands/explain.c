@@ -111,6 +111,7 @@ static void show_foreignscan_info(ForeignScanState *fsstate, ExplainState *es);
 static void show_eval_params(Bitmapset *bms_params, ExplainState *es);
 static const char *explain_get_index_name(Oid indexId);
 static void show_buffer_usage(ExplainState *es, const BufferUsage *usage);
+static void show_lambda_instrumentation(PlanState *planstate, ExplainState *es);
 static void ExplainIndexScanDetails(Oid indexid, ScanDirection indexorderdir,
 						ExplainState *es);
 static void ExplainScanTarget(Scan *plan, ExplainState *es);
@@ -1793,6 +1794,10 @@ ExplainNode(PlanState *planstate, List *ancestors,
 	if (es->buffers && planstate->instrument)
 		show_buffer_usage(es, &planstate->instrument->bufusage);
 
+	/* Show the lambdas passed to the node's table functions */
+	if (es->analyze && es->verbose && planstate->lambda_instrument != NIL)
+		show_lambda_instrumentation(planstate, es);
+
 	/* Show worker detail */
 	if (es->analyze && es->verbose && planstate->worker_instrument)
 	{
@@ -2767,6 +2772,92 @@ explain_get_index_name(Oid indexId)
 	return result;
 }
 
+/*
+ * Show the instrumentation of the lambdas passed to table functions.
+ */
+static void
+show_lambda_instrumentation(PlanState *planstate, ExplainState *es)
+{
+	/* indexed by LambdaTier */
+	static const char *const tier_names[] = {"interpreted", "baseline", "optimized"};
+	ListCell   *lc;
+	int			n = 0;
+
+	ExplainOpenGroup("Lambdas", "Lambdas", false, es);
+	foreach(lc, planstate->lambda_instrument)
+	{
+		LambdaInstrumentation *instr = (LambdaInstrumentation *) lfirst(lc);
+		double		compile_time[lengthof(tier_names)];
+		double		eval_time = 1000.0 * INSTR_TIME_GET_DOUBLE(instr->eval_time);
+		double		derive_time = 1000.0 * INSTR_TIME_GET_DOUBLE(instr->derive_time);
+		double		kernel_time = 1000.0 * INSTR_TIME_GET_DOUBLE(instr->kernel_time);
+		char		fingerprint[32];
+
+		for (int i = 0; i < lengthof(tier_names); i++)
+			compile_time[i] = 1000.0 * INSTR_TIME_GET_DOUBLE(instr->compile_time[i]);
+		snprintf(fingerprint, sizeof(fingerprint), UINT64_FORMAT, instr->fingerprint);
+		n++;
+
+		ExplainOpenGroup("Lambda", NULL, true, es);
+		if (es->format == EXPLAIN_FORMAT_TEXT)
+		{
+			appendStringInfoSpaces(es->str, es->indent * 2);
+			appendStringInfo(es->str, "Lambda %d: Fingerprint: %s  Tier: %s\n",
+							 n, fingerprint, tier_names[instr->tier]);
+			es->indent++;
+
+			appendStringInfoSpaces(es->str, es->indent * 2);
+			appendStringInfo(es->str, "Compiles: %ld", (long) instr->ncompiles);
+			if (es->timing)
+				appendStringInfo(es->str, "  Time: interpreted=%.3f ms baseline=%.3f ms optimized=%.3f ms",
+								 compile_time[0], compile_time[1], compile_time[2]);
+			appendStringInfoChar(es->str, '\n');
+
+			appendStringInfoSpaces(es->str, es->indent * 2);
+			appendStringInfo(es->str, "Evaluations: %ld", (long) instr->nevals);
+			if (es->timing)
+				appendStringInfo(es->str, "  Time: %.3f ms", eval_time);
+			appendStringInfo(es->str, "  Derivations: %ld", (long) instr->nderives);
+			if (es->timing)
+				appendStringInfo(es->str, "  Time: %.3f ms  Average: %.3f ms", derive_time,
+								 instr->nderives > 0 ? derive_time / instr->nderives : 0.0);
+			appendStringInfoChar(es->str, '\n');
+
+			appendStringInfoSpaces(es->str, es->indent * 2);
+			appendStringInfoString(es->str, "Matrix Kernels:");
+			if (es->timing)
+				appendStringInfo(es->str, "  Time: %.3f ms", kernel_time);
+			appendStringInfo(es->str, "  Allocated: " UINT64_FORMAT "kB\n", (instr->kernel_bytes + 1023) / 1024);
+
+			es->indent--;
+		}
+		else
+		{
+			ExplainPropertyText("Fingerprint", fingerprint, es);
+			ExplainPropertyText("Tier", tier_names[instr->tier], es);
+			ExplainPropertyInteger("Compiles", NULL, instr->ncompiles, es);
+			if (es->timing)
+			{
+				ExplainPropertyFloat("Interpreted Init Time", "ms", compile_time[0], 3, es);
+				ExplainPropertyFloat("Baseline Compile Time", "ms", compile_time[1], 3, es);
+				ExplainPropertyFloat("Optimized Compile Time", "ms", compile_time[2], 3, es);
+			}
+			ExplainPropertyInteger("Evaluations", NULL, instr->nevals, es);
+			if (es->timing)
+				ExplainPropertyFloat("Evaluation Time", "ms", eval_time, 3, es);
+			ExplainPropertyInteger("Derivations", NULL, instr->nderives, es);
+			if (es->timing)
+			{
+				ExplainPropertyFloat("Derivation Time", "ms", derive_time, 3, es);
+				ExplainPropertyFloat("Matrix Kernel Time", "ms", kernel_time, 3, es);
+			}
+			ExplainPropertyInteger("Matrix Allocated", "kB", (instr->kernel_bytes + 1023) / 1024, es);
+		}
+		ExplainCloseGroup("Lambda", NULL, true, es);
+	}
+	ExplainCloseGroup("Lambdas", "Lambdas", false, es);
+}
+
 /*
  * Show buffer usage details.
  */
@@ -572,6 +572,10 @@ IndexSupportsBackwardScan(Oid indexid)
  * its output (typically by keeping it in a tuplestore).  For such plans,
  * a rescan without any parameter change will have zero startup cost and
  * very low per-tuple cost.
+ *
+ * A FunctionScan may stream the rows of its function instead, but only when
+ * it is not asked to support such rescans (EXEC_FLAG_REWIND), which is the
+ * case whenever the planner relies on the result of this function.
  */
 bool
 ExecMaterializesOutput(NodeTag plantype)
@@ -30,8 +30,10 @@
  */
 #include "postgres.h"
 
+#include "access/hash.h"
 #include "access/nbtree.h"
 #include "catalog/objectaccess.h"
+#include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
 #include "executor/execExpr.h"
 #include "executor/nodeSubplan.h"
@@ -58,6 +60,10 @@ typedef struct LastAttnumInfo
 
 static void ExecReadyExpr(ExprState *state);
 static void ExecReadyDeriveExpr(ExprState *state);
+static bool ExecLambdaTapeStepsEqual(ExprState *state, LambdaDeriveTape *tape, int a, int b);
+static void ExecLambdaDeriveTape(ExprState *state, Datum seed, Datum *derivatives);
+static void ExecLambdaTapeAccumulate(ExprState *state, int stepIndex, Datum seed);
+static char *ExecLambdaKeyString(LambdaExpr *lambda, Bitmapset *wrt);
 static void ExecInitExprRec(Expr *node, ExprState *state,
 							Datum *resv, bool *resnull);
 static void ExecInitFunc(ExprEvalStep *scratch, Expr *node, List *args,
@@ -153,18 +159,62 @@ ExecInitExpr(Expr *node, PlanState *parent)
  */
 ExprState *
 ExecInitLambdaExpr(Node *node, bool fastLambda, bool buildDiff)
+{
+	return ExecInitLambdaExprWrt(node, fastLambda, buildDiff, NULL);
+}
+
+/*
+ * ExecInitLambdaExprWrt: prepare a lambda expression, that is only derived with respect to some of its inputs
+ *
+ * WRT holds the derivative indexes(see ExecGenerateIndexArray) of the inputs, whose derivatives the caller
+ * reads, NULL derives for all inputs. The derivatives of the other inputs are left untouched, and subexpressions
+ * not depending on any requested input are skipped by the reverse sweep.
+ */
+ExprState *
+ExecInitLambdaExprWrt(Node *node, bool fastLambda, bool buildDiff, Bitmapset *wrt)
+{
+	return ExecInitLambdaExprTier(node, fastLambda, buildDiff, wrt, LAMBDA_TIER_OPTIMIZED);
+}
+
+/*
+ * ExecInitLambdaExprTier: prepare a lambda expression for execution in TIER
+ *
+ * Table functions start a large input in a cheap tier, and switch to the optimized code once the input turned
+ * out to be long enough to pay for its compilation, by initializing the lambda again. Fast lambdas cannot be
+ * interpreted, as they take their inputs as plain datums instead of parameters. Code of the lower tiers is never
+ * added to the cache of compiled lambdas.
+ */
+ExprState *
+ExecInitLambdaExprTier(Node *node, bool fastLambda, bool buildDiff, Bitmapset *wrt, LambdaTier tier)
 {
 	int oldflags;
-	ParamListInfo paramList;
+	ParamListInfo paramList = NULL;
 	ExprState *state;
 	LambdaExpr *expr = (LambdaExpr *)node;
+	LambdaInstrumentation *instr;
 
 	/* Special case: NULL expression produces a NULL ExprState pointer */
 	if (node == NULL)
 		return NULL;
 
+	if (fastLambda && tier == LAMBDA_TIER_INTERPRETED)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("fast lambda expressions cannot be interpreted")));
+
+	if (buildDiff)
+		ExecCheckLambdaDerivable(expr);
+
 	ExprEvalStep scratch = {0};
 
+	/* The initialization counts as compile time of the tier */
+	instr = ExecLambdaInstrumentation(expr);
+	if (instr)
+	{
+		instr->tier = tier;
+		InstrLambdaStart(instr);
+	}
+
 	if (!fastLambda)
 	{
 		paramList = (ParamListInfo)palloc0(offsetof(ParamListInfoData, params) +
@@ -205,14 +255,31 @@ ExecInitLambdaExpr(Node *node, bool fastLambda, bool buildDiff)
 	/* Set indexArray for easy lookups of derivative index */
 	state->indexArray = ExecGenerateIndexArray(expr);
 
+	/* Fast lambdas may reuse code compiled by earlier queries */
+	if (fastLambda && tier == LAMBDA_TIER_OPTIMIZED)
+		state->lambda_cache_key = ExecLambdaCacheKey(expr, buildDiff ? wrt : NULL);
+
 
 	oldflags = state->parent->state->es_jit_flags;
 
 	state->fast_jit = fastLambda;
-	state->parent->state->es_jit_flags |= PGJIT_INLINE;
-	state->parent->state->es_jit_flags |= PGJIT_OPT3;
+	if (tier == LAMBDA_TIER_OPTIMIZED)
+	{
+		state->parent->state->es_jit_flags |= PGJIT_INLINE;
+		state->parent->state->es_jit_flags |= PGJIT_OPT3;
+	}
+	else
+		state->parent->state->es_jit_flags &= ~(PGJIT_INLINE | PGJIT_OPT3);
+
+	if (tier == LAMBDA_TIER_INTERPRETED) {
+		if (buildDiff) {
+			ExecBuildLambdaDeriveTape(state, wrt);
+			state->derivefunc = (ExprStateDeriveFunc) ExecDeriveLambdaExpr;
+		}
+		ExecReadyInterpretedExpr(state);
+	} else if (buildDiff) {
+		ExecBuildLambdaDeriveTape(state, wrt);
 
-	if (buildDiff) {
 		if (!jit_force_compile_expr(state, true))
 		{
 			ereport(WARNING,
@@ -244,9 +311,57 @@ ExecInitLambdaExpr(Node *node, bool fastLambda, bool buildDiff)
 		castNode(ExprContext, expr->econtext)->ecxt_param_list_info = paramList;
 	}
 
+	state->lambda_instr = instr;
+	if (instr)
+		InstrLambdaStop(instr, LAMBDA_INSTR_COMPILE, 1);
+
 	return state;
 }
 
+/*
+ * lambda_contains_matrix_walker: true, if any node of the expression is of the matrix type
+ */
+static bool
+lambda_contains_matrix_walker(Node *node, void *context)
+{
+	if (node == NULL)
+		return false;
+	if (!IsA(node, List) && exprType(node) == MATRIXOID)
+		return true;
+	return expression_tree_walker(node, lambda_contains_matrix_walker, context);
+}
+
+/*
+ * ExecCheckLambdaDerivable: reject the derivation of lambdas over the matrix type
+ *
+ * The matrix type is a storage type: lambdas over it can be evaluated, but the
+ * reverse sweep only knows the float8[] versions of the matrix functions and
+ * builds its derivatives as float8[].  Inputs of type matrix have to be cast to
+ * float8[] by the input query.
+ */
+void
+ExecCheckLambdaDerivable(LambdaExpr *expr)
+{
+	bool		containsMatrix = false;
+	ListCell   *lc;
+
+	foreach(lc, expr->argtypes)
+	{
+		TupleDesc	desc = (TupleDesc) lfirst(lc);
+
+		for (int i = 0; i < desc->natts; i++)
+			containsMatrix |= TupleDescAttr(desc, i)->atttypid == MATRIXOID;
+	}
+	containsMatrix |= expr->rettype == MATRIXOID;
+	containsMatrix |= lambda_contains_matrix_walker((Node *) expr->expr, NULL);
+
+	if (containsMatrix)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("lambda expressions over the matrix type cannot be derived"),
+				 errhint("Cast the matrix columns of the input to float8[].")));
+}
+
 /*
  * ExecCheckLambdaForMatrix: Check lambda for Matrix 
  * 
@@ -303,6 +418,227 @@ int ExecGetLambdaDerivativesLength(LambdaExpr *expr) {
 	return runningTally;
 }
 
+static bool
+ExecLambdaHasByRefConst(Node *node, void *context)
+{
+	if (node == NULL)
+		return false;
+	if (IsA(node, Const))
+		return !((Const *) node)->constisnull && !((Const *) node)->constbyval;
+
+	return expression_tree_walker(node, ExecLambdaHasByRefConst, context);
+}
+
+/*
+ * ExecLambdaCacheKey: Key of a fast lambda in the cache of compiled lambdas
+ *
+ * The key is the lambda body in its textual node form without the token locations, followed by the column types
+ * of the argument rows, the return type and the derived inputs(WRT).  Lambdas with constants of pass-by-reference
+ * types get no key(NULL), since their compiled code points to memory of the current query.
+ */
+char *ExecLambdaCacheKey(LambdaExpr *lambda, Bitmapset *wrt)
+{
+	if (ExecLambdaHasByRefConst((Node *) lambda->expr, NULL))
+		return NULL;
+
+	return ExecLambdaKeyString(lambda, wrt);
+}
+
+/*
+ * ExecLambdaFingerprint: Hash identifying a lambda across queries, for its statistics
+ *
+ * Unlike the cache key, the fingerprint neither depends on the derived inputs nor on the kind of constants.
+ */
+uint64 ExecLambdaFingerprint(LambdaExpr *lambda)
+{
+	char *key = ExecLambdaKeyString(lambda, NULL);
+	uint64 fingerprint = DatumGetUInt64(hash_any_extended((unsigned char *) key, strlen(key), 0));
+
+	pfree(key);
+	return fingerprint;
+}
+
+/*
+ * The textual form of LAMBDA underlying ExecLambdaCacheKey
+ */
+static char *ExecLambdaKeyString(LambdaExpr *lambda, Bitmapset *wrt)
+{
+	StringInfoData buf;
+	char *tree;
+	ListCell *lc;
+
+	initStringInfo(&buf);
+	tree = nodeToString(lambda->expr);
+	for (char *p = tree; *p != '\0'; p++)
+	{
+		if (strncmp(p, " :location ", 11) == 0)
+		{
+			p += 11;
+			if (*p == '-')
+				p++;
+			while (isdigit((unsigned char) p[1]))
+				p++;
+			continue;
+		}
+		appendStringInfoChar(&buf, *p);
+	}
+	pfree(tree);
+
+	foreach(lc, lambda->argtypes)
+	{
+		TupleDesc inDesc = (TupleDesc) lfirst(lc);
+
+		appendStringInfoString(&buf, " :argtypes");
+		for (int i = 0; i < inDesc->natts; i++)
+			appendStringInfo(&buf, " %u/%d", TupleDescAttr(inDesc, i)->atttypid, TupleDescAttr(inDesc, i)->atttypmod);
+	}
+	appendStringInfo(&buf, " :rettype %u/%d", lambda->rettype, lambda->rettypmod);
+	if (wrt != NULL)
+	{
+		int member = -1;
+
+		appendStringInfoString(&buf, " :wrt");
+		while ((member = bms_next_member(wrt, member)) >= 0)
+			appendStringInfo(&buf, " %d", member);
+	}
+
+	return buf.data;
+}
+
+/*
+ * ExecBuildLambdaDeriveTape: Build the reverse-mode tape for a lambda expression
+ *
+ * Replays the postfix step sequence on a stack, to record which steps produce the arguments of each step, and
+ * maps every step onto the first structurally identical step(canonical step). Identical subexpressions, e.g. both
+ * operands of a.x * a.x, thereby share one adjoint slot and are only derived once per row.
+ * A step is marked active, if it selects an input in WRT(any input, if WRT is NULL) or has an active argument.
+ */
+void ExecBuildLambdaDeriveTape(ExprState *state, Bitmapset *wrt)
+{
+	LambdaDeriveTape *tape = palloc0(sizeof(LambdaDeriveTape));
+	int *stack = palloc(state->steps_len * sizeof(int));
+	int stackPointer = 0;
+	int numArgs = 0;
+
+	tape->nsteps = state->steps_len;
+	tape->canonical = palloc(state->steps_len * sizeof(int));
+	tape->nargs = palloc0(state->steps_len * sizeof(int));
+	tape->argoffset = palloc0(state->steps_len * sizeof(int));
+	tape->args = palloc(state->steps_len * sizeof(int));
+	tape->adjoints = palloc0(state->steps_len * sizeof(Datum));
+	tape->hasadjoint = palloc0(state->steps_len * sizeof(bool));
+	tape->active = palloc0(state->steps_len * sizeof(bool));
+
+	for (int i = 0; i < state->steps_len; i++)
+	{
+		ExprEvalStep *op = &state->steps[i];
+		int nargs;
+
+		switch (ExecEvalStepOp(state, op))
+		{
+		case EEOP_DONE:
+			nargs = -1;
+			break;
+		case EEOP_FIELDSELECT:
+			nargs = 1;
+			break;
+		case EEOP_FUNCEXPR:
+		case EEOP_FUNCEXPR_STRICT:
+		case EEOP_FUNCEXPR_FUSAGE:
+		case EEOP_FUNCEXPR_STRICT_FUSAGE:
+			nargs = op->d.func.nargs;
+			break;
+		default:
+			/* consts and params, other ops are rejected once derived */
+			nargs = 0;
+			break;
+		}
+
+		tape->canonical[i] = i;
+		if (nargs < 0)
+			continue;
+
+		if (stackPointer < nargs)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("lambda expression cannot be differentiated, step %d has no operands", i)));
+
+		stackPointer -= nargs;
+		tape->nargs[i] = nargs;
+		tape->argoffset[i] = numArgs;
+		for (int argno = 0; argno < nargs; argno++)
+		{
+			tape->args[numArgs] = stack[stackPointer + argno];
+			tape->active[i] |= tape->active[tape->args[numArgs]];
+			numArgs++;
+		}
+		stack[stackPointer++] = i;
+
+		if (ExecEvalStepOp(state, op) == EEOP_FIELDSELECT)
+		{
+			if (wrt == NULL)
+				tape->active[i] = true;
+			else if (ExecEvalStepOp(state, &state->steps[i - 1]) == EEOP_PARAM_EXTERN)
+				tape->active[i] = bms_is_member(state->indexArray[state->steps[i - 1].d.param.paramid - 1] +
+												(op->d.fieldselect.fieldnum - 1), wrt);
+		}
+
+		for (int j = 0; j < i; j++)
+		{
+			if (tape->canonical[j] == j && ExecLambdaTapeStepsEqual(state, tape, i, j))
+			{
+				tape->canonical[i] = j;
+				break;
+			}
+		}
+	}
+
+	pfree(stack);
+	state->derivTape = tape;
+}
+
+/*
+ * ExecLambdaTapeStepsEqual: Check, if steps A and B compute the same value
+ *
+ * Requires the arguments of both steps to be already mapped to their canonical steps. Volatile functions
+ * are never considered equal.
+ */
+static bool
+ExecLambdaTapeStepsEqual(ExprState *state, LambdaDeriveTape *tape, int a, int b)
+{
+	ExprEvalStep *opA = &state->steps[a];
+	ExprEvalStep *opB = &state->steps[b];
+	ExprEvalOp opcode = ExecEvalStepOp(state, opA);
+
+	if (opcode != ExecEvalStepOp(state, opB) || tape->nargs[a] != tape->nargs[b])
+		return false;
+
+	for (int argno = 0; argno < tape->nargs[a]; argno++)
+	{
+		if (tape->canonical[LAMBDA_TAPE_ARG(tape, a, argno)] != tape->canonical[LAMBDA_TAPE_ARG(tape, b, argno)])
+			return false;
+	}
+
+	switch (opcode)
+	{
+	case EEOP_CONST:
+		return opA->d.constval.isnull == opB->d.constval.isnull &&
+			   opA->d.constval.value == opB->d.constval.value;
+	case EEOP_PARAM_EXTERN:
+		return opA->d.param.paramid == opB->d.param.paramid;
+	case EEOP_FIELDSELECT:
+		return opA->d.fieldselect.fieldnum == opB->d.fieldselect.fieldnum;
+	case EEOP_FUNCEXPR:
+	case EEOP_FUNCEXPR_STRICT:
+	case EEOP_FUNCEXPR_FUSAGE:
+	case EEOP_FUNCEXPR_STRICT_FUSAGE:
+		return opA->d.func.finfo->fn_oid == opB->d.func.finfo->fn_oid &&
+			   func_volatile(opA->d.func.finfo->fn_oid) != PROVOLATILE_VOLATILE;
+	default:
+		return false;
+	}
+}
+
 /*
  * ExecLambdaDerive: Evaluate LAMBDA and derive into DERIVATIVES 
  * 
@@ -332,21 +668,75 @@ Datum ExecDeriveLambdaExpr(ExprState *expression, ExprContext *econtext, bool *i
 		seed = Float8GetDatum(1.0);
 	}
 
-	//reverse through steps to derive each var
-	ExecLambdaDeriveSubtree(expression, expression->steps_len - 2, seed, derivatives);
+	//single reverse sweep over the tape to derive each var
+	ExecLambdaDeriveTape(expression, seed, derivatives);
 
 	return result;
 }
 
 /*
- * ExecLambdaDeriveSubtree: Evaluates a subtree in the op-code-sequence recursively, keeping track of the seed along the way
+ * ExecLambdaDeriveTape: Reverse sweep over the derivation tape of a lambda
+ *
+ * Seeds the adjoint of the root step and walks the steps once in reverse order. Every step, that received
+ * an adjoint from its consumers, pushes its local derivatives into the adjoint slots of its arguments.
+ * As the steps are in postfix order, all consumers of a step have been processed, before the step itself is reached.
+ */
+static void
+ExecLambdaDeriveTape(ExprState *state, Datum seed, Datum *derivatives)
+{
+	LambdaDeriveTape *tape = state->derivTape;
+	int root = state->steps_len - 2;
+
+	memset(tape->hasadjoint, 0, tape->nsteps * sizeof(bool));
+	ExecLambdaTapeAccumulate(state, root, seed);
+
+	for (int i = root; i >= 0; i--)
+	{
+		if (tape->active[i] && tape->hasadjoint[i])
+			ExecLambdaDeriveStep(state, i, tape->adjoints[i], derivatives);
+	}
+}
+
+/*
+ * ExecLambdaTapeAccumulate: Add SEED to the adjoint of step STEPINDEX
  *
- * Takes the state(containing the steps and other useful info), the fetchIndex(the point, at which this sub-recursion should start its evaluation),
- * and the seed for the sub tree and returns the step, at which it had to stop(end of subtree).
+ * Contributions are summed in the slot of the canonical step, so shared subexpressions are derived only once.
+ * The first contribution is stored as is, as seeds may be shared between multiple arguments (e.g. in additions),
+ * every further one allocates a fresh sum, instead of modifying a seed inplace.  Seeds for inactive steps are
+ * dropped.
  */
-int
-ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *derivatives) {
-	int resultFetchIndex = fetchIndex;
+static void
+ExecLambdaTapeAccumulate(ExprState *state, int stepIndex, Datum seed)
+{
+	LambdaDeriveTape *tape = state->derivTape;
+	int slot = tape->canonical[stepIndex];
+
+	if (!tape->active[stepIndex])
+		return;
+	if (!tape->hasadjoint[slot])
+	{
+		tape->adjoints[slot] = seed;
+		tape->hasadjoint[slot] = true;
+	}
+	else if (state->lambdaContainsMatrix)
+	{
+		tape->adjoints[slot] = matrix_add_internal(tape->adjoints[slot], seed);
+	}
+	else
+	{
+		tape->adjoints[slot] = Float8GetDatum(DatumGetFloat8(tape->adjoints[slot]) + DatumGetFloat8(seed));
+	}
+}
+
+/*
+ * ExecLambdaDeriveStep: Derives a single step in the op-code-sequence
+ *
+ * Takes the state(containing the steps and other useful info), the fetchIndex(the step to derive) and the accumulated
+ * adjoint of that step as seed. Leaves add the seed to their derivative, functions push the seeds for their arguments
+ * onto the tape.
+ */
+void
+ExecLambdaDeriveStep(ExprState *state, int fetchIndex, Datum seed, Datum *derivatives) {
 	switch (ExecEvalStepOp(state, &(state->steps[fetchIndex])))
 	{
 	case 59: /*EEOP_FIELDSELECT*/
@@ -358,12 +748,10 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 		} else {
 			derivatives[fieldNum] = Float8GetDatum(DatumGetFloat8(derivatives[fieldNum]) + DatumGetFloat8(seed));
 		}
-		resultFetchIndex = resultFetchIndex - 2;
 		break;
 	}
 	case 16: /*EEOP_CONST*/
 	{
-		resultFetchIndex = resultFetchIndex - 1;
 		break;
 	}
 	case 17:
@@ -380,9 +768,8 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * y);
 			Datum newSeedY = Float8GetDatum(DatumGetFloat8(seed) * x);
 
-			int startingPointForY = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedY, derivatives);
-			int stepIndexAfterX = ExecLambdaDeriveSubtree(state, startingPointForY, newSeedX, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1727:
@@ -397,17 +784,15 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) / y);
 			Datum newSeedY = Float8GetDatum((DatumGetFloat8(seed) * x * (-1)) / (y * y));
 
-			int startingPointForY = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedY, derivatives);
-			int stepIndexAfterX = ExecLambdaDeriveSubtree(state, startingPointForY, newSeedX, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1724:
 		case 218: /*float8 binary addition*/
 		{
-			int startingPointForY = ExecLambdaDeriveSubtree(state, fetchIndex - 1, seed, derivatives);
-			int stepIndexAfterX = ExecLambdaDeriveSubtree(state, startingPointForY, seed, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), seed);
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), seed);
 			break;
 		}
 		case 1725:
@@ -415,9 +800,8 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 		{
 			Datum newSeedY = Float8GetDatum(DatumGetFloat8(seed) * (-1));
 
-			int startingPointForY = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedY, derivatives);
-			int stepIndexAfterX = ExecLambdaDeriveSubtree(state, startingPointForY, seed, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), seed);
 			break;
 		}
 		case 232:
@@ -429,9 +813,8 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * y * (pow(x, y - 1)));
 			Datum newSeedY = Float8GetDatum(DatumGetFloat8(seed) * pow(x, y) * log(x));
 
-			int startingPointForY = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedY, derivatives);
-			int stepIndexAfterX = ExecLambdaDeriveSubtree(state, startingPointForY, newSeedX, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 230:
@@ -444,8 +827,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) / (2 * sqrt(x)));
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 221:
@@ -460,8 +842,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * signOfX);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1604: /*float8 unary sin*/
@@ -470,8 +851,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * cos(x));
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1605: /*float8 unary cos*/
@@ -480,8 +860,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * (-1) * sin(x));
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1347: /*float8 unary exp*/
@@ -490,15 +869,13 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * exp(x));
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 220: /* float unary minus/negation */
 		{
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * (-1.0));
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1600: /* float arcus sine */
@@ -508,8 +885,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			float8 tmp = 1 / (sqrt(1 - x) * sqrt(1 + x));
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * tmp);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1601: /* float arcus cosine */
@@ -519,8 +895,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			float8 tmp = 1 / (sqrt(1 - x) * sqrt(1 + x));
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * tmp * (-1.0));
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1602: /* float arcus tangens */
@@ -530,8 +905,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			float8 tmp = 1 / (x * x + 1);
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * tmp);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1603: /* float arcus tangens 2 (c: atan2) */
@@ -542,9 +916,8 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * (y / (x * x + y * y)));
 			Datum newSeedY = Float8GetDatum(DatumGetFloat8(seed) * ((-x) / (x * x + y * y)));
 
-			int startingPointForY = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedY, derivatives);
-			int stepIndexAfterX = ExecLambdaDeriveSubtree(state, startingPointForY, newSeedX, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1606: /* float tangens */
@@ -554,8 +927,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			float8 tmp = 1.0 / (cos(x) * cos(x));
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * tmp);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1607: /* float co-tangens */
@@ -565,8 +937,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			float8 tmp = (-1.0) / (sin(x) * sin(x));
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * tmp);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1339: /* float log base 10 */
@@ -576,8 +947,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			float8 tmp = (1.0) / (x * log(10));
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * tmp);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1341: /* float natural log */
@@ -586,8 +956,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) / x);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7801: /* float softmax_ce */
@@ -595,12 +964,23 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			Datum x = state->steps[fetchIndex].d.func.fcinfo_data->arg[0]; //nn-output vector
 			Datum y = state->steps[fetchIndex].d.func.fcinfo_data->arg[1]; //labels-vector(needs no derivation)
 
-			Datum newSeedX = matrix_mul_internal(seed, softmax_cce_derive(x, y), false, false); 
-			Datum newSeedY = PointerGetDatum(createScalar(0.0)); //derivative to one-hot is not important, but needs derivation nonetheless
+			// the labels are usually inactive, then neither of their seeds is computed
+			if (LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 1))
+				ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1),
+										 PointerGetDatum(createScalar(0.0))); //derivative to one-hot is not important, but needs derivation nonetheless
+			if (LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 0))
+				ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0),
+										 softmax_cce_backward(seed, x, y));
+			break;
+		}
+		case 7806: /* float softmax_ce with class index */
+		{
+			Datum x = state->steps[fetchIndex].d.func.fcinfo_data->arg[0]; //nn-output vector
+			Datum y = state->steps[fetchIndex].d.func.fcinfo_data->arg[1]; //class index, has no derivative
 
-			int stepIndexAfterY = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedY, derivatives);
-			int stepIndexAfterX = ExecLambdaDeriveSubtree(state, stepIndexAfterY, newSeedX, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			if (LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 0))
+				ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0),
+										 softmax_cce_class_backward(seed, x, y));
 			break;
 		}
 		case 7802: /* float sigmoid rectified linear unit(silu) */
@@ -610,8 +990,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			float8 tmp = (1 + exp(-x) + x * exp(-x)) / ((1 + exp(-x)) * (1 + exp(-x)));
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * tmp);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7803: /* float sigmoid */
@@ -622,8 +1001,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			float8 tmp = sigX * (1 - sigX);
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * tmp);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7804: /* float tangens hyperbolicus(tanh) */
@@ -633,8 +1011,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			float8 tmp = 1 - tanh(x) * tanh(x);
 			Datum newSeedX = Float8GetDatum(DatumGetFloat8(seed) * tmp);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7805: /* float rectified linear unit(relu) */
@@ -651,8 +1028,7 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 				newSeedX = seed;
 			}
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9000: /* array float8 matrix multiplication */
@@ -660,55 +1036,51 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 			Datum x = state->steps[fetchIndex].d.func.fcinfo_data->arg[0];
 			Datum y = state->steps[fetchIndex].d.func.fcinfo_data->arg[1];
 
-			Datum newSeedX = matrix_mul_internal(seed, y, false, true);
-			Datum newSeedY = matrix_mul_internal(x, seed, true, false);
-
-			int startingPointForY = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedY, derivatives);
-			int stepIndexAfterX = ExecLambdaDeriveSubtree(state, startingPointForY, newSeedX, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			// skip the product for an inactive side, e.g. the input batch of a layer
+			if (LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 1))
+				ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1),
+										 matrix_mul_internal(x, seed, true, false));
+			if (LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 0))
+				ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0),
+										 matrix_mul_internal(seed, y, false, true));
 			break;
 		}
 		case 9001: /* matrix element-wise silu */
 		{
 			Datum x = state->steps[fetchIndex].d.func.fcinfo_data->arg[0];
-			Datum newSeedX = matrix_elem_mult(seed, silu_m_derive(x));
+			Datum newSeedX = silu_m_backward(seed, x);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9002: /* matrix element-wise sigmoid */
 		{
 			Datum x = state->steps[fetchIndex].d.func.fcinfo_data->arg[0];
-			Datum newSeedX = matrix_elem_mult(seed, sigmoid_m_derive(x));
+			Datum newSeedX = sigmoid_m_backward(seed, x);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9003: /* matrix element-wise tanh */
 		{
 			Datum x = state->steps[fetchIndex].d.func.fcinfo_data->arg[0];
-			Datum newSeedX = matrix_elem_mult(seed, tanh_m_derive(x));
+			Datum newSeedX = tanh_m_backward(seed, x);
 
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9004: /* matrix element-wise relu */
 		{
 			Datum x = state->steps[fetchIndex].d.func.fcinfo_data->arg[0];
-			Datum newSeedX = matrix_elem_mult(seed, relu_m_derive(x));
+			Datum newSeedX = relu_m_backward(seed, x);
 			
-			int stepsAfterSubtree = ExecLambdaDeriveSubtree(state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9005: /* array float8 matrix addition */
 		{
-			int startingPointForY = ExecLambdaDeriveSubtree(state, fetchIndex - 1, seed, derivatives);
-			int stepIndexAfterX = ExecLambdaDeriveSubtree(state, startingPointForY, seed, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), seed);
+			ExecLambdaTapeAccumulate(state, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), seed);
 			break;
 		}
 		default:
@@ -725,7 +1097,6 @@ ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *der
 		break;
 	}
 	}
-	return resultFetchIndex;
 }
 
 /*
@@ -0,0 +1,579 @@
+/*-------------------------------------------------------------------------
+ *
+ * execLambdaBatch.c
+ *	  Derivation of scalar lambda expressions over batches of rows.
+ *
+ *	ExecDeriveLambdaExpr() evaluates and derives a lambda for a single row,
+ *	so callers deriving a whole table pay the step interpretation(or the
+ *	call into the JIT-compiled code), the tuple forming and the adjoint
+ *	bookkeeping once per row.  For lambdas consisting only of float8
+ *	arithmetic, the rows can instead be gathered into one column per input
+ *	attribute: the forward pass then evaluates every step of the derivation
+ *	tape(see ExecBuildLambdaDeriveTape) once for all rows of the batch, and
+ *	the reverse sweep pushes whole adjoint columns through the tape.  The
+ *	inner loops are plain loops over float8 arrays, which the compiler can
+ *	vectorize, the activation functions use the kernels in matrix_vecmath.c.
+ *
+ *	Lambdas with matrix arithmetics, non-float8 attributes or functions
+ *	without a batched implementation are rejected by
+ *	ExecLambdaBatchSupported(), callers have to derive them row by row.
+ *
+ * IDENTIFICATION
+ *	  src/backend/executor/execLambdaBatch.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "catalog/pg_type.h"
+#include "executor/execExpr.h"
+#include "executor/executor.h"
+#include "utils/array.h"
+#include <math.h>
+
+static bool ExecLambdaBatchFuncSupported(Oid fnoid);
+static void ExecLambdaBatchForward(LambdaBatch *batch, int step, int nrows, float8 **columns);
+static void ExecLambdaBatchDeriveStep(LambdaBatch *batch, int step, int nrows, float8 **derivatives);
+static void ExecLambdaBatchAccumulate(LambdaBatch *batch, int step, const float8 *seed, int nrows);
+
+/*
+ * ExecLambdaBatchSupported: Check, if the lambda can be derived by ExecDeriveLambdaBatch()
+ *
+ * Requires the derivation tape, i.e. the lambda has been initialized with buildDiff set.
+ */
+bool
+ExecLambdaBatchSupported(ExprState *state)
+{
+	if (state->derivTape == NULL || state->lambdaContainsMatrix)
+		return false;
+
+	for (int i = 0; i < state->steps_len; i++)
+	{
+		ExprEvalStep *op = &state->steps[i];
+
+		switch (ExecEvalStepOp(state, op))
+		{
+		case EEOP_DONE:
+		case EEOP_PARAM_EXTERN:
+			break;
+		case EEOP_CONST:
+			if (op->d.constval.isnull)
+				return false;
+			break;
+		case EEOP_FIELDSELECT:
+			if (op->d.fieldselect.resulttype != FLOAT8OID || i == 0 ||
+				ExecEvalStepOp(state, &state->steps[i - 1]) != EEOP_PARAM_EXTERN)
+				return false;
+			break;
+		case EEOP_FUNCEXPR:
+		case EEOP_FUNCEXPR_STRICT:
+		case EEOP_FUNCEXPR_FUSAGE:
+		case EEOP_FUNCEXPR_STRICT_FUSAGE:
+			if (!ExecLambdaBatchFuncSupported(op->d.func.finfo->fn_oid))
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * ExecLambdaBatchFuncSupported: float8 functions with a batched forward and reverse implementation
+ */
+static bool
+ExecLambdaBatchFuncSupported(Oid fnoid)
+{
+	switch (fnoid)
+	{
+	case 216: /* float8mul */
+	case 217: /* float8div */
+	case 218: /* float8pl */
+	case 219: /* float8mi */
+	case 220: /* float8um */
+	case 221: /* float8abs */
+	case 1395:
+	case 230: /* sqrt */
+	case 1344:
+	case 232: /* pow */
+	case 1346:
+	case 1339: /* log10 */
+	case 1341: /* ln */
+	case 1347: /* exp */
+	case 1600: /* asin */
+	case 1601: /* acos */
+	case 1602: /* atan */
+	case 1603: /* atan2 */
+	case 1604: /* sin */
+	case 1605: /* cos */
+	case 1606: /* tan */
+	case 1607: /* cot */
+	case 7802: /* silu */
+	case 7803: /* sigmoid */
+	case 7804: /* tanh */
+	case 7805: /* relu */
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * ExecInitLambdaBatch: Allocate the columns to derive up to MAXROWS rows at once
+ */
+LambdaBatch *
+ExecInitLambdaBatch(ExprState *state, int maxrows)
+{
+	LambdaBatch *batch;
+	int nsteps;
+
+	if (!ExecLambdaBatchSupported(state))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("lambda expression cannot be derived in batches")));
+	if (maxrows <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("batch size must be positive")));
+
+	nsteps = state->derivTape->nsteps;
+	batch = palloc0(sizeof(LambdaBatch));
+	batch->state = state;
+	batch->maxrows = maxrows;
+	batch->values = palloc_extended((Size) nsteps * maxrows * sizeof(float8), MCXT_ALLOC_HUGE);
+	batch->adjoints = palloc_extended((Size) nsteps * maxrows * sizeof(float8), MCXT_ALLOC_HUGE);
+	batch->hasadjoint = palloc0(nsteps * sizeof(bool));
+	batch->scratch = palloc_extended((Size) maxrows * sizeof(float8), MCXT_ALLOC_HUGE);
+
+	/* constants are the same for every batch */
+	for (int i = 0; i < nsteps; i++)
+	{
+		ExprEvalStep *op = &state->steps[i];
+
+		if (state->derivTape->canonical[i] == i && ExecEvalStepOp(state, op) == EEOP_CONST)
+		{
+			float8 *out = LAMBDA_BATCH_COLUMN(batch, values, i);
+			float8 value = DatumGetFloat8(op->d.constval.value);
+
+			for (int row = 0; row < maxrows; row++)
+				out[row] = value;
+		}
+	}
+
+	return batch;
+}
+
+/*
+ * ExecDeriveLambdaBatch: Evaluate and derive the lambda for NROWS rows
+ *
+ * COLUMNS and DERIVATIVES are indexed like the derivatives array of ExecDeriveLambdaExpr(), i.e. by the
+ * running attribute number over all lambda inputs(see ExecGenerateIndexArray), each holding NROWS values.
+ * The lambda values are written to RESULTS, the derivatives of each row are added to DERIVATIVES.
+ * NOTICE: Like for ExecDeriveLambdaExpr, the caller has to set the derivatives to zero before each batch
+ */
+void
+ExecDeriveLambdaBatch(LambdaBatch *batch, int nrows, float8 **columns, float8 *results, float8 **derivatives)
+{
+	ExprState *state = batch->state;
+	LambdaDeriveTape *tape = state->derivTape;
+	int root = state->steps_len - 2;
+
+	Assert(nrows <= batch->maxrows);
+
+	/* forward pass, computing each distinct step once */
+	for (int i = 0; i <= root; i++)
+	{
+		if (tape->canonical[i] == i)
+			ExecLambdaBatchForward(batch, i, nrows, columns);
+	}
+	memcpy(results, LAMBDA_BATCH_COLUMN(batch, values, root), nrows * sizeof(float8));
+
+	/* reverse sweep, seeded with 1.0 for every row */
+	memset(batch->hasadjoint, 0, tape->nsteps * sizeof(bool));
+	for (int row = 0; row < nrows; row++)
+		batch->scratch[row] = 1.0;
+	ExecLambdaBatchAccumulate(batch, root, batch->scratch, nrows);
+
+	for (int i = root; i >= 0; i--)
+	{
+		if (tape->active[i] && batch->hasadjoint[i])
+			ExecLambdaBatchDeriveStep(batch, i, nrows, derivatives);
+	}
+}
+
+/*
+ * ExecLambdaBatchForward: Compute the value column of STEP from the value columns of its arguments
+ */
+static void
+ExecLambdaBatchForward(LambdaBatch *batch, int step, int nrows, float8 **columns)
+{
+	ExprState *state = batch->state;
+	ExprEvalStep *op = &state->steps[step];
+	float8 *out = LAMBDA_BATCH_COLUMN(batch, values, step);
+	const float8 *x;
+	const float8 *y;
+
+	switch (ExecEvalStepOp(state, op))
+	{
+	case EEOP_FIELDSELECT:
+	{
+		int fieldNum = state->indexArray[state->steps[step - 1].d.param.paramid - 1] +
+					   (op->d.fieldselect.fieldnum - 1);
+
+		memcpy(out, columns[fieldNum], nrows * sizeof(float8));
+		return;
+	}
+	case EEOP_FUNCEXPR:
+	case EEOP_FUNCEXPR_STRICT:
+	case EEOP_FUNCEXPR_FUSAGE:
+	case EEOP_FUNCEXPR_STRICT_FUSAGE:
+		break;
+	default:
+		/* params carry no value, constants are filled in by ExecInitLambdaBatch */
+		return;
+	}
+
+	x = LAMBDA_BATCH_COLUMN(batch, values, LAMBDA_TAPE_ARG(state->derivTape, step, 0));
+	y = (op->d.func.nargs > 1) ? LAMBDA_BATCH_COLUMN(batch, values, LAMBDA_TAPE_ARG(state->derivTape, step, 1)) : NULL;
+
+	switch (op->d.func.finfo->fn_oid)
+	{
+	case 216: /* float8 binary multiplication */
+		for (int row = 0; row < nrows; row++)
+			out[row] = x[row] * y[row];
+		break;
+	case 217: /* float8 binary division */
+		for (int row = 0; row < nrows; row++)
+		{
+			if (y[row] == 0.0)
+				ereport(ERROR, (errcode(ERRCODE_DIVISION_BY_ZERO), errmsg("division by zero")));
+		}
+		for (int row = 0; row < nrows; row++)
+			out[row] = x[row] / y[row];
+		break;
+	case 218: /* float8 binary addition */
+		for (int row = 0; row < nrows; row++)
+			out[row] = x[row] + y[row];
+		break;
+	case 219: /* float8 binary subtraction */
+		for (int row = 0; row < nrows; row++)
+			out[row] = x[row] - y[row];
+		break;
+	case 220: /* float8 unary minus */
+		for (int row = 0; row < nrows; row++)
+			out[row] = -x[row];
+		break;
+	case 221:
+	case 1395: /* float8 unary abs */
+		for (int row = 0; row < nrows; row++)
+			out[row] = fabs(x[row]);
+		break;
+	case 230:
+	case 1344: /* float8 unary sqrt */
+		for (int row = 0; row < nrows; row++)
+		{
+			if (x[row] < 0.0)
+				ereport(ERROR, (errcode(ERRCODE_INVALID_ARGUMENT_FOR_POWER_FUNCTION),
+								errmsg("cannot take square root of a negative number")));
+		}
+		for (int row = 0; row < nrows; row++)
+			out[row] = sqrt(x[row]);
+		break;
+	case 232:
+	case 1346: /* float8 binary pow x^y */
+		for (int row = 0; row < nrows; row++)
+			out[row] = pow(x[row], y[row]);
+		break;
+	case 1339: /* float8 log base 10 */
+	case 1341: /* float8 natural log */
+		for (int row = 0; row < nrows; row++)
+		{
+			if (x[row] <= 0.0)
+				ereport(ERROR, (errcode(ERRCODE_INVALID_ARGUMENT_FOR_LOG),
+								errmsg("cannot take logarithm of %s", x[row] == 0.0 ? "zero" : "a negative number")));
+		}
+		if (op->d.func.finfo->fn_oid == 1339)
+		{
+			for (int row = 0; row < nrows; row++)
+				out[row] = log10(x[row]);
+		}
+		else
+		{
+			for (int row = 0; row < nrows; row++)
+				out[row] = log(x[row]);
+		}
+		break;
+	case 1347: /* float8 unary exp */
+		for (int row = 0; row < nrows; row++)
+			out[row] = exp(x[row]);
+		break;
+	case 1600: /* float8 arcus sine */
+	case 1601: /* float8 arcus cosine */
+		for (int row = 0; row < nrows; row++)
+		{
+			if (x[row] < -1.0 || x[row] > 1.0)
+				ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE), errmsg("input is out of range")));
+		}
+		for (int row = 0; row < nrows; row++)
+			out[row] = (op->d.func.finfo->fn_oid == 1600) ? asin(x[row]) : acos(x[row]);
+		break;
+	case 1602: /* float8 arcus tangens */
+		for (int row = 0; row < nrows; row++)
+			out[row] = atan(x[row]);
+		break;
+	case 1603: /* float8 arcus tangens 2 */
+		for (int row = 0; row < nrows; row++)
+			out[row] = atan2(x[row], y[row]);
+		break;
+	case 1604: /* float8 sine */
+		for (int row = 0; row < nrows; row++)
+			out[row] = sin(x[row]);
+		break;
+	case 1605: /* float8 cosine */
+		for (int row = 0; row < nrows; row++)
+			out[row] = cos(x[row]);
+		break;
+	case 1606: /* float8 tangens */
+		for (int row = 0; row < nrows; row++)
+			out[row] = tan(x[row]);
+		break;
+	case 1607: /* float8 co-tangens */
+		for (int row = 0; row < nrows; row++)
+			out[row] = 1.0 / tan(x[row]);
+		break;
+	case 7802: /* float8 silu */
+		matrix_activation_forward(MATRIX_ACT_SILU, x, out, nrows);
+		break;
+	case 7803: /* float8 sigmoid */
+		matrix_activation_forward(MATRIX_ACT_SIGMOID, x, out, nrows);
+		break;
+	case 7804: /* float8 tanh */
+		matrix_activation_forward(MATRIX_ACT_TANH, x, out, nrows);
+		break;
+	case 7805: /* float8 relu */
+		matrix_activation_forward(MATRIX_ACT_RELU, x, out, nrows);
+		break;
+	default:
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("Derive(Batch): current operator not supported, aborting...")));
+		break;
+	}
+}
+
+/*
+ * ExecLambdaBatchAccumulate: Add the column SEED to the adjoint column of step STEP, if the step is active
+ */
+static void
+ExecLambdaBatchAccumulate(LambdaBatch *batch, int step, const float8 *seed, int nrows)
+{
+	int slot = batch->state->derivTape->canonical[step];
+	float8 *adjoint = LAMBDA_BATCH_COLUMN(batch, adjoints, step);
+
+	if (!batch->state->derivTape->active[step])
+		return;
+
+	if (!batch->hasadjoint[slot])
+	{
+		memcpy(adjoint, seed, nrows * sizeof(float8));
+		batch->hasadjoint[slot] = true;
+	}
+	else
+	{
+		for (int row = 0; row < nrows; row++)
+			adjoint[row] += seed[row];
+	}
+}
+
+/*
+ * ExecLambdaBatchDeriveStep: Batched counterpart of ExecLambdaDeriveStep()
+ *
+ * Pushes the adjoint column of STEP into the adjoint columns of its arguments, leaves add it to their derivative.
+ * The rules follow ExecLambdaDeriveStep(), including its errors.
+ */
+static void
+ExecLambdaBatchDeriveStep(LambdaBatch *batch, int step, int nrows, float8 **derivatives)
+{
+	ExprState *state = batch->state;
+	ExprEvalStep *op = &state->steps[step];
+	const float8 *seed = LAMBDA_BATCH_COLUMN(batch, adjoints, step);
+	float8 *tmp = batch->scratch;
+	const float8 *x;
+	const float8 *y;
+	int argX, argY;
+
+	switch (ExecEvalStepOp(state, op))
+	{
+	case EEOP_FIELDSELECT:
+	{
+		int fieldNum = state->indexArray[state->steps[step - 1].d.param.paramid - 1] +
+					   (op->d.fieldselect.fieldnum - 1);
+		float8 *derivative = derivatives[fieldNum];
+
+		for (int row = 0; row < nrows; row++)
+			derivative[row] += seed[row];
+		return;
+	}
+	case EEOP_FUNCEXPR:
+	case EEOP_FUNCEXPR_STRICT:
+	case EEOP_FUNCEXPR_FUSAGE:
+	case EEOP_FUNCEXPR_STRICT_FUSAGE:
+		break;
+	default:
+		return;
+	}
+
+	argX = LAMBDA_TAPE_ARG(state->derivTape, step, 0);
+	argY = (op->d.func.nargs > 1) ? LAMBDA_TAPE_ARG(state->derivTape, step, 1) : -1;
+	x = LAMBDA_BATCH_COLUMN(batch, values, argX);
+	y = (argY >= 0) ? LAMBDA_BATCH_COLUMN(batch, values, argY) : NULL;
+
+	switch (op->d.func.finfo->fn_oid)
+	{
+	case 216: /* float8 binary multiplication */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] * x[row];
+		ExecLambdaBatchAccumulate(batch, argY, tmp, nrows);
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] * y[row];
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 217: /* float8 binary division, y != 0 is checked by the forward pass */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = (seed[row] * x[row] * (-1)) / (y[row] * y[row]);
+		ExecLambdaBatchAccumulate(batch, argY, tmp, nrows);
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] / y[row];
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 218: /* float8 binary addition */
+		ExecLambdaBatchAccumulate(batch, argY, seed, nrows);
+		ExecLambdaBatchAccumulate(batch, argX, seed, nrows);
+		break;
+	case 219: /* float8 binary subtraction */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = -seed[row];
+		ExecLambdaBatchAccumulate(batch, argY, tmp, nrows);
+		ExecLambdaBatchAccumulate(batch, argX, seed, nrows);
+		break;
+	case 220: /* float8 unary minus */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = -seed[row];
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 221:
+	case 1395: /* float8 unary abs */
+		for (int row = 0; row < nrows; row++)
+		{
+			if (x[row] == 0)
+				ereport(ERROR, (errcode(ERRCODE_DIVISION_BY_ZERO), errmsg("Derive: ABS, division by Zero!")));
+			tmp[row] = (x[row] < 0) ? -seed[row] : seed[row];
+		}
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 230:
+	case 1344: /* float8 unary sqrt */
+		for (int row = 0; row < nrows; row++)
+		{
+			if (x[row] == 0)
+				ereport(ERROR, (errcode(ERRCODE_DIVISION_BY_ZERO), errmsg("Derive: SQRT, division by Zero!")));
+			tmp[row] = seed[row] / (2 * sqrt(x[row]));
+		}
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 232:
+	case 1346: /* float8 binary pow x^y */
+	{
+		const float8 *result = LAMBDA_BATCH_COLUMN(batch, values, step);
+
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] * result[row] * log(x[row]);
+		ExecLambdaBatchAccumulate(batch, argY, tmp, nrows);
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] * y[row] * pow(x[row], y[row] - 1);
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	}
+	case 1339: /* float8 log base 10 */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] / (x[row] * log(10));
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 1341: /* float8 natural log */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] / x[row];
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 1347: /* float8 unary exp, the derivative is the result itself */
+	{
+		const float8 *result = LAMBDA_BATCH_COLUMN(batch, values, step);
+
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] * result[row];
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	}
+	case 1600: /* float8 arcus sine */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] / (sqrt(1 - x[row]) * sqrt(1 + x[row]));
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 1601: /* float8 arcus cosine */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = -seed[row] / (sqrt(1 - x[row]) * sqrt(1 + x[row]));
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 1602: /* float8 arcus tangens */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] / (x[row] * x[row] + 1);
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 1603: /* float8 arcus tangens 2 */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] * ((-x[row]) / (x[row] * x[row] + y[row] * y[row]));
+		ExecLambdaBatchAccumulate(batch, argY, tmp, nrows);
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] * (y[row] / (x[row] * x[row] + y[row] * y[row]));
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 1604: /* float8 sine */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] * cos(x[row]);
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 1605: /* float8 cosine */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = -seed[row] * sin(x[row]);
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 1606: /* float8 tangens */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = seed[row] / (cos(x[row]) * cos(x[row]));
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 1607: /* float8 co-tangens */
+		for (int row = 0; row < nrows; row++)
+			tmp[row] = -seed[row] / (sin(x[row]) * sin(x[row]));
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 7802: /* float8 silu */
+		matrix_activation_backward(MATRIX_ACT_SILU, seed, false, x, tmp, nrows);
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 7803: /* float8 sigmoid */
+		matrix_activation_backward(MATRIX_ACT_SIGMOID, seed, false, x, tmp, nrows);
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 7804: /* float8 tanh */
+		matrix_activation_backward(MATRIX_ACT_TANH, seed, false, x, tmp, nrows);
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	case 7805: /* float8 relu, 0 at x = 0 like the row-wise derivation */
+		matrix_activation_backward(MATRIX_ACT_RELU, seed, false, x, tmp, nrows);
+		ExecLambdaBatchAccumulate(batch, argX, tmp, nrows);
+		break;
+	default:
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("Derive(Batch): current operator not supported, aborting...")));
+		break;
+	}
+}
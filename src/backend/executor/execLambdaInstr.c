@@ -0,0 +1,219 @@
+/*-------------------------------------------------------------------------
+ *
+ * execLambdaInstr.c
+ *	  Instrumentation of the lambda expressions passed to table functions.
+ *
+ *	Every instrumented lambda gets a LambdaInstrumentation in the plan node
+ *	calling the table function(PlanState->lambda_instrument).  It counts the
+ *	initialization and compile time per tier(see ExecInitLambdaExprTier), the
+ *	evaluations and derivations with their time, and the part of that time
+ *	spent in the matrix kernels together with the bytes of matrices they
+ *	allocated.  The table functions time their calls with InstrLambdaStart()
+ *	and InstrLambdaStop().
+ *
+ *	Lambdas are instrumented under EXPLAIN ANALYZE, which shows the counters
+ *	under the node, and in every query if track_lambdas is set.  At the end
+ *	of the node, the counters are added to the statistics of this backend,
+ *	aggregated by the fingerprint of the lambda(see ExecLambdaFingerprint),
+ *	which pg_stat_get_lambdas() returns.  Like the cache of compiled lambdas,
+ *	the statistics are local to the backend.
+ *
+ * IDENTIFICATION
+ *	  src/backend/executor/execLambdaInstr.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "executor/executor.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+/* GUC: instrument the lambdas of all queries, not only under EXPLAIN ANALYZE */
+bool		track_lambdas = false;
+
+/* statistics of one lambda fingerprint */
+typedef struct LambdaStatsEntry
+{
+	uint64		fingerprint;	/* hash key, must be first */
+	int64		nscans;			/* # of plan nodes the lambda was used in */
+	LambdaInstrumentation counters;
+} LambdaStatsEntry;
+
+static HTAB *LambdaStats = NULL;
+
+static void ExecLambdaInstrAdd(LambdaInstrumentation *dst, LambdaInstrumentation *add);
+
+/*
+ * ExecLambdaInstrumentation: The instrumentation of a lambda, NULL if it is not instrumented
+ *
+ * Initializing the lambda again(e.g. in a higher tier) continues the instrumentation of the first initialization.
+ */
+LambdaInstrumentation *
+ExecLambdaInstrumentation(LambdaExpr *lambda)
+{
+	PlanState  *parent = (PlanState *) lambda->parentPlan;
+	LambdaInstrumentation *instr;
+	MemoryContext oldcontext;
+	ListCell   *lc;
+
+	if (parent == NULL || (parent->instrument == NULL && !track_lambdas))
+		return NULL;
+
+	foreach(lc, parent->lambda_instrument)
+	{
+		instr = (LambdaInstrumentation *) lfirst(lc);
+		if (instr->lambda == lambda)
+			return instr;
+	}
+
+	oldcontext = MemoryContextSwitchTo(parent->state->es_query_cxt);
+	instr = palloc0(sizeof(LambdaInstrumentation));
+	instr->lambda = lambda;
+	instr->fingerprint = ExecLambdaFingerprint(lambda);
+	parent->lambda_instrument = lappend(parent->lambda_instrument, instr);
+	MemoryContextSwitchTo(oldcontext);
+
+	return instr;
+}
+
+/*
+ * ExecReportLambdaInstrumentation: Add the lambda instrumentation of a plan node to the backend's statistics
+ */
+void
+ExecReportLambdaInstrumentation(PlanState *node)
+{
+	ListCell   *lc;
+
+	if (LambdaStats == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(uint64);
+		ctl.entrysize = sizeof(LambdaStatsEntry);
+		ctl.hcxt = TopMemoryContext;
+		LambdaStats = hash_create("Lambda statistics", 64, &ctl,
+								  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	foreach(lc, node->lambda_instrument)
+	{
+		LambdaInstrumentation *instr = (LambdaInstrumentation *) lfirst(lc);
+		LambdaStatsEntry *entry;
+		bool		found;
+
+		entry = (LambdaStatsEntry *) hash_search(LambdaStats, &instr->fingerprint, HASH_ENTER, &found);
+		if (!found)
+		{
+			entry->nscans = 0;
+			memset(&entry->counters, 0, sizeof(LambdaInstrumentation));
+			entry->counters.fingerprint = instr->fingerprint;
+		}
+		entry->nscans++;
+		ExecLambdaInstrAdd(&entry->counters, instr);
+	}
+}
+
+/* dst += add */
+static void
+ExecLambdaInstrAdd(LambdaInstrumentation *dst, LambdaInstrumentation *add)
+{
+	dst->ncompiles += add->ncompiles;
+	for (int i = 0; i < lengthof(dst->compile_time); i++)
+		INSTR_TIME_ADD(dst->compile_time[i], add->compile_time[i]);
+	dst->nevals += add->nevals;
+	INSTR_TIME_ADD(dst->eval_time, add->eval_time);
+	dst->nderives += add->nderives;
+	INSTR_TIME_ADD(dst->derive_time, add->derive_time);
+	INSTR_TIME_ADD(dst->kernel_time, add->kernel_time);
+	dst->kernel_bytes += add->kernel_bytes;
+}
+
+/*
+ * pg_stat_get_lambdas: The lambda statistics of this backend, one row per fingerprint
+ */
+Datum
+pg_stat_get_lambdas(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_LAMBDAS_COLS	12
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	HASH_SEQ_STATUS status;
+	LambdaStatsEntry *entry;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (LambdaStats == NULL)
+		return (Datum) 0;
+
+	hash_seq_init(&status, LambdaStats);
+	while ((entry = (LambdaStatsEntry *) hash_seq_search(&status)) != NULL)
+	{
+		LambdaInstrumentation *c = &entry->counters;
+		Datum		values[PG_STAT_GET_LAMBDAS_COLS];
+		bool		nulls[PG_STAT_GET_LAMBDAS_COLS];
+
+		MemSet(nulls, 0, sizeof(nulls));
+		values[0] = Int64GetDatum((int64) entry->fingerprint);
+		values[1] = Int64GetDatum(entry->nscans);
+		values[2] = Int64GetDatum(c->ncompiles);
+		values[3] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(c->compile_time[LAMBDA_TIER_INTERPRETED]));
+		values[4] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(c->compile_time[LAMBDA_TIER_BASELINE]));
+		values[5] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(c->compile_time[LAMBDA_TIER_OPTIMIZED]));
+		values[6] = Int64GetDatum(c->nevals);
+		values[7] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(c->eval_time));
+		values[8] = Int64GetDatum(c->nderives);
+		values[9] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(c->derive_time));
+		values[10] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(c->kernel_time));
+		values[11] = Int64GetDatum((int64) c->kernel_bytes);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * pg_stat_reset_lambdas: Discard the lambda statistics of this backend
+ */
+Datum
+pg_stat_reset_lambdas(PG_FUNCTION_ARGS)
+{
+	if (LambdaStats != NULL)
+	{
+		hash_destroy(LambdaStats);
+		LambdaStats = NULL;
+	}
+
+	PG_RETURN_VOID();
+}
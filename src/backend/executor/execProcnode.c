@@ -556,6 +556,9 @@ ExecEndNode(PlanState *node)
 		node->chgParam = NULL;
 	}
 
+	if (node->lambda_instrument != NIL)
+		ExecReportLambdaInstrumentation(node);
+
 	switch (nodeTag(node))
 	{
 			/*
@@ -415,6 +415,164 @@ no_function_result:
 }
 
 
+/*
+ * ExecNextTableFunctionResult
+ *
+ * Fetch the next row of a set-returning table function into SLOT, calling
+ * the function once per row instead of materializing its whole result
+ * first.  An empty slot is returned after the last row.  STREAM holds the
+ * state between calls and must be zeroed before the first one; zeroing it
+ * again restarts the function.
+ *
+ * Functions choosing the materialize mode are read from the tuplestore they
+ * return.  This is used by nodeFunctionscan.c for functions that opt in to
+ * it (see fmgr_streams_result) when the scan needs neither backward scans
+ * nor cheap rescans, so a LIMIT above the scan stops the function early.
+ */
+TupleTableSlot *
+ExecNextTableFunctionResult(SetExprState *setexpr,
+							ExprContext *econtext,
+							MemoryContext argContext,
+							TupleDesc expectedDesc,
+							TableFunctionStream *stream,
+							TupleTableSlot *slot)
+{
+	FunctionCallInfo fcinfo = &stream->fcinfo;
+	ReturnSetInfo *rsinfo = &stream->rsinfo;
+	PgStat_FunctionCallUsage fcusage;
+	MemoryContext oldcontext;
+	Datum		result;
+
+	Assert(setexpr->funcReturnsSet && !setexpr->elidedFuncState);
+
+	if (!stream->started)
+	{
+		rsinfo->type = T_ReturnSetInfo;
+		rsinfo->econtext = econtext;
+		rsinfo->expectedDesc = expectedDesc;
+		rsinfo->allowedModes = (int) (SFRM_ValuePerCall | SFRM_Materialize | SFRM_Materialize_Preferred);
+		rsinfo->returnMode = SFRM_ValuePerCall;
+		rsinfo->setResult = NULL;
+		rsinfo->setDesc = NULL;
+		InitFunctionCallInfoData(*fcinfo, &(setexpr->func),
+								 list_length(setexpr->args),
+								 setexpr->fcinfo_data.fncollation,
+								 NULL, (Node *) rsinfo);
+
+		/* as in ExecMakeTableFunctionResult, the arguments live in argContext */
+		MemoryContextReset(argContext);
+		oldcontext = MemoryContextSwitchTo(argContext);
+		ExecEvalFuncArgs(fcinfo, setexpr->args, econtext);
+		MemoryContextSwitchTo(oldcontext);
+
+		stream->started = true;
+		stream->done = false;
+		if (setexpr->func.fn_strict)
+		{
+			int			i;
+
+			for (i = 0; i < fcinfo->nargs; i++)
+			{
+				if (fcinfo->argnull[i])
+					stream->done = true;
+			}
+		}
+	}
+
+	if (stream->tstore != NULL)
+	{
+		(void) tuplestore_gettupleslot(stream->tstore, true, false, slot);
+		return slot;
+	}
+	if (stream->done)
+		return ExecClearTuple(slot);
+
+	/*
+	 * The result lives in the per-tuple memory, which the scan resets before
+	 * fetching the next row.
+	 */
+	oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+
+	pgstat_init_function_usage(fcinfo, &fcusage);
+	fcinfo->isnull = false;
+	rsinfo->isDone = ExprSingleResult;
+	result = FunctionCallInvoke(fcinfo);
+	pgstat_end_function_usage(&fcusage, rsinfo->isDone != ExprMultipleResult);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (rsinfo->returnMode == SFRM_Materialize)
+	{
+		if (rsinfo->isDone != ExprSingleResult)
+			ereport(ERROR,
+					(errcode(ERRCODE_E_R_I_E_SRF_PROTOCOL_VIOLATED),
+					 errmsg("table-function protocol for materialize mode was not followed")));
+		stream->done = true;
+		if (rsinfo->setResult == NULL)
+			return ExecClearTuple(slot);
+		if (rsinfo->setDesc)
+			tupledesc_match(expectedDesc, rsinfo->setDesc);
+		stream->tstore = rsinfo->setResult;
+		tuplestore_rescan(stream->tstore);
+		(void) tuplestore_gettupleslot(stream->tstore, true, false, slot);
+		return slot;
+	}
+	else if (rsinfo->returnMode != SFRM_ValuePerCall)
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_SRF_PROTOCOL_VIOLATED),
+				 errmsg("unrecognized table-function returnMode: %d",
+						(int) rsinfo->returnMode)));
+
+	if (rsinfo->isDone == ExprEndResult)
+	{
+		stream->done = true;
+		return ExecClearTuple(slot);
+	}
+
+	/* as in ExecMakeTableFunctionResult, a single result is the last row */
+	if (rsinfo->isDone != ExprMultipleResult)
+		stream->done = true;
+
+	if (!type_is_rowtype(exprType((Node *) setexpr->expr)))
+	{
+		/* scalar result */
+		ExecClearTuple(slot);
+		slot->tts_values[0] = result;
+		slot->tts_isnull[0] = fcinfo->isnull;
+		return ExecStoreVirtualTuple(slot);
+	}
+	if (fcinfo->isnull)
+	{
+		/* a NULL composite is a row of NULLs */
+		ExecClearTuple(slot);
+		memset(slot->tts_isnull, true, expectedDesc->natts * sizeof(bool));
+		return ExecStoreVirtualTuple(slot);
+	}
+
+	stream->tuple.t_data = DatumGetHeapTupleHeader(result);
+	stream->tuple.t_len = HeapTupleHeaderGetDatumLength(stream->tuple.t_data);
+	ItemPointerSetInvalid(&(stream->tuple.t_self));
+	stream->tuple.t_tableOid = InvalidOid;
+
+	if (stream->tupdesc == NULL)
+	{
+		/* check the row type of the first row against the expected one */
+		oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_query_memory);
+		stream->tupdesc =
+			lookup_rowtype_tupdesc_copy(HeapTupleHeaderGetTypeId(stream->tuple.t_data),
+										HeapTupleHeaderGetTypMod(stream->tuple.t_data));
+		MemoryContextSwitchTo(oldcontext);
+		tupledesc_match(expectedDesc, stream->tupdesc);
+	}
+	else if (HeapTupleHeaderGetTypeId(stream->tuple.t_data) != stream->tupdesc->tdtypeid ||
+			 HeapTupleHeaderGetTypMod(stream->tuple.t_data) != stream->tupdesc->tdtypmod)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("rows returned by function are not all of the same row type")));
+
+	return ExecStoreTuple(&stream->tuple, slot, InvalidBuffer, false);
+}
+
 /*
  * Prepare targetlist SRF function call for execution.
  *
@@ -16,6 +16,7 @@
 #include <unistd.h>
 
 #include "executor/instrument.h"
+#include "utils/array.h"
 
 BufferUsage pgBufferUsage;
 static BufferUsage save_pgBufferUsage;
@@ -188,6 +189,50 @@ InstrAccumParallelQuery(BufferUsage *result)
 	BufferUsageAdd(&pgBufferUsage, result);
 }
 
+/*
+ * Start of a call of an instrumented lambda
+ *
+ * The matrix kernels count their time and allocations until the call stops.
+ */
+void
+InstrLambdaStart(LambdaInstrumentation *instr)
+{
+	matrix_instrument.enabled = true;
+	matrix_instrument.depth = 0;
+	instr->kernel_start = matrix_instrument.kernel_time;
+	instr->bytes_start = matrix_instrument.bytes;
+	INSTR_TIME_SET_CURRENT(instr->starttime);
+}
+
+/* End of a call of an instrumented lambda, that did NCALLS evaluations etc. */
+void
+InstrLambdaStop(LambdaInstrumentation *instr, LambdaInstrCall call, int64 ncalls)
+{
+	instr_time	endtime;
+
+	INSTR_TIME_SET_CURRENT(endtime);
+	matrix_instrument.enabled = false;
+
+	switch (call)
+	{
+		case LAMBDA_INSTR_COMPILE:
+			instr->ncompiles += ncalls;
+			INSTR_TIME_ACCUM_DIFF(instr->compile_time[instr->tier], endtime, instr->starttime);
+			return;
+		case LAMBDA_INSTR_EVAL:
+			instr->nevals += ncalls;
+			INSTR_TIME_ACCUM_DIFF(instr->eval_time, endtime, instr->starttime);
+			break;
+		case LAMBDA_INSTR_DERIVE:
+			instr->nderives += ncalls;
+			INSTR_TIME_ACCUM_DIFF(instr->derive_time, endtime, instr->starttime);
+			break;
+	}
+
+	INSTR_TIME_ACCUM_DIFF(instr->kernel_time, matrix_instrument.kernel_time, instr->kernel_start);
+	instr->kernel_bytes += matrix_instrument.bytes - instr->bytes_start;
+}
+
 /* dst += add */
 static void
 BufferUsageAdd(BufferUsage *dst, const BufferUsage *add)
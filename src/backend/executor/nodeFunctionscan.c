@@ -39,6 +39,7 @@ typedef struct FunctionScanPerFuncState
 	TupleDesc	tupdesc;		/* desc of the function result type */
 	int			colcount;		/* expected number of result columns */
 	Tuplestorestate *tstore;	/* holds the function result set */
+	TableFunctionStream *stream;	/* rows fetched on demand, or NULL */
 	int64		rowcount;		/* # of rows in result set, -1 if not known */
 	TupleTableSlot *func_slot;	/* function result slot (or NULL) */
 } FunctionScanPerFuncState;
@@ -84,6 +85,18 @@ FunctionNext(FunctionScanState *node)
 		 */
 		Tuplestorestate *tstore = node->funcstates[0].tstore;
 
+		/*
+		 * Streamed functions are called one row at a time, so nodes above
+		 * can stop them early.
+		 */
+		if (node->funcstates[0].stream != NULL)
+			return ExecNextTableFunctionResult(node->funcstates[0].setexpr,
+											   node->ss.ps.ps_ExprContext,
+											   node->argcontext,
+											   node->funcstates[0].tupdesc,
+											   node->funcstates[0].stream,
+											   scanslot);
+
 		/*
 		 * If first time through, read all tuples from function and put them
 		 * in a tuplestore. Subsequent calls just fetch tuples from
@@ -361,6 +374,21 @@ ExecInitFunctionScan(FunctionScan *node, EState *estate, int eflags)
 		fs->tstore = NULL;
 		fs->rowcount = -1;
 
+		/*
+		 * A lone set-returning function that opts in to it is streamed,
+		 * unless the result must be read backwards or rescanned cheaply.
+		 * Without EXEC_FLAG_REWIND, rescans are allowed to call the function
+		 * again, so the planner's assumptions about rescans still hold (see
+		 * ExecMaterializesOutput and cost_rescan).
+		 */
+		if (scanstate->simple &&
+			!(eflags & (EXEC_FLAG_REWIND | EXEC_FLAG_BACKWARD)) &&
+			fs->setexpr->funcReturnsSet && fs->setexpr->elidedFuncState == NULL &&
+			fmgr_streams_result(fs->setexpr->func.fn_oid))
+			fs->stream = palloc0(sizeof(TableFunctionStream));
+		else
+			fs->stream = NULL;
+
 		/*
 		 * Now determine if the function returns a simple or composite type,
 		 * and build an appropriate tupdesc.  Note that in the composite case,
@@ -547,6 +575,11 @@ ExecEndFunctionScan(FunctionScanState *node)
 			tuplestore_end(node->funcstates[i].tstore);
 			fs->tstore = NULL;
 		}
+		if (fs->stream != NULL && fs->stream->tstore != NULL)
+		{
+			tuplestore_end(fs->stream->tstore);
+			fs->stream->tstore = NULL;
+		}
 	}
 }
 
@@ -604,6 +637,30 @@ ExecReScanFunctionScan(FunctionScanState *node)
 		}
 	}
 
+	/*
+	 * A streamed function is called again from the start, unless it
+	 * materialized its result and the parameters did not change.
+	 */
+	for (i = 0; i < node->nfuncs; i++)
+	{
+		TableFunctionStream *stream = node->funcstates[i].stream;
+		RangeTblFunction *rtfunc = (RangeTblFunction *) list_nth(scan->functions, i);
+
+		if (stream == NULL)
+			continue;
+		if (stream->tstore != NULL &&
+			!(chgparam && bms_overlap(chgparam, rtfunc->funcparams)))
+		{
+			tuplestore_rescan(stream->tstore);
+			continue;
+		}
+		if (stream->tstore != NULL)
+			tuplestore_end(stream->tstore);
+		if (stream->tupdesc != NULL)
+			FreeTupleDesc(stream->tupdesc);
+		memset(stream, 0, sizeof(TableFunctionStream));
+	}
+
 	/* Reset ordinality counter */
 	node->ordinal = 0;
 
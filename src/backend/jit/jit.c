@@ -42,6 +42,9 @@ bool		jit_tuple_deforming = true;
 double		jit_above_cost = 100000;
 double		jit_inline_above_cost = 500000;
 double		jit_optimize_above_cost = 500000;
+int			jit_lambda_cache_size = 64;
+int			jit_lambda_tier_rows = 1000;
+bool		jit_lambda_tier_baseline = false;
 
 static JitProviderCallbacks provider;
 static bool provider_successfully_loaded = false;
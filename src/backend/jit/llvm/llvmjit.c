@@ -18,10 +18,16 @@
 
 #include "miscadmin.h"
 
+#include "access/hash.h"
+#include "executor/executor.h"
+#include "lib/ilist.h"
+#include "lib/stringinfo.h"
+#include "utils/hsearch.h"
 #include "utils/memutils.h"
 #include "utils/resowner_private.h"
 #include "portability/instr_time.h"
 #include "storage/ipc.h"
+#include "storage/proc.h"
 #include "nodes/value.h"
 
 
@@ -91,6 +97,22 @@ LLVMValueRef FuncExecAggTransReparent;
 LLVMValueRef FuncExecAggInitGroup;
 
 
+/*
+ * Entry of the cache of compiled lambdas, see llvm_lambda_cache_lookup()
+ */
+typedef struct LLVMLambdaCacheEntry
+{
+	char	   *key;			/* hash key, see ExecLambdaCacheKey() */
+	void	   *func;			/* the compiled function */
+	List	   *handles;		/* emitted code holding the function */
+	LocalTransactionId lastUsed;	/* local transaction of the last use */
+	dlist_node	lru;			/* position in lambda_cache_lru */
+} LLVMLambdaCacheEntry;
+
+/* the cached lambdas, and the same entries by the time of their last use, most recent first */
+static HTAB *lambda_cache = NULL;
+static dlist_head lambda_cache_lru = DLIST_STATIC_INIT(lambda_cache_lru);
+
 static bool llvm_session_initialized = false;
 static size_t llvm_generation = 0;
 static const char *llvm_triple = NULL;
@@ -157,6 +179,7 @@ llvm_create_context(int jitFlags)
 
 	context->funcnames = NIL;
 	context->simpleFuncnames = NIL;
+	context->lambdaKeys = NIL;
 
 	/* ensure cleanup */
 	context->base.resowner = CurrentResourceOwner;
@@ -359,6 +382,253 @@ llvm_get_function(LLVMJitContext *context, const char *funcname)
 	return NULL;
 }
 
+static uint32
+llvm_lambda_cache_hash(const void *key, Size keysize)
+{
+	const char *str = *(const char *const *) key;
+
+	return DatumGetUInt32(hash_any((const unsigned char *) str, strlen(str)));
+}
+
+static int
+llvm_lambda_cache_match(const void *key1, const void *key2, Size keysize)
+{
+	return strcmp(*(const char *const *) key1, *(const char *const *) key2);
+}
+
+/*
+ * Drop a cached lambda, together with its emitted code.
+ */
+static void
+llvm_lambda_cache_evict(LLVMLambdaCacheEntry *entry)
+{
+	char	   *key = entry->key;
+	ListCell   *lc;
+
+	foreach(lc, entry->handles)
+	{
+		LLVMJitHandle *jit_handle = (LLVMJitHandle *) lfirst(lc);
+
+		LLVMOrcRemoveModule(jit_handle->stack, jit_handle->orc_handle);
+		pfree(jit_handle);
+	}
+	list_free(entry->handles);
+
+	dlist_delete(&entry->lru);
+	hash_search(lambda_cache, &key, HASH_REMOVE, NULL);
+	pfree(key);
+}
+
+/*
+ * Look up the compiled code of a lambda in the backend-local cache.
+ *
+ * Compiling a lambda with inlining and -O3 often takes longer than running
+ * it, so the code of lambdas is kept across queries, up to
+ * jit_lambda_cache_size entries.  KEY identifies the lambda and what was
+ * compiled for it, see llvm_get_cached_function().  Returns NULL if the code
+ * is not cached.
+ */
+void *
+llvm_lambda_cache_lookup(const char *key)
+{
+	LLVMLambdaCacheEntry *entry;
+
+	if (key == NULL || lambda_cache == NULL || jit_lambda_cache_size <= 0)
+		return NULL;
+
+	entry = (LLVMLambdaCacheEntry *) hash_search(lambda_cache, &key, HASH_FIND, NULL);
+	if (entry == NULL)
+		return NULL;
+
+	entry->lastUsed = MyProc->lxid;
+	dlist_move_head(&lambda_cache_lru, &entry->lru);
+
+	return entry->func;
+}
+
+/*
+ * Add the compiled function FUNC to the cache.
+ *
+ * The emitted code of CONTEXT from its FIRST_HANDLE'th handle on must hold
+ * nothing but FUNC and what it calls, it is taken over by the cache.  The
+ * least recently used entry is evicted if the cache is full, but never one
+ * used by the current transaction, whose code might still be running.  If
+ * there is no such entry, the code stays with CONTEXT.
+ */
+void
+llvm_lambda_cache_store(LLVMJitContext *context, const char *key, void *func, int first_handle)
+{
+	LLVMLambdaCacheEntry *entry;
+	MemoryContext oldcontext;
+	bool		found;
+
+	if (key == NULL || jit_lambda_cache_size <= 0)
+		return;
+
+	if (lambda_cache == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(char *);
+		ctl.entrysize = sizeof(LLVMLambdaCacheEntry);
+		ctl.hash = llvm_lambda_cache_hash;
+		ctl.match = llvm_lambda_cache_match;
+		lambda_cache = hash_create("LLVM lambda cache", 64, &ctl,
+								   HASH_ELEM | HASH_FUNCTION | HASH_COMPARE);
+	}
+
+	while (hash_get_num_entries(lambda_cache) >= jit_lambda_cache_size)
+	{
+		LLVMLambdaCacheEntry *victim;
+
+		victim = dlist_tail_element(LLVMLambdaCacheEntry, lru, &lambda_cache_lru);
+		if (victim->lastUsed == MyProc->lxid)
+			return;
+		llvm_lambda_cache_evict(victim);
+	}
+
+	entry = (LLVMLambdaCacheEntry *) hash_search(lambda_cache, &key, HASH_ENTER, &found);
+	if (found)
+		return;
+
+	/* the hash table copied the pointer only */
+	entry->key = MemoryContextStrdup(TopMemoryContext, key);
+	entry->func = func;
+	entry->handles = NIL;
+	entry->lastUsed = MyProc->lxid;
+	dlist_push_head(&lambda_cache_lru, &entry->lru);
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	while (list_length(context->handles) > first_handle)
+	{
+		LLVMJitHandle *jit_handle = (LLVMJitHandle *) llast(context->handles);
+
+		entry->handles = lcons(jit_handle, entry->handles);
+		context->handles = list_delete_ptr(context->handles, jit_handle);
+	}
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Number of functions defined in MOD.
+ */
+static int
+llvm_count_defined_functions(LLVMModuleRef mod)
+{
+	int			count = 0;
+
+	for (LLVMValueRef fn = LLVMGetFirstFunction(mod); fn != NULL; fn = LLVMGetNextFunction(fn))
+	{
+		if (!LLVMIsDeclaration(fn))
+			count++;
+	}
+
+	return count;
+}
+
+/*
+ * Like llvm_get_function(), for the code of a fast lambda compiled as TARGET
+ * ("eval" or "derive").
+ *
+ * LAMBDA_KEY is the lambda_cache_key of its ExprState.  The code is taken
+ * from the cache if present.  Otherwise it is emitted, and cached if the
+ * pending module of CONTEXT defines this function only, which is the usual
+ * case of a table function with a single lambda.
+ */
+void *
+llvm_get_cached_function(LLVMJitContext *context, const char *funcname,
+						 const char *lambda_key, const char *target)
+{
+	char	   *key;
+	void	   *func;
+	int			first_handle;
+
+	if (lambda_key == NULL || jit_lambda_cache_size <= 0)
+		return llvm_get_function(context, funcname);
+
+	key = psprintf("%s %s", target, lambda_key);
+	if ((func = llvm_lambda_cache_lookup(key)) != NULL)
+	{
+		pfree(key);
+		return func;
+	}
+
+	if (context->compiled || context->module == NULL ||
+		llvm_count_defined_functions(context->module) != 1)
+	{
+		pfree(key);
+		return llvm_get_function(context, funcname);
+	}
+
+	first_handle = list_length(context->handles);
+	func = llvm_get_function(context, funcname);
+	llvm_lambda_cache_store(context, key, func, first_handle);
+	pfree(key);
+
+	return func;
+}
+
+/*
+ * Is the simple derivation of LAMBDA, for all of its inputs, in the cache?
+ *
+ * Table functions compiling it anyway skip their cheaper tiers then, see
+ * jit_lambda_tier_rows.
+ */
+bool
+llvm_lambda_cache_has_derivation(LambdaExpr *lambda)
+{
+	char	   *lambda_key;
+	char	   *key;
+	bool		found;
+
+	if (lambda_cache == NULL || jit_lambda_cache_size <= 0 ||
+		(lambda_key = ExecLambdaCacheKey(lambda, NULL)) == NULL)
+		return false;
+
+	key = psprintf("derive %s", lambda_key);
+	found = llvm_lambda_cache_lookup(key) != NULL;
+	pfree(key);
+	pfree(lambda_key);
+
+	return found;
+}
+
+/*
+ * Cache key of the table function FUNCNAME from BCMODULE, with the
+ * NUMLAMBDAS lambdas compiled into CONTEXT injected.
+ *
+ * Returns NULL if the result must not be cached: unless CONTEXT is fresh and
+ * holds nothing but the fast lambdas of this table function, its emitted
+ * code would be shared with other functions.
+ */
+char *
+llvm_lambda_cache_tablefunc_key(LLVMJitContext *context, const char *bcModule,
+								const char *funcName, int numLambdas)
+{
+	StringInfoData buf;
+	ListCell   *lc;
+
+	if (jit_lambda_cache_size <= 0 || context->compiled || context->handles != NIL ||
+		context->funcnames != NIL || list_length(context->simpleFuncnames) != numLambdas ||
+		list_length(context->lambdaKeys) != numLambdas)
+		return NULL;
+
+	initStringInfo(&buf);
+	appendStringInfo(&buf, "tablefunc %s %s", bcModule, funcName);
+	foreach(lc, context->lambdaKeys)
+	{
+		if (lfirst(lc) == NULL)
+		{
+			pfree(buf.data);
+			return NULL;
+		}
+		appendStringInfo(&buf, " :lambda %s", (char *) lfirst(lc));
+	}
+
+	return buf.data;
+}
+
 /*
  * Return declaration for passed function, adding it to the module if
  * necessary.
@@ -61,11 +61,15 @@ static LLVMValueRef build_EvalCFunc(LLVMBuilderRef b, LLVMModuleRef mod,
 									const char *funcname, LLVMValueRef *params,
 									LLVMTypeRef *param_types, LLVMTypeRef rettype, int nparams);
 static LLVMValueRef create_LifetimeEnd(LLVMModuleRef mod);
-static int llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, LLVMModuleRef mod, ExprState *state, 
-										   int fetchIndex, LLVMValueRef seed, LLVMValueRef derivatives);
-static int llvm_compile_simple_deriv_subtree(LLVMBuilderRef b, LLVMModuleRef mod, ExprState *state,
-											 int fetchIndex, LLVMValueRef seed,
-											 LLVMValueRef derivatives, LLVMValueRef *funcVals, int *intermediates_pointer);
+static void llvm_deriv_tape_accumulate(LLVMBuilderRef b, LLVMModuleRef mod, ExprState *state,
+									   LLVMValueRef *adjoints, int stepIndex, LLVMValueRef seed);
+static void llvm_compile_expr_deriv_step(LLVMBuilderRef b, LLVMModuleRef mod, ExprState *state, 
+										 int fetchIndex, LLVMValueRef seed, LLVMValueRef derivatives,
+										 LLVMValueRef *adjoints);
+static void llvm_compile_simple_deriv_step(LLVMBuilderRef b, LLVMModuleRef mod, ExprState *state,
+										   int fetchIndex, LLVMValueRef seed,
+										   LLVMValueRef derivatives, LLVMValueRef *funcVals, int *intermediates_pointer,
+										   LLVMValueRef *adjoints);
 
 #define CASE_FLOAT8_CFUNC_2ARG(oid, fname)                                                                   \
 	case oid:                                                                                                \
@@ -2693,6 +2697,8 @@ bool llvm_compile_simple_expr(ExprState *state)
 	b = LLVMCreateBuilder();
 
 	funcname = llvm_expand_funcname(context, "evalexpr", true);
+	context->lambdaKeys = lappend(context->lambdaKeys,
+								  state->lambda_cache_key ? psprintf("eval %s", state->lambda_cache_key) : NULL);
 
 	/* Create the signature and function */
 	{
@@ -3272,6 +3278,7 @@ bool llvm_compile_expr_derive(ExprState *state)
 		case EEOP_DONE:
 		{
 			LLVMValueRef v_tmpisnull, v_tmpvalue, v_seed;
+			LLVMValueRef *adjoints;
 			
 			v_tmpvalue = LLVMBuildLoad(b, v_tmpvaluep, "");
 			v_tmpisnull = LLVMBuildLoad(b, v_tmpisnullp, "");
@@ -3311,7 +3318,14 @@ bool llvm_compile_expr_derive(ExprState *state)
 				v_seed = l_float8_const(1.0);
 			}
 
-			llvm_compile_expr_deriv_subtree(b, mod, state, state->steps_len - 2, v_seed, v_derivatives);
+			/* single reverse sweep over the tape, each distinct step is derived once */
+			adjoints = palloc0(state->steps_len * sizeof(LLVMValueRef));
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, state->steps_len - 2, v_seed);
+			for (int step = state->steps_len - 2; step >= 0; step--)
+			{
+				if (state->derivTape->active[step] && adjoints[step] != NULL)
+					llvm_compile_expr_deriv_step(b, mod, state, step, adjoints[step], v_derivatives, adjoints);
+			}
 
 			LLVMBuildRet(b, v_tmpvalue);
 			break;
@@ -3465,15 +3479,60 @@ bool llvm_compile_expr_derive(ExprState *state)
 	return true;
 }
 
-static int
-llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pre-built eval-func */
-                                LLVMModuleRef mod,		/* The module where the build function will be stored */
-                                ExprState *state, 		/* State containing intermediate values for the derivations */
-								int fetchIndex,   		/* The step in the op_code sequence from where to start */
-								LLVMValueRef seed,		/* seed for current subtree, not a pointer */
-								LLVMValueRef derivatives) /* Datum(therefore pointer) array, containing all derivatives */
+/*
+ * Adds the seed to the adjoint of a step on the derivation tape(see LambdaDeriveTape).
+ * The adjoints only exist at compile time, summing contributions of shared subexpressions
+ * emits a single addition, so each distinct op is only derived once.  Inactive steps get
+ * no adjoint, so no code is emitted to derive them.
+ */
+static void
+llvm_deriv_tape_accumulate(LLVMBuilderRef b,
+						   LLVMModuleRef mod,
+						   ExprState *state,
+						   LLVMValueRef *adjoints,	/* adjoint value per step, NULL if not yet seeded */
+						   int stepIndex,			/* step, whose adjoint receives the seed */
+						   LLVMValueRef seed)
+{
+	int slot = state->derivTape->canonical[stepIndex];
+
+	if (!state->derivTape->active[stepIndex])
+		return;
+
+	if (adjoints[slot] == NULL)
+	{
+		adjoints[slot] = seed;
+	}
+	else if (state->lambdaContainsMatrix)
+	{
+		LLVMValueRef params[2];
+		LLVMTypeRef types[2];
+
+		params[0] = adjoints[slot];
+		params[1] = seed;
+		types[0] = TypeDatum;
+		types[1] = TypeDatum;
+
+		adjoints[slot] = build_EvalCFunc(b, mod, "matrix_add_internal", (LLVMValueRef *)&params,
+										 (LLVMTypeRef *)&types, TypeDatum, 2);
+	}
+	else
+	{
+		adjoints[slot] = LLVMBuildBinOp(b, LLVMFAdd,
+										l_as_float8(b, adjoints[slot]),
+										l_as_float8(b, seed),
+										"");
+	}
+}
+
+static void
+llvm_compile_expr_deriv_step(LLVMBuilderRef b, 		/* Builder containing the pre-built eval-func */
+                             LLVMModuleRef mod,		/* The module where the build function will be stored */
+                             ExprState *state, 		/* State containing intermediate values for the derivations */
+							 int fetchIndex,   		/* The step in the op_code sequence to derive */
+							 LLVMValueRef seed,		/* accumulated adjoint of the step, not a pointer */
+							 LLVMValueRef derivatives, /* Datum(therefore pointer) array, containing all derivatives */
+							 LLVMValueRef *adjoints)	/* adjoints of all steps, receive the seeds for the arguments */
 {
-	int resultFetchIndex = fetchIndex;
 	switch (ExecEvalStepOp(state, &(state->steps[fetchIndex])))
 	{
 	case 59: /*EEOP_FIELDSELECT*/ 
@@ -3509,12 +3568,10 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 											 "");
 		}
 		LLVMBuildStore(b, v_tmpderivative, v_derivative_p);
-		resultFetchIndex = fetchIndex - 2;
 		break;
 	}
 	case 16: /*EEOP_CONST*/
 	{
-		resultFetchIndex = fetchIndex - 1; //can be skipped, d_const/d_x=0
 		break;
 	}
 	case 17: /* EEOP_FUNCEXPR */
@@ -3526,7 +3583,6 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 		case 216: /*float8 binary multiplication*/
 		{
 			LLVMValueRef x, y, newSeedX, newSeedY;
-			int startingPointY, stepAfterX;
 
 			//TODO: Read value from fn_info
 			x = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), ""));
@@ -3535,16 +3591,14 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 			newSeedX = LLVMBuildBinOp(b, LLVMFMul, y, l_as_float8(b, seed), "");
 			newSeedY = LLVMBuildBinOp(b, LLVMFMul, x, l_as_float8(b, seed), "");
 
-			startingPointY = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives);
-			stepAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, startingPointY, newSeedX, derivatives);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1727:
 		case 217: /*float8 binary divison*/
 		{
 			LLVMValueRef x, y, newSeedX, newSeedY;
-			int startingPointY, stepAfterX;
 
 			x = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), ""));
 			y = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[1], l_ptr(TypeDatum)), ""));
@@ -3564,36 +3618,28 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 													  "")),
 									  "");
 
-			startingPointY = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives);
-			stepAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, startingPointY, newSeedX, derivatives);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1724:
 		case 218: /*float8 binary addition*/
 		{
-			int startingPointY, stepAfterX;
-
-			startingPointY = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, seed, derivatives);
-			stepAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, startingPointY, seed, derivatives);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), seed);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), seed);
 			break;
 		}
 		case 1725:
 		case 219: /*float8 binary subtraction*/
 		{
-			int startingPointY, stepAfterX;
-
-			startingPointY = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1,
-															 LLVMBuildBinOp(
-																 b,
-																 LLVMFMul,
-																 seed,
-																 l_float8_const(-1.0),
-																 ""),
-															 derivatives);
-			stepAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, startingPointY, seed, derivatives);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1),
+									   LLVMBuildBinOp(
+										   b,
+										   LLVMFMul,
+										   seed,
+										   l_float8_const(-1.0),
+										   ""));
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), seed);
 			break;
 		}
 		case 232:
@@ -3601,7 +3647,6 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 		{
 			LLVMValueRef x, y, newSeedX, newSeedY, params_pow_x[2], params_pow_y[2], params_log[1];
 			LLVMTypeRef types[2];
-			int startingPointY, stepAfterX;
 
 			types[0] = LLVMDoubleType();
 			types[1] = LLVMDoubleType();
@@ -3654,9 +3699,8 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 									  l_as_float8(b, seed),
 									  "");
 
-			startingPointY = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives);
-			stepAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, startingPointY, newSeedX, derivatives);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 230:
@@ -3664,7 +3708,6 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 		{
 			LLVMValueRef x, newSeedX, params_sqrt[1];
 			LLVMTypeRef types[1];
-			int stepAfterX;
 
 			types[0] = LLVMDoubleType();
 
@@ -3688,8 +3731,7 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 											         ""),
 									 "");
 
-			stepAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 221:
@@ -3697,7 +3739,6 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 		{
 			LLVMValueRef x, newSeedX, params_abs[1];
 			LLVMTypeRef types[1];
-			int stepAfterX;
 
 			types[0] = LLVMDoubleType();
 
@@ -3721,15 +3762,13 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 													 ""),
 									  "");
 
-			stepAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1604: /*float8 unary sin*/
 		{
 			LLVMValueRef x, newSeedX, params_cos[1];
 			LLVMTypeRef types[1];
-			int stepAfterX;
 
 			types[0] = LLVMDoubleType();
 
@@ -3749,15 +3788,13 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 													  1),
 									  "");
 
-			stepAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1605: /*float8 unary cos*/
 		{
 			LLVMValueRef x, newSeedX, params_sin[1];
 			LLVMTypeRef types[1];
-			int stepAfterX;
 
 			types[0] = LLVMDoubleType();
 
@@ -3782,15 +3819,13 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 													  1),
 									  "");
 
-			stepAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1347: /*float8 unary exp*/
 		{
 			LLVMValueRef x, newSeedX, params_exp[1];
 			LLVMTypeRef types[1];
-			int stepAfterX;
 
 			types[0] = LLVMDoubleType();
 
@@ -3810,14 +3845,12 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 													  1),
 									  "");
 
-			stepAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 220: /* float unary minus/negation */
 		{
 			LLVMValueRef newSeedX;
-			int stepsAfterSubtree;
 
 			newSeedX = LLVMBuildBinOp(
 				b,
@@ -3827,15 +3860,13 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 				""
 			);
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1600: /* float arcus sine */
 		{
 			LLVMValueRef newSeedX, x, params_sqrt_1[1], params_sqrt_2[1];
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			types[0] = LLVMDoubleType();
 
@@ -3875,15 +3906,13 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1601: /* float arcus cosine */
 		{
 			LLVMValueRef newSeedX, x, params_sqrt_1[1], params_sqrt_2[1];
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			types[0] = LLVMDoubleType();
 
@@ -3928,14 +3957,12 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1602: /* float unary arcus tangens */
 		{
 			LLVMValueRef newSeedX, x;
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), ""));
 
@@ -3953,14 +3980,12 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1603: /* float binary arcus tangens 2 (c: atan2)(normally defined as: atan2(y,x), but in this case, x is the first and y the second argument) */
 		{
 			LLVMValueRef x, y, newSeedX, newSeedY, tmp_newSeedY;
-			int startingPointForY, stepIndexAfterX;
 
 			x = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), ""));
 			y = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[1], l_ptr(TypeDatum)), ""));
@@ -4015,16 +4040,14 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 				l_float8_const(-1.0),
 				"");
 
-			startingPointForY = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives);
-			stepIndexAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, startingPointForY, newSeedX, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1606: /* float tangens */
 		{
 			LLVMValueRef x, newSeedX, params_cos[1], tmp_cos;
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), ""));
 			params_cos[0] = x;
@@ -4048,15 +4071,13 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1607: /* float co-tangens */
 		{
 			LLVMValueRef x, newSeedX, params_sin[1], tmp_sin;
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), ""));
 			params_sin[0] = x;
@@ -4085,14 +4106,12 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1339: /* float log base 10 */
 		{
 			LLVMValueRef x, newSeedX, naturalLogOf10;
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), ""));
 			naturalLogOf10 = l_float8_const(2.3025850929940456840179914546843642076011014886287729760333279009);
@@ -4107,14 +4126,12 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1341: /* float natural log */
 		{
 			LLVMValueRef x, newSeedX;
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), ""));
 
@@ -4124,58 +4141,67 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 									  x,
 									  "");
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7801: /* softmax */ 
 		{
-			LLVMValueRef x, y, newSeedX, newSeedY, tmp, softmax_params[2], mat_mul_params[4], scalar_param[1];
-			LLVMTypeRef softmax_types[2], mat_mul_types[4], scalar_type[1];
-			int stepIndexAfterX, stepIndexAfterY;
+			LLVMValueRef x, y, newSeedX, newSeedY, backward_params[3], scalar_param[1];
+			LLVMTypeRef backward_types[3], scalar_type[1];
 
 			x = LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), "");
 			y = LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[1], l_ptr(TypeDatum)), "");
 
-			softmax_params[0] = x;
-			softmax_params[1] = y;
+			/* the labels are usually inactive, then neither of their seeds is emitted */
+			if (LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 1))
+			{
+				scalar_param[0] = l_float8_const(0.0);
+				scalar_type[0] = LLVMDoubleType();
+
+				newSeedY = build_EvalCFunc(b, mod, "createScalar", (LLVMValueRef *)&scalar_param, (LLVMTypeRef *)&scalar_type, TypeDatum, 1);
+				llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			}
+			if (!LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 0))
+				break;
+
+			backward_params[0] = seed;
+			backward_params[1] = x;
+			backward_params[2] = y;
 
-			softmax_types[0] = TypeDatum;
-			softmax_types[1] = TypeDatum;
+			backward_types[0] = TypeDatum;
+			backward_types[1] = TypeDatum;
+			backward_types[2] = TypeDatum;
 
-			tmp = build_EvalCFunc(b, mod, "softmax_cce_derive", (LLVMValueRef *)&softmax_params, (LLVMTypeRef *)&softmax_types, TypeDatum, 2);
+			newSeedX = build_EvalCFunc(b, mod, "softmax_cce_backward", (LLVMValueRef *)&backward_params, (LLVMTypeRef *)&backward_types, TypeDatum, 3);
 
-			mat_mul_params[0] = seed;
-			mat_mul_params[1] = tmp;
-			mat_mul_params[2] = l_pbool_const(false);
-			mat_mul_params[3] = l_pbool_const(false);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
+			break;
+		}
+		case 7806: /* softmax with class index */
+		{
+			LLVMValueRef newSeedX, backward_params[3];
+			LLVMTypeRef backward_types[3];
 
-			mat_mul_types[0] = TypeDatum;
-			mat_mul_types[1] = TypeDatum;
-			mat_mul_types[2] = TypeParamBool;
-			mat_mul_types[3] = TypeParamBool;
+			if (!LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 0))
+				break;
 
-			newSeedX = build_EvalCFunc(b, mod,
-									   "matrix_mul_internal",
-									   (LLVMValueRef *)&mat_mul_params,
-									   (LLVMTypeRef *)&mat_mul_types,
-									   TypeDatum, 4);
+			backward_params[0] = seed;
+			backward_params[1] = LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), "");
+			backward_params[2] = LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[1], l_ptr(TypeDatum)), "");
 
-			scalar_param[0] = l_float8_const(0.0);
-			scalar_type[0] = LLVMDoubleType();
+			backward_types[0] = TypeDatum;
+			backward_types[1] = TypeDatum;
+			backward_types[2] = TypeDatum;
 
-			newSeedY = build_EvalCFunc(b, mod, "createScalar", (LLVMValueRef *)&scalar_param, (LLVMTypeRef *)&scalar_type, TypeDatum, 1);
+			newSeedX = build_EvalCFunc(b, mod, "softmax_cce_class_backward", (LLVMValueRef *)&backward_params, (LLVMTypeRef *)&backward_types, TypeDatum, 3);
 
-			stepIndexAfterY = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives);
-			stepIndexAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, stepIndexAfterY, newSeedX, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7802: /* float sigmoidial rectified linear unit */
 		{
 			LLVMValueRef x, newSeedX, tmp, params[1], eToMX;
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), ""));
 
@@ -4225,15 +4251,13 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 									  "");
 			// newSeedX = l_float8_const(2);
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7803: /* float sigmoid */
 		{
 			LLVMValueRef x, newSeedX, tmp, params[1], sig_val;
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), ""));
 
@@ -4270,15 +4294,13 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 									  tmp,
 									  "");
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7804: /* float tangens hyperbolicus */
 		{
 			LLVMValueRef x, newSeedX, tmp, params[1], tanh_val;
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), ""));
 
@@ -4303,15 +4325,13 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 									  tmp,
 									  "");
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7805: /* float rectified linear unit(relu) */
 		{
 			LLVMValueRef newSeedX, x, factor;
 			LLVMTypeRef typeDouble;
-			int stepsAfterSubtree;
 
 			typeDouble = LLVMDoubleType();
 
@@ -4324,15 +4344,13 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 									  l_as_float8(b, factor),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9000: /* Matrix multiplication */
 		{
 			LLVMValueRef x, y, newSeedX, newSeedY, mat_mul_params_x[4], mat_mul_params_y[4];
 			LLVMTypeRef mat_mul_types_x[4], mat_mul_types_y[4];
-			int startingPointForY, stepIndexAfterX;
 
 			x = LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), "");
 			y = LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[1], l_ptr(TypeDatum)), "");
@@ -4357,109 +4375,95 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 			mat_mul_types_y[2] = TypeParamBool;
 			mat_mul_types_y[3] = TypeParamBool;
 
-			newSeedX = build_EvalCFunc(b, mod, "matrix_mul_internal", (LLVMValueRef *)&mat_mul_params_x, (LLVMTypeRef *)&mat_mul_types_x, TypeDatum, 4);
-			newSeedY = build_EvalCFunc(b, mod, "matrix_mul_internal", (LLVMValueRef *)&mat_mul_params_y, (LLVMTypeRef *)&mat_mul_types_y, TypeDatum, 4);
-
-			startingPointForY = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives);
-			stepIndexAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, startingPointForY, newSeedX, derivatives);
-			resultFetchIndex = stepIndexAfterX;
+			/* no product is emitted for an inactive side */
+			if (LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 1))
+			{
+				newSeedY = build_EvalCFunc(b, mod, "matrix_mul_internal", (LLVMValueRef *)&mat_mul_params_y, (LLVMTypeRef *)&mat_mul_types_y, TypeDatum, 4);
+				llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			}
+			if (LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 0))
+			{
+				newSeedX = build_EvalCFunc(b, mod, "matrix_mul_internal", (LLVMValueRef *)&mat_mul_params_x, (LLVMTypeRef *)&mat_mul_types_x, TypeDatum, 4);
+				llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
+			}
 			break;
 		}
 		case 9001: /* matrix sigmoidial linear unit(silu) */
 		{
-			LLVMValueRef newSeedX, x, mat_elem_mul[2], mat_silu;
-			LLVMTypeRef mat_elem_mul_types[2], mat_silu_type;
-			int stepsAfterSubtree;
+			LLVMValueRef newSeedX, x, params[2];
+			LLVMTypeRef types[2];
 
 			x = LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), "");
 
-			mat_elem_mul_types[0] = TypeDatum;
-			mat_elem_mul_types[1] = TypeDatum;
-			mat_silu_type = TypeDatum;
-
-			mat_elem_mul[0] = seed;
-			mat_silu = x;
-			mat_elem_mul[1] = build_EvalCFunc(b, mod, "silu_m_derive", (LLVMValueRef *)&mat_silu, (LLVMTypeRef *)&mat_silu_type, TypeDatum, 1);
+			types[0] = TypeDatum;
+			types[1] = TypeDatum;
+			params[0] = seed;
+			params[1] = x;
 
-			newSeedX = build_EvalCFunc(b, mod, "matrix_elem_mult", (LLVMValueRef *)&mat_elem_mul, (LLVMTypeRef *)&mat_elem_mul_types, TypeDatum, 2);
+			// fused seed * f'(x), see matrix_vecmath.c
+			newSeedX = build_EvalCFunc(b, mod, "silu_m_backward", (LLVMValueRef *)&params, (LLVMTypeRef *)&types, TypeDatum, 2);
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9002: /* matrix sigmoid */
 		{
-			LLVMValueRef newSeedX, x, mat_elem_mul[2], mat_silu;
-			LLVMTypeRef mat_elem_mul_types[2], mat_silu_type;
-			int stepsAfterSubtree;
+			LLVMValueRef newSeedX, x, params[2];
+			LLVMTypeRef types[2];
 
 			x = LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), "");
 
-			mat_elem_mul_types[0] = TypeDatum;
-			mat_elem_mul_types[1] = TypeDatum;
-			mat_silu_type = TypeDatum;
+			types[0] = TypeDatum;
+			types[1] = TypeDatum;
+			params[0] = seed;
+			params[1] = x;
 
-			mat_elem_mul[0] = seed;
-			mat_silu = x;
-			mat_elem_mul[1] = build_EvalCFunc(b, mod, "sigmoid_m_derive", (LLVMValueRef *)&mat_silu, (LLVMTypeRef *)&mat_silu_type, TypeDatum, 1);
+			// fused seed * f'(x), see matrix_vecmath.c
+			newSeedX = build_EvalCFunc(b, mod, "sigmoid_m_backward", (LLVMValueRef *)&params, (LLVMTypeRef *)&types, TypeDatum, 2);
 
-			newSeedX = build_EvalCFunc(b, mod, "matrix_elem_mult", (LLVMValueRef *)&mat_elem_mul, (LLVMTypeRef *)&mat_elem_mul_types, TypeDatum, 2);
-
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9003: /* matrix tanh */
 		{
-			LLVMValueRef newSeedX, x, mat_elem_mul[2], mat_silu;
-			LLVMTypeRef mat_elem_mul_types[2], mat_silu_type;
-			int stepsAfterSubtree;
+			LLVMValueRef newSeedX, x, params[2];
+			LLVMTypeRef types[2];
 
 			x = LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), "");
 
-			mat_elem_mul_types[0] = TypeDatum;
-			mat_elem_mul_types[1] = TypeDatum;
-			mat_silu_type = TypeDatum;
-
-			mat_elem_mul[0] = seed;
-			mat_silu = x;
-			mat_elem_mul[1] = build_EvalCFunc(b, mod, "tanh_m_derive", (LLVMValueRef *)&mat_silu, (LLVMTypeRef *)&mat_silu_type, TypeDatum, 1);
+			types[0] = TypeDatum;
+			types[1] = TypeDatum;
+			params[0] = seed;
+			params[1] = x;
 
-			newSeedX = build_EvalCFunc(b, mod, "matrix_elem_mult", (LLVMValueRef *)&mat_elem_mul, (LLVMTypeRef *)&mat_elem_mul_types, TypeDatum, 2);
+			// fused seed * f'(x), see matrix_vecmath.c
+			newSeedX = build_EvalCFunc(b, mod, "tanh_m_backward", (LLVMValueRef *)&params, (LLVMTypeRef *)&types, TypeDatum, 2);
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9004: /* matrix rectified linear unit(relu) */
 		{
-			LLVMValueRef newSeedX, x, mat_elem_mul[2], mat_silu;
-			LLVMTypeRef mat_elem_mul_types[2], mat_silu_type;
-			int stepsAfterSubtree;
+			LLVMValueRef newSeedX, x, params[2];
+			LLVMTypeRef types[2];
 
 			x = LLVMBuildLoad(b, l_ptr_const((void *)&state->steps[fetchIndex].d.func.fcinfo_data->arg[0], l_ptr(TypeDatum)), "");
 
-			mat_elem_mul_types[0] = TypeDatum;
-			mat_elem_mul_types[1] = TypeDatum;
-			mat_silu_type = TypeDatum;
-
-			mat_elem_mul[0] = seed;
-			mat_silu = x;
-			mat_elem_mul[1] = build_EvalCFunc(b, mod, "relu_m_derive", (LLVMValueRef *)&mat_silu, (LLVMTypeRef *)&mat_silu_type, TypeDatum, 1);
+			types[0] = TypeDatum;
+			types[1] = TypeDatum;
+			params[0] = seed;
+			params[1] = x;
 
-			newSeedX = build_EvalCFunc(b, mod, "matrix_elem_mult", (LLVMValueRef *)&mat_elem_mul, (LLVMTypeRef *)&mat_elem_mul_types, TypeDatum, 2);
+			// fused seed * f'(x), see matrix_vecmath.c
+			newSeedX = build_EvalCFunc(b, mod, "relu_m_backward", (LLVMValueRef *)&params, (LLVMTypeRef *)&types, TypeDatum, 2);
 
-			stepsAfterSubtree = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9005: /*matrix float8 binary addition*/
 		{
-			int startingPointY, stepAfterX;
-
-			startingPointY = llvm_compile_expr_deriv_subtree(b, mod, state, fetchIndex - 1, seed, derivatives);
-			stepAfterX = llvm_compile_expr_deriv_subtree(b, mod, state, startingPointY, seed, derivatives);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), seed);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), seed);
 			break;
 		}
 		default:
@@ -4476,7 +4480,6 @@ llvm_compile_expr_deriv_subtree(LLVMBuilderRef b, 		/* Builder containing the pr
 		break;
 	}
 	}
-	return resultFetchIndex;
 }
 
 bool llvm_compile_simple_expr_derive(ExprState *state)
@@ -4499,6 +4502,7 @@ bool llvm_compile_simple_expr_derive(ExprState *state)
 	LLVMBasicBlockRef *opblocks;
 	LLVMValueRef registers[50];
 	LLVMValueRef intermediate_vals[2 * state->steps_len];
+	int lastFuncInput[state->steps_len];
 	int registerPointer = 0;
 	int funcInputPointer = 0;
 
@@ -4529,6 +4533,8 @@ bool llvm_compile_simple_expr_derive(ExprState *state)
 	b = LLVMCreateBuilder();
 
 	funcname = llvm_expand_funcname(context, "diffexpr", true);
+	context->lambdaKeys = lappend(context->lambdaKeys,
+								  state->lambda_cache_key ? psprintf("derive %s", state->lambda_cache_key) : NULL);
 
 	/* Create the signature and function */
 	{
@@ -4576,6 +4582,8 @@ bool llvm_compile_simple_expr_derive(ExprState *state)
 		case EEOP_DONE:
 		{
 			LLVMValueRef seed;
+			LLVMValueRef *adjoints;
+
 			if (state->lambdaContainsMatrix)
 			{
 				LLVMValueRef params[1];
@@ -4610,8 +4618,18 @@ bool llvm_compile_simple_expr_derive(ExprState *state)
 				seed = l_float8_const(1.0);
 			}
 
-			funcInputPointer--;
-			llvm_compile_simple_deriv_subtree(b, mod, state, state->steps_len - 2, seed, v_derivatives, intermediate_vals, &funcInputPointer);
+			/* single reverse sweep over the tape, each distinct step is derived once */
+			adjoints = palloc0(state->steps_len * sizeof(LLVMValueRef));
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, state->steps_len - 2, seed);
+			for (int step = state->steps_len - 2; step >= 0; step--)
+			{
+				if (!state->derivTape->active[step] || adjoints[step] == NULL)
+					continue;
+
+				funcInputPointer = lastFuncInput[step];
+				llvm_compile_simple_deriv_step(b, mod, state, step, adjoints[step], v_derivatives,
+											   intermediate_vals, &funcInputPointer, adjoints);
+			}
 
 			LLVMBuildRet(b, LLVMBuildZExtOrBitCast(b, registers[registerPointer - 1], TypeDatum, ""));
 			break;
@@ -4890,6 +4908,20 @@ bool llvm_compile_simple_expr_derive(ExprState *state)
 				break;
 			}
 
+			case 7806:
+			{
+				LLVMTypeRef types[2];
+				LLVMValueRef params[2];
+				numparams = 2;
+				types[0] = TypeDatum;
+				types[1] = TypeDatum;
+				params[0] = registers[registerPointer - 2];
+				params[1] = registers[registerPointer - 1];
+
+				opres = build_EvalCFunc(b, mod, "softmax_cce_class_internal", (LLVMValueRef *)&params, (LLVMTypeRef *)&types, TypeDatum, 2);
+				break;
+			}
+
 			case 7802:
 			{
 				LLVMTypeRef types[1];
@@ -5086,6 +5118,8 @@ bool llvm_compile_simple_expr_derive(ExprState *state)
 				}
 			}
 
+			lastFuncInput[i] = funcInputPointer - 1;
+
 			registerPointer -= numparams;
 			registers[registerPointer++] = opres;
 
@@ -5142,17 +5176,17 @@ bool llvm_compile_simple_expr_derive(ExprState *state)
 	return true;
 }
 
-static int
-llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing the pre-built eval-func */
-								  LLVMModuleRef mod,		    /* The module where the build function will be stored */
-								  ExprState *state,			    /* State containing intermediate values for the derivations */
-								  int fetchIndex,			    /* The step in the op_code sequence from where to start */
-								  LLVMValueRef seed,		    /* seed for current subtree, not a pointer */
-								  LLVMValueRef derivatives,     /* Datum(therefore pointer) array, containing all derivatives */
-								  LLVMValueRef *funcVals,	    /* All FuncInputs, as we have no access to them due to L3/L4 */
-								  int *intermediates_pointer)    /* the stack pointer, as to which values to take from funcVals */
+static void
+llvm_compile_simple_deriv_step(LLVMBuilderRef b,			    /* Builder containing the pre-built eval-func */
+							   LLVMModuleRef mod,		    /* The module where the build function will be stored */
+							   ExprState *state,			    /* State containing intermediate values for the derivations */
+							   int fetchIndex,			    /* The step in the op_code sequence to derive */
+							   LLVMValueRef seed,		    /* accumulated adjoint of the step, not a pointer */
+							   LLVMValueRef derivatives,     /* Datum(therefore pointer) array, containing all derivatives */
+							   LLVMValueRef *funcVals,	    /* All FuncInputs, as we have no access to them due to L3/L4 */
+							   int *intermediates_pointer,    /* points to the last input of this step in funcVals */
+							   LLVMValueRef *adjoints)		/* adjoints of all steps, receive the seeds for the arguments */
 {
-	int resultFetchIndex = fetchIndex;
 	switch (ExecEvalStepOp(state, &(state->steps[fetchIndex])))
 	{
 	case 59: /*EEOP_FIELDSELECT*/
@@ -5191,12 +5225,10 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 											 "");
 		}
 		LLVMBuildStore(b, v_tmpderivative, v_derivative_p);
-		resultFetchIndex = fetchIndex - 2;
 		break;
 	}
 	case 16: /*EEOP_CONST*/
 	{
-		resultFetchIndex = fetchIndex - 1; //can be skipped, d_const/d_x=0
 		break;
 	}
 	case 17: /* EEOP_FUNCEXPR */
@@ -5208,7 +5240,6 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 		case 216: /*float8 binary multiplication*/
 		{
 			LLVMValueRef x, y, newSeedX, newSeedY;
-			int startingPointY, stepAfterX;
 
 			y = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
 			x = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
@@ -5216,16 +5247,14 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 			newSeedX = LLVMBuildBinOp(b, LLVMFMul, y, l_as_float8(b, seed), "");
 			newSeedY = LLVMBuildBinOp(b, LLVMFMul, x, l_as_float8(b, seed), "");
 
-			startingPointY = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives, funcVals, intermediates_pointer);
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, startingPointY, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1727:
 		case 217: /*float8 binary divison*/
 		{
 			LLVMValueRef x, y, newSeedX, newSeedY;
-			int startingPointY, stepAfterX;
 
 			y = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
 			x = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
@@ -5245,46 +5274,39 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													  "")),
 									  "");
 
-			startingPointY = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives, funcVals, intermediates_pointer);
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, startingPointY, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1724:
 		case 218: /*float8 binary addition*/
 		{
-			int startingPointY, stepAfterX;
 			(*intermediates_pointer)--; 				//add, subtract, um, etc.  put values onto stack, but dont retrieve them, we need to decrease the stack 
 			(*intermediates_pointer)--;
 
-			startingPointY = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, seed, derivatives, funcVals, intermediates_pointer);
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, startingPointY, seed, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), seed);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), seed);
 
 			break;
 		}
 		case 1725:
 		case 219: /*float8 binary subtraction*/
 		{
-			int startingPointY, stepAfterX;
 			(*intermediates_pointer)--;
 			(*intermediates_pointer)--;
 
-			startingPointY = llvm_compile_simple_deriv_subtree(b,
-															   mod,
-															   state,
-															   fetchIndex - 1,
-															   LLVMBuildBinOp(
-																   b,
-																   LLVMFMul,
-																   seed,
-																   l_float8_const(-1.0),
-																   ""),
-															   derivatives,
-															   funcVals,
-															   intermediates_pointer);
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, startingPointY, seed, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b,
+									   mod,
+									   state,
+									   adjoints,
+									   LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1),
+									   LLVMBuildBinOp(
+										   b,
+										   LLVMFMul,
+										   seed,
+										   l_float8_const(-1.0),
+										   ""));
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), seed);
 
 			break;
 		}
@@ -5293,7 +5315,6 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 		{
 			LLVMValueRef x, y, newSeedX, newSeedY, params_pow_x[2], params_pow_y[2], params_log[1];
 			LLVMTypeRef types[2];
-			int startingPointY, stepAfterX;
 
 			types[0] = LLVMDoubleType();
 			types[1] = LLVMDoubleType();
@@ -5346,9 +5367,8 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 									  l_as_float8(b, seed),
 									  "");
 
-			startingPointY = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives, funcVals, intermediates_pointer);
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, startingPointY, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 230:
@@ -5356,7 +5376,6 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 		{
 			LLVMValueRef x, newSeedX, params_sqrt[1];
 			LLVMTypeRef types[1];
-			int stepAfterX;
 
 			types[0] = LLVMDoubleType();
 
@@ -5380,8 +5399,7 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													 ""),
 									  "");
 
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 221:
@@ -5389,7 +5407,6 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 		{
 			LLVMValueRef x, newSeedX, params_abs[1];
 			LLVMTypeRef types[1];
-			int stepAfterX;
 
 			types[0] = LLVMDoubleType();
 
@@ -5413,15 +5430,13 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													 ""),
 									  "");
 
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1604: /*float8 unary sin*/
 		{
 			LLVMValueRef x, newSeedX, params_cos[1];
 			LLVMTypeRef types[1];
-			int stepAfterX;
 
 			types[0] = LLVMDoubleType();
 
@@ -5441,15 +5456,13 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													  1),
 									  "");
 
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1605: /*float8 unary cos*/
 		{
 			LLVMValueRef x, newSeedX, params_sin[1];
 			LLVMTypeRef types[1];
-			int stepAfterX;
 
 			types[0] = LLVMDoubleType();
 
@@ -5474,15 +5487,13 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													  1),
 									  "");
 
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1347: /*float8 unary exp*/
 		{
 			LLVMValueRef x, newSeedX, params_exp[1];
 			LLVMTypeRef types[1];
-			int stepAfterX;
 
 			types[0] = LLVMDoubleType();
 
@@ -5502,14 +5513,12 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													  1),
 									  "");
 
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 220: /* float unary minus/negation */
 		{
 			LLVMValueRef newSeedX;
-			int stepsAfterSubtree;
 			(*intermediates_pointer)--;
 
 			newSeedX = LLVMBuildBinOp(
@@ -5519,15 +5528,13 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 				l_float8_const(-1.0),
 				"");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1600: /* float arcus sine */
 		{
 			LLVMValueRef newSeedX, x, params_sqrt_1[1], params_sqrt_2[1];
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			types[0] = LLVMDoubleType();
 
@@ -5567,15 +5574,13 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1601: /* float arcus cosine */
 		{
 			LLVMValueRef newSeedX, x, params_sqrt_1[1], params_sqrt_2[1];
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			types[0] = LLVMDoubleType();
 
@@ -5620,14 +5625,12 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1602: /* float unary arcus tangens */
 		{
 			LLVMValueRef newSeedX, x;
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
 
@@ -5645,14 +5648,12 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1603: /* float binary arcus tangens 2 (c: atan2)(normally defined as: atan2(y,x), but in this case, x is the first and y the second argument) */
 		{
 			LLVMValueRef x, y, newSeedX, newSeedY, tmp_newSeedY;
-			int startingPointForY, stepIndexAfterX;
 
 			y = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
 			x = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
@@ -5707,16 +5708,14 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 				l_float8_const(-1.0),
 				"");
 
-			startingPointForY = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives, funcVals, intermediates_pointer);
-			stepIndexAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, startingPointForY, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepIndexAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1606: /* float tangens */
 		{
 			LLVMValueRef x, newSeedX, params_cos[1], tmp_cos;
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
 			params_cos[0] = x;
@@ -5740,15 +5739,13 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1607: /* float co-tangens */
 		{
 			LLVMValueRef x, newSeedX, params_sin[1], tmp_sin;
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
 			params_sin[0] = x;
@@ -5777,14 +5774,12 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1339: /* float log base 10 */
 		{
 			LLVMValueRef x, newSeedX, naturalLogOf10;
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
 			naturalLogOf10 = l_float8_const(log(10));
@@ -5799,14 +5794,12 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 													 ""),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 1341: /* float natural log */
 		{
 			LLVMValueRef x, newSeedX;
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
 
@@ -5816,57 +5809,74 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 									  x,
 									  "");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7801: /* Softmax_CCE */
 		{
-			LLVMValueRef x, y, newSeedX, newSeedY, tmp, params_softmax[2], params_mul[4], param_scalar[1];
-			LLVMTypeRef types_softmax[2], types_mul[4], type_scalar[1];
-			int stepAfterX, stepAfterY;
+			LLVMValueRef x, y, newSeedX, newSeedY, params_backward[3], param_scalar[1];
+			LLVMTypeRef types_backward[3], type_scalar[1];
 			y = funcVals[(*intermediates_pointer)--];
 			x = funcVals[(*intermediates_pointer)--];
 
-			params_softmax[0] = x;       			
-			params_softmax[1] = y;
-
-			types_softmax[0] = TypeDatum;
-			types_softmax[1] = TypeDatum;
+			/* the labels are usually inactive, then neither of their seeds is emitted */
+			if (LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 1))
+			{
+				param_scalar[0] = l_float8_const(0.0);
+				type_scalar[0] = LLVMDoubleType();
 
-			tmp = build_EvalCFunc(b, mod, "softmax_cce_derive", (LLVMValueRef *)&params_softmax, (LLVMTypeRef *)&types_softmax, TypeDatum, 2);
+				newSeedY = build_EvalCFunc(b, mod, "createScalar", (LLVMValueRef *)&param_scalar, (LLVMTypeRef *)&type_scalar, TypeDatum, 1);
+				llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			}
+			if (!LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 0))
+				break;
 
-			types_mul[0] = TypeDatum;
-			types_mul[1] = TypeDatum;
-			types_mul[2] = TypeParamBool;
-			types_mul[3] = TypeParamBool;
+			params_backward[0] = seed;
+			params_backward[1] = x;
+			params_backward[2] = y;
 
-			params_mul[0] = seed;
-			params_mul[1] = tmp;
-			params_mul[2] = l_pbool_const(false);
-			params_mul[3] = l_pbool_const(false);
+			types_backward[0] = TypeDatum;
+			types_backward[1] = TypeDatum;
+			types_backward[2] = TypeDatum;
 
-			newSeedX = build_EvalCFunc(b, mod, "matrix_mul_internal",
-									   (LLVMValueRef *)&params_mul,
-									   (LLVMTypeRef *)&types_mul,
+			newSeedX = build_EvalCFunc(b, mod, "softmax_cce_backward",
+									   (LLVMValueRef *)&params_backward,
+									   (LLVMTypeRef *)&types_backward,
 									   TypeDatum,
-									   4);
+									   3);
+
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
+			break;
+		}
+		case 7806: /* Softmax_CCE with class index */
+		{
+			LLVMValueRef newSeedX, params_backward[3];
+			LLVMTypeRef types_backward[3];
+
+			params_backward[2] = funcVals[(*intermediates_pointer)--];
+			params_backward[1] = funcVals[(*intermediates_pointer)--];
+			params_backward[0] = seed;
 
-			param_scalar[0] = l_float8_const(0.0);
-			type_scalar[0] = LLVMDoubleType();
+			if (!LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 0))
+				break;
+
+			types_backward[0] = TypeDatum;
+			types_backward[1] = TypeDatum;
+			types_backward[2] = TypeDatum;
 
-			newSeedY = build_EvalCFunc(b, mod, "createScalar", (LLVMValueRef *)&param_scalar, (LLVMTypeRef *)&type_scalar, TypeDatum, 1);
+			newSeedX = build_EvalCFunc(b, mod, "softmax_cce_class_backward",
+									   (LLVMValueRef *)&params_backward,
+									   (LLVMTypeRef *)&types_backward,
+									   TypeDatum,
+									   3);
 
-			stepAfterY = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives, funcVals, intermediates_pointer);
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, stepAfterY, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7802: /* float sigmoidial rectified linear unit */
 		{
 			LLVMValueRef x, newSeedX, tmp, params[1], eToMX;
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
 
@@ -5915,15 +5925,13 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 									  l_as_float8(b, tmp),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7803: /* float sigmoid */
 		{
 			LLVMValueRef x, newSeedX, tmp, params[1], sig_val;
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
 
@@ -5960,15 +5968,13 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 									  tmp,
 									  "");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7804: /* float tangens hyperbolicus */
 		{
 			LLVMValueRef x, newSeedX, tmp, params[1], tanh_val;
 			LLVMTypeRef types[1];
-			int stepsAfterSubtree;
 
 			x = l_as_float8(b, funcVals[(*intermediates_pointer)--]);
 
@@ -5993,15 +5999,13 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 									  tmp,
 									  "");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 7805: /* float rectified linear unit(relu) */
 		{
 			LLVMValueRef newSeedX, x, factor;
 			LLVMTypeRef typeDouble;
-			int stepsAfterSubtree;
 
 			typeDouble = LLVMDoubleType();
 
@@ -6014,15 +6018,13 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 									  l_as_float8(b, factor),
 									  "");
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9000: /* Matrix multiplication */
 		{
 			LLVMValueRef x, y, newSeedX, newSeedY, mat_mul_params_x[4], mat_mul_params_y[4];
 			LLVMTypeRef mat_mul_types_x[4], mat_mul_types_y[4];
-			int startingPointY, stepAfterX;
 
 			y = funcVals[(*intermediates_pointer)--];
 			x = funcVals[(*intermediates_pointer)--];
@@ -6047,112 +6049,98 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 			mat_mul_types_y[2] = TypeParamBool;
 			mat_mul_types_y[3] = TypeParamBool;
 
-			newSeedX = build_EvalCFunc(b, mod, "matrix_mul_internal", (LLVMValueRef *)&mat_mul_params_x, (LLVMTypeRef *)&mat_mul_types_x, TypeDatum, 4);
-			newSeedY = build_EvalCFunc(b, mod, "matrix_mul_internal", (LLVMValueRef *)&mat_mul_params_y, (LLVMTypeRef *)&mat_mul_types_y, TypeDatum, 4);
-
-			startingPointY = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedY, derivatives, funcVals, intermediates_pointer);
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, startingPointY, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			/* no product is emitted for an inactive side */
+			if (LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 1))
+			{
+				newSeedY = build_EvalCFunc(b, mod, "matrix_mul_internal", (LLVMValueRef *)&mat_mul_params_y, (LLVMTypeRef *)&mat_mul_types_y, TypeDatum, 4);
+				llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), newSeedY);
+			}
+			if (LAMBDA_TAPE_ARG_ACTIVE(state->derivTape, fetchIndex, 0))
+			{
+				newSeedX = build_EvalCFunc(b, mod, "matrix_mul_internal", (LLVMValueRef *)&mat_mul_params_x, (LLVMTypeRef *)&mat_mul_types_x, TypeDatum, 4);
+				llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
+			}
 			break;
 		}
 		case 9001: /* matrix sigmoidial linear unit(silu) */
 		{
-			LLVMValueRef newSeedX, x, mat_elem_mul[2], mat_silu;
-			LLVMTypeRef mat_elem_mul_types[2], mat_silu_type;
-			int stepsAfterSubtree;
+			LLVMValueRef newSeedX, x, params[2];
+			LLVMTypeRef types[2];
 
 			x = funcVals[(*intermediates_pointer)--];
 
-			mat_elem_mul_types[0] = TypeDatum;
-			mat_elem_mul_types[1] = TypeDatum;
-			mat_silu_type = TypeDatum;
+			types[0] = TypeDatum;
+			types[1] = TypeDatum;
+			params[0] = seed;
+			params[1] = x;
 
-			mat_elem_mul[0] = seed;
-			mat_silu = x;
-			mat_elem_mul[1] = build_EvalCFunc(b, mod, "silu_m_derive", (LLVMValueRef *)&mat_silu, (LLVMTypeRef *)&mat_silu_type, TypeDatum, 1);
+			// fused seed * f'(x), see matrix_vecmath.c
+			newSeedX = build_EvalCFunc(b, mod, "silu_m_backward", (LLVMValueRef *)&params, (LLVMTypeRef *)&types, TypeDatum, 2);
 
-			newSeedX = build_EvalCFunc(b, mod, "matrix_elem_mult", (LLVMValueRef *)&mat_elem_mul, (LLVMTypeRef *)&mat_elem_mul_types, TypeDatum, 2);
-
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9002: /* matrix sigmoid */
 		{
-			LLVMValueRef newSeedX, x, mat_elem_mul[2], mat_silu;
-			LLVMTypeRef mat_elem_mul_types[2], mat_silu_type;
-			int stepsAfterSubtree;
+			LLVMValueRef newSeedX, x, params[2];
+			LLVMTypeRef types[2];
 
 			x = funcVals[(*intermediates_pointer)--];
 
-			mat_elem_mul_types[0] = TypeDatum;
-			mat_elem_mul_types[1] = TypeDatum;
-			mat_silu_type = TypeDatum;
-
-			mat_elem_mul[0] = seed;
-			mat_silu = x;
-			mat_elem_mul[1] = build_EvalCFunc(b, mod, "sigmoid_m_derive", (LLVMValueRef *)&mat_silu, (LLVMTypeRef *)&mat_silu_type, TypeDatum, 1);
+			types[0] = TypeDatum;
+			types[1] = TypeDatum;
+			params[0] = seed;
+			params[1] = x;
 
-			newSeedX = build_EvalCFunc(b, mod, "matrix_elem_mult", (LLVMValueRef *)&mat_elem_mul, (LLVMTypeRef *)&mat_elem_mul_types, TypeDatum, 2);
+			// fused seed * f'(x), see matrix_vecmath.c
+			newSeedX = build_EvalCFunc(b, mod, "sigmoid_m_backward", (LLVMValueRef *)&params, (LLVMTypeRef *)&types, TypeDatum, 2);
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9003: /* matrix tanh */
 		{
-			LLVMValueRef newSeedX, x, mat_elem_mul[2], mat_silu;
-			LLVMTypeRef mat_elem_mul_types[2], mat_silu_type;
-			int stepsAfterSubtree;
+			LLVMValueRef newSeedX, x, params[2];
+			LLVMTypeRef types[2];
 
 			x = funcVals[(*intermediates_pointer)--];
 
-			mat_elem_mul_types[0] = TypeDatum;
-			mat_elem_mul_types[1] = TypeDatum;
-			mat_silu_type = TypeDatum;
-
-			mat_elem_mul[0] = seed;
-			mat_silu = x;
-			mat_elem_mul[1] = build_EvalCFunc(b, mod, "tanh_m_derive", (LLVMValueRef *)&mat_silu, (LLVMTypeRef *)&mat_silu_type, TypeDatum, 1);
+			types[0] = TypeDatum;
+			types[1] = TypeDatum;
+			params[0] = seed;
+			params[1] = x;
 
-			newSeedX = build_EvalCFunc(b, mod, "matrix_elem_mult", (LLVMValueRef *)&mat_elem_mul, (LLVMTypeRef *)&mat_elem_mul_types, TypeDatum, 2);
+			// fused seed * f'(x), see matrix_vecmath.c
+			newSeedX = build_EvalCFunc(b, mod, "tanh_m_backward", (LLVMValueRef *)&params, (LLVMTypeRef *)&types, TypeDatum, 2);
 
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9004: /* matrix rectified linear unit(relu) */
 		{
-			LLVMValueRef newSeedX, x, mat_elem_mul[2], mat_silu;
-			LLVMTypeRef mat_elem_mul_types[2], mat_silu_type;
-			int stepsAfterSubtree;
+			LLVMValueRef newSeedX, x, params[2];
+			LLVMTypeRef types[2];
 
 			x = funcVals[(*intermediates_pointer)--];
 
-			mat_elem_mul_types[0] = TypeDatum;
-			mat_elem_mul_types[1] = TypeDatum;
-			mat_silu_type = TypeDatum;
+			types[0] = TypeDatum;
+			types[1] = TypeDatum;
+			params[0] = seed;
+			params[1] = x;
 
-			mat_elem_mul[0] = seed;
-			mat_silu = x;
-			mat_elem_mul[1] = build_EvalCFunc(b, mod, "relu_m_derive", (LLVMValueRef *)&mat_silu, (LLVMTypeRef *)&mat_silu_type, TypeDatum, 1);
+			// fused seed * f'(x), see matrix_vecmath.c
+			newSeedX = build_EvalCFunc(b, mod, "relu_m_backward", (LLVMValueRef *)&params, (LLVMTypeRef *)&types, TypeDatum, 2);
 
-			newSeedX = build_EvalCFunc(b, mod, "matrix_elem_mult", (LLVMValueRef *)&mat_elem_mul, (LLVMTypeRef *)&mat_elem_mul_types, TypeDatum, 2);
-
-			stepsAfterSubtree = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, newSeedX, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepsAfterSubtree;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), newSeedX);
 			break;
 		}
 		case 9005: /* Matrix addition */
 		{
-			int startingPointY, stepAfterX;
-
 			(*intermediates_pointer)--;
 			(*intermediates_pointer)--;
 
-			startingPointY = llvm_compile_simple_deriv_subtree(b, mod, state, fetchIndex - 1, seed, derivatives, funcVals, intermediates_pointer);
-			stepAfterX = llvm_compile_simple_deriv_subtree(b, mod, state, startingPointY, seed, derivatives, funcVals, intermediates_pointer);
-			resultFetchIndex = stepAfterX;
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 1), seed);
+			llvm_deriv_tape_accumulate(b, mod, state, adjoints, LAMBDA_TAPE_ARG(state->derivTape, fetchIndex, 0), seed);
 			break;
 		}
 		default:
@@ -6169,5 +6157,4 @@ llvm_compile_simple_deriv_subtree(LLVMBuilderRef b,			    /* Builder containing
 		break;
 	}
 	}
-	return resultFetchIndex;
 }
\ No newline at end of file
@@ -294,6 +294,7 @@ bool LambdaInjectionPass::runOnFunction(llvm::Function &F) {
 
 	m_context->funcnames = NIL;
 	m_context->simpleFuncnames = NIL;
+	m_context->lambdaKeys = NIL;
 
     return changed;
 }
@@ -363,6 +364,17 @@ Datum (*llvm_prepare_lambda_tablefunc(LLVMJitContext *context,
 	llvm::Module* mod;
 	llvm::Function* func;
 	Datum (*funcPtr)(FunctionCallInfo);
+	char *cacheKey = llvm_lambda_cache_tablefunc_key(context, bcModule, funcName, numLambdas);
+
+	/* A cached table function needs neither the extension module nor the lambdas */
+	if ((funcPtr = (Datum (*)(FunctionCallInfo)) llvm_lambda_cache_lookup(cacheKey)))
+	{
+		context->funcnames = NIL;
+		context->simpleFuncnames = NIL;
+		context->lambdaKeys = NIL;
+		return funcPtr;
+	}
+
 	auto tfMod = load_module(bcModule);
 
 	/* Keep a copy of the mutable module in case multiple compilations are needed */
@@ -384,11 +396,43 @@ Datum (*llvm_prepare_lambda_tablefunc(LLVMJitContext *context,
 
 	/*
 	 * Erase all functions from the extension which should not be compiled
-	 * to reduce compile time.
+	 * to reduce compile time.  Functions reachable from funcName, e.g. static
+	 * helpers of the table function, have to stay, or their calls would be
+	 * replaced by undef.
 	 */
+	llvm::SmallPtrSet<llvm::Function *, 16> reachable;
+	llvm::SmallVector<llvm::Function *, 16> worklist;
+
+	if ((func = tfMod->getFunction(funcName)))
+	{
+		reachable.insert(func);
+		worklist.push_back(func);
+	}
+	while (!worklist.empty())
+	{
+		llvm::Function *cur = worklist.pop_back_val();
+
+		if (cur->materialize())
+			elog(FATAL, "failed to materialize function");
+
+		for (llvm::BasicBlock &BB : *cur)
+		{
+			for (llvm::Instruction &I : BB)
+			{
+				for (llvm::Use &U : I.operands())
+				{
+					auto callee = llvm::dyn_cast<llvm::Function>(U.get()->stripPointerCasts());
+
+					if (callee && !callee->isDeclaration() && reachable.insert(callee).second)
+						worklist.push_back(callee);
+				}
+			}
+		}
+	}
+
 	for (llvm::Function &functmp : tfMod->functions())
 	{
-		if (!functmp.isDeclaration() && functmp.getName() != funcName)
+		if (!functmp.isDeclaration() && !reachable.count(&functmp))
 		{	
 			functmp.replaceAllUsesWith(llvm::UndefValue::get(functmp.getType()));
 			funcsToDelete.push_back(&functmp);	
@@ -409,8 +453,12 @@ Datum (*llvm_prepare_lambda_tablefunc(LLVMJitContext *context,
 	FPM.add(new LambdaInjectionPass(context, numLambdas));
 	FPM.run(*func);
 	
-	/* The call to llvm_get_function will compile and optimize the function */
+	/*
+	 * The call to llvm_get_function will compile and optimize the function.
+	 * All code emitted by a cacheable context belongs to this function.
+	 */
 	funcPtr = (Datum (*)(FunctionCallInfo)) llvm_get_function(context, funcName);
+	llvm_lambda_cache_store(context, cacheKey, (void *) funcPtr, 0);
 
 	return funcPtr;
 }
@@ -425,10 +473,15 @@ Datum (*llvm_prepare_simple_expression(ExprState *state))(Datum **)
 	CompiledExprState *cstate = (CompiledExprState *) state->evalfunc_simple_private;
 	Datum (*func)(Datum**);
 
+	/* the emission is part of the compile time of the lambda */
+	if (state->lambda_instr)
+		InstrLambdaStart(state->lambda_instr);
 	llvm_enter_fatal_on_oom();
-	func = (Datum (*)(Datum **)) llvm_get_function(cstate->context,
-												 cstate->funcname);
+	func = (Datum (*)(Datum **)) llvm_get_cached_function(cstate->context, cstate->funcname,
+														  state->lambda_cache_key, "eval");
 	llvm_leave_fatal_on_oom();
+	if (state->lambda_instr)
+		InstrLambdaStop(state->lambda_instr, LAMBDA_INSTR_COMPILE, 0);
 	Assert(func);
 	return func;
 }
@@ -446,10 +499,14 @@ Datum (*llvm_prepare_simple_expression_derivation(ExprState *state))(Datum **, D
 	CompiledExprState *cstate = (CompiledExprState *)state->derivefunc_simple_private;
 	Datum (*func)(Datum **, Datum *);
 
+	if (state->lambda_instr)
+		InstrLambdaStart(state->lambda_instr);
 	llvm_enter_fatal_on_oom();
-	func = (Datum(*)(Datum **, Datum *))llvm_get_function(cstate->context,
-												 		  cstate->funcname);
+	func = (Datum(*)(Datum **, Datum *))llvm_get_cached_function(cstate->context, cstate->funcname,
+																 state->lambda_cache_key, "derive");
 	llvm_leave_fatal_on_oom();
+	if (state->lambda_instr)
+		InstrLambdaStop(state->lambda_instr, LAMBDA_INSTR_COMPILE, 0);
 	Assert(func);
 	return func;
 }
@@ -152,6 +152,7 @@ static MergeScanSelCache *cached_scansel(PlannerInfo *root,
 			   PathKey *pathkey);
 static void cost_rescan(PlannerInfo *root, Path *path,
 			Cost *rescan_startup_cost, Cost *rescan_total_cost);
+static bool functionscan_streams(PlannerInfo *root, Path *path);
 static bool cost_qual_eval_walker(Node *node, cost_qual_eval_context *context);
 static void get_restriction_qual_cost(PlannerInfo *root, RelOptInfo *baserel,
 						  ParamPathInfo *param_info,
@@ -3620,14 +3621,26 @@ cost_rescan(PlannerInfo *root, Path *path,
 		case T_FunctionScan:
 
 			/*
-			 * Currently, nodeFunctionscan.c always executes the function to
-			 * completion before returning any rows, and caches the results in
-			 * a tuplestore.  So the function eval cost is all startup cost
-			 * and isn't paid over again on rescans. However, all run costs
-			 * will be paid over again.
+			 * Usually, nodeFunctionscan.c executes the function to completion
+			 * before returning any rows, and caches the results in a
+			 * tuplestore.  So the function eval cost is all startup cost and
+			 * isn't paid over again on rescans. However, all run costs will
+			 * be paid over again.
+			 *
+			 * A parameterized scan is not asked to support cheap rescans, so
+			 * a function that opts in to streaming is called again on every
+			 * rescan and all costs are paid over again.
 			 */
-			*rescan_startup_cost = 0;
-			*rescan_total_cost = path->total_cost - path->startup_cost;
+			if (path->param_info != NULL && functionscan_streams(root, path))
+			{
+				*rescan_startup_cost = path->startup_cost;
+				*rescan_total_cost = path->total_cost;
+			}
+			else
+			{
+				*rescan_startup_cost = 0;
+				*rescan_total_cost = path->total_cost - path->startup_cost;
+			}
 			break;
 		case T_HashJoin:
 
@@ -3707,6 +3720,31 @@ cost_rescan(PlannerInfo *root, Path *path,
 	}
 }
 
+/*
+ * functionscan_streams
+ *		Would the FunctionScan of the given Path stream its function, if it
+ *		is not asked to support cheap rescans?  Keep this in sync with
+ *		ExecInitFunctionScan.
+ */
+static bool
+functionscan_streams(PlannerInfo *root, Path *path)
+{
+	RangeTblEntry *rte = planner_rt_fetch(path->parent->relid, root);
+	RangeTblFunction *rtfunc;
+	FuncExpr   *funcexpr;
+
+	Assert(rte->rtekind == RTE_FUNCTION);
+	if (list_length(rte->functions) != 1 || rte->funcordinality)
+		return false;
+
+	rtfunc = (RangeTblFunction *) linitial(rte->functions);
+	if (!IsA(rtfunc->funcexpr, FuncExpr))
+		return false;
+	funcexpr = (FuncExpr *) rtfunc->funcexpr;
+
+	return funcexpr->funcretset && fmgr_streams_result(funcexpr->funcid);
+}
+
 
 /*
  * cost_qual_eval
@@ -0,0 +1,564 @@
+/*-------------------------------------------------------------------------
+ *
+ * matrix.c
+ *	  I/O, casts and operations of the native dense matrix type.
+ *
+ *    The matrix type stores its elements as plain float8 values behind a
+ *    fixed header(see utils/matrix.h), therefore the operations in this
+ *    file neither deconstruct array headers nor box elements as Datums.
+ *    The text representation is the same as the one of float8[], such that
+ *    '{{1,2},{3,4}}'::matrix and '{{1,2},{3,4}}'::float8[]::matrix are equal.
+ *
+ * IDENTIFICATION
+ *	  src/backend/utils/adt/matrix.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "fmgr.h"
+
+#include "catalog/pg_type.h"
+#include "libpq/pqformat.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/matrix.h"
+#include "utils/memutils.h"
+
+#include <math.h>
+
+#define MAT_2D(X, Y, ROW_SIZE) ((X) * (ROW_SIZE) + (Y))
+
+static Matrix *matrix_scale(Matrix *in, float8 factor);
+
+/*
+ * Create a new zero initialized matrix of the given size
+ */
+Matrix *matrix_create(int rows, int cols, int flags)
+{
+    Matrix *ret;
+    Size nbytes;
+
+    if (rows < 0 || cols < 0)
+    {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Matrix create: invalid dimensions %d x %d", rows, cols)));
+    }
+    nbytes = MATRIX_SIZE(rows, cols);
+    if (!AllocSizeIsValid(nbytes))
+    {
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("Matrix create: matrix of size %d x %d exceeds the maximum allowed size", rows, cols)));
+    }
+
+    ret = (Matrix *)palloc0(nbytes);
+    if (matrix_instrument.enabled)
+        matrix_instrument.bytes += nbytes;
+    SET_VARSIZE(ret, nbytes);
+    ret->rows = rows;
+    ret->cols = cols;
+    ret->flags = flags;
+    return ret;
+}
+
+/*
+ * Create a new matrix, copy of the given matrix
+ */
+Matrix *matrix_copy(Matrix *in)
+{
+    Matrix *ret = (Matrix *)palloc(VARSIZE(in));
+    if (matrix_instrument.enabled)
+        matrix_instrument.bytes += VARSIZE(in);
+    memcpy(ret, in, VARSIZE(in));
+    return ret;
+}
+
+/*
+ * Convert a float8[] into a matrix
+ * 1D arrays become Nx1 vectors, arrays with lbs[0] == -1 scalars(see matrix_ops.c),
+ * empty arrays are rejected, every matrix has at least one element
+ */
+Matrix *matrix_from_array(ArrayType *in)
+{
+    Matrix *ret;
+    int ndims = ARR_NDIM(in);
+
+    if (ARR_ELEMTYPE(in) != FLOAT8OID)
+    {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                        errmsg("Matrix from array: array has to be of type float8[]")));
+    }
+    if (ARR_HASNULL(in) && array_contains_nulls(in))
+    {
+        ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                        errmsg("Matrix from array: array must not contain nulls")));
+    }
+
+    if (ndims == 0)
+    {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Matrix from array: array must not be empty")));
+    }
+    else if (ndims == 1 && isScalar(in))
+    {
+        ret = matrix_create(1, 1, MATRIX_IS_SCALAR);
+    }
+    else if (ndims == 1)
+    {
+        ret = matrix_create(ARR_DIMS(in)[0], 1, MATRIX_IS_VECTOR);
+    }
+    else if (ndims == 2)
+    {
+        ret = matrix_create(ARR_DIMS(in)[0], ARR_DIMS(in)[1], 0);
+    }
+    else
+    {
+        ereport(ERROR, (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                        errmsg("Matrix from array: array has %d dimensions, matrices have at most 2", ndims)));
+    }
+
+    memcpy(MATRIX_DATA(ret), ARR_DATA_PTR(in), MATRIX_NELEMS(ret) * sizeof(float8));
+    return ret;
+}
+
+/*
+ * Convert a matrix into a float8[], the inverse of matrix_from_array
+ */
+ArrayType *matrix_to_array(Matrix *in)
+{
+    ArrayType *ret;
+    int dims[2], lbs[2] = {1, 1};
+
+    if (MATRIX_ISSCALAR(in))
+    {
+        return DatumGetArrayTypeP(createScalar(MATRIX_DATA(in)[0]));
+    }
+
+    dims[0] = in->rows;
+    dims[1] = in->cols;
+    ret = initResult((in->flags & MATRIX_IS_VECTOR) ? 1 : 2, dims, lbs);
+    memcpy(ARR_DATA_PTR(ret), MATRIX_DATA(in), MATRIX_NELEMS(in) * sizeof(float8));
+    return ret;
+}
+
+/*
+ * matrix_in    -   parses the float8[] text representation
+ */
+Datum matrix_in(PG_FUNCTION_ARGS)
+{
+    char *str = PG_GETARG_CSTRING(0);
+    Datum array = OidInputFunctionCall(F_ARRAY_IN, str, FLOAT8OID, -1);
+
+    PG_RETURN_MATRIX_P(matrix_from_array(DatumGetArrayTypeP(array)));
+}
+
+/*
+ * matrix_out   -   prints the float8[] text representation
+ */
+Datum matrix_out(PG_FUNCTION_ARGS)
+{
+    Matrix *in = PG_GETARG_MATRIX_P(0);
+
+    PG_RETURN_CSTRING(OidOutputFunctionCall(F_ARRAY_OUT, PointerGetDatum(matrix_to_array(in))));
+}
+
+/*
+ * matrix_recv  -   converts external binary format(rows, cols, flags, data) to matrix
+ */
+Datum matrix_recv(PG_FUNCTION_ARGS)
+{
+    StringInfo buf = (StringInfo)PG_GETARG_POINTER(0);
+    Matrix *ret;
+    int rows, cols, flags;
+    float8 *data;
+
+    rows = pq_getmsgint(buf, sizeof(int32));
+    cols = pq_getmsgint(buf, sizeof(int32));
+    flags = pq_getmsgint(buf, sizeof(int32));
+    if (flags & ~(MATRIX_IS_SCALAR | MATRIX_IS_VECTOR))
+    {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid flags in external \"matrix\" value")));
+    }
+    if (rows < 1 || cols < 1)
+    {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid dimensions %d x %d in external \"matrix\" value", rows, cols)));
+    }
+    // scalars are 1x1, vectors Nx1(see matrix_from_array)
+    if (((flags & MATRIX_IS_SCALAR) && (rows != 1 || cols != 1)) ||
+        ((flags & MATRIX_IS_VECTOR) && cols != 1))
+    {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("flags do not match the dimensions %d x %d in external \"matrix\" value", rows, cols)));
+    }
+
+    ret = matrix_create(rows, cols, flags);
+    data = MATRIX_DATA(ret);
+    for (Size i = 0; i < MATRIX_NELEMS(ret); i++)
+    {
+        data[i] = pq_getmsgfloat8(buf);
+    }
+    PG_RETURN_MATRIX_P(ret);
+}
+
+/*
+ * matrix_send  -   converts matrix to binary format
+ */
+Datum matrix_send(PG_FUNCTION_ARGS)
+{
+    Matrix *in = PG_GETARG_MATRIX_P(0);
+    float8 *data = MATRIX_DATA(in);
+    StringInfoData buf;
+
+    pq_begintypsend(&buf);
+    pq_sendint32(&buf, in->rows);
+    pq_sendint32(&buf, in->cols);
+    pq_sendint32(&buf, in->flags);
+    for (Size i = 0; i < MATRIX_NELEMS(in); i++)
+    {
+        pq_sendfloat8(&buf, data[i]);
+    }
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Cast float8[] to matrix
+ */
+Datum array_to_matrix(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_MATRIX_P(matrix_from_array(PG_GETARG_ARRAYTYPE_P(0)));
+}
+
+/*
+ * Cast matrix to float8[]
+ */
+Datum matrix_to_float8_array(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_ARRAYTYPE_P(matrix_to_array(PG_GETARG_MATRIX_P(0)));
+}
+
+/*
+ * Multiply every element of a matrix with a factor and return result as new matrix
+ */
+static Matrix *matrix_scale(Matrix *in, float8 factor)
+{
+    Matrix *ret = matrix_copy(in);
+    float8 *data = MATRIX_DATA(ret);
+    const Size length = MATRIX_NELEMS(ret);
+
+    matrix_elementwise(MATRIX_ELEM_MUL_SCALAR, data, NULL, factor, data, length);
+    return ret;
+}
+
+/*
+ * Calculate the matrix product of matrix A and B, uses element-wise multiplication, if one is a scalar
+ */
+Datum matrix_mat_mul(PG_FUNCTION_ARGS)
+{
+    Matrix *a = PG_GETARG_MATRIX_P(0);
+    Matrix *b = PG_GETARG_MATRIX_P(1);
+    Matrix *ret;
+    int flags = 0;
+
+    if (MATRIX_ISSCALAR(a))
+    {
+        PG_RETURN_MATRIX_P(matrix_scale(b, MATRIX_DATA(a)[0]));
+    }
+    if (MATRIX_ISSCALAR(b))
+    {
+        PG_RETURN_MATRIX_P(matrix_scale(a, MATRIX_DATA(b)[0]));
+    }
+    if ((a->flags & MATRIX_IS_VECTOR) && (b->flags & MATRIX_IS_VECTOR))
+    {
+        ereport(ERROR, (errmsg("Matrix Multiplication: Two column vectors can not be multiplied!")));
+    }
+    if (a->cols != b->rows)
+    {
+        ereport(ERROR, (errmsg("Matrix Multiplication: Matrices are mismatched! (%d x %d) * (%d x %d)",
+                               a->rows, a->cols, b->rows, b->cols)));
+    }
+
+    // 1xN * Nx1 case (create scalar), Nx1 result of a vector stays a vector
+    if (a->rows == 1 && b->cols == 1)
+    {
+        flags = MATRIX_IS_SCALAR;
+    }
+    else if (b->flags & MATRIX_IS_VECTOR)
+    {
+        flags = MATRIX_IS_VECTOR;
+    }
+
+    ret = matrix_create(a->rows, b->cols, flags);
+    matrix_gemm(MATRIX_DATA(a), MATRIX_DATA(b), MATRIX_DATA(ret), a->rows, a->cols, b->cols, false, false);
+    PG_RETURN_MATRIX_P(ret);
+}
+
+/*
+ * Add two matrices element-wise, a scalar is added to every element
+ */
+Datum matrix_mat_add(PG_FUNCTION_ARGS)
+{
+    Matrix *a = PG_GETARG_MATRIX_P(0);
+    Matrix *b = PG_GETARG_MATRIX_P(1);
+    Matrix *ret;
+    float8 *ret_data, *b_data;
+    Size length;
+
+    if (MATRIX_ISSCALAR(a) && !MATRIX_ISSCALAR(b))
+    {
+        Matrix *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    ret = matrix_copy(a);
+    ret_data = MATRIX_DATA(ret);
+    b_data = MATRIX_DATA(b);
+    length = MATRIX_NELEMS(ret);
+
+    if (MATRIX_ISSCALAR(b))
+    {
+        matrix_elementwise(MATRIX_ELEM_ADD_SCALAR, ret_data, NULL, b_data[0], ret_data, length);
+        PG_RETURN_MATRIX_P(ret);
+    }
+
+    if (a->rows != b->rows || a->cols != b->cols)
+    {
+        ereport(ERROR, (errmsg("Matrix element-wise addition: Matrices are mismatched!")));
+    }
+    matrix_elementwise(MATRIX_ELEM_ADD, ret_data, b_data, 0.0, ret_data, length);
+    PG_RETURN_MATRIX_P(ret);
+}
+
+/*
+ * Subtract matrix from matrix and return result as new matrix, a scalar is subtracted from every
+ * element, or every element from a scalar
+ */
+Datum matrix_mat_sub(PG_FUNCTION_ARGS)
+{
+    Matrix *a = PG_GETARG_MATRIX_P(0);
+    Matrix *b = PG_GETARG_MATRIX_P(1);
+    Matrix *ret;
+    float8 *ret_data, *b_data;
+    Size length;
+
+    if (MATRIX_ISSCALAR(b))
+    {
+        ret = matrix_copy(a);
+        ret_data = MATRIX_DATA(ret);
+        matrix_elementwise(MATRIX_ELEM_ADD_SCALAR, ret_data, NULL, -MATRIX_DATA(b)[0], ret_data,
+                           MATRIX_NELEMS(ret));
+        PG_RETURN_MATRIX_P(ret);
+    }
+    if (MATRIX_ISSCALAR(a))
+    {
+        // s - b = -b + s
+        ret = matrix_copy(b);
+        ret_data = MATRIX_DATA(ret);
+        length = MATRIX_NELEMS(ret);
+        matrix_elementwise(MATRIX_ELEM_MUL_SCALAR, ret_data, NULL, -1.0, ret_data, length);
+        matrix_elementwise(MATRIX_ELEM_ADD_SCALAR, ret_data, NULL, MATRIX_DATA(a)[0], ret_data, length);
+        PG_RETURN_MATRIX_P(ret);
+    }
+    if (a->rows != b->rows || a->cols != b->cols)
+    {
+        ereport(ERROR, (errmsg("Matrix element-wise Subtraction: Matrices are mismatched!")));
+    }
+    ret = matrix_copy(a);
+    ret_data = MATRIX_DATA(ret);
+    b_data = MATRIX_DATA(b);
+    length = MATRIX_NELEMS(ret);
+    matrix_elementwise(MATRIX_ELEM_SUB, ret_data, b_data, 0.0, ret_data, length);
+    PG_RETURN_MATRIX_P(ret);
+}
+
+/*
+ * Multiply two matrices element-wise and return product as new matrix
+ */
+Datum matrix_mat_mul_elem(PG_FUNCTION_ARGS)
+{
+    Matrix *a = PG_GETARG_MATRIX_P(0);
+    Matrix *b = PG_GETARG_MATRIX_P(1);
+    Matrix *ret;
+    float8 *ret_data, *b_data;
+    Size length;
+
+    if (MATRIX_ISSCALAR(a))
+    {
+        PG_RETURN_MATRIX_P(matrix_scale(b, MATRIX_DATA(a)[0]));
+    }
+    if (MATRIX_ISSCALAR(b))
+    {
+        PG_RETURN_MATRIX_P(matrix_scale(a, MATRIX_DATA(b)[0]));
+    }
+    if (a->rows != b->rows || a->cols != b->cols)
+    {
+        ereport(ERROR, (errmsg("Matrix element-wise Multiplication: Matrices are mismatched!")));
+    }
+    ret = matrix_copy(a);
+    ret_data = MATRIX_DATA(ret);
+    b_data = MATRIX_DATA(b);
+    length = MATRIX_NELEMS(ret);
+    matrix_elementwise(MATRIX_ELEM_MUL, ret_data, b_data, 0.0, ret_data, length);
+    PG_RETURN_MATRIX_P(ret);
+}
+
+/*
+ * Return transposed copy of matrix/vector, a transposed vector becomes a 1xN matrix
+ */
+Datum matrix_mat_transpose(PG_FUNCTION_ARGS)
+{
+    Matrix *in = PG_GETARG_MATRIX_P(0);
+    Matrix *ret;
+    float8 *A, *B;
+    const int rows = in->rows, cols = in->cols;
+
+    if (MATRIX_ISSCALAR(in))
+    {
+        PG_RETURN_MATRIX_P(matrix_copy(in));
+    }
+    // a 1xN matrix transposed is a column vector
+    ret = matrix_create(cols, rows, (rows == 1) ? MATRIX_IS_VECTOR : 0);
+    A = MATRIX_DATA(in);
+    B = MATRIX_DATA(ret);
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            B[MAT_2D(j, i, rows)] = A[MAT_2D(i, j, cols)];
+        }
+    }
+    PG_RETURN_MATRIX_P(ret);
+}
+
+/*
+ * Return index of largest value
+ */
+Datum matrix_index_max(PG_FUNCTION_ARGS)
+{
+    Matrix *in = PG_GETARG_MATRIX_P(0);
+    float8 *data = MATRIX_DATA(in);
+    const Size length = MATRIX_NELEMS(in);
+    int max_index = 0;
+
+    if (length == 0)
+    {
+        ereport(ERROR, (errmsg("Index_max recieved empty input!")));
+    }
+    for (Size i = 1; i < length; i++)
+    {
+        if (data[i] > data[max_index])
+        {
+            max_index = i;
+        }
+    }
+    PG_RETURN_INT32(max_index);
+}
+
+/*
+ * Softmax implementation with numerical stability
+ */
+Datum matrix_softmax(PG_FUNCTION_ARGS)
+{
+    Matrix *ret = PG_GETARG_MATRIX_P_COPY(0);
+    float8 *data = MATRIX_DATA(ret);
+    const Size length = MATRIX_NELEMS(ret);
+    float8 max = (length > 0) ? data[0] : 0.0, sum = 0.0;
+
+    for (Size i = 1; i < length; i++)
+    {
+        if (max < data[i])
+            max = data[i];
+    }
+    for (Size i = 0; i < length; i++)
+    {
+        data[i] = exp(data[i] - max);
+        sum += data[i];
+    }
+    for (Size i = 0; i < length; i++)
+    {
+        data[i] /= sum;
+    }
+    PG_RETURN_MATRIX_P(ret);
+}
+
+/*
+ *		softmax_cce, returns the softmax_cce loss of arg1 as inputs and arg2 as labels(one_hot)
+ */
+Datum matrix_softmax_cce(PG_FUNCTION_ARGS)
+{
+    Matrix *input = PG_GETARG_MATRIX_P(0);
+    Matrix *labels = PG_GETARG_MATRIX_P(1);
+    float8 *data = MATRIX_DATA(input);
+    float8 *label_data = MATRIX_DATA(labels);
+    const Size length = MATRIX_NELEMS(input);
+    float8 max, sum = 0.0, lse, result = 0.0;
+
+    if (input->rows != labels->rows || input->cols != labels->cols)
+    {
+        ereport(ERROR, (errmsg("Softmax CCE: *labels* (%d x %d) and *input* (%d x %d) do not match!",
+                               labels->rows, labels->cols, input->rows, input->cols)));
+    }
+    if (input->rows != 1 && input->cols != 1)
+    {
+        ereport(ERROR, (errmsg("Softmax CCE: *input* is not a vector!")));
+    }
+    if (length == 0)
+    {
+        ereport(ERROR, (errmsg("Softmax CCE: *input* is empty!")));
+    }
+
+    max = data[0];
+    for (Size i = 1; i < length; i++)
+    {
+        if (max < data[i])
+            max = data[i];
+    }
+    for (Size i = 0; i < length; i++)
+    {
+        sum += exp(data[i] - max);
+    }
+    lse = log(sum);
+    for (Size i = 0; i < length; i++)
+    {
+        result += (data[i] - max - lse) * label_data[i];
+    }
+    PG_RETURN_FLOAT8(result);
+}
+
+/* silu_m   -   apply silu to every element of a matrix*/
+Datum matrix_silu(PG_FUNCTION_ARGS)
+{
+    Matrix *ret = PG_GETARG_MATRIX_P_COPY(0);
+
+    matrix_activation_forward(MATRIX_ACT_SILU, MATRIX_DATA(ret), MATRIX_DATA(ret), MATRIX_NELEMS(ret));
+    PG_RETURN_MATRIX_P(ret);
+}
+
+/* sigmoid_m   -   apply sigmoid to every element of a matrix*/
+Datum matrix_sigmoid(PG_FUNCTION_ARGS)
+{
+    Matrix *ret = PG_GETARG_MATRIX_P_COPY(0);
+
+    matrix_activation_forward(MATRIX_ACT_SIGMOID, MATRIX_DATA(ret), MATRIX_DATA(ret), MATRIX_NELEMS(ret));
+    PG_RETURN_MATRIX_P(ret);
+}
+
+/* tanh_m   -   apply tanh to every element of a matrix*/
+Datum matrix_tanh(PG_FUNCTION_ARGS)
+{
+    Matrix *ret = PG_GETARG_MATRIX_P_COPY(0);
+
+    matrix_activation_forward(MATRIX_ACT_TANH, MATRIX_DATA(ret), MATRIX_DATA(ret), MATRIX_NELEMS(ret));
+    PG_RETURN_MATRIX_P(ret);
+}
+
+/* relu_m   -   apply relu to every element of a matrix*/
+Datum matrix_relu(PG_FUNCTION_ARGS)
+{
+    Matrix *ret = PG_GETARG_MATRIX_P_COPY(0);
+
+    matrix_activation_forward(MATRIX_ACT_RELU, MATRIX_DATA(ret), MATRIX_DATA(ret), MATRIX_NELEMS(ret));
+    PG_RETURN_MATRIX_P(ret);
+}
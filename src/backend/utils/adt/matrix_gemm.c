@@ -0,0 +1,325 @@
+/*-------------------------------------------------------------------------
+ *
+ * matrix_gemm.c
+ *	  Dense matrix product used by the float8[] and the native matrix
+ *    operations(see matrix_ops.c and matrix.c).
+ *
+ *    C = op(A) * op(B), op() being an optional transposition, is computed in
+ *    the usual blocked fashion: B is packed into KC x NC panels, A into
+ *    MC x KC panels, both laid out such that a register-tiled microkernel
+ *    computes one GEMM_MR x GEMM_NR tile of C by streaming contiguous memory.
+ *    Transposed operands are only read in different order while packing, so
+ *    no transposed copy is ever materialized.
+ *
+ *    The microkernel uses GCC vector extensions, on x86-64 a second copy is
+ *    compiled for AVX2/FMA and chosen at runtime if the CPU supports it.
+ *    Compilers without vector extensions use the plain C loop.
+ *
+ *    The column slivers of a block of C are independent and are distributed
+ *    over the helper threads of matrix_parallel.c.
+ *
+ * IDENTIFICATION
+ *	  src/backend/utils/adt/matrix_gemm.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "utils/array.h"
+
+/* register tile, GEMM_NR has to be a multiple of 4 */
+#define GEMM_MR 4
+#define GEMM_NR 8
+/* cache blocking: a MC x KC panel of A fits into L2, a KC x NR sliver of B into L1 */
+#define GEMM_MC 128
+#define GEMM_KC 256
+#define GEMM_NC 1024
+
+/* products smaller than this(m*k*n) use the simple loop, packing does not pay off */
+#define GEMM_BLOCKING_THRESHOLD (32 * 32 * 32)
+
+#define GEMM_ALIGN 64
+
+/* op(X)[row][col] of a row-major matrix with the given number of stored columns */
+#define GEMM_ELEM(X, row, col, ld, trans) ((trans) ? (X)[(size_t)(col) * (ld) + (row)] : (X)[(size_t)(row) * (ld) + (col)])
+
+typedef void (*gemm_kernel_fn)(int kc, const float8 *a, const float8 *b, float8 *c);
+
+static void gemm_simple(const float8 *A, const float8 *B, float8 *C, int m, int k, int n,
+                        bool transA, bool transB);
+static void gemm_pack_a(const float8 *A, float8 *packed, int lda, bool transA,
+                        int row, int mc, int p0, int kc);
+static void gemm_pack_b(const float8 *B, float8 *packed, int ldb, bool transB,
+                        int p0, int kc, int col, int nc);
+static void gemm_kernel_generic(int kc, const float8 *a, const float8 *b, float8 *c);
+static gemm_kernel_fn gemm_choose_kernel(void);
+
+#if defined(__GNUC__)
+#define GEMM_HAVE_VECTOR_EXT 1
+typedef double gemm_v4d __attribute__((vector_size(4 * sizeof(double))));
+#endif
+
+#if defined(GEMM_HAVE_VECTOR_EXT) && defined(__x86_64__)
+#define GEMM_HAVE_AVX2 1
+static void gemm_kernel_avx2(int kc, const float8 *a, const float8 *b, float8 *c);
+#endif
+
+/*
+ * Microkernel: c(GEMM_MR x GEMM_NR, dense) = a(packed panel) * b(packed panel)
+ * a holds GEMM_MR values per k, b GEMM_NR values per k, both aligned to GEMM_ALIGN.
+ */
+#ifdef GEMM_HAVE_VECTOR_EXT
+static inline __attribute__((always_inline)) void
+gemm_kernel_body(int kc, const float8 *a, const float8 *b, float8 *c)
+{
+    gemm_v4d acc[GEMM_MR][GEMM_NR / 4];
+
+    memset(acc, 0, sizeof(acc));
+    for (int p = 0; p < kc; p++)
+    {
+        const gemm_v4d *bp = (const gemm_v4d *)(b + p * GEMM_NR);
+        for (int r = 0; r < GEMM_MR; r++)
+        {
+            const float8 ar = a[p * GEMM_MR + r];
+            const gemm_v4d av = {ar, ar, ar, ar};
+            for (int v = 0; v < GEMM_NR / 4; v++)
+            {
+                acc[r][v] += av * bp[v];
+            }
+        }
+    }
+    memcpy(c, acc, sizeof(acc));
+}
+#else
+static inline void
+gemm_kernel_body(int kc, const float8 *a, const float8 *b, float8 *c)
+{
+    float8 acc[GEMM_MR][GEMM_NR];
+
+    memset(acc, 0, sizeof(acc));
+    for (int p = 0; p < kc; p++)
+    {
+        for (int r = 0; r < GEMM_MR; r++)
+        {
+            const float8 ar = a[p * GEMM_MR + r];
+            for (int col = 0; col < GEMM_NR; col++)
+            {
+                acc[r][col] += ar * b[p * GEMM_NR + col];
+            }
+        }
+    }
+    memcpy(c, acc, sizeof(acc));
+}
+#endif
+
+static void
+gemm_kernel_generic(int kc, const float8 *a, const float8 *b, float8 *c)
+{
+    gemm_kernel_body(kc, a, b, c);
+}
+
+#ifdef GEMM_HAVE_AVX2
+__attribute__((target("avx2,fma"))) static void
+gemm_kernel_avx2(int kc, const float8 *a, const float8 *b, float8 *c)
+{
+    gemm_kernel_body(kc, a, b, c);
+}
+#endif
+
+/*
+ * Pick the best microkernel for the running CPU, done once per backend
+ */
+static gemm_kernel_fn
+gemm_choose_kernel(void)
+{
+#ifdef GEMM_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return gemm_kernel_avx2;
+    }
+#endif
+    return gemm_kernel_generic;
+}
+
+/*
+ * Pack rows [row, row + mc) and k-range [p0, p0 + kc) of op(A) into GEMM_MR row panels,
+ * rows past the end of A are zero padded
+ */
+static void
+gemm_pack_a(const float8 *A, float8 *packed, int lda, bool transA, int row, int mc, int p0, int kc)
+{
+    for (int ir = 0; ir < mc; ir += GEMM_MR)
+    {
+        const int mr = Min(GEMM_MR, mc - ir);
+        for (int p = 0; p < kc; p++)
+        {
+            for (int r = 0; r < GEMM_MR; r++)
+            {
+                *packed++ = (r < mr) ? GEMM_ELEM(A, row + ir + r, p0 + p, lda, transA) : 0.0;
+            }
+        }
+    }
+}
+
+/*
+ * Pack k-range [p0, p0 + kc) and columns [col, col + nc) of op(B) into GEMM_NR column panels,
+ * columns past the end of B are zero padded
+ */
+static void
+gemm_pack_b(const float8 *B, float8 *packed, int ldb, bool transB, int p0, int kc, int col, int nc)
+{
+    for (int jr = 0; jr < nc; jr += GEMM_NR)
+    {
+        const int nr = Min(GEMM_NR, nc - jr);
+        for (int p = 0; p < kc; p++)
+        {
+            for (int c = 0; c < GEMM_NR; c++)
+            {
+                *packed++ = (c < nr) ? GEMM_ELEM(B, p0 + p, col + jr + c, ldb, transB) : 0.0;
+            }
+        }
+    }
+}
+
+/*
+ * Reference implementation, used for small products
+ */
+static void
+gemm_simple(const float8 *A, const float8 *B, float8 *C, int m, int k, int n, bool transA, bool transB)
+{
+    const int lda = transA ? m : k;
+    const int ldb = transB ? k : n;
+
+    for (int i = 0; i < m; i++)
+    {
+        for (int col = 0; col < n; col++)
+        {
+            float8 tmp = 0.0;
+            for (int j = 0; j < k; j++)
+            {
+                tmp += GEMM_ELEM(A, i, j, lda, transA) * GEMM_ELEM(B, j, col, ldb, transB);
+            }
+            C[(size_t)i * n + col] = tmp;
+        }
+    }
+}
+
+/* one MC x NC block of C, split into GEMM_NR wide slivers */
+typedef struct GemmBlock
+{
+    gemm_kernel_fn kernel;
+    const float8 *packedA;
+    const float8 *packedB;
+    float8 *C;
+    int n;
+    int ic, jc;
+    int mc, nc, kc;
+} GemmBlock;
+
+/*
+ * Multiply the packed panels for the slivers [START, END) of a block, called by matrix_parallel_for()
+ */
+static void gemm_block_range(void *arg, int start, int end)
+{
+    const GemmBlock *ctx = (const GemmBlock *)arg;
+    const int kc = ctx->kc;
+    const int n = ctx->n;
+    float8 tile[GEMM_MR * GEMM_NR];
+
+    for (int jr = start * GEMM_NR; jr < Min(end * GEMM_NR, ctx->nc); jr += GEMM_NR)
+    {
+        const int nr = Min(GEMM_NR, ctx->nc - jr);
+
+        for (int ir = 0; ir < ctx->mc; ir += GEMM_MR)
+        {
+            const int mr = Min(GEMM_MR, ctx->mc - ir);
+            float8 *c = ctx->C + (size_t)(ctx->ic + ir) * n + ctx->jc + jr;
+
+            ctx->kernel(kc, ctx->packedA + (size_t)ir * kc, ctx->packedB + (size_t)jr * kc, tile);
+            for (int r = 0; r < mr; r++)
+            {
+                for (int col = 0; col < nr; col++)
+                {
+                    c[(size_t)r * n + col] += tile[r * GEMM_NR + col];
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Dense product C(m x n) = op(A)(m x k) * op(B)(k x n), all row-major
+ * transA/transB: A is stored as k x m / B is stored as n x k and read transposed
+ * Shared by the float8[] and the native matrix implementation
+ */
+void matrix_gemm(const float8 *A, const float8 *B, float8 *C, int m, int k, int n, bool transA, bool transB)
+{
+    static gemm_kernel_fn kernel = NULL;
+    const int lda = transA ? m : k;
+    const int ldb = transB ? k : n;
+    char *a_buf, *b_buf;
+    float8 *packedA, *packedB;
+    int mc_max, kc_max, nc_max;
+    GemmBlock ctx;
+    instr_time start;
+
+    if (m == 0 || n == 0)
+    {
+        return;
+    }
+    matrix_kernel_begin(&start);
+    if ((double)m * k * n < GEMM_BLOCKING_THRESHOLD || k == 0)
+    {
+        gemm_simple(A, B, C, m, k, n, transA, transB);
+        matrix_kernel_end(&start);
+        return;
+    }
+    if (kernel == NULL)
+    {
+        kernel = gemm_choose_kernel();
+    }
+
+    mc_max = TYPEALIGN(GEMM_MR, Min(m, GEMM_MC));
+    kc_max = Min(k, GEMM_KC);
+    nc_max = TYPEALIGN(GEMM_NR, Min(n, GEMM_NC));
+    a_buf = palloc((Size)mc_max * kc_max * sizeof(float8) + GEMM_ALIGN);
+    b_buf = palloc((Size)kc_max * nc_max * sizeof(float8) + GEMM_ALIGN);
+    packedA = (float8 *)TYPEALIGN(GEMM_ALIGN, a_buf);
+    packedB = (float8 *)TYPEALIGN(GEMM_ALIGN, b_buf);
+
+    memset(C, 0, (Size)m * n * sizeof(float8));
+    ctx.kernel = kernel;
+    ctx.packedA = packedA;
+    ctx.packedB = packedB;
+    ctx.C = C;
+    ctx.n = n;
+
+    for (int jc = 0; jc < n; jc += GEMM_NC)
+    {
+        const int nc = Min(GEMM_NC, n - jc);
+        for (int pc = 0; pc < k; pc += GEMM_KC)
+        {
+            const int kc = Min(GEMM_KC, k - pc);
+            gemm_pack_b(B, packedB, ldb, transB, pc, kc, jc, nc);
+
+            for (int ic = 0; ic < m; ic += GEMM_MC)
+            {
+                const int mc = Min(GEMM_MC, m - ic);
+                gemm_pack_a(A, packedA, lda, transA, ic, mc, pc, kc);
+
+                ctx.ic = ic;
+                ctx.jc = jc;
+                ctx.mc = mc;
+                ctx.nc = nc;
+                ctx.kc = kc;
+                // every sliver owns a distinct column block of C
+                matrix_parallel_for((nc + GEMM_NR - 1) / GEMM_NR, 2.0 * mc * kc * GEMM_NR, gemm_block_range, &ctx);
+            }
+        }
+    }
+
+    pfree(a_buf);
+    pfree(b_buf);
+    matrix_kernel_end(&start);
+}
@@ -28,7 +28,7 @@
 
 #include <math.h>
 
-#define MAT_2D(X, Y, ROW_SIZE) (X * ROW_SIZE + Y)
+#define MAT_2D(X, Y, ROW_SIZE) ((X) * (ROW_SIZE) + (Y))
 
 /*
  * Calculate the matrix product of Matrix(ArrayType) A and B
@@ -71,22 +71,16 @@ Datum matrix_mul(PG_FUNCTION_ARGS)
     {
         ret = PG_GETARG_ARRAYTYPE_P_COPY(1);
         float8 *data = (float8 *)ARR_DATA_PTR(ret);
-#pragma omp parallel for
-        for (int i = 0; i < length2; i++)
-        {
-            data[i] *= DatumGetFloat8(((Datum *)ARR_DATA_PTR(a1))[0]);
-        }
+        matrix_elementwise(MATRIX_ELEM_MUL_SCALAR, data, NULL, DatumGetFloat8(((Datum *)ARR_DATA_PTR(a1))[0]), data,
+                           length2);
         PG_RETURN_ARRAYTYPE_P(ret);
     }
     if (isScalar(a2))
     {
         ret = PG_GETARG_ARRAYTYPE_P_COPY(0);
         float8 *data = (float8 *)ARR_DATA_PTR(ret);
-#pragma omp parallel for
-        for (int i = 0; i < length1; i++)
-        {
-            data[i] *= DatumGetFloat8(((Datum *)ARR_DATA_PTR(a2))[0]);
-        }
+        matrix_elementwise(MATRIX_ELEM_MUL_SCALAR, data, NULL, DatumGetFloat8(((Datum *)ARR_DATA_PTR(a2))[0]), data,
+                           length1);
         PG_RETURN_ARRAYTYPE_P(ret);
     }
 
@@ -126,23 +120,30 @@ Datum matrix_mul(PG_FUNCTION_ARGS)
 
     ret = initResult(ndim_res, dims, lbs);
 
-    float8 *ps1 = (float8 *)ARR_DATA_PTR(a1);
-    float8 *ps2 = (float8 *)ARR_DATA_PTR(a2);
-    float8 *ps;
+    matrix_gemm((float8 *)ARR_DATA_PTR(a1), (float8 *)ARR_DATA_PTR(a2), (float8 *)ARR_DATA_PTR(ret),
+                dima, dimb, dimc, false, false);
+    PG_RETURN_ARRAYTYPE_P(ret);
+}
 
-    ps = (float8 *)ARR_DATA_PTR(ret);
-#pragma omp parallel for
-    for (int i = 0; i < dima; i++)
+/*
+ * Logical shape of op(X), where op() optionally transposes X
+ * The transposition of a column vector is a 1xN matrix and vice versa(see matrix_transpose_internal)
+ */
+static void matrix_op_shape(ArrayType *x, const bool transpose, int *rows, int *cols, int *ndim)
+{
+    int stored_rows = ARR_DIMS(x)[0];
+    int stored_cols = (ARR_NDIM(x) == 2) ? ARR_DIMS(x)[1] : 1;
+
+    if (!transpose)
     {
-        for (int j = 0; j < dimb; j++)
-        {
-            for (int k = 0; k < dimc; k++)
-            {
-                ps[MAT_2D(i, k, dimc)] += ps1[MAT_2D(i, j, dimb)] * ps2[MAT_2D(j, k, dimc)];
-            }
-        }
+        *rows = stored_rows;
+        *cols = stored_cols;
+        *ndim = ARR_NDIM(x);
+        return;
     }
-    PG_RETURN_ARRAYTYPE_P(ret);
+    *rows = stored_cols;
+    *cols = stored_rows;
+    *ndim = (ARR_NDIM(x) == 2 && stored_rows == 1) ? 1 : 2;
 }
 
 /*
@@ -168,11 +169,11 @@ Datum matrix_mul_internal(Datum MatA, Datum MatB, const bool transposeA, const b
     }
 
     // Extract the PostgreSQL arrays from the parameters passed to this function call.
-    a1 = DatumGetArrayTypeP((transposeA) ? (matrix_transpose_internal(MatA)) : (MatA));
-    a2 = DatumGetArrayTypeP((transposeB) ? (matrix_transpose_internal(MatB)) : (MatB));
+    // Transposed inputs are not copied, the GEMM kernel reads them transposed.
+    a1 = DatumGetArrayTypeP(MatA);
+    a2 = DatumGetArrayTypeP(MatB);
 
-    int *dim1 = ARR_DIMS(a1);
-    int *dim2 = ARR_DIMS(a2);
+    int rows1, cols1, ndim1, rows2, cols2, ndim2;
     int lbs[2] = {1, 1};
     int dims[2] = {1, 1};
     int ndim_res;
@@ -188,52 +189,54 @@ Datum matrix_mul_internal(Datum MatA, Datum MatB, const bool transposeA, const b
     {
         ret = copyArray(MatB);
         float8 *data = (float8 *)ARR_DATA_PTR(ret);
-#pragma omp parallel for
-        for (int i = 0; i < length2; i++)
-        {
-            data[i] *= DatumGetFloat8(((Datum *)ARR_DATA_PTR(a1))[0]);
-        }
+        matrix_elementwise(MATRIX_ELEM_MUL_SCALAR, data, NULL, DatumGetFloat8(((Datum *)ARR_DATA_PTR(a1))[0]), data,
+                           length2);
         PG_RETURN_ARRAYTYPE_P(ret);
     }
     if (isScalar(a2))
     {
         ret = copyArray(MatA);
         float8 *data = (float8 *)ARR_DATA_PTR(ret);
-#pragma omp parallel for
-        for (int i = 0; i < length1; i++)
-        {
-            data[i] *= DatumGetFloat8(((Datum *)ARR_DATA_PTR(a2))[0]);
-        }
+        matrix_elementwise(MATRIX_ELEM_MUL_SCALAR, data, NULL, DatumGetFloat8(((Datum *)ARR_DATA_PTR(a2))[0]), data,
+                           length1);
         PG_RETURN_ARRAYTYPE_P(ret);
     }
 
-    if (ARR_NDIM(a1) == 1 && ARR_NDIM(a2) == 1)
+    matrix_op_shape(a1, transposeA, &rows1, &cols1, &ndim1);
+    matrix_op_shape(a2, transposeB, &rows2, &cols2, &ndim2);
+
+    if (ndim1 == 1 && ndim2 == 1)
     {
         ereport(ERROR, (errmsg("Matrix Multiplication Internal: Two column vectors can not be multiplied!")));
     }
 
     // no matter the NDIM of MatA, dima will always be the first dimension of the result
-    dima = dim1[0];
-    dims[0] = dim1[0];
+    dima = rows1;
+    dims[0] = rows1;
 
     // if NDIM of MatB is 2, it is either a transposed vector(row-vector), or full matrix
     // in either case, we create a result matrix, as both would result in matrices
     //(except for 1xN * Nx1 case)
-    if (ARR_NDIM(a2) == 2)
+    dimb = rows2;
+    if (ndim2 == 2)
     {
-        dimb = dim2[0];
-        dimc = dim2[1];
-        dims[1] = dim2[1];
+        dimc = cols2;
+        dims[1] = cols2;
         ndim_res = 2;
     }
     else
     {
-        dimb = dim2[0];
         dimc = 1;
         dims[1] = 1;
         ndim_res = 1;
     }
 
+    if (cols1 != dimb)
+    {
+        ereport(ERROR, (errmsg("Matrix Multiplication Internal: Matrices are mismatched! (%d x %d) * (%d x %d)",
+                               rows1, cols1, rows2, cols2)));
+    }
+
     // 1xN * Nx1 case (create scalar)
     if (dima == 1 && dimc == 1)
     {
@@ -244,23 +247,8 @@ Datum matrix_mul_internal(Datum MatA, Datum MatB, const bool transposeA, const b
 
     ret = initResult(ndim_res, dims, lbs);
 
-    float8 *ps1 = (float8 *)ARR_DATA_PTR(a1);
-    float8 *ps2 = (float8 *)ARR_DATA_PTR(a2);
-    float8 *ps = (float8 *)ARR_DATA_PTR(ret);
-
-    //#pragma omp parallel for
-    for (int i = 0; i < dima; i++)
-    {
-        for (int k = 0; k < dimc; k++)
-        {
-            float8 tmp = 0.0;
-            for (int j = 0; j < dimb; j++)
-            {
-                tmp += ps1[MAT_2D(i, j, dimb)] * ps2[MAT_2D(j, k, dimc)];
-            }
-            ps[MAT_2D(i, k, dimc)] = tmp;
-        }
-    }
+    matrix_gemm((float8 *)ARR_DATA_PTR(a1), (float8 *)ARR_DATA_PTR(a2), (float8 *)ARR_DATA_PTR(ret),
+                dima, dimb, dimc, transposeA, transposeB);
     PG_RETURN_ARRAYTYPE_P(ret);
 }
 
@@ -294,23 +282,15 @@ Datum matrix_add_inplace(Datum MatA, Datum MatB)
     {
         Datum elem = ((Datum *)ARR_DATA_PTR(a1))[0];
         a1 = copyArray(MatB);
-        Datum *data = (Datum *)ARR_DATA_PTR(a1);
-#pragma omp parallel for
-        for (int i = 0; i < length2; i++)
-        {
-            data[i] = Float8GetDatum(DatumGetFloat8(data[i]) + DatumGetFloat8(elem));
-        }
+        float8 *data = (float8 *)ARR_DATA_PTR(a1);
+        matrix_elementwise(MATRIX_ELEM_ADD_SCALAR, data, NULL, DatumGetFloat8(elem), data, length2);
         PG_RETURN_ARRAYTYPE_P(a1);
     }
     if (isScalar(a2))
     {
-        Datum *data = (Datum *)ARR_DATA_PTR(a1);
+        float8 *data = (float8 *)ARR_DATA_PTR(a1);
         Datum elem = ((Datum *)ARR_DATA_PTR(a2))[0];
-#pragma omp parallel for
-        for (int i = 0; i < length1; i++)
-        {
-            data[i] = Float8GetDatum(DatumGetFloat8(data[i]) + DatumGetFloat8(elem));
-        }
+        matrix_elementwise(MATRIX_ELEM_ADD_SCALAR, data, NULL, DatumGetFloat8(elem), data, length1);
         PG_RETURN_ARRAYTYPE_P(a1);
     }
 
@@ -326,15 +306,8 @@ Datum matrix_add_inplace(Datum MatA, Datum MatB)
         }
     }
 
-    Datum *ps1 = (Datum *)ARR_DATA_PTR(a1);
-    Datum *ps2 = (Datum *)ARR_DATA_PTR(a2);
-#pragma omp parallel for
-    for (int pos = 0; pos < length1; pos++)
-    {
-        float8 ret = DatumGetFloat8(ps1[pos]);
-        ret += DatumGetFloat8(ps2[pos]);
-        ps1[pos] = Float8GetDatum(ret);
-    }
+    float8 *ps1 = (float8 *)ARR_DATA_PTR(a1);
+    matrix_elementwise(MATRIX_ELEM_ADD, ps1, (float8 *)ARR_DATA_PTR(a2), 0.0, ps1, length1);
 
     PG_RETURN_ARRAYTYPE_P(a1);
 }
@@ -390,26 +363,18 @@ Datum matrix_elem_mult(Datum matA, Datum matB)
     {
         ret = copyArray(matB);
 
-        Datum *data = (Datum *)ARR_DATA_PTR(ret);
+        float8 *data = (float8 *)ARR_DATA_PTR(ret);
         const Datum elem = ((Datum *)ARR_DATA_PTR(a))[0];
-#pragma omp parallel for
-        for (int i = 0; i < length2; i++)
-        {
-            data[i] = Float8GetDatum(DatumGetFloat8(elem) * DatumGetFloat8(data[i]));
-        }
+        matrix_elementwise(MATRIX_ELEM_MUL_SCALAR, data, NULL, DatumGetFloat8(elem), data, length2);
         PG_RETURN_ARRAYTYPE_P(ret);
     }
     else if (isScalar(b))
     {
         ret = copyArray(matA);
 
-        Datum *data = (Datum *)ARR_DATA_PTR(ret);
+        float8 *data = (float8 *)ARR_DATA_PTR(ret);
         const Datum elem = ((Datum *)ARR_DATA_PTR(b))[0];
-#pragma omp parallel for
-        for (int i = 0; i < length1; i++)
-        {
-            data[i] = Float8GetDatum(DatumGetFloat8(elem) * DatumGetFloat8(data[i]));
-        }
+        matrix_elementwise(MATRIX_ELEM_MUL_SCALAR, data, NULL, DatumGetFloat8(elem), data, length1);
         PG_RETURN_ARRAYTYPE_P(ret);
     }
 
@@ -429,15 +394,8 @@ Datum matrix_elem_mult(Datum matA, Datum matB)
 
     ret = initResult(ndims, dims, ARR_LBOUND(a));
 
-    Datum *ret_data = (Datum *)ARR_DATA_PTR(ret);
-    Datum *a_data = (Datum *)ARR_DATA_PTR(a);
-    Datum *b_data = (Datum *)ARR_DATA_PTR(b);
-
-#pragma omp parrallel for
-    for (int i = 0; i < ArrayGetNItems(ARR_NDIM(a), ARR_DIMS(a)); i++)
-    {
-        ret_data[i] = Float8GetDatum(DatumGetFloat8(a_data[i]) * DatumGetFloat8(b_data[i]));
-    }
+    matrix_elementwise(MATRIX_ELEM_MUL, (float8 *)ARR_DATA_PTR(a), (float8 *)ARR_DATA_PTR(b), 0.0,
+                       (float8 *)ARR_DATA_PTR(ret), length1);
     PG_RETURN_ARRAYTYPE_P(ret);
 }
 
@@ -464,15 +422,8 @@ Datum mat_sub_mm(PG_FUNCTION_ARGS)
     }
 
     ret = initResult(ARR_NDIM(a1), ARR_DIMS(a1), ARR_LBOUND(a1));
-    Datum *retData = (Datum *)ARR_DATA_PTR(ret);
-    Datum *a1Data = (Datum *)ARR_DATA_PTR(a1);
-    Datum *a2Data = (Datum *)ARR_DATA_PTR(a2);
-
-#pragma omp parallel for
-    for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
-    {
-        retData[i] = Float8GetDatum(DatumGetFloat8(a1Data[i]) - DatumGetFloat8(a2Data[i]));
-    }
+    matrix_elementwise(MATRIX_ELEM_SUB, (float8 *)ARR_DATA_PTR(a1), (float8 *)ARR_DATA_PTR(a2), 0.0,
+                       (float8 *)ARR_DATA_PTR(ret), ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)));
 
     PG_RETURN_ARRAYTYPE_P(ret);
 }
@@ -490,7 +441,6 @@ Datum mat_sub_ms(PG_FUNCTION_ARGS)
     ret = initResult(ARR_NDIM(a1), ARR_DIMS(a1), ARR_LBOUND(a1));
     Datum *retData = (Datum *)ARR_DATA_PTR(ret);
 
-#pragma omp parallel for
     for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
     {
         retData[i] = Float8GetDatum(DatumGetFloat8(retData[i]) - scalar);
@@ -512,7 +462,6 @@ Datum mat_sub_sm(PG_FUNCTION_ARGS)
     ret = initResult(ARR_NDIM(a1), ARR_DIMS(a1), ARR_LBOUND(a1));
     Datum *retData = (Datum *)ARR_DATA_PTR(ret);
 
-#pragma omp parallel for
     for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
     {
         retData[i] = Float8GetDatum(scalar - DatumGetFloat8(retData[i]));
@@ -534,7 +483,6 @@ Datum mat_mul_sm(PG_FUNCTION_ARGS)
     ret = initResult(ARR_NDIM(a1), ARR_DIMS(a1), ARR_LBOUND(a1));
     Datum *retData = (Datum *)ARR_DATA_PTR(ret);
 
-#pragma omp parallel for
     for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
     {
         retData[i] = Float8GetDatum(scalar * DatumGetFloat8(retData[i]));
@@ -598,7 +546,6 @@ Datum matrix_transpose_internal(Datum MatA)
     Datum *B = (Datum *)ARR_DATA_PTR(ret);
 
     // transpose data
-#pragma omp parallel for
     for (int i = 0; i < dims[1]; i++)
     {
         for (int j = 0; j < dims[0]; j++)
@@ -718,7 +665,6 @@ Datum softmax(PG_FUNCTION_ARGS)
     {
         sum += exp(data[i] - max);
     }
-#pragma omp parallel for
     for (int i = 0; i < ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array)); i++)
     {
         data[i] = exp(data[i] - max) / sum;
@@ -726,6 +672,148 @@ Datum softmax(PG_FUNCTION_ARGS)
     PG_RETURN_ARRAYTYPE_P(array);
 }
 
+/*
+ * Softmax of the last softmax_cce input, shared by the loss and its derivation
+ *
+ * A lambda is usually derived right after its forward pass for the same row.  The forward pass therefore keeps the
+ * log-sum-exp and the probabilities of its input, and the derivation(p - y) only needs a single pass over them.
+ * The entry is identified by a copy of the input values, so an input that merely reuses the memory of an earlier
+ * one recomputes the softmax.  The entry is allocated in the memory context of the forward pass and forgotten, when
+ * that context is reset or deleted, at the latest at the end of the query.
+ */
+typedef struct SoftmaxCCECache
+{
+    MemoryContextCallback callback; /* forgets the entry on reset of its context */
+    int length;                     /* number of elements of input */
+    int capacity;                   /* allocated length of input and probs */
+    float8 lse;                     /* log(sum(exp(input))) */
+    float8 *input;                  /* copy of the input values */
+    float8 *probs;                  /* softmax of input */
+} SoftmaxCCECache;
+
+static SoftmaxCCECache *softmax_cce_cache = NULL;
+
+/*
+ * Check, that ARR is a non-empty vector, returns its number of elements
+ */
+static int softmax_cce_vector_length(ArrayType *arr, const char *name, const char *what)
+{
+    int length = ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr));
+
+    if (ARR_NDIM(arr) > 2 || (ARR_NDIM(arr) == 2 && ARR_DIMS(arr)[0] != 1))
+    {
+        ereport(ERROR, (errmsg("%s: Array *%s* is not a vector!", name, what)));
+    }
+    if (length <= 0)
+    {
+        ereport(ERROR, (errmsg("%s: Array *%s* is empty!", name, what)));
+    }
+    return length;
+}
+
+/*
+ * Reset callback of the memory context holding a cache entry
+ */
+static void softmax_cce_cache_forget(void *arg)
+{
+    if (softmax_cce_cache == (SoftmaxCCECache *)arg)
+        softmax_cce_cache = NULL;
+}
+
+/*
+ * Compute the softmax of INPUT(LENGTH elements) into softmax_cce_cache
+ */
+static const SoftmaxCCECache *softmax_cce_forward(ArrayType *input, int length)
+{
+    SoftmaxCCECache *cache = softmax_cce_cache;
+    float8 *data = (float8 *)ARR_DATA_PTR(input);
+    float8 *probs;
+    float8 max, sum = 0.0, scale;
+
+    // an entry registered with another context cannot be freed, it stays until that context goes away
+    if (cache == NULL || cache->capacity < length || GetMemoryChunkContext(cache) != CurrentMemoryContext)
+    {
+        cache = (SoftmaxCCECache *)palloc(MAXALIGN(sizeof(SoftmaxCCECache)) + 2 * length * sizeof(float8));
+        cache->input = (float8 *)((char *)cache + MAXALIGN(sizeof(SoftmaxCCECache)));
+        cache->probs = cache->input + length;
+        cache->capacity = length;
+        cache->callback.func = softmax_cce_cache_forget;
+        cache->callback.arg = cache;
+        MemoryContextRegisterResetCallback(CurrentMemoryContext, &cache->callback);
+    }
+    softmax_cce_cache = NULL;
+    probs = cache->probs;
+
+    max = data[0];
+    for (int i = 1; i < length; i++)
+    {
+        if (max < data[i])
+            max = data[i];
+    }
+    for (int i = 0; i < length; i++)
+    {
+        probs[i] = exp(data[i] - max);
+        sum += probs[i];
+    }
+    scale = 1.0 / sum;
+    for (int i = 0; i < length; i++)
+    {
+        probs[i] *= scale;
+    }
+
+    memcpy(cache->input, data, length * sizeof(float8));
+    cache->lse = max + log(sum);
+    cache->length = length;
+    softmax_cce_cache = cache;
+    return cache;
+}
+
+/*
+ * Softmax of INPUT, reusing the forward pass, if it was computed for the same values
+ */
+static const float8 *softmax_cce_probs(ArrayType *input, int length)
+{
+    const SoftmaxCCECache *cache = softmax_cce_cache;
+
+    if (cache == NULL || cache->length != length ||
+        memcmp(cache->input, ARR_DATA_PTR(input), length * sizeof(float8)) != 0)
+        cache = softmax_cce_forward(input, length);
+    return cache->probs;
+}
+
+/*
+ * The seed of a softmax_cce derivation, the loss is a scalar, so its seed is one as well
+ */
+static float8 softmax_cce_seed(Datum seed, const char *name)
+{
+    ArrayType *s;
+
+    if (DatumGetPointer(seed) == NULL)
+    {
+        ereport(ERROR, (errmsg("%s: Null pointer passed as Matrix Seed!", name)));
+    }
+    s = DatumGetArrayTypeP(seed);
+    if (ArrayGetNItems(ARR_NDIM(s), ARR_DIMS(s)) != 1)
+    {
+        ereport(ERROR, (errmsg("%s: Seed is not a scalar!", name)));
+    }
+    return ((float8 *)ARR_DATA_PTR(s))[0];
+}
+
+/*
+ * The class index of a softmax_cce_class call, counted from 0 like index_max()
+ */
+static int softmax_cce_class_index(Datum class_in, int length, const char *name)
+{
+    int32 class_index = DatumGetInt32(class_in);
+
+    if (class_index < 0 || class_index >= length)
+    {
+        ereport(ERROR, (errmsg("%s: Class index %d is out of range(%d classes)!", name, class_index, length)));
+    }
+    return class_index;
+}
+
 /*
  *		softmax, returns the softmax_cce loss of arg1 as inputs and arg2 as labels(one_hot)
  */
@@ -750,11 +838,10 @@ Datum softmax_cce_internal(Datum inputs_in, Datum labels_in)
     }
     input = DatumGetArrayTypeP(inputs_in);
     labels = DatumGetArrayTypeP(labels_in);
-    float8 max, sum = 0.0;
+    float8 lse, sum = 0.0;
     float8 *data = (float8 *)ARR_DATA_PTR(input);
     float8 *label_data = (float8 *)ARR_DATA_PTR(labels);
 
-    int length = ArrayGetNItems(ARR_NDIM(input), ARR_DIMS(input));
     if (ARR_NDIM(input) != ARR_NDIM(labels))
     {
         ereport(ERROR, (errmsg("Softmax CCE: Arrays *labels* and *input* do not have same number of dims! (#dims labels: %d <-> %d :#dims input)", ARR_NDIM(labels), ARR_NDIM(input))));
@@ -766,48 +853,43 @@ Datum softmax_cce_internal(Datum inputs_in, Datum labels_in)
             ereport(ERROR, (errmsg("Softmax CCE: Dim %d does not match (dim in 'labels': %d <-> %d :dim in 'input')", i, ARR_DIMS(labels)[i], ARR_DIMS(input)[i])));
         }
     }
-    if ((ARR_NDIM(input) > 2 && ARR_NDIM(input) <= 0) || (ARR_NDIM(input) == 2 && ARR_DIMS(input)[0] != 1))
-    {
-        ereport(ERROR, (errmsg("Softmax CCE: Array *input* is not a vector!")));
-    }
-    if ((ARR_NDIM(labels) > 2 && ARR_NDIM(labels) <= 0) || (ARR_NDIM(labels) == 2 && ARR_DIMS(labels)[0] != 1))
-    {
-        ereport(ERROR, (errmsg("Softmax CCE: Array *labels* is not a vector!")));
-    }
-    float8 *result = (float8 *)palloc0(length * sizeof(float8));
+    int length = softmax_cce_vector_length(input, "Softmax CCE", "input");
 
-    max = data[0];
-    for (int i = 0; i < length; i++)
-    {
-        if ((max < data[i]))
-        {
-            max = data[i];
-        }
-    }
-#pragma omp parallel for
-    for (int i = 0; i < length; i++)
-    {
-        result[i] = data[i] - max;
-    }
-#pragma omp barrier
-    for (int i = 0; i < length; i++)
-    {
-        sum += exp(result[i]);
-    }
-#pragma omp parallel for
+    lse = softmax_cce_forward(input, length)->lse;
     for (int i = 0; i < length; i++)
     {
-        result[i] -= log(sum);
-        result[i] *= label_data[i];
+        sum += (data[i] - lse) * label_data[i];
     }
-#pragma omp barrier
-    sum = 0.0;
-    for (int i = 0; i < length; i++)
+
+    PG_RETURN_FLOAT8(sum);
+}
+
+/*
+ *		softmax_cce with the class index arg2 instead of one-hot labels, arg1 are the inputs
+ */
+Datum softmax_cce_class(PG_FUNCTION_ARGS)
+{
+    return softmax_cce_class_internal(PG_GETARG_DATUM(0), PG_GETARG_DATUM(1));
+}
+
+/*
+ *		softmax_cce with the class index arg2 instead of one-hot labels, arg1 are the inputs
+ *      Equals softmax_cce with a one-hot vector, that is 1 at index class_in(counted from 0).
+ */
+Datum softmax_cce_class_internal(Datum inputs_in, Datum class_in)
+{
+    ArrayType *input;
+    int length, class_index;
+
+    if (DatumGetPointer(inputs_in) == NULL)
     {
-        sum += result[i];
+        ereport(ERROR, (errmsg("Matrix SoftMax Internal: Null pointer passed as Matrix Inputs!")));
     }
+    input = DatumGetArrayTypeP(inputs_in);
+    length = softmax_cce_vector_length(input, "Softmax CCE", "input");
+    class_index = softmax_cce_class_index(class_in, length, "Softmax CCE");
 
-    PG_RETURN_FLOAT8(sum);
+    PG_RETURN_FLOAT8(((float8 *)ARR_DATA_PTR(input))[class_index] - softmax_cce_forward(input, length)->lse);
 }
 
 /*
@@ -815,8 +897,22 @@ Datum softmax_cce_internal(Datum inputs_in, Datum labels_in)
  *      returns the derivative of the softmax function w.r.t. x(input 1)
  */
 Datum softmax_cce_derive(Datum inputs_in, Datum labels_in)
+{
+    return softmax_cce_backward(createScalar(1.0), inputs_in, labels_in);
+}
+
+/*
+ * Fused backward pass of softmax_cce: seed * (softmax(inputs) - labels), written into one new array
+ * The softmax is taken from the forward pass(see SoftmaxCCECache).
+ */
+Datum softmax_cce_backward(Datum seed, Datum inputs_in, Datum labels_in)
 {
     ArrayType *input_arr, *labels_arr, *result_arr;
+    const float8 *probs;
+    float8 *labels, *result;
+    float8 s;
+    int length;
+
     if (DatumGetPointer(inputs_in) == NULL)
     {
         ereport(ERROR, (errmsg("Matrix SoftMax Derive: Null pointer passed as Matrix Inputs!")));
@@ -825,55 +921,107 @@ Datum softmax_cce_derive(Datum inputs_in, Datum labels_in)
     {
         ereport(ERROR, (errmsg("Matrix SoftMax Derive: Null pointer passed as Matrix Labels!")));
     }
+    s = softmax_cce_seed(seed, "Softmax Derivation");
     input_arr = DatumGetArrayTypeP(inputs_in);
     labels_arr = DatumGetArrayTypeP(labels_in);
-    float8 max, sum = 0.0;
-    float8 *input = (float8 *)ARR_DATA_PTR(input_arr);
-    float8 *labels = (float8 *)ARR_DATA_PTR(labels_arr);
+    labels = (float8 *)ARR_DATA_PTR(labels_arr);
 
-    int length = ArrayGetNItems(ARR_NDIM(input_arr), ARR_DIMS(input_arr));
+    length = softmax_cce_vector_length(input_arr, "Softmax Derivation", "input");
+    softmax_cce_vector_length(labels_arr, "Softmax Derivation", "labels");
     if (length != ArrayGetNItems(ARR_NDIM(labels_arr), ARR_DIMS(labels_arr)))
     {
         ereport(ERROR, (errmsg("Softmax Derivation: Arrays *labels* and *input* do not match!")));
     }
-    if ((ARR_NDIM(input_arr) > 2 && ARR_NDIM(input_arr) <= 0) || (ARR_NDIM(input_arr) == 2 && ARR_DIMS(input_arr)[0] != 1))
+    probs = softmax_cce_probs(input_arr, length);
+
+    result_arr = initResult(ARR_NDIM(input_arr), ARR_DIMS(input_arr), ARR_LBOUND(input_arr));
+    result = (float8 *)ARR_DATA_PTR(result_arr);
+    for (int i = 0; i < length; i++)
     {
-        ereport(ERROR, (errmsg("Softmax Derivation: Array *input* is not a vector!")));
+        result[i] = s * (probs[i] - labels[i]);
     }
-    if ((ARR_NDIM(labels_arr) > 2 && ARR_NDIM(labels_arr) <= 0) || (ARR_NDIM(labels_arr) == 2 && ARR_DIMS(labels_arr)[0] != 1))
+
+    PG_RETURN_ARRAYTYPE_P(result_arr);
+}
+
+/*
+ * Fused backward pass of softmax_cce_class: seed * (softmax(inputs) - one_hot(class_in))
+ */
+Datum softmax_cce_class_backward(Datum seed, Datum inputs_in, Datum class_in)
+{
+    ArrayType *input_arr, *result_arr;
+    const float8 *probs;
+    float8 *result;
+    float8 s;
+    int length, class_index;
+
+    if (DatumGetPointer(inputs_in) == NULL)
     {
-        ereport(ERROR, (errmsg("Softmax Derivation: Array *labels* is not a vector!")));
+        ereport(ERROR, (errmsg("Matrix SoftMax Derive: Null pointer passed as Matrix Inputs!")));
     }
+    s = softmax_cce_seed(seed, "Softmax Derivation");
+    input_arr = DatumGetArrayTypeP(inputs_in);
+    length = softmax_cce_vector_length(input_arr, "Softmax Derivation", "input");
+    class_index = softmax_cce_class_index(class_in, length, "Softmax Derivation");
+    probs = softmax_cce_probs(input_arr, length);
+
     result_arr = initResult(ARR_NDIM(input_arr), ARR_DIMS(input_arr), ARR_LBOUND(input_arr));
-    float8 *result = (float8 *)ARR_DATA_PTR(result_arr);
+    result = (float8 *)ARR_DATA_PTR(result_arr);
+    for (int i = 0; i < length; i++)
+    {
+        result[i] = s * probs[i];
+    }
+    result[class_index] -= s;
 
-    max = input[0];
-    for (int i = 1; i < length; i++)
+    PG_RETURN_ARRAYTYPE_P(result_arr);
+}
+
+/*
+ * Apply an element-wise activation to a copy of input(see matrix_vecmath.c)
+ */
+static Datum matrix_activation_internal(Datum input, MatrixActivation act, const char *name)
+{
+    if (DatumGetPointer(input) == NULL)
     {
-        if (max < input[i])
-        {
-            max = input[i];
-        }
+        ereport(ERROR, (errmsg("Matrix %s Internal: Null pointer passed as Matrix Inputs!", name)));
     }
-#pragma omp parallel for
-    for (int i = 0; i < length; i++)
+    ArrayType *ret = copyArray(input);
+    float8 *data = (float8 *)ARR_DATA_PTR(ret);
+    matrix_activation_forward(act, data, data, ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)));
+    PG_RETURN_ARRAYTYPE_P(ret);
+}
+
+/*
+ * Fused backward pass of an element-wise activation: seed * act'(input), written into one new array
+ * The seed is either a scalar or has as many elements as input
+ */
+static Datum matrix_activation_backward_internal(Datum seed, Datum input, MatrixActivation act, const char *name)
+{
+    ArrayType *x, *s, *ret;
+    bool seedIsScalar;
+    int length;
+
+    if (DatumGetPointer(input) == NULL)
     {
-        result[i] = input[i] - max;
+        ereport(ERROR, (errmsg("Matrix %s Backward: Null pointer passed as Matrix Inputs!", name)));
     }
-#pragma omp barrier
-    for (int i = 0; i < length; i++)
+    if (DatumGetPointer(seed) == NULL)
     {
-        sum += exp(result[i]);
+        ereport(ERROR, (errmsg("Matrix %s Backward: Null pointer passed as Matrix Seed!", name)));
     }
-#pragma omp parallel for
-    for (int i = 0; i < length; i++)
+    x = DatumGetArrayTypeP(input);
+    s = DatumGetArrayTypeP(seed);
+    length = ArrayGetNItems(ARR_NDIM(x), ARR_DIMS(x));
+    seedIsScalar = isScalar(s);
+    if (!seedIsScalar && ArrayGetNItems(ARR_NDIM(s), ARR_DIMS(s)) != length)
     {
-        result[i] -= log(sum);
-        result[i] = exp(result[i]);
-        result[i] -= labels[i];
+        ereport(ERROR, (errmsg("Matrix %s Backward: Seed and Inputs are mismatched!", name)));
     }
 
-    PG_RETURN_ARRAYTYPE_P(result_arr);
+    ret = initResult(ARR_NDIM(x), ARR_DIMS(x), ARR_LBOUND(x));
+    matrix_activation_backward(act, (float8 *)ARR_DATA_PTR(s), seedIsScalar,
+                               (float8 *)ARR_DATA_PTR(x), (float8 *)ARR_DATA_PTR(ret), length);
+    PG_RETURN_ARRAYTYPE_P(ret);
 }
 
 /* silu_m   -   apply silu to an entire n-dimensional array*/
@@ -885,38 +1033,19 @@ Datum silu_m(PG_FUNCTION_ARGS)
 /* silu_m   -   apply silu to an entire n-dimensional array*/
 Datum silu_m_internal(Datum input)
 {
-    if (DatumGetPointer(input) == NULL)
-    {
-        ereport(ERROR, (errmsg("Matrix Silu Internal: Null pointer passed as Matrix Inputs!")));
-    }
-    ArrayType *ret = copyArray(input);
-    Datum *data = ARR_DATA_PTR(ret);
-#pragma omp parallel for
-    for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
-    {
-        float8 val = (DatumGetFloat8(data[i])) / (1 + exp((-1) * DatumGetFloat8(data[i])));
-        data[i] = Float8GetDatum(val);
-    }
-    PG_RETURN_ARRAYTYPE_P(ret);
+    return matrix_activation_internal(input, MATRIX_ACT_SILU, "Silu");
 }
 
 /* silu_m_derive   -   calculate the derivative of element-wise silu*/
 Datum silu_m_derive(Datum input)
 {
-    if (DatumGetPointer(input) == NULL)
-    {
-        ereport(ERROR, (errmsg("Matrix Silu Derive: Null pointer passed as Matrix Inputs!")));
-    }
-    ArrayType *ret = copyArray(input);
-    Datum *data = ARR_DATA_PTR(ret);
-#pragma omp parallel for
-    for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
-    {
-        float8 x = DatumGetFloat8(data[i]);
-        float8 val = (1 + exp((-1) * x) + x * exp((-1) * x)) / (pow((1 + exp((-1) * x)), 2));
-        data[i] = Float8GetDatum(val);
-    }
-    PG_RETURN_ARRAYTYPE_P(ret);
+    return matrix_activation_backward_internal(createScalar(1.0), input, MATRIX_ACT_SILU, "Silu");
+}
+
+/* silu_m_backward   -   seed multiplied element-wise with the derivative of silu*/
+Datum silu_m_backward(Datum seed, Datum input)
+{
+    return matrix_activation_backward_internal(seed, input, MATRIX_ACT_SILU, "Silu");
 }
 
 /* sigmoid_m   -   apply sigmoid to an entire n-dimensional array*/
@@ -928,40 +1057,19 @@ Datum sigmoid_m(PG_FUNCTION_ARGS)
 /* sigmoid_m   -   apply sigmoid to an entire n-dimensional array*/
 Datum sigmoid_m_internal(Datum input)
 {
-    if (DatumGetPointer(input) == NULL)
-    {
-        ereport(ERROR, (errmsg("Matrix Sigmoid Internal: Null pointer passed as Matrix Inputs!")));
-    }
-    ArrayType *ret = copyArray(input);
-    Datum *data = ARR_DATA_PTR(ret);
-#pragma omp parallel for
-    for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
-    {
-        float8 x = DatumGetFloat8(data[i]);
-        float8 val = (1) / (1 + exp((-1) * x));
-        data[i] = Float8GetDatum(val);
-    }
-    PG_RETURN_ARRAYTYPE_P(ret);
+    return matrix_activation_internal(input, MATRIX_ACT_SIGMOID, "Sigmoid");
 }
 
 /* sigmoid_m_derive   -   calculate the derivative of element-wise sigmoid*/
 Datum sigmoid_m_derive(Datum input)
 {
-    if (DatumGetPointer(input) == NULL)
-    {
-        ereport(ERROR, (errmsg("Matrix Sigmoid Derive: Null pointer passed as Matrix Inputs!")));
-    }
-    ArrayType *ret = copyArray(input);
-    Datum *data = ARR_DATA_PTR(ret);
-#pragma omp parallel for
-    for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
-    {
-        float8 x = DatumGetFloat8(data[i]);
-        float8 sig_of_x = (1) / (1 + exp((-1) * x));
-        float8 val = sig_of_x * (1 - sig_of_x);
-        data[i] = Float8GetDatum(val);
-    }
-    PG_RETURN_ARRAYTYPE_P(ret);
+    return matrix_activation_backward_internal(createScalar(1.0), input, MATRIX_ACT_SIGMOID, "Sigmoid");
+}
+
+/* sigmoid_m_backward   -   seed multiplied element-wise with the derivative of sigmoid*/
+Datum sigmoid_m_backward(Datum seed, Datum input)
+{
+    return matrix_activation_backward_internal(seed, input, MATRIX_ACT_SIGMOID, "Sigmoid");
 }
 
 /* tanh_m   -   apply tanh to an entire n-dimensional array*/
@@ -973,41 +1081,19 @@ Datum tanh_m(PG_FUNCTION_ARGS)
 /* tanh_m   -   apply tanh to an entire n-dimensional array*/
 Datum tanh_m_internal(Datum input)
 {
-    if (DatumGetPointer(input) == NULL)
-    {
-        ereport(ERROR, (errmsg("Matrix tanh Internal: Null pointer passed as Matrix Inputs!")));
-    }
-    ArrayType *ret = copyArray(input);
-    Datum *data = ARR_DATA_PTR(ret);
-#pragma omp parallel for
-    for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
-    {
-        float8 x = DatumGetFloat8(data[i]);
-        float8 val = tanh(x);
-        data[i] = Float8GetDatum(val);
-    }
-
-    PG_RETURN_ARRAYTYPE_P(ret);
+    return matrix_activation_internal(input, MATRIX_ACT_TANH, "tanh");
 }
 
 /* tanh_m_derive   -   calculate the derivative of element-wise tanh*/
 Datum tanh_m_derive(Datum input)
 {
-    if (DatumGetPointer(input) == NULL)
-    {
-        ereport(ERROR, (errmsg("Matrix tanh derive: Null pointer passed as Matrix Inputs!")));
-    }
-    ArrayType *ret = copyArray(input);
-    Datum *data = ARR_DATA_PTR(ret);
-#pragma omp parallel for
-    for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
-    {
-        float8 x = DatumGetFloat8(data[i]);
-        float8 tanh_of_x = tanh(x);
-        float8 val = 1 - tanh_of_x * tanh_of_x;
-        data[i] = Float8GetDatum(val);
-    }
-    PG_RETURN_ARRAYTYPE_P(ret);
+    return matrix_activation_backward_internal(createScalar(1.0), input, MATRIX_ACT_TANH, "tanh");
+}
+
+/* tanh_m_backward   -   seed multiplied element-wise with the derivative of tanh*/
+Datum tanh_m_backward(Datum seed, Datum input)
+{
+    return matrix_activation_backward_internal(seed, input, MATRIX_ACT_TANH, "tanh");
 }
 
 /* relu_m   -   apply relu to an entire n-dimensional array*/
@@ -1019,39 +1105,19 @@ Datum relu_m(PG_FUNCTION_ARGS)
 /* relu_m   -   apply relu to an entire n-dimensional array*/
 Datum relu_m_internal(Datum input)
 {
-    if (DatumGetPointer(input) == NULL)
-    {
-        ereport(ERROR, (errmsg("Matrix relu Internal: Null pointer passed as Matrix Inputs!")));
-    }
-    ArrayType *ret = copyArray(input);
-    Datum *data = (Datum *)ARR_DATA_PTR(ret);
-#pragma omp parallel for
-    for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
-    {
-        float8 x = DatumGetFloat8(data[i]);
-        float8 val = Max(x, 0);
-        data[i] = Float8GetDatum(val);
-    }
-    PG_RETURN_ARRAYTYPE_P(ret);
+    return matrix_activation_internal(input, MATRIX_ACT_RELU, "relu");
 }
 
 /* relu_m_derive   -   calculate the derivative of element-wise relu*/
 Datum relu_m_derive(Datum input)
 {
-    if (DatumGetPointer(input) == NULL)
-    {
-        ereport(ERROR, (errmsg("Matrix relu derive: Null pointer passed as Matrix Inputs!")));
-    }
-    ArrayType *ret = copyArray(input);
-    Datum *data = (Datum *)ARR_DATA_PTR(ret);
-#pragma omp parallel for
-    for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
-    {
-        float8 x = DatumGetFloat8(data[i]);
-        float8 val = (x > 0) ? (1) : (0);
-        data[i] = Float8GetDatum(val);
-    }
-    PG_RETURN_ARRAYTYPE_P(ret);
+    return matrix_activation_backward_internal(createScalar(1.0), input, MATRIX_ACT_RELU, "relu");
+}
+
+/* relu_m_backward   -   seed multiplied element-wise with the derivative of relu*/
+Datum relu_m_backward(Datum seed, Datum input)
+{
+    return matrix_activation_backward_internal(seed, input, MATRIX_ACT_RELU, "relu");
 }
 
 /*
@@ -1064,6 +1130,8 @@ ArrayType *initResult(int ndims, int *dims, int *lbs)
     int32 nbytes = nelems * ALIGNOF_DOUBLE;
     nbytes += ARR_OVERHEAD_NONULLS(ndims);
     ArrayType *ret = (ArrayType *)palloc_extended(nbytes, (MCXT_ALLOC_ZERO));
+    if (matrix_instrument.enabled)
+        matrix_instrument.bytes += nbytes;
     SET_VARSIZE(ret, nbytes);
     ret->ndim = ndims;
     ret->dataoffset = 0;
@@ -1092,6 +1160,8 @@ ArrayType *copyArray(Datum orgArray)
     int32 nbytes = nelems * ALIGNOF_DOUBLE;
     nbytes += ARR_OVERHEAD_NONULLS(ndims);
     ArrayType *ret = (ArrayType *)palloc_extended(nbytes, (MCXT_ALLOC_ZERO));
+    if (matrix_instrument.enabled)
+        matrix_instrument.bytes += nbytes;
     SET_VARSIZE(ret, nbytes);
     ret->ndim = ndims;
     ret->dataoffset = 0;
@@ -1115,7 +1185,6 @@ Datum createArray(int *dims, const float8 value, const bool identityMatrix)
     Datum *data = (Datum *)ARR_DATA_PTR(ret);
     if (identityMatrix)
     {
-#pragma omp parallel for
         for (int i = 0; i < dims[0]; i++)
         {
             for (int j = 0; j < dims[0]; j++)
@@ -1133,7 +1202,6 @@ Datum createArray(int *dims, const float8 value, const bool identityMatrix)
     }
     else
     {
-#pragma omp parallel for
         for (int i = 0; i < dims[0]; i++)
         {
             for (int j = 0; j < dims[1]; j++)
@@ -1155,7 +1223,6 @@ Datum createSeedArray(Datum result)
         ereport(ERROR, (errmsg("Matrix createSeedArray: Null pointer passed as Matrix Inputs!")));
     }
     ArrayType *ret = copyArray(result);
-#pragma omp parallel for
     for (int i = 0; i < ArrayGetNItems(ARR_NDIM(ret), ARR_DIMS(ret)); i++)
     {
         ARR_DATA_PTR(ret)
@@ -0,0 +1,277 @@
+/*-------------------------------------------------------------------------
+ *
+ * matrix_parallel.c
+ *	  Intra-operator parallelism for the matrix kernels(see matrix_ops.c,
+ *    matrix_gemm.c and matrix_vecmath.c).
+ *
+ *    matrix_parallel_for() splits an index range into chunks, which are
+ *    processed by the calling backend and up to matrix_parallel_workers
+ *    helper threads.  The threads are started on first use, and then sleep
+ *    on a condition variable between jobs.  Small jobs, whose estimated work
+ *    is below MATRIX_PARALLEL_MIN_WORK per thread, stay serial.
+ *
+ *    The helper threads run nothing but the kernel passed in, which must not
+ *    call into the backend: no palloc, no ereport, no catalog access.  All
+ *    allocations and error checks happen before and after the parallel part,
+ *    in the backend itself.  The threads block all signals, so signal
+ *    handlers only ever run in the backend's thread.
+ *
+ * IDENTIFICATION
+ *	  src/backend/utils/adt/matrix_parallel.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+#include "port/atomics.h"
+#include "utils/array.h"
+
+/* GUC: number of helper threads per backend, 0 keeps all kernels serial */
+int matrix_parallel_workers = 0;
+
+MatrixInstrumentation matrix_instrument = {false};
+
+/* upper bound for matrix_parallel_workers, also the size of the thread array */
+#define MATRIX_PARALLEL_MAX_WORKERS 256
+
+typedef struct MatrixParallelPool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        /* signalled when a new job is published */
+    pthread_cond_t done;        /* signalled when the last helper finished a job */
+    pthread_t threads[MATRIX_PARALLEL_MAX_WORKERS];
+    int nstarted;               /* number of helper threads running */
+
+    /* the current job, protected by lock, except for next */
+    uint64 generation;          /* incremented for every job */
+    int nhelpers;               /* helpers taking part in the job(ids 1..nhelpers) */
+    int nfinished;              /* helpers that are done with the job */
+    MatrixParallelFunc func;
+    void *arg;
+    int n;
+    int chunk;
+    pg_atomic_uint32 next;      /* first index not yet handed out */
+} MatrixParallelPool;
+
+static MatrixParallelPool pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+static bool pool_initialized = false;
+static bool in_parallel = false;
+
+/*
+ * Process chunks of the current job until none is left
+ */
+static void matrix_parallel_work(MatrixParallelFunc func, void *arg, int n, int chunk)
+{
+    for (;;)
+    {
+        uint32 start = pg_atomic_fetch_add_u32(&pool.next, chunk);
+
+        if (start >= (uint32)n)
+            break;
+        func(arg, (int)start, (int)Min((uint32)n, start + chunk));
+    }
+}
+
+static void *matrix_parallel_thread(void *argp)
+{
+    int id = (int)(intptr_t)argp;
+    uint64 seen = 0;
+
+    /*
+     * Start from generation 0 rather than the current one, the job this thread was started for may have been
+     * published already.  Older jobs are skipped, they never include a thread that did not exist yet.
+     */
+    pthread_mutex_lock(&pool.lock);
+    for (;;)
+    {
+        MatrixParallelFunc func;
+        void *arg;
+        int n, chunk;
+
+        while (pool.generation == seen)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        seen = pool.generation;
+        if (id > pool.nhelpers)
+            continue;
+
+        func = pool.func;
+        arg = pool.arg;
+        n = pool.n;
+        chunk = pool.chunk;
+        pthread_mutex_unlock(&pool.lock);
+
+        matrix_parallel_work(func, arg, n, chunk);
+
+        pthread_mutex_lock(&pool.lock);
+        if (++pool.nfinished == pool.nhelpers)
+            pthread_cond_signal(&pool.done);
+    }
+
+    return NULL;
+}
+
+/*
+ * Make sure NHELPERS helper threads are running, returns the number actually available
+ */
+static int matrix_parallel_start(int nhelpers)
+{
+    sigset_t all, old;
+
+    if (!pool_initialized)
+    {
+        pg_atomic_init_u32(&pool.next, 0);
+        pool_initialized = true;
+    }
+    if (pool.nstarted >= nhelpers)
+        return nhelpers;
+
+    // the helpers inherit a signal mask blocking everything
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    while (pool.nstarted < nhelpers)
+    {
+        if (pthread_create(&pool.threads[pool.nstarted], NULL, matrix_parallel_thread,
+                           (void *)(intptr_t)(pool.nstarted + 1)) != 0)
+            break;
+        pool.nstarted++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (pool.nstarted < nhelpers)
+        ereport(WARNING,
+                (errmsg("could only start %d of %d matrix worker threads", pool.nstarted, nhelpers)));
+    return pool.nstarted;
+}
+
+/*
+ * Start timing a kernel for matrix_instrument, kernels called by another kernel are part of the outer one
+ */
+void matrix_kernel_begin(instr_time *start)
+{
+    if (matrix_instrument.enabled && matrix_instrument.depth++ == 0)
+        INSTR_TIME_SET_CURRENT(*start);
+}
+
+/*
+ * End of a kernel started by matrix_kernel_begin
+ */
+void matrix_kernel_end(const instr_time *start)
+{
+    instr_time end;
+
+    if (matrix_instrument.enabled && --matrix_instrument.depth == 0)
+    {
+        INSTR_TIME_SET_CURRENT(end);
+        INSTR_TIME_ACCUM_DIFF(matrix_instrument.kernel_time, end, *start);
+    }
+}
+
+/*
+ * Call FUNC(ARG, start, end) for disjoint ranges covering [0, N), possibly on multiple threads
+ * WORK_PER_ITEM estimates the cost of one index(about one per floating point operation), it decides how many
+ * threads are worth using.  Returns after all ranges have been processed.
+ */
+void matrix_parallel_for(int n, double work_per_item, MatrixParallelFunc func, void *arg)
+{
+    double work = (double)n * work_per_item;
+    int nhelpers = Min(matrix_parallel_workers, MATRIX_PARALLEL_MAX_WORKERS);
+    int nthreads;
+    instr_time start;
+
+    if (n <= 0)
+        return;
+    matrix_kernel_begin(&start);
+
+    // every thread should get at least MATRIX_PARALLEL_MIN_WORK, nested calls stay on the current thread
+    nhelpers = (int)Min((double)nhelpers, work / MATRIX_PARALLEL_MIN_WORK - 1);
+    nhelpers = Min(nhelpers, n - 1);
+    if (nhelpers <= 0 || in_parallel)
+    {
+        func(arg, 0, n);
+        matrix_kernel_end(&start);
+        return;
+    }
+
+    nhelpers = matrix_parallel_start(nhelpers);
+    nthreads = nhelpers + 1;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.func = func;
+    pool.arg = arg;
+    pool.n = n;
+    // a few chunks per thread to even out imbalance
+    pool.chunk = Max(1, n / (nthreads * 4));
+    pool.nhelpers = nhelpers;
+    pool.nfinished = 0;
+    pg_atomic_write_u32(&pool.next, 0);
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    in_parallel = true;
+    matrix_parallel_work(func, arg, n, pool.chunk);
+    in_parallel = false;
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.nfinished < pool.nhelpers)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    matrix_kernel_end(&start);
+}
+
+typedef struct MatrixElemJob
+{
+    MatrixElemOp op;
+    const float8 *a;
+    const float8 *b;
+    float8 s;
+    float8 *out;
+} MatrixElemJob;
+
+static void matrix_elementwise_range(void *arg, int start, int end)
+{
+    const MatrixElemJob *job = (const MatrixElemJob *)arg;
+    const float8 *a = job->a;
+    const float8 *b = job->b;
+    const float8 s = job->s;
+    float8 *out = job->out;
+
+    switch (job->op)
+    {
+    case MATRIX_ELEM_ADD:
+        for (int i = start; i < end; i++)
+            out[i] = a[i] + b[i];
+        break;
+    case MATRIX_ELEM_SUB:
+        for (int i = start; i < end; i++)
+            out[i] = a[i] - b[i];
+        break;
+    case MATRIX_ELEM_MUL:
+        for (int i = start; i < end; i++)
+            out[i] = a[i] * b[i];
+        break;
+    case MATRIX_ELEM_ADD_SCALAR:
+        for (int i = start; i < end; i++)
+            out[i] = a[i] + s;
+        break;
+    case MATRIX_ELEM_MUL_SCALAR:
+        for (int i = start; i < end; i++)
+            out[i] = a[i] * s;
+        break;
+    }
+}
+
+/*
+ * Element-wise OP over N elements, OUT may be the same buffer as A or B
+ * B is only read by the matrix-matrix operations, S only by the scalar ones.
+ */
+void matrix_elementwise(MatrixElemOp op, const float8 *a, const float8 *b, float8 s, float8 *out, Size n)
+{
+    MatrixElemJob job = {op, a, b, s, out};
+
+    Assert(n <= INT_MAX);
+    matrix_parallel_for((int)n, 1.0, matrix_elementwise_range, &job);
+}
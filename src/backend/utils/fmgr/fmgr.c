@@ -404,8 +404,6 @@ fmgr_info_C_lang(Oid functionId, FmgrInfo *finfo, HeapTuple procedureTuple)
 		/* Get the function information record (real or default) */
 		inforec = fetch_finfo_record(libraryhandle, prosrcstring);
 
-		finfo->fn_rectype = inforec->rectype_func;
-
 		/* Cache the addresses for later calls */
 		record_C_func(procedureTuple, user_fn, inforec);
 
@@ -413,6 +411,8 @@ fmgr_info_C_lang(Oid functionId, FmgrInfo *finfo, HeapTuple procedureTuple)
 		pfree(probinstring);
 	}
 
+	finfo->fn_rectype = inforec->rectype_func;
+
 	switch (inforec->api_version)
 	{
 		case 1:
@@ -513,6 +513,48 @@ fetch_finfo_record(void *filehandle, const char *funcname)
 	return inforec;
 }
 
+/*
+ * fmgr_streams_result: does a function opt in to being streamed?
+ *
+ * Only C functions declared with PG_FUNCTION_INFO_V1_STREAMING do.  Their
+ * library is loaded if that didn't happen yet.  Security definer functions,
+ * functions with SET options and those hooked by a plugin are
+ * called through a handler that can't be streamed, so they never are.
+ */
+bool
+fmgr_streams_result(Oid functionId)
+{
+	HeapTuple	procedureTuple;
+	Form_pg_proc procedureStruct;
+	CFuncHashTabEntry *hashentry;
+	bool		result = false;
+
+	procedureTuple = SearchSysCache1(PROCOID, ObjectIdGetDatum(functionId));
+	if (!HeapTupleIsValid(procedureTuple))
+		elog(ERROR, "cache lookup failed for function %u", functionId);
+	procedureStruct = (Form_pg_proc) GETSTRUCT(procedureTuple);
+
+	if (procedureStruct->prolang == ClanguageId &&
+		!procedureStruct->prosecdef &&
+		heap_attisnull(procedureTuple, Anum_pg_proc_proconfig, NULL) &&
+		!FmgrHookIsNeeded(functionId))
+	{
+		hashentry = lookup_C_func(procedureTuple);
+		if (hashentry == NULL)
+		{
+			FmgrInfo	finfo;
+
+			fmgr_info_C_lang(functionId, &finfo, procedureTuple);
+			hashentry = lookup_C_func(procedureTuple);
+		}
+		result = hashentry->inforec->streaming;
+	}
+
+	ReleaseSysCache(procedureTuple);
+
+	return result;
+}
+
 
 /*-------------------------------------------------------------------------
  *		Routines for caching lookup information for external C functions.
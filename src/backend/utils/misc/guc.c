@@ -41,6 +41,7 @@
 #include "commands/vacuum.h"
 #include "commands/variable.h"
 #include "commands/trigger.h"
+#include "executor/executor.h"
 #include "funcapi.h"
 #include "jit/jit.h"
 #include "libpq/auth.h"
@@ -77,6 +78,7 @@
 #include "storage/predicate.h"
 #include "tcop/tcopprot.h"
 #include "tsearch/ts_cache.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/bytea.h"
 #include "utils/guc_tables.h"
@@ -1308,6 +1310,16 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"track_lambdas", PGC_USERSET, STATS_COLLECTOR,
+			gettext_noop("Collects statistics on the lambda expressions of table functions."),
+			gettext_noop("The statistics are kept per backend, see pg_stat_lambdas.")
+		},
+		&track_lambdas,
+		false,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"update_process_title", PGC_SUSET, PROCESS_TITLE,
 			gettext_noop("Updates the process title to show the active SQL command."),
@@ -1824,6 +1836,16 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"jit_lambda_tier_baseline", PGC_USERSET, QUERY_TUNING_OTHER,
+			gettext_noop("Compiles lambda expressions without optimization until they reach jit_lambda_tier_rows."),
+			gettext_noop("Otherwise they are interpreted until then.")
+		},
+		&jit_lambda_tier_baseline,
+		false,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"data_sync_retry", PGC_POSTMASTER, ERROR_HANDLING_OPTIONS,
 			gettext_noop("Whether to continue running after a failure to sync data files."),
@@ -2909,6 +2931,36 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"jit_lambda_cache_size", PGC_USERSET, QUERY_TUNING_OTHER,
+			gettext_noop("Sets the number of JIT-compiled lambda expressions a backend keeps for later queries."),
+			gettext_noop("Zero compiles the lambda expressions of every query anew.")
+		},
+		&jit_lambda_cache_size,
+		64, 0, INT_MAX,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"jit_lambda_tier_rows", PGC_USERSET, QUERY_TUNING_OTHER,
+			gettext_noop("Sets the number of rows a table function derives before it compiles its lambda with optimization."),
+			gettext_noop("Zero compiles the lambda before the first row.")
+		},
+		&jit_lambda_tier_rows,
+		1000, 0, INT_MAX,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"matrix_parallel_workers", PGC_USERSET, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the number of helper threads a backend uses for large matrix operations."),
+			gettext_noop("Zero runs all matrix operations in the backend itself.")
+		},
+		&matrix_parallel_workers,
+		0, 0, 256,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"autovacuum_work_mem", PGC_SIGHUP, RESOURCES_MEM,
 			gettext_noop("Sets the maximum memory to be used by each autovacuum worker process."),
@@ -25,4 +25,10 @@ language C STRICT;
 create or replace function autodiff_l4(lambdacursor, "lambda")
 returns setof record
 as '/home/clemens/masterarbeit/psql-autodiff/src/ext/autodiff_ext.so','autodiff_l4'
+language C STRICT;
+
+-- batch size(rows derived at once), sum_rows(return only the sums over all rows)
+create or replace function autodiff_batch(lambdacursor, "lambda", int, bool)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/autodiff_ext.so','autodiff_batch'
 language C STRICT;
\ No newline at end of file
@@ -65,6 +65,28 @@ returns setof record
 as '/home/clemens/masterarbeit/psql-autodiff/src/ext/kmeans_ext.so','kmeans_threads'
 language C STRICT;
 
+-- max iterations, initialization('given' or 'kmeans++') and seed of the k-means++ draws
+create or replace function kmeans(lambdatable, lambdatable, "lambda", int, int, int, text, int) 
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/kmeans_ext.so','kmeans'
+language C STRICT;
+
+create or replace function kmeans_threads(lambdatable, lambdatable, "lambda", int, int, int, text, int) 
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/kmeans_ext.so','kmeans_threads'
+language C STRICT;
+
+-- streaming mini-batch kmeans over a cursor: batch size and threads, then passes, initialization and seed
+create or replace function kmeans_minibatch(lambdatable, lambdacursor, "lambda", int, int) 
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/kmeans_ext.so','kmeans_minibatch'
+language C STRICT;
+
+create or replace function kmeans_minibatch(lambdatable, lambdacursor, "lambda", int, int, int, text, int) 
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/kmeans_ext.so','kmeans_minibatch'
+language C STRICT;
+
 create or replace function pagerank(lambdatable, "lambda", "lambda", float, float, int, int) 
 returns setof record
 as '/home/clemens/masterarbeit/psql-autodiff/src/ext/pagerank_ext.so','pagerank'
@@ -75,6 +97,28 @@ returns setof record
 as '/home/clemens/masterarbeit/psql-autodiff/src/ext/pagerank_ext.so','pagerank_threads'
 language C STRICT;
 
+-- iteration mode: 'jacobi' or 'gauss-seidel'
+create or replace function pagerank(lambdatable, "lambda", "lambda", float, float, int, int, text) 
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/pagerank_ext.so','pagerank'
+language C STRICT;
+
+create or replace function pagerank_threads(lambdatable, "lambda", "lambda", float, float, int, int, text) 
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/pagerank_ext.so','pagerank_threads'
+language C STRICT;
+
+-- warm start from a previous result(node, pagerank)
+create or replace function pagerank(lambdatable, "lambda", "lambda", float, float, int, int, text, lambdatable) 
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/pagerank_ext.so','pagerank'
+language C STRICT;
+
+create or replace function pagerank_threads(lambdatable, "lambda", "lambda", float, float, int, int, text, lambdatable) 
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/pagerank_ext.so','pagerank_threads'
+language C STRICT;
+
 create or replace function autodiff_l1_2(lambdacursor, "lambda")
 returns setof record
 as '/home/clemens/masterarbeit/psql-autodiff/src/ext/autodiff_ext.so','autodiff_l1_2'
@@ -105,6 +149,12 @@ returns setof record
 as '/home/clemens/masterarbeit/psql-autodiff/src/ext/autodiff_timing.so','autodiff_t_l4'
 language C STRICT;
 
+-- batch size(rows derived at once), sum_rows(return only the sums over all rows)
+create or replace function autodiff_batch(lambdacursor, "lambda", int, bool)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/autodiff_ext.so','autodiff_batch'
+language C STRICT;
+
 --parameters: inputtable(weights and data combined), lambdafunction, iterations, num attrs, batch size(if 0 or lower, BGD will be done, otherwise mini-batchGD), learning_rate
 create or replace function gradient_descent_l1_2(lambdatable, "lambda", int, int, int, float)
 returns setof record
@@ -121,6 +171,75 @@ returns setof record
 as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_l4'
 language C STRICT;
 
+--additional parameters: shuffle(visit the tuples in a new random order every iteration), seed of the shuffle
+create or replace function gradient_descent_l1_2(lambdatable, "lambda", int, int, int, float, bool, int)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_l1_2'
+language C STRICT;
+
+create or replace function gradient_descent_l3(lambdatable, "lambda", int, int, int, float, bool, int)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_l3'
+language C STRICT;
+
+create or replace function gradient_descent_l4(lambdatable, "lambda", int, int, int, float, bool, int)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_l4'
+language C STRICT;
+
+--additional parameters: optimizer('sgd', 'momentum', 'rmsprop' or 'adam'), beta1(momentum decay), beta2(decay of squared gradients)
+create or replace function gradient_descent_l1_2(lambdatable, "lambda", int, int, int, float, bool, int, text)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_l1_2'
+language C STRICT;
+
+create or replace function gradient_descent_l1_2(lambdatable, "lambda", int, int, int, float, bool, int, text, float, float)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_l1_2'
+language C STRICT;
+
+create or replace function gradient_descent_l3(lambdatable, "lambda", int, int, int, float, bool, int, text)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_l3'
+language C STRICT;
+
+create or replace function gradient_descent_l3(lambdatable, "lambda", int, int, int, float, bool, int, text, float, float)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_l3'
+language C STRICT;
+
+create or replace function gradient_descent_l4(lambdatable, "lambda", int, int, int, float, bool, int, text)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_l4'
+language C STRICT;
+
+create or replace function gradient_descent_l4(lambdatable, "lambda", int, int, int, float, bool, int, text, float, float)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_l4'
+language C STRICT;
+
+--parameters: as gradient_descent_l3, followed by the number of threads, shuffle, seed, optimizer, beta1, beta2(only lambdas over float8 values)
+--lambdas over matrices are not split across threads, use gradient_descent_m_l3 and set matrix_parallel_workers to run its matrix kernels in parallel
+create or replace function gradient_descent_threads(lambdatable, "lambda", int, int, int, float, int)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_threads'
+language C STRICT;
+
+create or replace function gradient_descent_threads(lambdatable, "lambda", int, int, int, float, int, bool, int)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_threads'
+language C STRICT;
+
+create or replace function gradient_descent_threads(lambdatable, "lambda", int, int, int, float, int, bool, int, text)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_threads'
+language C STRICT;
+
+create or replace function gradient_descent_threads(lambdatable, "lambda", int, int, int, float, int, bool, int, text, float, float)
+returns setof record
+as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_ext.so','gradient_descent_threads'
+language C STRICT;
+
 --parameters: inputtable(weights and data combined), lambdafunction, iterations, num attrs, batch size(if 0 or lower, BGD will be done, otherwise mini-batchGD), learning_rate
 -- create or replace function gradient_descent_m_l1_2(lambdatable, "lambda", int, int, int, float)
 -- returns setof record
@@ -136,6 +255,11 @@ language C STRICT;
 -- returns setof record
 -- as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_m_ext.so','gradient_descent_m_l4'
 -- language C STRICT;
+
+-- create or replace function gradient_descent_m_l3(lambdatable, "lambda", int, int, int, float, bool, int, text, float, float)
+-- returns setof record
+-- as '/home/clemens/masterarbeit/psql-autodiff/src/ext/gradient_desc_m_ext.so','gradient_descent_m_l3'
+-- language C STRICT;
 ----------------------------------------------------------------------------------------------------------------------------------------
 
 
@@ -169,8 +293,13 @@ language C STRICT;
 -- select * from label_fast((select * from nums),(lambda(a)(atan2(a.x, a.y)))) limit 10;
 -- select * from kmeans((select * from points),(select * from points),(lambda(a,b)(a.x + a.y - (b.x + b.y))), 10, 100) limit 10;
 -- select * from kmeans_threads((select * from points),(select * from points),(lambda(a,b)(a.x + a.y - (b.x + b.y))), 10, 100) limit 10;
+-- select * from kmeans_threads((select * from points),(select * from points),(lambda(a,b)((a.x - b.x)^2 + (a.y - b.y)^2)), 10, 8) limit 10;
+-- select * from kmeans_threads((select * from points limit 100),(select * from points),(lambda(a,b)((a.x - b.x)^2 + (a.y - b.y)^2)), 10, 8, 500, 'kmeans++', 42) limit 10;
+-- select * from kmeans_minibatch((select * from points limit 10),(select * from points),(lambda(a,b)((a.x - b.x)^2 + (a.y - b.y)^2)), 4096, 8, 3, 'kmeans++', 42);
 -- select * from pagerank((select * from pages), (lambda(src)(src.src)), (lambda(dst)(dst.dst)), 0.85, 0.00001, 100, 100) limit 10;
 -- select * from pagerank_threads((select * from pages), (lambda(src)(src.src)), (lambda(dst)(dst.dst)), 0.85, 0.00001, 100, 100) limit 10;
+-- select * from pagerank_threads((select * from pages), (lambda(src)(src.src)), (lambda(dst)(dst.dst)), 0.85, 0.00001, 100, 8, 'gauss-seidel') limit 10;
+-- select * from pagerank_threads((select * from pages), (lambda(src)(src.src)), (lambda(dst)(dst.dst)), 0.85, 0.00001, 100, 8, 'jacobi', (select * from pagerank_yesterday)) limit 10;
 
 set jit='off';
 select * from autodiff_l1_2((select x, y, z from nums_numeric), (lambda(a)(relu(a.x) + relu(a.y) + relu(a.z)))) limit 10;
@@ -179,6 +308,35 @@ select * from autodiff_l1_2((select x, y, z from nums_numeric), (lambda(a)(relu(
 select * from autodiff_l3(  (select x, y, z from nums_numeric), (lambda(a)(relu(a.x) + relu(a.y) + relu(a.z)))) limit 10;
 select * from autodiff_l4(  (select x, y, z from nums_numeric), (lambda(a)(relu(a.x) + relu(a.y) + relu(a.z)))) limit 10;
 
+--autodiff_l3 over a square, the derivative has to be 2*x in every row, expected output:
+--  rows | mismatches
+-- ------+------------
+--   100 |          0
+-- (1 row)
+select count(*) as rows, count(*) filter (where result <> x * x or d_x <> 2 * x) as mismatches
+from autodiff_l3((select x from nums), (lambda(a)(a.x * a.x)));
+--the first rows, expected output:
+--  x | result | d_x
+-- ---+--------+-----
+--  1 |      1 |   2
+--  2 |      4 |   4
+--  3 |      9 |   6
+-- (3 rows)
+select * from autodiff_l3((select x from nums where x <= 3), (lambda(a)(a.x * a.x)));
+
+--batched derivation, has to match autodiff_l1_2 row by row(16 does not divide the 100 rows, so the last batch is partial)
+with batched as (select * from autodiff_batch((select x, y, z from nums), (lambda(a)(a.x * a.y + a.z * a.z)), 16, false)),
+     single as (select * from autodiff_l1_2((select x, y, z from nums), (lambda(a)(a.x * a.y + a.z * a.z))))
+select count(*) as mismatches
+from batched b full join single s using (x, y, z)
+where b.result is null or s.result is null
+   or abs(b.result - s.result) > 1e-9 or abs(b.d_x - s.d_x) > 1e-9
+   or abs(b.d_y - s.d_y) > 1e-9 or abs(b.d_z - s.d_z) > 1e-9;
+with batched as (select * from autodiff_batch((select x, y, z from nums), (lambda(a)(a.x * a.y + a.z * a.z)), 16, true)),
+     single as (select * from autodiff_l1_2((select x, y, z from nums), (lambda(a)(a.x * a.y + a.z * a.z))))
+select b.result = s.result and b.d_x = s.d_x and b.d_y = s.d_y and b.d_z = s.d_z as sums_match
+from batched b, (select sum(result) as result, sum(d_x) as d_x, sum(d_y) as d_y, sum(d_z) as d_z from single) s;
+
 select mat_add(x, y), x, y from nums_matrix_test; 
 -- set jit='off';
 -- select * from nums_matrix;
@@ -17,6 +17,7 @@
 #include <math.h>
 #include <pthread.h>
 #include "miscadmin.h"
+#include "lambda_srf.h"
 
 extern TupleDesc autodiff_record_type(List *args)
 {
@@ -99,301 +100,353 @@ extern TupleDesc autodiff_mult_record_type(List *args)
 }
 
 PG_MODULE_MAGIC;
-PG_FUNCTION_INFO_V1_RECTYPE(autodiff_l1_2, autodiff_record_type);
-PG_FUNCTION_INFO_V1_RECTYPE(autodiff_l3, autodiff_record_type);
-PG_FUNCTION_INFO_V1_RECTYPE(autodiff_l4, autodiff_record_type);
-
-Datum autodiff_l1_2_internal(PG_FUNCTION_ARGS)
+PG_FUNCTION_INFO_V1_STREAMING(autodiff_l1_2, autodiff_record_type);
+PG_FUNCTION_INFO_V1_STREAMING(autodiff_l3, autodiff_record_type);
+PG_FUNCTION_INFO_V1_STREAMING(autodiff_l4, autodiff_record_type);
+PG_FUNCTION_INFO_V1_RECTYPE(autodiff_batch, autodiff_record_type);
+
+/*
+ * State of a row-wise derivation between the calls(see lambda_srf.h)
+ */
+typedef struct AutodiffRowState
 {
-    MemoryContext oldcontext;
-    FuncCallContext *funcctx;
-    MemoryContext per_query_ctx;
-    TupleDesc outDesc = NULL;
-    Datum *replVal;
+    PlanState *planState;       /* the input cursor */
+    LambdaExpr *lambda;
+    TupleDesc inDesc;
+    TupleDesc outDesc;          /* input columns, result and one derivative per input column */
+    Tuplestorestate *tsOut;     /* NULL when returning a row per call */
+    MemoryContext rowContext;   /* everything derived from one input row, reset for the next one */
     Datum *oldVal;
-    bool *replIsNull;
     bool *oldIsNull;
+    Datum *replVal;
+    bool *replIsNull;
+    Datum *derivatives;
+    void *func;                 /* the compiled derivation, if any */
+    LambdaTier tier;            /* how autodiff_l3 derives the lambda */
+    uint64 tierRows;            /* rows autodiff_l3 derived below the optimized tier */
+} AutodiffRowState;
+
+/*
+ * The state of the current scan, set up on the first call
+ */
+static AutodiffRowState *autodiff_row_state(FunctionCallInfo fcinfo)
+{
+    FuncCallContext *funcctx;
+    AutodiffRowState *st;
+    MemoryContext oldcontext;
+    Tuplestorestate *tsOut;
+
+    if (!SRF_IS_FIRSTCALL())
+        return (AutodiffRowState *) SRF_PERCALL_SETUP()->user_fctx;
+
+    funcctx = lambda_srf_first_call(fcinfo, &tsOut);
+    oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+    st = (AutodiffRowState *) palloc0(sizeof(AutodiffRowState));
+    st->planState = (PlanState *) PG_GETARG_POINTER(0);
+    st->lambda = PG_GETARG_LAMBDA(1);
+    st->inDesc = (TupleDesc) list_nth(st->lambda->argtypes, 0);
+    st->tsOut = tsOut;
+    st->rowContext = AllocSetContextCreate(funcctx->multi_call_memory_ctx, "autodiff row", ALLOCSET_DEFAULT_SIZES);
+    st->oldVal = (Datum *) palloc(st->inDesc->natts * sizeof(Datum));
+    st->oldIsNull = (bool *) palloc(st->inDesc->natts * sizeof(bool));
+    st->replVal = (Datum *) palloc((st->inDesc->natts * 2 + 1) * sizeof(Datum));
+    st->replIsNull = (bool *) palloc((st->inDesc->natts * 2 + 1) * sizeof(bool));
+    st->derivatives = (Datum *) palloc(st->inDesc->natts * sizeof(Datum));
+
+    // the descriptor outlives the multi call context in materialize mode
+    MemoryContextSwitchTo(((ReturnSetInfo *) fcinfo->resultinfo)->econtext->ecxt_per_query_memory);
+    st->outDesc = BlessTupleDesc(autodiff_record_type(list_make2(NULL, st->lambda)));
 
-    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
-    LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
-
-    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("set-valued function called in context that cannot accept a set")));
-    if (!(rsinfo->allowedModes & SFRM_Materialize))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("materialize mode required, but it is not "
-                        "allowed in this context")));
-
-    LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
-    TupleDesc inDesc = (TupleDesc)list_nth(lambda->argtypes, 0);
+    MemoryContextSwitchTo(oldcontext);
+    funcctx->user_fctx = st;
+    return st;
+}
 
-    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
-    oldcontext = MemoryContextSwitchTo(per_query_ctx);
+/*
+ * Read the next input row, returns false at the end of the input
+ * The values are either deformed into the state or taken from the slot.  With HDR, the row is also provided as a
+ * heap tuple header, for lambdas taking the row as a parameter.  Both live in the row context, which is reset here.
+ */
+static bool autodiff_fetch_row(AutodiffRowState *st, Datum **val_ptr, bool **null_ptr, HeapTupleHeader *hdr)
+{
+    TupleTableSlot *slot;
+    MemoryContext oldcontext;
 
-    PlanState *planState = (PlanState *)PG_GETARG_POINTER(0);
-    TupleTableSlot *slot = MakeTupleTableSlot(NULL);
-    Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
+    // the previous row has been handed out or copied into the tuplestore by now
+    MemoryContextReset(st->rowContext);
 
-    HeapTuple tuple;
+    slot = ExecProcNode(st->planState);
+    if (TupIsNull(slot))
+        return false;
 
-    outDesc = CreateTupleDescCopy(inDesc);
-    oldIsNull = (bool *)palloc(inDesc->natts * sizeof(bool));
-    oldVal = (Datum *)palloc(inDesc->natts * sizeof(Datum));
+    oldcontext = MemoryContextSwitchTo(st->rowContext);
 
-    outDesc = CreateTemplateTupleDesc(inDesc->natts * 2 + 1, false);
+    if (slot->tts_mintuple)
+    {
+        *val_ptr = st->oldVal;
+        *null_ptr = st->oldIsNull;
+        heap_deform_tuple(slot->tts_tuple, st->inDesc, *val_ptr, *null_ptr);
+        if (hdr != NULL)
+            *hdr = slot->tts_tuple->t_data;
+    }
+    else
+    {
+        slot_getallattrs(slot);
+        *val_ptr = slot->tts_values;
+        *null_ptr = slot->tts_isnull;
+        if (hdr != NULL)
+            *hdr = heap_form_tuple(st->inDesc, slot->tts_values, slot->tts_isnull)->t_data;
+    }
 
-    { // register each tuple-descriptor field with the corresponding field name
-        for (int i = 0; i < inDesc->natts; i++)
+    /* reset derivatives to avoid undefined behaviour */
+    for (int i = 0; i < st->inDesc->natts; i++)
+    {
+        if (castNode(ExprState, st->lambda->exprstate)->lambdaContainsMatrix)
         {
-            TupleDescCopyEntry(outDesc, (AttrNumber)(i + 1), inDesc, (AttrNumber)(i + 1));
+            st->derivatives[i] = createScalar(0.0);
         }
-
-        TupleDescInitEntry(outDesc, 
-                           (AttrNumber)(inDesc->natts + 1), 
-                           "result",
-                           lambda->rettype, 
-                           lambda->rettypmod, 
-                           0);
-
-        for (int i = 0; i < inDesc->natts; i++)
+        else
         {
-            char buffer[64];
-            char *column_name = inDesc->attrs[i].attname.data;
-            sprintf(buffer, "d_%s", column_name);
-
-            TupleDescInitEntry(outDesc,
-                               (AttrNumber)(inDesc->natts + 1 + i + 1),
-                               buffer,
-                               inDesc->attrs[i].atttypid,
-                               inDesc->attrs[i].atttypmod,
-                               inDesc->attrs[i].attndims);
+            st->derivatives[i] = Float8GetDatum(0.0);
         }
     }
 
-    replIsNull = (bool *)palloc((inDesc->natts * 2 + 1) * sizeof(bool));
-    replVal = (Datum *)palloc((inDesc->natts * 2 + 1) * sizeof(Datum));
+    MemoryContextSwitchTo(oldcontext);
+    return true;
+}
 
-    Datum derivatives[inDesc->natts];
+/*
+ * The output row: the input columns, the result and the derivatives
+ */
+static HeapTuple autodiff_form_row(AutodiffRowState *st, Datum *val_ptr, bool *null_ptr, Datum result)
+{
+    int natts = st->inDesc->natts;
 
-    for (slot = ExecProcNode(planState); !TupIsNull(slot); slot = ExecProcNode(planState))
+    for (int i = 0; i < natts; i++)
     {
-        bool isnull;
-        Datum *val_ptr = oldVal;
-        bool *null_ptr = oldIsNull;
+        st->replVal[i] = val_ptr[i];
+        st->replIsNull[i] = null_ptr[i];
+    }
 
-        HeapTuple t;
-        HeapTupleHeader hdr;
+    st->replVal[natts] = result;
+    st->replIsNull[natts] = false;
 
-        if (slot->tts_mintuple)
-        {
-            hdr = slot->tts_tuple->t_data;
-            heap_deform_tuple(slot->tts_tuple, inDesc, val_ptr, null_ptr);
-        }
-        else
-        {
-            slot_getallattrs(slot);
-            t = heap_form_tuple(inDesc, slot->tts_values, slot->tts_isnull);
-            val_ptr = slot->tts_values;
-            null_ptr = slot->tts_isnull;
-            hdr = t->t_data;
-        }
+    for (int i = 0; i < natts; i++)
+    {
+        st->replVal[natts + 1 + i] = st->derivatives[i];
+        st->replIsNull[natts + 1 + i] = false;
+    }
 
-        /* reset derivatives to avoid undefined behaviour */
-        for(int i = 0; i < inDesc->natts; i++) {
-            if (castNode(ExprState, lambda->exprstate)->lambdaContainsMatrix)
-            {
-                derivatives[i] = createScalar(0.0);
-            } else {
-                derivatives[i] = Float8GetDatum(0.0);
-            }
-        }
-        PG_LAMBDA_SETARG(lambda, 0, HeapTupleHeaderGetDatum(hdr));
-        Datum result = PG_LAMBDA_DERIVE(lambda, &isnull, derivatives);
+    return heap_form_tuple(st->outDesc, st->replVal, st->replIsNull);
+}
 
-        for (int i = 0; i < inDesc->natts; i++)
-        {
-            replVal[i] = val_ptr[i];
-            replIsNull[i] = null_ptr[i];
-        }
+Datum autodiff_l1_2_internal(PG_FUNCTION_ARGS)
+{
+    AutodiffRowState *st = autodiff_row_state(fcinfo);
+    Datum *val_ptr;
+    bool *null_ptr;
+    HeapTupleHeader hdr;
 
-        replVal[inDesc->natts] = result;
-        replIsNull[inDesc->natts] = false;
+    LambdaInstrumentation *instr = lambda_srf_instr(st->lambda);
 
-        for(int i = 0; i < inDesc->natts; i++) {
-            replVal[inDesc->natts + 1 + i] = derivatives[i];
-            replIsNull[inDesc->natts + 1 + i] = false;
-        }
+    while (autodiff_fetch_row(st, &val_ptr, &null_ptr, &hdr))
+    {
+        MemoryContext oldcontext = MemoryContextSwitchTo(st->rowContext);
+        bool isnull;
 
-        tuple = heap_form_tuple(outDesc, replVal, replIsNull);
-        tuplestore_puttuple(tsOut, tuple);
+        if (instr)
+            InstrLambdaStart(instr);
+        PG_LAMBDA_SETARG(st->lambda, 0, HeapTupleHeaderGetDatum(hdr));
+        Datum result = PG_LAMBDA_DERIVE(st->lambda, &isnull, st->derivatives);
+        if (instr)
+            InstrLambdaStop(instr, LAMBDA_INSTR_DERIVE, 1);
+        HeapTuple tuple = autodiff_form_row(st, val_ptr, null_ptr, result);
+
+        MemoryContextSwitchTo(oldcontext);
+        if (lambda_srf_next(fcinfo, st->tsOut, tuple))
+            return HeapTupleGetDatum(tuple);
     }
 
-    rsinfo->returnMode = SFRM_Materialize;
-    rsinfo->setResult = tsOut;
-    rsinfo->setDesc = outDesc;
-
-    MemoryContextSwitchTo(oldcontext);
-
-    return (Datum)0;
+    return lambda_srf_done(fcinfo, st->tsOut, st->outDesc);
 }
 
-Datum autodiff_l3_internal(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum **arg, Datum *derivatives))
+/*
+ * Set up the derivation of autodiff_l3 in TIER(see ExecInitLambdaExprTier)
+ * The compiled derivation is stored in the state, the interpreted tier leaves it NULL.
+ */
+static void autodiff_l3_prepare(FunctionCallInfo fcinfo, AutodiffRowState *st, LambdaTier tier)
 {
-    MemoryContext oldcontext;
-    FuncCallContext *funcctx;
-    MemoryContext per_query_ctx;
-    TupleDesc outDesc = NULL;
-    Datum *replVal;
-    Datum *oldVal;
-    bool *replIsNull;
-    bool *oldIsNull;
+    ExprContext *econtext = ((ReturnSetInfo *) fcinfo->resultinfo)->econtext;
+    MemoryContext oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_query_memory);
+    LLVMJitContext *jitContext;
+    int oldflags;
 
-    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
-    LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
+    st->tier = tier;
+    st->func = NULL;
+    if (tier == LAMBDA_TIER_INTERPRETED)
+    {
+        ExecInitLambdaExprTier((Node *)st->lambda, false, true, NULL, tier);
+        MemoryContextSwitchTo(oldcontext);
+        return;
+    }
 
-    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("set-valued function called in context that cannot accept a set")));
-    if (!(rsinfo->allowedModes & SFRM_Materialize))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("materialize mode required, but it is not "
-                        "allowed in this context")));
+    llvm_enter_tmp_context(econtext->ecxt_estate);
+    jitContext = (LLVMJitContext *)(econtext->ecxt_estate->es_jit);
 
-    LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
-    TupleDesc inDesc = (TupleDesc)list_nth(lambda->argtypes, 0);
+    // the temporary context compiles with -O3 and inlining, baseline code is emitted without
+    oldflags = jitContext->base.flags;
+    if (tier == LAMBDA_TIER_BASELINE)
+        jitContext->base.flags &= ~(PGJIT_OPT3 | PGJIT_INLINE);
 
-    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
-    oldcontext = MemoryContextSwitchTo(per_query_ctx);
+    ExecInitLambdaExprTier((Node *)st->lambda, true, true, NULL, tier);
+    st->func = (void *) llvm_prepare_simple_expression_derivation(castNode(ExprState, st->lambda->exprstate));
 
-    PlanState *planState = (PlanState *)PG_GETARG_POINTER(0);
-    TupleTableSlot *slot = MakeTupleTableSlot(NULL);
-    Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
+    jitContext->base.flags = oldflags;
+    llvm_leave_tmp_context(econtext->ecxt_estate);
+    MemoryContextSwitchTo(oldcontext);
+}
 
-    HeapTuple tuple;
+/*
+ * The tier autodiff_l3 starts in
+ * The optimized code is compiled right away, if it is cached or the planner expects enough rows to need it anyway.
+ */
+static LambdaTier autodiff_l3_first_tier(AutodiffRowState *st)
+{
+    if (jit_lambda_tier_rows <= 0 || st->planState->plan->plan_rows >= jit_lambda_tier_rows ||
+        llvm_lambda_cache_has_derivation(st->lambda))
+        return LAMBDA_TIER_OPTIMIZED;
 
-    outDesc = CreateTupleDescCopy(inDesc);
-    oldIsNull = (bool *)palloc(inDesc->natts * sizeof(bool));
-    oldVal = (Datum *)palloc(outDesc->natts * sizeof(Datum));
+    return jit_lambda_tier_baseline ? LAMBDA_TIER_BASELINE : LAMBDA_TIER_INTERPRETED;
+}
 
-    outDesc = CreateTemplateTupleDesc(inDesc->natts * 2 + 1, false);
+Datum autodiff_l3_internal(PG_FUNCTION_ARGS)
+{
+    AutodiffRowState *st = autodiff_row_state(fcinfo);
+    Datum *val_ptr;
+    bool *null_ptr;
+    HeapTupleHeader hdr;
+
+    while (autodiff_fetch_row(st, &val_ptr, &null_ptr, st->tier == LAMBDA_TIER_INTERPRETED ? &hdr : NULL))
+    {
+        MemoryContext oldcontext = MemoryContextSwitchTo(st->rowContext);
+        LambdaInstrumentation *instr = lambda_srf_instr(st->lambda);
+        Datum result;
+        HeapTuple tuple;
+
+        if (instr)
+            InstrLambdaStart(instr);
+        if (st->tier == LAMBDA_TIER_INTERPRETED)
+        {
+            bool isnull;
 
-    { // register each tuple-descriptor field with the corresponding field name
-        for (int i = 0; i < inDesc->natts; i++)
+            PG_LAMBDA_SETARG(st->lambda, 0, HeapTupleHeaderGetDatum(hdr));
+            result = PG_LAMBDA_DERIVE(st->lambda, &isnull, st->derivatives);
+        }
+        else
         {
-            TupleDescCopyEntry(outDesc, (AttrNumber)(i + 1), inDesc, (AttrNumber)(i + 1));
+            result = ((Datum (*)(Datum **, Datum *)) st->func)(&val_ptr, st->derivatives);
         }
+        if (instr)
+            InstrLambdaStop(instr, LAMBDA_INSTR_DERIVE, 1);
+        tuple = autodiff_form_row(st, val_ptr, null_ptr, result);
 
-        TupleDescInitEntry(outDesc,
-                           (AttrNumber)(inDesc->natts + 1),
-                           "result",
-                           lambda->rettype,
-                           lambda->rettypmod,
-                           0);
+        MemoryContextSwitchTo(oldcontext);
 
-        for (int i = 0; i < inDesc->natts; i++)
-        {
-            char buffer[64];
-            char *column_name = inDesc->attrs[i].attname.data;
-            sprintf(buffer, "d_%s", column_name);
+        // the input turned out long enough, the following rows are derived by the optimized code
+        if (st->tier != LAMBDA_TIER_OPTIMIZED && ++st->tierRows >= (uint64) jit_lambda_tier_rows)
+            autodiff_l3_prepare(fcinfo, st, LAMBDA_TIER_OPTIMIZED);
 
-            TupleDescInitEntry(outDesc,
-                               (AttrNumber)(inDesc->natts + 2 + i),
-                               buffer,
-                               inDesc->attrs[i].atttypid,
-                               inDesc->attrs[i].atttypmod,
-                               inDesc->attrs[i].attndims);
-        }
+        if (lambda_srf_next(fcinfo, st->tsOut, tuple))
+            return HeapTupleGetDatum(tuple);
     }
 
-    replIsNull = (bool *)palloc((inDesc->natts * 2 + 1) * sizeof(bool));
-    replVal = (Datum *)palloc((inDesc->natts * 2 + 1) * sizeof(Datum));
+    return lambda_srf_done(fcinfo, st->tsOut, st->outDesc);
+}
 
-    Datum derivatives[inDesc->natts];
+Datum autodiff_l4_internal(PG_FUNCTION_ARGS)
+{
+    AutodiffRowState *st = autodiff_row_state(fcinfo);
+    Datum *val_ptr;
+    bool *null_ptr;
 
-    for (slot = ExecProcNode(planState); !TupIsNull(slot); slot = ExecProcNode(planState))
+    while (autodiff_fetch_row(st, &val_ptr, &null_ptr, NULL))
     {
-        bool isnull;
-        Datum *val_ptr = oldVal;
-        bool *null_ptr = oldIsNull;
+        MemoryContext oldcontext = MemoryContextSwitchTo(st->rowContext);
+        Datum result = PG_SIMPLE_LAMBDA_INJECT_DERIV(&val_ptr, st->derivatives, 0);
+        HeapTuple tuple = autodiff_form_row(st, val_ptr, null_ptr, result);
 
-        HeapTuple t;
-        HeapTupleHeader hdr;
+        MemoryContextSwitchTo(oldcontext);
+        if (lambda_srf_next(fcinfo, st->tsOut, tuple))
+            return HeapTupleGetDatum(tuple);
+    }
 
-        if (slot->tts_mintuple)
-        {
-            hdr = slot->tts_tuple->t_data;
-            heap_deform_tuple(slot->tts_tuple, inDesc, val_ptr, null_ptr);
-        }
-        else
+    return lambda_srf_done(fcinfo, st->tsOut, st->outDesc);
+}
+
+/*
+ * Derives the gathered rows of one batch, and either appends them to the output or adds them to the sums
+ */
+static void autodiff_batch_flush(LambdaBatch *batch, int nrows, int natts, float8 **columns, float8 *results,
+                                 float8 **derivatives, float8 *sums, TupleDesc outDesc, Tuplestorestate *tsOut)
+{
+    Datum replVal[natts * 2 + 1];
+    bool replIsNull[natts * 2 + 1];
+
+    for (int i = 0; i < natts; i++)
+    {
+        memset(derivatives[i], 0, nrows * sizeof(float8));
+    }
+    ExecDeriveLambdaBatch(batch, nrows, columns, results, derivatives);
+
+    if (sums != NULL)
+    {
+        for (int row = 0; row < nrows; row++)
         {
-            slot_getallattrs(slot);
-            t = heap_form_tuple(inDesc, slot->tts_values, slot->tts_isnull);
-            val_ptr = slot->tts_values;
-            null_ptr = slot->tts_isnull;
-            hdr = t->t_data;
+            sums[natts] += results[row];
         }
-        /* reset derivatives to avoid undefined behaviour */
-        for (int i = 0; i < inDesc->natts; i++)
+        for (int i = 0; i < natts; i++)
         {
-            if (castNode(ExprState, lambda->exprstate)->lambdaContainsMatrix)
-            {
-                derivatives[i] = createScalar(0.0);
-            }
-            else
+            for (int row = 0; row < nrows; row++)
             {
-                derivatives[i] = Float8GetDatum(0.0);
+                sums[natts + 1 + i] += derivatives[i][row];
             }
         }
+        return;
+    }
 
-        Datum result = derivefunc(&val_ptr, derivatives);
-
-        for (int i = 0; i < inDesc->natts; i++)
-        {
-            replVal[i] = val_ptr[i];
-            replIsNull[i] = null_ptr[i];
-        }
-
-        replVal[inDesc->natts] = result;
-        replIsNull[inDesc->natts] = false;
+    memset(replIsNull, 0, sizeof(replIsNull));
+    for (int row = 0; row < nrows; row++)
+    {
+        HeapTuple tuple;
 
-        for (int i = 0; i < inDesc->natts; i++)
+        for (int i = 0; i < natts; i++)
         {
-            replVal[inDesc->natts + 1 + i] = derivatives[i];
-            replIsNull[inDesc->natts + 1 + i] = false;
+            replVal[i] = Float8GetDatum(columns[i][row]);
+            replVal[natts + 1 + i] = Float8GetDatum(derivatives[i][row]);
         }
+        replVal[natts] = Float8GetDatum(results[row]);
 
         tuple = heap_form_tuple(outDesc, replVal, replIsNull);
-
         tuplestore_puttuple(tsOut, tuple);
+        heap_freetuple(tuple);
     }
-
-    rsinfo->returnMode = SFRM_Materialize;
-    rsinfo->setResult = tsOut;
-    rsinfo->setDesc = outDesc;
-
-    MemoryContextSwitchTo(oldcontext);
-
-    return (Datum)0;
 }
 
-Datum autodiff_l4_internal(PG_FUNCTION_ARGS)
+/*
+ * Batched variant of autodiff_l1_2: gathers batch_size rows into one column per attribute and derives them with a
+ * single forward and reverse sweep(see execLambdaBatch.c), instead of interpreting the lambda once per row.
+ * Returns the same rows as autodiff_l1_2, or with sum_rows set a single row with the sums of the results and
+ * derivatives over all rows(the attributes being NULL).
+ * Only lambdas of float8 attributes and float8 arithmetics are supported.
+ */
+Datum autodiff_batch(PG_FUNCTION_ARGS)
 {
     MemoryContext oldcontext;
-    FuncCallContext *funcctx;
     MemoryContext per_query_ctx;
-    TupleDesc outDesc = NULL;
-    Datum *replVal;
-    Datum *oldVal;
-    bool *replIsNull;
-    bool *oldIsNull;
+    TupleDesc outDesc;
 
     ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
-    LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
 
     if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
         ereport(ERROR,
@@ -405,112 +458,105 @@ Datum autodiff_l4_internal(PG_FUNCTION_ARGS)
                  errmsg("materialize mode required, but it is not "
                         "allowed in this context")));
 
+    PlanState *planState = (PlanState *)PG_GETARG_POINTER(0);
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
+    int batch_size = PG_GETARG_INT32(2); // number of rows derived at once
+    bool sum_rows = PG_GETARG_BOOL(3);   // return only the sums over all rows
     TupleDesc inDesc = (TupleDesc)list_nth(lambda->argtypes, 0);
+    int natts = inDesc->natts;
 
-    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
-    oldcontext = MemoryContextSwitchTo(per_query_ctx);
-
-    PlanState *planState = (PlanState *)PG_GETARG_POINTER(0);
-    TupleTableSlot *slot = MakeTupleTableSlot(NULL);
-    Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
-
-    HeapTuple tuple;
-
-    outDesc = CreateTupleDescCopy(inDesc);
-    oldIsNull = (bool *)palloc(inDesc->natts * sizeof(bool));
-    oldVal = (Datum *)palloc(outDesc->natts * sizeof(Datum));
-
-    outDesc = CreateTemplateTupleDesc(inDesc->natts * 2 + 1, false);
-
-    { // register each tuple-descriptor field with the corresponding field name
-        for (int i = 0; i < inDesc->natts; i++)
-        {
-            TupleDescCopyEntry(outDesc, (AttrNumber)(i + 1), inDesc, (AttrNumber)(i + 1));
-        }
+    if (batch_size < 1)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("batch size must be at least 1")));
 
-        TupleDescInitEntry(outDesc,
-                           (AttrNumber)(inDesc->natts + 1),
-                           "result",
-                           lambda->rettype,
-                           lambda->rettypmod,
-                           0);
+    llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
+    ExecInitLambdaExpr((Node *)lambda, false, true);
+    llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
 
-        for (int i = 0; i < inDesc->natts; i++)
-        {
-            char buffer[64];
-            char *column_name = inDesc->attrs[i].attname.data;
-            sprintf(buffer, "d_%s", column_name);
+    ExprState *state = castNode(ExprState, lambda->exprstate);
+    bool supported = lambda->rettype == FLOAT8OID && ExecLambdaBatchSupported(state);
 
-            TupleDescInitEntry(outDesc,
-                               (AttrNumber)(inDesc->natts + 2 + i),
-                               buffer,
-                               inDesc->attrs[i].atttypid,
-                               inDesc->attrs[i].atttypmod,
-                               inDesc->attrs[i].attndims);
-        }
+    for (int i = 0; i < natts; i++)
+    {
+        supported &= inDesc->attrs[i].atttypid == FLOAT8OID;
     }
+    if (!supported)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("lambda expression cannot be derived in batches"),
+                 errhint("Only lambdas of float8 attributes and float8 arithmetics are supported, "
+                         "use autodiff_l1_2 to derive other lambdas row by row.")));
 
-    replIsNull = (bool *)palloc((inDesc->natts * 2 + 1) * sizeof(bool));
-    replVal = (Datum *)palloc((inDesc->natts * 2 + 1) * sizeof(Datum));
+    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+    oldcontext = MemoryContextSwitchTo(per_query_ctx);
 
-    Datum derivatives[inDesc->natts];
+    Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
+    LambdaBatch *batch = ExecInitLambdaBatch(state, batch_size);
+    TupleTableSlot *slot;
+    Datum values[natts];
+    bool isnull[natts];
+    float8 *columns[natts];
+    float8 *derivatives[natts];
+    float8 *results = palloc(batch_size * sizeof(float8));
+    float8 *sums = sum_rows ? palloc0((natts * 2 + 1) * sizeof(float8)) : NULL;
+    int nrows = 0;
+
+    outDesc = autodiff_record_type(list_make2(NULL, lambda));
+
+    for (int i = 0; i < natts; i++)
+    {
+        columns[i] = palloc(batch_size * sizeof(float8));
+        derivatives[i] = palloc(batch_size * sizeof(float8));
+    }
 
     for (slot = ExecProcNode(planState); !TupIsNull(slot); slot = ExecProcNode(planState))
     {
-        bool isnull;
-        Datum *val_ptr = oldVal;
-        bool *null_ptr = oldIsNull;
-
-        HeapTuple t;
-        HeapTupleHeader hdr;
+        Datum *val_ptr = values;
+        bool *null_ptr = isnull;
 
         if (slot->tts_mintuple)
         {
-            hdr = slot->tts_tuple->t_data;
             heap_deform_tuple(slot->tts_tuple, inDesc, val_ptr, null_ptr);
         }
         else
         {
             slot_getallattrs(slot);
-            t = heap_form_tuple(inDesc, slot->tts_values, slot->tts_isnull);
             val_ptr = slot->tts_values;
             null_ptr = slot->tts_isnull;
-            hdr = t->t_data;
         }
-        /* reset derivatives to avoid undefined behaviour */
-        for (int i = 0; i < inDesc->natts; i++)
+
+        for (int i = 0; i < natts; i++)
         {
-            if (castNode(ExprState, lambda->exprstate)->lambdaContainsMatrix)
-            {
-                derivatives[i] = createScalar(0.0);
-            }
-            else
-            {
-                derivatives[i] = Float8GetDatum(0.0);
-            }
+            if (null_ptr[i])
+                ereport(ERROR,
+                        (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                         errmsg("batched derivation does not support NULL values")));
+            columns[i][nrows] = DatumGetFloat8(val_ptr[i]);
         }
 
-        Datum result = PG_SIMPLE_LAMBDA_INJECT_DERIV(&val_ptr, derivatives, 0);
-
-        for (int i = 0; i < inDesc->natts; i++)
+        if (++nrows == batch_size)
         {
-            replVal[i] = val_ptr[i];
-            replIsNull[i] = null_ptr[i];
+            autodiff_batch_flush(batch, nrows, natts, columns, results, derivatives, sums, outDesc, tsOut);
+            nrows = 0;
         }
+    }
+    if (nrows > 0)
+    {
+        autodiff_batch_flush(batch, nrows, natts, columns, results, derivatives, sums, outDesc, tsOut);
+    }
 
-        replVal[inDesc->natts] = result;
-        replIsNull[inDesc->natts] = false;
+    if (sum_rows)
+    {
+        Datum replVal[natts * 2 + 1];
+        bool replIsNull[natts * 2 + 1];
 
-        for (int i = 0; i < inDesc->natts; i++)
+        for (int i = 0; i < natts * 2 + 1; i++)
         {
-            replVal[inDesc->natts + 1 + i] = derivatives[i];
-            replIsNull[inDesc->natts + 1 + i] = false;
+            replVal[i] = Float8GetDatum(sums[i]);
+            replIsNull[i] = i < natts;
         }
-
-        tuple = heap_form_tuple(outDesc, replVal, replIsNull);
-
-        tuplestore_puttuple(tsOut, tuple);
+        tuplestore_puttuple(tsOut, heap_form_tuple(outDesc, replVal, replIsNull));
     }
 
     rsinfo->returnMode = SFRM_Materialize;
@@ -527,28 +573,28 @@ Datum autodiff_l1_2(PG_FUNCTION_ARGS)
     ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
 
-    llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
-    ExecInitLambdaExpr((Node *)lambda, false, true);
-    llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
+    // with a row per call, the lambda is set up once per scan
+    if (SRF_IS_FIRSTCALL())
+    {
+        llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
+        ExecInitLambdaExpr((Node *)lambda, false, true);
+        llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
+    }
 
     return autodiff_l1_2_internal(fcinfo);
 }
 
 Datum autodiff_l3(PG_FUNCTION_ARGS)
 {
-    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
-    LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
-
-    llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
-    LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
-
-    ExecInitLambdaExpr((Node *)lambda, true, true);
-    Datum (*compiled_func)(Datum **, Datum *);
-    compiled_func = llvm_prepare_simple_expression_derivation(castNode(ExprState, lambda->exprstate));
+    // the first rows may be derived by a cheaper tier, until the input is long enough for the optimized code
+    if (SRF_IS_FIRSTCALL())
+    {
+        AutodiffRowState *st = autodiff_row_state(fcinfo);
 
-    llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
+        autodiff_l3_prepare(fcinfo, st, autodiff_l3_first_tier(st));
+    }
 
-    return autodiff_l3_internal(fcinfo, compiled_func);
+    return autodiff_l3_internal(fcinfo);
 }
 
 Datum autodiff_l4(PG_FUNCTION_ARGS)
@@ -556,14 +602,22 @@ Datum autodiff_l4(PG_FUNCTION_ARGS)
     ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
     LLVMJitContext *jitContext;
+    Datum (*compiled_func)(FunctionCallInfo);
+
+    // the compiled copy of autodiff_l4_internal is kept for the following calls
+    if (!SRF_IS_FIRSTCALL())
+    {
+        compiled_func = (Datum (*)(FunctionCallInfo)) autodiff_row_state(fcinfo)->func;
+        return compiled_func(fcinfo);
+    }
 
     llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
     ExecInitLambdaExpr((Node *)lambda, true, true);
     jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
 
-    Datum (*compiled_func)(FunctionCallInfo);
     compiled_func = llvm_prepare_lambda_tablefunc(jitContext, "ext/autodiff_ext.bc", "autodiff_l4_internal", 1);
     llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
 
+    autodiff_row_state(fcinfo)->func = (void *) compiled_func;
     return compiled_func(fcinfo);
-}
\ No newline at end of file
+}
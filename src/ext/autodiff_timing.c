@@ -17,6 +17,7 @@
 #include <math.h>
 #include <pthread.h>
 #include "miscadmin.h"
+#include "utils/memutils.h"
 #include <time.h>
 
 extern TupleDesc autodiff_t_record_type(List *args)
@@ -121,12 +122,17 @@ Datum autodiff_t_l2_internal(PG_FUNCTION_ARGS, clock_t diff)
     replVal = (Datum *)palloc((inDesc->natts * 2 + 1) * sizeof(Datum));
 
     Datum derivatives[inDesc->natts];
+    // everything derived from one row, reset before the next one
+    MemoryContext row_ctx = AllocSetContextCreate(per_query_ctx, "autodiff row", ALLOCSET_DEFAULT_SIZES);
     int counter = 0;
     float8 time_compilation = 0.0, time_execution = 0.0;
     clock_t execution_tally = 0;
 
     for (slot = ExecProcNode(planState); !TupIsNull(slot); slot = ExecProcNode(planState))
     {
+        MemoryContextReset(row_ctx);
+        MemoryContextSwitchTo(row_ctx);
+
         bool isnull;
         Datum *val_ptr = oldVal;
         bool *null_ptr = oldIsNull;
@@ -192,7 +198,10 @@ Datum autodiff_t_l2_internal(PG_FUNCTION_ARGS, clock_t diff)
         tuple = heap_form_tuple(outDesc, replVal, replIsNull);
         tuplestore_puttuple(tsOut, tuple);
         //counter++;
+
+        MemoryContextSwitchTo(per_query_ctx);
     }
+    MemoryContextDelete(row_ctx);
 
     // time_execution = ((float8)execution_tally) / CLOCKS_PER_SEC;
     // printf("all ticks combined for eval were: %ld\n", execution_tally);
@@ -278,9 +287,14 @@ Datum autodiff_t_l3_internal(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum **arg,
     replVal = (Datum *)palloc((inDesc->natts * 2 + 1) * sizeof(Datum));
 
     Datum derivatives[inDesc->natts];
+    // everything derived from one row, reset before the next one
+    MemoryContext row_ctx = AllocSetContextCreate(per_query_ctx, "autodiff row", ALLOCSET_DEFAULT_SIZES);
 
     for (slot = ExecProcNode(planState); !TupIsNull(slot); slot = ExecProcNode(planState))
     {
+        MemoryContextReset(row_ctx);
+        MemoryContextSwitchTo(row_ctx);
+
         bool isnull;
         Datum *val_ptr = oldVal;
         bool *null_ptr = oldIsNull;
@@ -327,7 +341,10 @@ Datum autodiff_t_l3_internal(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum **arg,
         tuple = heap_form_tuple(outDesc, replVal, replIsNull);
 
         tuplestore_puttuple(tsOut, tuple);
+
+        MemoryContextSwitchTo(per_query_ctx);
     }
+    MemoryContextDelete(row_ctx);
 
     rsinfo->returnMode = SFRM_Materialize;
     rsinfo->setResult = tsOut;
@@ -407,9 +424,14 @@ Datum autodiff_t_l4_internal(PG_FUNCTION_ARGS)
     replVal = (Datum *)palloc((inDesc->natts * 2 + 1) * sizeof(Datum));
 
     Datum derivatives[inDesc->natts];
+    // everything derived from one row, reset before the next one
+    MemoryContext row_ctx = AllocSetContextCreate(per_query_ctx, "autodiff row", ALLOCSET_DEFAULT_SIZES);
 
     for (slot = ExecProcNode(planState); !TupIsNull(slot); slot = ExecProcNode(planState))
     {
+        MemoryContextReset(row_ctx);
+        MemoryContextSwitchTo(row_ctx);
+
         bool isnull;
         Datum *val_ptr = oldVal;
         bool *null_ptr = oldIsNull;
@@ -456,7 +478,10 @@ Datum autodiff_t_l4_internal(PG_FUNCTION_ARGS)
         tuple = heap_form_tuple(outDesc, replVal, replIsNull);
 
         tuplestore_puttuple(tsOut, tuple);
+
+        MemoryContextSwitchTo(per_query_ctx);
     }
+    MemoryContextDelete(row_ctx);
 
     rsinfo->returnMode = SFRM_Materialize;
     rsinfo->setResult = tsOut;
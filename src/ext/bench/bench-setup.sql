@@ -0,0 +1,196 @@
+-- Functions and helpers of the benchmark suite, loaded by run-bench.sh
+-- The table functions are loaded from $libdir, as installed by the Dockerfile(cp *.so /psql/install/lib/).
+
+create or replace function autodiff_l1_2(lambdacursor, "lambda")
+returns setof record
+as '$libdir/autodiff_ext', 'autodiff_l1_2'
+language C STRICT;
+
+create or replace function autodiff_l3(lambdacursor, "lambda")
+returns setof record
+as '$libdir/autodiff_ext', 'autodiff_l3'
+language C STRICT;
+
+create or replace function autodiff_l4(lambdacursor, "lambda")
+returns setof record
+as '$libdir/autodiff_ext', 'autodiff_l4'
+language C STRICT;
+
+--parameters: input cursor, lambdafunction, batch size(rows derived at once), sum_rows(return only the sums over all rows)
+create or replace function autodiff_batch(lambdacursor, "lambda", int, bool)
+returns setof record
+as '$libdir/autodiff_ext', 'autodiff_batch'
+language C STRICT;
+
+--parameters: inputtable(weights and data combined), lambdafunction, iterations, num attrs, batch size, learning_rate, shuffle, seed
+create or replace function gradient_descent_l1_2(lambdatable, "lambda", int, int, int, float, bool, int)
+returns setof record
+as '$libdir/gradient_desc_ext', 'gradient_descent_l1_2'
+language C STRICT;
+
+create or replace function gradient_descent_l3(lambdatable, "lambda", int, int, int, float, bool, int)
+returns setof record
+as '$libdir/gradient_desc_ext', 'gradient_descent_l3'
+language C STRICT;
+
+create or replace function gradient_descent_l4(lambdatable, "lambda", int, int, int, float, bool, int)
+returns setof record
+as '$libdir/gradient_desc_ext', 'gradient_descent_l4'
+language C STRICT;
+
+--parameters: clusters, points, distance lambda, unused, threads, max iterations, initialization, seed
+create or replace function kmeans_threads(lambdatable, lambdatable, "lambda", int, int, int, text, int)
+returns setof record
+as '$libdir/kmeans_ext', 'kmeans_threads'
+language C STRICT;
+
+--parameters: edges, source lambda, destination lambda, damping, threshold, iterations, threads, mode
+create or replace function pagerank_threads(lambdatable, "lambda", "lambda", float, float, int, int, text)
+returns setof record
+as '$libdir/pagerank_ext', 'pagerank_threads'
+language C STRICT;
+
+
+------------------------------------------------------- synthetic datasets -------------------------------------------------------
+-- Every generator seeds random() first, so equal parameters and seeds always produce the same table.
+
+-- NROWS rows of NCOLS float columns c1..cN, uniform in [0, 1)
+create or replace function bench_gen_scalar(ncols int, nrows int, seed float8)
+returns text language plpgsql as $$
+declare
+    tbl text := format('bench_scalar_%s', ncols);
+begin
+    perform setseed(seed);
+    execute format('drop table if exists %I', tbl);
+    execute format('create table %I as select %s from generate_series(1, %s)', tbl,
+                   (select string_agg(format('random() as c%s', i), ', ' order by i) from generate_series(1, ncols) i),
+                   nrows);
+    return tbl;
+end $$;
+
+-- linear regression: weights a1..aN, b (all 1.0) next to data x1..xN, y = 0.5 + 0.8 * sum(x)
+create or replace function bench_gen_regression(ncols int, nrows int, seed float8)
+returns text language plpgsql as $$
+declare
+    tbl text := format('bench_regression_%s', ncols);
+begin
+    perform setseed(seed);
+    execute format('drop table if exists %I', tbl);
+    execute format('create table %I as select %s, 1.0::float8 as b, d.*, 0.5 + 0.8 * (%s) as y from (select %s from generate_series(1, %s)) d',
+                   tbl,
+                   (select string_agg(format('1.0::float8 as a%s', i), ', ' order by i) from generate_series(1, ncols) i),
+                   (select string_agg(format('d.x%s', i), ' + ' order by i) from generate_series(1, ncols) i),
+                   (select string_agg(format('random() as x%s', i), ', ' order by i) from generate_series(1, ncols) i),
+                   nrows);
+    return tbl;
+end $$;
+
+-- random NROWS x NCOLS matrix, uniform in [-0.5, 0.5)
+create or replace function bench_random_matrix(nrows int, ncols int)
+returns float8[] language sql volatile as $$
+    select array_agg(r order by i)
+    from (select i, array_agg(random() - 0.5 order by j) as r
+          from generate_series(1, nrows) i, generate_series(1, ncols) j
+          group by i) m
+$$;
+
+-- MLP classifier: NROWS samples(img 1 x NIN, one_hot 1 x NCLASSES) and one row of weights
+-- (w_xh NIN x WIDTH, w_ho WIDTH x NCLASSES)
+create or replace function bench_gen_mlp(width int, nin int, nclasses int, nrows int, seed float8)
+returns text language plpgsql as $$
+declare
+    tbl text := format('bench_mlp_%s', width);
+begin
+    perform setseed(seed);
+    execute format('drop table if exists %I', tbl || '_data');
+    execute format('drop table if exists %I', tbl || '_weights');
+    execute format('create table %I as
+                        select bench_random_matrix(1, %s) as img,
+                               array[array(select (j = c)::int::float8 from generate_series(0, %s - 1) j order by j)] as one_hot
+                        from generate_series(1, %s) s, lateral (select floor(random() * %s)::int + s * 0 as c) l',
+                   tbl || '_data', nin, nclasses, nrows, nclasses);
+    execute format('create table %I as select bench_random_matrix(%s, %s) as w_xh, bench_random_matrix(%s, %s) as w_ho',
+                   tbl || '_weights', nin, width, width, nclasses);
+    return tbl;
+end $$;
+
+-- NROWS points of D float columns p1..pD in K unit cubes(blobs) along the diagonal
+create or replace function bench_gen_points(k int, d int, nrows int, seed float8)
+returns text language plpgsql as $$
+declare
+    tbl text := format('bench_points_%sx%s', k, d);
+begin
+    perform setseed(seed);
+    execute format('drop table if exists %I', tbl);
+    execute format('create table %I as select %s from generate_series(1, %s) s, lateral (select floor(random() * %s) + s * 0 as blob) b',
+                   tbl,
+                   (select string_agg(format('b.blob * 10 + random() as p%s', i), ', ' order by i) from generate_series(1, d) i),
+                   nrows, k);
+    return tbl;
+end $$;
+
+-- NEDGES edges between NNODES pages, the destinations follow random()^SKEW(1 is uniform, larger values
+-- concentrate the links on few pages)
+create or replace function bench_gen_pages(nnodes int, nedges int, skew float8, seed float8)
+returns text language plpgsql as $$
+declare
+    tbl text := format('bench_pages_%s_%s_%s', nnodes, nedges, replace(skew::text, '.', '_'));
+begin
+    perform setseed(seed);
+    execute format('drop table if exists %I', tbl);
+    execute format('create table %I as select floor(random() * %s)::float8 as src, floor(power(random(), %s) * %s)::float8 as dst
+                    from generate_series(1, %s)', tbl, nnodes, skew, nnodes, nedges);
+    return tbl;
+end $$;
+
+
+------------------------------------------------------- measurement -------------------------------------------------------
+
+-- a field of /proc/self/status in kB, NULL if it cannot be read(needs a superuser on Linux)
+create or replace function bench_proc_status(field text)
+returns bigint language plpgsql as $$
+begin
+    return substring(pg_read_file('/proc/self/status') from field || ':\s*(\d+) kB')::bigint;
+exception when others then
+    return null;
+end $$;
+
+-- time spent initializing and compiling the lambdas of PLAN and its children(see EXPLAIN (ANALYZE, VERBOSE))
+create or replace function bench_lambda_compile(plan jsonb)
+returns float8 language sql immutable as $$
+    select coalesce((select sum(coalesce((l->>'Interpreted Init Time')::float8, 0) +
+                                coalesce((l->>'Baseline Compile Time')::float8, 0) +
+                                coalesce((l->>'Optimized Compile Time')::float8, 0))
+                     from jsonb_array_elements(coalesce(plan->'Lambdas', '[]')) l), 0) +
+           coalesce((select sum(bench_lambda_compile(p))
+                     from jsonb_array_elements(coalesce(plan->'Plans', '[]')) p), 0)
+$$;
+
+-- run QUERY under EXPLAIN ANALYZE and return one JSON result of the suite
+-- INPUT_ROWS is the number of rows the table function reads, rows_per_s refers to it.  The peak memory is the
+-- high water mark of the backend, so every measurement should run in a new session.
+create or replace function bench_measure(bench text, params text, variant text, query text, input_rows bigint)
+returns json language plpgsql as $$
+declare
+    plan jsonb;
+    start_kb bigint := bench_proc_status('VmRSS');
+    exec_ms float8;
+begin
+    begin
+        execute 'explain (analyze, verbose, format json) ' || query into plan;
+    exception when others then
+        return json_build_object('bench', bench, 'params', params, 'variant', variant, 'error', sqlerrm);
+    end;
+
+    exec_ms := (plan->0->>'Execution Time')::float8;
+    return json_build_object('bench', bench,
+                             'params', params,
+                             'variant', variant,
+                             'input_rows', input_rows,
+                             'execution_ms', exec_ms,
+                             'jit_ms', (plan->0->'JIT'->'Timing'->>'Total')::float8,
+                             'lambda_compile_ms', bench_lambda_compile(plan->0->'Plan'),
+                             'rows_per_s', input_rows * 1000.0 / nullif(exec_ms, 0),
+                             'start_memory_kb', start_kb,
+                             'peak_memory_kb', bench_proc_status('VmHWM'));
+end $$;
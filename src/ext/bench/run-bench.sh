@@ -0,0 +1,176 @@
+#!/bin/bash
+#
+# run-bench.sh
+#    Reproducible benchmark of the lambda table functions, started by "make bench" in src/ext
+#
+# Generates the synthetic datasets with fixed seeds, runs every case of the suite in a new session(cold lambda
+# cache, fresh memory high water mark) and writes one JSON document with the compile time, the rows per second and
+# the peak memory of every run.  The server must run with the extensions installed in $libdir, and the user must be a
+# superuser for the peak memory(read from /proc/self/status), otherwise it is null.
+#
+# Settings(environment variables):
+#    PSQL                psql command including connection options   (psql)
+#    BENCH_DB            database, the tables are created in it       (postgres)
+#    BENCH_OUT           result file                                  (bench-results.json)
+#    BENCH_SEED          seed of all generators and algorithms        (42)
+#    BENCH_REPEAT        runs per case                                (3)
+#    BENCH_THREADS       threads of the parallel variants             (4)
+#    BENCH_ROWS          rows of the scalar and regression datasets   (100000)
+#    BENCH_SCALAR_COLS   columns of the scalar lambdas                (4 16 64)
+#    BENCH_GD_ITERATIONS iterations of gradient descent               (5)
+#    BENCH_MLP_ROWS      samples of the MLP                           (10000)
+#    BENCH_MLP_WIDTHS    hidden layer widths of the MLP               (8 32 128)
+#    BENCH_MLP_INPUTS    input features x classes of the MLP          (64x10)
+#    BENCH_KMEANS_ROWS   points of kmeans                             (100000)
+#    BENCH_KMEANS        clusters x dimensions of kmeans              (8x2 16x8 32x32)
+#    BENCH_PAGERANK      nodes x edges x skew of the pagerank graphs  (10000x100000x1 10000x100000x4 100000x1000000x2)
+#
+# The variants L1 to L4 are the levels of the autodiff and gradient descent functions: L1 interprets the lambda
+# (jit off), L2 JIT compiles it per call(_l1_2 with jit on), L3 uses the fast lambda JIT(_l3) and L4 compiles the
+# whole table function(_l4).  kmeans and pagerank have a single level, their variants are thread counts and modes.
+
+set -e -o pipefail
+
+PSQL=${PSQL:-psql}
+BENCH_DB=${BENCH_DB:-postgres}
+BENCH_OUT=${BENCH_OUT:-bench-results.json}
+BENCH_SEED=${BENCH_SEED:-42}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+BENCH_THREADS=${BENCH_THREADS:-4}
+BENCH_ROWS=${BENCH_ROWS:-100000}
+BENCH_SCALAR_COLS=${BENCH_SCALAR_COLS:-"4 16 64"}
+BENCH_GD_ITERATIONS=${BENCH_GD_ITERATIONS:-5}
+BENCH_MLP_ROWS=${BENCH_MLP_ROWS:-10000}
+BENCH_MLP_WIDTHS=${BENCH_MLP_WIDTHS:-"8 32 128"}
+BENCH_MLP_INPUTS=${BENCH_MLP_INPUTS:-64x10}
+BENCH_KMEANS_ROWS=${BENCH_KMEANS_ROWS:-100000}
+BENCH_KMEANS=${BENCH_KMEANS:-"8x2 16x8 32x32"}
+BENCH_PAGERANK=${BENCH_PAGERANK:-"10000x100000x1 10000x100000x4 100000x1000000x2"}
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+# setseed() takes a value in [-1, 1]
+SQL_SEED="($BENCH_SEED % 1000) / 1000.0"
+
+# JIT settings of the variants, the costs are zero so every query compiles
+JIT_OFF="set jit = off;"
+JIT_ON="set jit = on; set jit_above_cost = 0; set jit_optimize_above_cost = 0; set jit_inline_above_cost = 0;"
+
+run_sql()
+{
+    $PSQL -X -q -t -A -v ON_ERROR_STOP=1 -d "$BENCH_DB" "$@"
+}
+
+RESULTS=()
+
+# measure BENCH PARAMS VARIANT SETTINGS INPUT_ROWS QUERY: runs the case BENCH_REPEAT times, each in a new session
+measure()
+{
+    local bench=$1 params=$2 variant=$3 settings=$4 rows=$5 query=$6
+    local run result
+
+    for run in $(seq 1 "$BENCH_REPEAT"); do
+        result=$(run_sql <<EOF
+load 'llvmjit.so';
+$settings
+select bench_measure('$bench', '$params', '$variant', \$bench\$ $query \$bench\$, $rows)::jsonb || jsonb_build_object('run', $run);
+EOF
+)
+        echo "$bench $params $variant #$run: $result" >&2
+        RESULTS+=("$result")
+    done
+}
+
+echo "loading functions and generating datasets(seed $BENCH_SEED)" >&2
+run_sql -f "$BENCH_DIR/bench-setup.sql" > /dev/null
+
+META=$(run_sql <<EOF
+select json_build_object('server_version', version(),
+                         'started', now(),
+                         'seed', $BENCH_SEED,
+                         'repeat', $BENCH_REPEAT,
+                         'threads', $BENCH_THREADS,
+                         'settings', (select json_object_agg(name, setting) from pg_settings
+                                      where name in ('jit_provider', 'jit_lambda_cache_size', 'jit_lambda_tier_rows',
+                                                     'jit_lambda_tier_baseline', 'work_mem', 'max_parallel_workers')));
+EOF
+)
+
+# autodiff and gradient descent over scalar lambdas with N columns
+for ncols in $BENCH_SCALAR_COLS; do
+    run_sql -c "select bench_gen_scalar($ncols, $BENCH_ROWS, $SQL_SEED), bench_gen_regression($ncols, $BENCH_ROWS, $SQL_SEED);" > /dev/null
+
+    # (c1 * c2 + c2 * c3 + ... + cN * c1)^2, every input appears in two products
+    body=$(seq 1 "$ncols" | awk -v n="$ncols" '{ printf "%sa.c%d * a.c%d", (NR > 1 ? " + " : ""), $1, $1 % n + 1 }')
+    lambda="lambda(a)(($body)^2)"
+    table="(select * from bench_scalar_$ncols)"
+    measure autodiff "cols=$ncols" L1 "$JIT_OFF" "$BENCH_ROWS" "select count(*) from autodiff_l1_2($table, ($lambda))"
+    measure autodiff "cols=$ncols" L2 "$JIT_ON" "$BENCH_ROWS" "select count(*) from autodiff_l1_2($table, ($lambda))"
+    measure autodiff "cols=$ncols" L3 "$JIT_ON" "$BENCH_ROWS" "select count(*) from autodiff_l3($table, ($lambda))"
+    measure autodiff "cols=$ncols" L4 "$JIT_ON" "$BENCH_ROWS" "select count(*) from autodiff_l4($table, ($lambda))"
+
+    # squared error of a linear model
+    body=$(seq 1 "$ncols" | awk '{ printf " + x.a%d * x.x%d", $1, $1 }')
+    lambda="lambda(x)((x.b$body - x.y)^2)"
+    table="(select * from bench_regression_$ncols)"
+    args="$BENCH_GD_ITERATIONS, $ncols, 0, 0.001, false, $BENCH_SEED"
+    rows=$((BENCH_ROWS * BENCH_GD_ITERATIONS))
+    measure gradient_descent "cols=$ncols" L1 "$JIT_OFF" "$rows" "select * from gradient_descent_l1_2($table, ($lambda), $args)"
+    measure gradient_descent "cols=$ncols" L2 "$JIT_ON" "$rows" "select * from gradient_descent_l1_2($table, ($lambda), $args)"
+    measure gradient_descent "cols=$ncols" L3 "$JIT_ON" "$rows" "select * from gradient_descent_l3($table, ($lambda), $args)"
+    measure gradient_descent "cols=$ncols" L4 "$JIT_ON" "$rows" "select * from gradient_descent_l4($table, ($lambda), $args)"
+done
+
+# one hidden layer MLP with a cross entropy loss, derived per sample
+nin=${BENCH_MLP_INPUTS%x*}
+nclasses=${BENCH_MLP_INPUTS#*x}
+for width in $BENCH_MLP_WIDTHS; do
+    run_sql -c "select bench_gen_mlp($width, $nin, $nclasses, $BENCH_MLP_ROWS, $SQL_SEED);" > /dev/null
+
+    lambda="lambda(x)(softmax_cce(tanh_m(x.img ** x.w_xh) ** x.w_ho, x.one_hot))"
+    table="(select * from bench_mlp_${width}_data, bench_mlp_${width}_weights)"
+    params="width=$width,inputs=$nin,classes=$nclasses"
+    measure mlp "$params" L1 "$JIT_OFF" "$BENCH_MLP_ROWS" "select count(*) from autodiff_l1_2($table, ($lambda))"
+    measure mlp "$params" L2 "$JIT_ON" "$BENCH_MLP_ROWS" "select count(*) from autodiff_l1_2($table, ($lambda))"
+    measure mlp "$params" L3 "$JIT_ON" "$BENCH_MLP_ROWS" "select count(*) from autodiff_l3($table, ($lambda))"
+    measure mlp "$params" L4 "$JIT_ON" "$BENCH_MLP_ROWS" "select count(*) from autodiff_l4($table, ($lambda))"
+done
+
+# kmeans with k clusters of d dimensions, squared euclidean distance
+for kd in $BENCH_KMEANS; do
+    k=${kd%x*}
+    d=${kd#*x}
+    run_sql -c "select bench_gen_points($k, $d, $BENCH_KMEANS_ROWS, $SQL_SEED);" > /dev/null
+
+    body=$(seq 1 "$d" | awk '{ printf "%s(a.p%d - b.p%d)^2", (NR > 1 ? " + " : ""), $1, $1 }')
+    table="bench_points_$kd"
+    for threads in 1 "$BENCH_THREADS"; do
+        measure kmeans "k=$k,d=$d" "threads=$threads" "$JIT_ON" "$BENCH_KMEANS_ROWS" \
+            "select * from kmeans_threads((select * from $table limit $k), (select * from $table), (lambda(a,b)($body)), $k, $threads, 100, 'kmeans++', $BENCH_SEED)"
+    done
+done
+
+# pagerank over graphs with a skewed in-degree
+for graph in $BENCH_PAGERANK; do
+    nnodes=${graph%%x*}
+    rest=${graph#*x}
+    nedges=${rest%%x*}
+    skew=${rest#*x}
+    table=$(run_sql -c "select bench_gen_pages($nnodes, $nedges, $skew, $SQL_SEED);")
+
+    for mode in jacobi gauss-seidel; do
+        for threads in 1 "$BENCH_THREADS"; do
+            measure pagerank "nodes=$nnodes,edges=$nedges,skew=$skew" "$mode,threads=$threads" "$JIT_ON" "$nedges" \
+                "select count(*) from pagerank_threads((select * from $table), (lambda(src)(src.src)), (lambda(dst)(dst.dst)), 0.85, 0.00001, 100, $threads, '$mode')"
+        done
+    done
+done
+
+{
+    printf '{"meta": %s,\n "results": [\n' "$META"
+    for i in "${!RESULTS[@]}"; do
+        printf '  %s%s\n' "${RESULTS[$i]}" "$([ "$i" -lt $((${#RESULTS[@]} - 1)) ] && echo ,)"
+    done
+    printf ']}\n'
+} > "$BENCH_OUT"
+
+echo "wrote ${#RESULTS[@]} results to $BENCH_OUT" >&2
@@ -36,6 +36,12 @@ returns setof record
 as '/psql/src/ext/autodiff_ext.so','autodiff_l4'
 language C STRICT;
 
+-- batch size(rows derived at once), sum_rows(return only the sums over all rows)
+create or replace function autodiff_batch(lambdacursor, "lambda", int, bool)
+returns setof record
+as '/psql/src/ext/autodiff_ext.so','autodiff_batch'
+language C STRICT;
+
 create or replace function gradient_descent_l1_2(lambdatable, "lambda", int, int)
 returns setof record
 as '/psql/src/ext/gradient_desc_ext.so','gradient_descent_l1_2'
@@ -0,0 +1,263 @@
+/*
+ * gradient_desc.h
+ *    Input handling shared by the gradient descent table functions(gradient_desc_ext.c, gradient_desc_m_ext.c)
+ *
+ * The materialized input(lambdatable) is read once per epoch.  Without shuffling, the tuples are streamed from the
+ * tuplestore in their stored order.  With shuffling, they are copied into memory once, and every epoch visits them in
+ * a fresh random permutation(Fisher-Yates), drawn from a generator seeded by the caller, so runs are reproducible.
+ *
+ * The update rule applied after every batch is selected by name(sgd, momentum, rmsprop, adam).  The stateful optimizers
+ * keep one or two moment buffers per coefficient block, allocated once per query and updated in place by a single fused
+ * pass over weights, gradients and moments.
+ */
+#ifndef GRADIENT_DESC_H
+#define GRADIENT_DESC_H
+
+#include "postgres.h"
+#include <math.h>
+#include "fmgr.h"
+#include "access/htup_details.h"
+#include "nodes/bitmapset.h"
+#include "executor/tuptable.h"
+#include "utils/builtins.h"
+#include "utils/tuplestore.h"
+
+typedef struct GradientDescentInput
+{
+    Tuplestorestate *ttsIn; /* materialized input */
+    TupleTableSlot *slot;   /* slot to read ttsIn */
+    int count;              /* number of tuples in ttsIn */
+    bool shuffle;           /* visit the tuples in random order? */
+    HeapTuple *tuples;      /* copies of all tuples, only if shuffled */
+    int *order;             /* permutation of the current epoch, only if shuffled */
+    int next;               /* position in order */
+    unsigned short rng[3];  /* state of pg_erand48() */
+} GradientDescentInput;
+
+/*
+ * Prepare reading TTSIN, if SHUFFLE is set, all tuples are copied into the current memory context
+ */
+static inline void gradient_descent_input_init(GradientDescentInput *input, Tuplestorestate *ttsIn,
+                                               TupleTableSlot *slot, bool shuffle, int seed)
+{
+    input->ttsIn = ttsIn;
+    input->slot = slot;
+    input->count = (int)tuplestore_tuple_count(ttsIn);
+    input->shuffle = shuffle;
+    input->tuples = NULL;
+    input->order = NULL;
+    input->next = 0;
+
+    // same seeding as srand48()
+    input->rng[0] = 0x330E;
+    input->rng[1] = (unsigned short)seed;
+    input->rng[2] = (unsigned short)((uint32)seed >> 16);
+
+    tuplestore_rescan(ttsIn);
+    if (shuffle && input->count > 0)
+    {
+        input->tuples = (HeapTuple *)palloc_extended(input->count * sizeof(HeapTuple), MCXT_ALLOC_HUGE);
+        input->order = (int *)palloc_extended(input->count * sizeof(int), MCXT_ALLOC_HUGE);
+        for (int i = 0; i < input->count && tuplestore_gettupleslot(ttsIn, true, false, slot); i++)
+        {
+            input->tuples[i] = ExecCopySlotTuple(slot);
+            input->order[i] = i;
+        }
+        tuplestore_rescan(ttsIn);
+    }
+}
+
+/*
+ * Permute ORDER(COUNT entries) uniformly at random(Fisher-Yates), drawing from the generator state RNG
+ */
+static inline void gradient_descent_shuffle(unsigned short rng[3], int *order, int count)
+{
+    for (int i = count - 1; i > 0; i--)
+    {
+        int j = (int)(pg_erand48(rng) * (i + 1));
+        int tmp = order[i];
+
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+}
+
+/*
+ * Start a new epoch, draws a new permutation if shuffled
+ */
+static inline void gradient_descent_input_rescan(GradientDescentInput *input)
+{
+    if (!input->shuffle)
+    {
+        tuplestore_rescan(input->ttsIn);
+        return;
+    }
+
+    gradient_descent_shuffle(input->rng, input->order, input->count);
+    input->next = 0;
+}
+
+/*
+ * Next tuple of the current epoch, NULL at its end
+ */
+static inline HeapTuple gradient_descent_input_next(GradientDescentInput *input)
+{
+    if (input->shuffle)
+    {
+        return (input->next < input->count) ? input->tuples[input->order[input->next++]] : NULL;
+    }
+    return tuplestore_gettupleslot(input->ttsIn, true, false, input->slot) ? input->slot->tts_tuple : NULL;
+}
+
+typedef enum GradientOptimizerKind
+{
+    GD_OPTIMIZER_SGD,      /* w -= lr * g */
+    GD_OPTIMIZER_MOMENTUM, /* m = b1 * m + g; w -= lr * m */
+    GD_OPTIMIZER_RMSPROP,  /* v = b2 * v + (1 - b2) * g^2; w -= lr * g / (sqrt(v) + eps) */
+    GD_OPTIMIZER_ADAM      /* both moments, bias corrected */
+} GradientOptimizerKind;
+
+typedef struct GradientOptimizer
+{
+    GradientOptimizerKind kind;
+    float8 learning_rate;
+    float8 beta1;   /* decay of the first moment(momentum, adam) */
+    float8 beta2;   /* decay of the second moment(rmsprop, adam) */
+    float8 epsilon; /* keeps the rmsprop/adam step finite for vanishing moments */
+    int step;       /* number of updates so far */
+    float8 rate;    /* learning rate of the current step, bias corrected for adam */
+} GradientOptimizer;
+
+/*
+ * Moment buffers of one coefficient block(a scalar coefficient vector or one matrix), NULL if unused
+ */
+typedef struct GradientOptimizerState
+{
+    float8 *m; /* first moment */
+    float8 *v; /* second moment */
+} GradientOptimizerState;
+
+/*
+ * Read the optional optimizer arguments starting at ARGNO: name(text), beta1, beta2
+ * Missing arguments default to plain sgd, beta1 = 0.9 and beta2 = 0.999(0.9 for rmsprop)
+ */
+static inline void gradient_optimizer_init(GradientOptimizer *opt, FunctionCallInfo fcinfo, int argno,
+                                           float8 learning_rate)
+{
+    opt->kind = GD_OPTIMIZER_SGD;
+    opt->learning_rate = learning_rate;
+    opt->epsilon = 1e-8;
+    opt->step = 0;
+    opt->rate = learning_rate;
+
+    if (PG_NARGS() > argno)
+    {
+        char *name = text_to_cstring(PG_GETARG_TEXT_PP(argno));
+
+        if (pg_strcasecmp(name, "sgd") == 0)
+            opt->kind = GD_OPTIMIZER_SGD;
+        else if (pg_strcasecmp(name, "momentum") == 0)
+            opt->kind = GD_OPTIMIZER_MOMENTUM;
+        else if (pg_strcasecmp(name, "rmsprop") == 0)
+            opt->kind = GD_OPTIMIZER_RMSPROP;
+        else if (pg_strcasecmp(name, "adam") == 0)
+            opt->kind = GD_OPTIMIZER_ADAM;
+        else
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("unknown optimizer \"%s\"", name),
+                     errhint("Valid optimizers are sgd, momentum, rmsprop and adam.")));
+        pfree(name);
+    }
+
+    opt->beta1 = PG_NARGS() > argno + 1 ? PG_GETARG_FLOAT8(argno + 1) : 0.9;
+    opt->beta2 = PG_NARGS() > argno + 2 ? PG_GETARG_FLOAT8(argno + 2)
+                                        : (opt->kind == GD_OPTIMIZER_RMSPROP ? 0.9 : 0.999);
+
+    if (opt->beta1 < 0.0 || opt->beta1 >= 1.0 || opt->beta2 < 0.0 || opt->beta2 >= 1.0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("optimizer decay rates must be in the range [0, 1)")));
+}
+
+/*
+ * Allocate the moment buffers for a block of N coefficients in the current memory context
+ */
+static inline void gradient_optimizer_state_init(const GradientOptimizer *opt, GradientOptimizerState *state, int n)
+{
+    bool first = opt->kind == GD_OPTIMIZER_MOMENTUM || opt->kind == GD_OPTIMIZER_ADAM;
+    bool second = opt->kind == GD_OPTIMIZER_RMSPROP || opt->kind == GD_OPTIMIZER_ADAM;
+
+    state->m = first ? (float8 *)palloc_extended(n * sizeof(float8), MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO) : NULL;
+    state->v = second ? (float8 *)palloc_extended(n * sizeof(float8), MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO) : NULL;
+}
+
+/*
+ * Advance to the next update, must be called once per batch before updating its blocks
+ */
+static inline void gradient_optimizer_next_step(GradientOptimizer *opt)
+{
+    opt->step++;
+    if (opt->kind == GD_OPTIMIZER_ADAM)
+    {
+        // fold both bias corrections into the step size
+        opt->rate = opt->learning_rate * sqrt(1.0 - pow(opt->beta2, opt->step)) / (1.0 - pow(opt->beta1, opt->step));
+    }
+}
+
+/*
+ * Update N WEIGHTS inplace from the GRADIENTS summed over BATCH_COUNT tuples, in a single pass
+ */
+static inline void gradient_optimizer_update(const GradientOptimizer *opt, GradientOptimizerState *state,
+                                             float8 *restrict weights, const float8 *restrict gradients, int n,
+                                             int batch_count)
+{
+    const float8 scale = 1.0 / batch_count;
+    const float8 rate = opt->rate;
+    const float8 b1 = opt->beta1, b2 = opt->beta2, eps = opt->epsilon;
+    float8 *restrict m = state->m;
+    float8 *restrict v = state->v;
+
+    switch (opt->kind)
+    {
+    case GD_OPTIMIZER_SGD:
+        for (int i = 0; i < n; i++)
+            weights[i] -= rate * gradients[i] * scale;
+        break;
+    case GD_OPTIMIZER_MOMENTUM:
+        for (int i = 0; i < n; i++)
+        {
+            m[i] = b1 * m[i] + gradients[i] * scale;
+            weights[i] -= rate * m[i];
+        }
+        break;
+    case GD_OPTIMIZER_RMSPROP:
+        for (int i = 0; i < n; i++)
+        {
+            float8 g = gradients[i] * scale;
+            v[i] = b2 * v[i] + (1.0 - b2) * g * g;
+            weights[i] -= rate * g / (sqrt(v[i]) + eps);
+        }
+        break;
+    case GD_OPTIMIZER_ADAM:
+        for (int i = 0; i < n; i++)
+        {
+            float8 g = gradients[i] * scale;
+            m[i] = b1 * m[i] + (1.0 - b1) * g;
+            v[i] = b2 * v[i] + (1.0 - b2) * g * g;
+            weights[i] -= rate * m[i] / (sqrt(v[i]) + eps);
+        }
+        break;
+    }
+}
+
+/*
+ * The inputs the lambda is derived for: only the coefficients, the first NUM_ATTS columns of the input row
+ * The features and labels in the other columns get no derivatives(see ExecInitLambdaExprWrt).
+ */
+static inline Bitmapset *gradient_descent_wrt(int num_atts)
+{
+    return bms_add_range(NULL, 0, num_atts - 1);
+}
+
+#endif /* GRADIENT_DESC_H */
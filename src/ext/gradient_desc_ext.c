@@ -17,6 +17,8 @@
 #include <math.h>
 #include <pthread.h>
 #include "miscadmin.h"
+#include "gradient_desc.h"
+#include "worker_pool.h"
 
 extern TupleDesc gradient_descent_record_type(List *args)
 {
@@ -38,6 +40,18 @@ PG_MODULE_MAGIC;
 PG_FUNCTION_INFO_V1_RECTYPE(gradient_descent_l1_2, gradient_descent_record_type);
 PG_FUNCTION_INFO_V1_RECTYPE(gradient_descent_l3, gradient_descent_record_type);
 PG_FUNCTION_INFO_V1_RECTYPE(gradient_descent_l4, gradient_descent_record_type);
+PG_FUNCTION_INFO_V1_RECTYPE(gradient_descent_threads, gradient_descent_record_type);
+
+/*
+ * Adjust the coefficients by the average gradient of a batch of BATCH_COUNT tuples, and reset the tally
+ */
+static void gradient_descent_apply(GradientOptimizer *opt, GradientOptimizerState *state, float8 *coefficients,
+                                   float8 *derivatives_tally, int num_atts, int batch_count)
+{
+    gradient_optimizer_next_step(opt);
+    gradient_optimizer_update(opt, state, coefficients, derivatives_tally, num_atts, batch_count);
+    memset(derivatives_tally, 0, num_atts * sizeof(float8));
+}
 
 Datum gradient_descent_internal_l1_2(PG_FUNCTION_ARGS)
 {
@@ -54,6 +68,10 @@ Datum gradient_descent_internal_l1_2(PG_FUNCTION_ARGS)
     int batch_size = PG_GETARG_INT32(4);        // amount of tuples to be loaded during grad_desc
     int num_atts = PG_GETARG_INT32(3);          // number of independent variables per run(DOES NOT INCLUDE b)
     int iterations = PG_GETARG_INT32(2);        // Number of iterations for grad_desc algorithm
+    bool shuffle = PG_NARGS() > 6 && PG_GETARG_BOOL(6); // visit the tuples in a new random order every iteration
+    int seed = PG_NARGS() > 7 ? PG_GETARG_INT32(7) : 0;  // seed for shuffling, runs with equal seeds are reproducible
+    GradientOptimizer optimizer;                        // update rule, optional arguments 8-10
+    GradientOptimizerState optimizer_state;
 
     ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
     LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
@@ -69,6 +87,7 @@ Datum gradient_descent_internal_l1_2(PG_FUNCTION_ARGS)
                         "allowed in this context")));
 
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
+    LambdaInstrumentation *instr = castNode(ExprState, lambda->exprstate)->lambda_instr;
     TupleDesc inDesc = (TupleDesc)list_nth(lambda->argtypes, 0);
 
     per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
@@ -78,8 +97,9 @@ Datum gradient_descent_internal_l1_2(PG_FUNCTION_ARGS)
     ttsIn = ((TypedTuplestore *)PG_GETARG_POINTER(0))->tuplestorestate;
     TupleTableSlot *slot = MakeTupleTableSlot(NULL);
     Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
-    int tupleStoreCount = tuplestore_tuple_count(ttsIn);
-    tuplestore_rescan(ttsIn);
+    GradientDescentInput input;
+    gradient_descent_input_init(&input, ttsIn, slot, shuffle, seed);
+    int tupleStoreCount = input.count;
 
     if (batch_size < 1 || batch_size > tupleStoreCount) {
         batch_size = tupleStoreCount;
@@ -103,42 +123,38 @@ Datum gradient_descent_internal_l1_2(PG_FUNCTION_ARGS)
     replVal = (Datum *)palloc((num_atts) * sizeof(Datum));
 
     Datum derivatives[inDesc->natts];                                          /* Returned derivatives from autodiff */
-    Datum coefficients_per_iteration[num_atts];                                /* coefficients of lambda_expr */
+    float8 coefficients_per_iteration[num_atts];                               /* coefficients of lambda_expr */
     float8 *derivatives_tally = (float8 *)palloc((num_atts) * sizeof(float8)); // all derivatives for a single iterations tallied up
 
     for (int i = 0; i < num_atts; i++)
     {
-        coefficients_per_iteration[i] = Float8GetDatum(1.0);
+        coefficients_per_iteration[i] = 1.0;
         derivatives_tally[i] = 0.0;
     }
+    gradient_optimizer_init(&optimizer, fcinfo, 8, learning_rate);
+    gradient_optimizer_state_init(&optimizer, &optimizer_state, num_atts);
+
+    // the interpreted lambda needs its argument as a formed tuple, which is built in a per row context and freed again
+    MemoryContext per_row_ctx = AllocSetContextCreate(per_query_ctx, "gradient descent per row", ALLOCSET_DEFAULT_SIZES);
 
     for (int i = 0; i < iterations; i++)
     {
-        int tuple_counter = 0; //number of already calculated samples in batch
-        while (tuplestore_gettupleslot(ttsIn, true, false, slot))
-        {
-            if (batch_size <= tuple_counter) {
-                /* Calculate avg of tally and adjust coefficients */
-                for (int it = 0; it < num_atts; it++)
-                {
-                    float8 tally = (learning_rate * derivatives_tally[it]) / batch_size;
-                    coefficients_per_iteration[it] = Float8GetDatum(DatumGetFloat8(coefficients_per_iteration[it]) - tally);
-                    derivatives_tally[it] = 0.0;
-                }
-                tuple_counter = 0;
-            }
+        int tuple_counter = 0; // number of already calculated samples in batch
+        HeapTuple inTuple;
 
-            HeapTupleHeader hdr;
-            hdr = slot->tts_tuple->t_data;
+        gradient_descent_input_rescan(&input);
+        while ((inTuple = gradient_descent_input_next(&input)) != NULL)
+        {
             bool isnull;
-            heap_deform_tuple(slot->tts_tuple, inDesc, oldVal, oldIsNull);
+            heap_deform_tuple(inTuple, inDesc, oldVal, oldIsNull);
 
             for (int it = 0; it < num_atts; it++)
             {
                 /* Set elements of tuple in slot to the correct cooefficients*/
-                oldVal[it] = coefficients_per_iteration[it];
+                oldVal[it] = Float8GetDatum(coefficients_per_iteration[it]);
             }
 
+            MemoryContextSwitchTo(per_row_ctx);
             HeapTuple newTup = heap_form_tuple(inDesc, oldVal, oldIsNull); //only way to feed the coefficients into the HeapTupleHeader struct-format
 
             for (int it = 0; it < inDesc->natts; it++)
@@ -147,8 +163,14 @@ Datum gradient_descent_internal_l1_2(PG_FUNCTION_ARGS)
                 derivatives[it] = Float8GetDatum(0.0);
             }
 
+            if (instr)
+                InstrLambdaStart(instr);
             PG_LAMBDA_SETARG(lambda, 0, HeapTupleHeaderGetDatum(newTup->t_data));
             Datum result = PG_LAMBDA_DERIVE(lambda, &isnull, derivatives);
+            if (instr)
+                InstrLambdaStop(instr, LAMBDA_INSTR_DERIVE, 1);
+            MemoryContextSwitchTo(per_query_ctx);
+            MemoryContextReset(per_row_ctx);
 
             for (int it = 0; it < num_atts; it++)
             {
@@ -156,21 +178,27 @@ Datum gradient_descent_internal_l1_2(PG_FUNCTION_ARGS)
                 derivatives_tally[it] += DatumGetFloat8(derivatives[it]);
             }
             tuple_counter++;
+
+            if (tuple_counter == batch_size)
+            {
+                /* Update after every full batch */
+                gradient_descent_apply(&optimizer, &optimizer_state, coefficients_per_iteration, derivatives_tally, num_atts, tuple_counter);
+                tuple_counter = 0;
+            }
         }
-        tuplestore_rescan(ttsIn);
 
-        /* Calculate avg of tally and adjust coefficients */
-        for (int it = 0; it < num_atts; it++)
+        /* The remaining tuples of the iteration form a smaller batch */
+        if (tuple_counter > 0)
         {
-            float8 tally = (learning_rate * derivatives_tally[it]) / batch_size;
-            coefficients_per_iteration[it] = Float8GetDatum(DatumGetFloat8(coefficients_per_iteration[it]) - tally);
-            derivatives_tally[it] = 0.0;
+            gradient_descent_apply(&optimizer, &optimizer_state, coefficients_per_iteration, derivatives_tally, num_atts, tuple_counter);
         }
     }
 
+    MemoryContextDelete(per_row_ctx);
+
     for (int i = 0; i < num_atts; i++)
     {
-        replVal[i] = coefficients_per_iteration[i];
+        replVal[i] = Float8GetDatum(coefficients_per_iteration[i]);
         replIsNull[i] = false;
     }
 
@@ -201,6 +229,10 @@ Datum gradient_descent_internal_l3(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum *
     int batch_size = PG_GETARG_INT32(4);        // amount of tuples to be loaded during grad_desc
     int num_atts = PG_GETARG_INT32(3);          // number of independent variables per run(DOES NOT INCLUDE b)
     int iterations = PG_GETARG_INT32(2);        // Number of iterations for grad_desc algorithm
+    bool shuffle = PG_NARGS() > 6 && PG_GETARG_BOOL(6); // visit the tuples in a new random order every iteration
+    int seed = PG_NARGS() > 7 ? PG_GETARG_INT32(7) : 0;  // seed for shuffling, runs with equal seeds are reproducible
+    GradientOptimizer optimizer;                        // update rule, optional arguments 8-10
+    GradientOptimizerState optimizer_state;
 
     ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
     LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
@@ -216,6 +248,7 @@ Datum gradient_descent_internal_l3(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum *
                         "allowed in this context")));
 
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
+    LambdaInstrumentation *instr = castNode(ExprState, lambda->exprstate)->lambda_instr;
     TupleDesc inDesc = (TupleDesc)list_nth(lambda->argtypes, 0);
 
     per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
@@ -225,8 +258,9 @@ Datum gradient_descent_internal_l3(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum *
     ttsIn = ((TypedTuplestore *)PG_GETARG_POINTER(0))->tuplestorestate;
     TupleTableSlot *slot = MakeTupleTableSlot(NULL);
     Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
-    int tupleStoreCount = tuplestore_tuple_count(ttsIn);
-    tuplestore_rescan(ttsIn);
+    GradientDescentInput input;
+    gradient_descent_input_init(&input, ttsIn, slot, shuffle, seed);
+    int tupleStoreCount = input.count;
 
     if (batch_size < 1 || batch_size > tupleStoreCount)
     {
@@ -251,36 +285,30 @@ Datum gradient_descent_internal_l3(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum *
     replVal = (Datum *)palloc((num_atts) * sizeof(Datum));
 
     Datum derivatives[inDesc->natts];                                                 /* Returned derivatives from autodiff */
-    Datum coefficients_per_iteration[num_atts];                                   /* coefficients of lambda_expr */
+    float8 coefficients_per_iteration[num_atts];                               /* coefficients of lambda_expr */
     float8 *derivatives_tally = (float8 *) palloc((num_atts) * sizeof(float8));   // all derivatives for a single iterations tallied up
 
     for (int i = 0; i < num_atts; i++)
     {
-        coefficients_per_iteration[i] = Float8GetDatum(1.0);
+        coefficients_per_iteration[i] = 1.0;
         derivatives_tally[i] = 0.0;
     }
+    gradient_optimizer_init(&optimizer, fcinfo, 8, learning_rate);
+    gradient_optimizer_state_init(&optimizer, &optimizer_state, num_atts);
 
     for (int i = 0; i < iterations; i++)
     {
         int tuple_counter = 0; // number of already calculated samples in batch
-        while (tuplestore_gettupleslot(ttsIn, true, false, slot))
+        HeapTuple inTuple;
+
+        gradient_descent_input_rescan(&input);
+        while ((inTuple = gradient_descent_input_next(&input)) != NULL)
         {
-            if (batch_size <= tuple_counter)
-            {
-                /* Calculate avg of tally and adjust coefficients */
-                for (int it = 0; it < num_atts; it++)
-                {
-                    float8 tally = (learning_rate * derivatives_tally[it]) / batch_size;
-                    coefficients_per_iteration[it] = Float8GetDatum(DatumGetFloat8(coefficients_per_iteration[it]) - tally);
-                    derivatives_tally[it] = 0.0;
-                }
-                tuple_counter = 0;
-            }
-            heap_deform_tuple(slot->tts_tuple, inDesc, oldVal, oldIsNull);
+            heap_deform_tuple(inTuple, inDesc, oldVal, oldIsNull);
 
             for(int it = 0; it < num_atts; it++) {
                 /* Set elements of tuple in slot to the correct cooefficients*/
-                oldVal[it] = coefficients_per_iteration[it];
+                oldVal[it] = Float8GetDatum(coefficients_per_iteration[it]);
             }
 
             for(int it = 0; it < inDesc->natts; it++) {
@@ -288,7 +316,11 @@ Datum gradient_descent_internal_l3(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum *
                 derivatives[it] = Float8GetDatum(0.0);
             }
 
+            if (instr)
+                InstrLambdaStart(instr);
             Datum result = derivefunc(&oldVal, derivatives);
+            if (instr)
+                InstrLambdaStop(instr, LAMBDA_INSTR_DERIVE, 1);
 
             for (int it = 0; it < num_atts; it++)
             {
@@ -296,21 +328,25 @@ Datum gradient_descent_internal_l3(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum *
                 derivatives_tally[it] += DatumGetFloat8(derivatives[it]);
             }
             tuple_counter++;
+
+            if (tuple_counter == batch_size)
+            {
+                /* Update after every full batch */
+                gradient_descent_apply(&optimizer, &optimizer_state, coefficients_per_iteration, derivatives_tally, num_atts, tuple_counter);
+                tuple_counter = 0;
+            }
         }
-        tuplestore_rescan(ttsIn);
 
-        /* Calculate avg of tally and adjust coefficients */
-        for (int it = 0; it < num_atts; it++)
+        /* The remaining tuples of the iteration form a smaller batch */
+        if (tuple_counter > 0)
         {
-            float8 tally = (learning_rate * derivatives_tally[it]) / batch_size;
-            coefficients_per_iteration[it] = Float8GetDatum(DatumGetFloat8(coefficients_per_iteration[it]) - tally);
-            derivatives_tally[it] = 0.0;
+            gradient_descent_apply(&optimizer, &optimizer_state, coefficients_per_iteration, derivatives_tally, num_atts, tuple_counter);
         }
     }
 
     for (int i = 0; i < num_atts; i++)
     {
-        replVal[i] = coefficients_per_iteration[i];
+        replVal[i] = Float8GetDatum(coefficients_per_iteration[i]);
         replIsNull[i] = false;
     }
 
@@ -341,6 +377,10 @@ Datum gradient_descent_internal_l4(PG_FUNCTION_ARGS)
     int batch_size = PG_GETARG_INT32(4);        // amount of tuples to be loaded during grad_desc
     int num_atts = PG_GETARG_INT32(3);          // number of independent variables per run(DOES NOT INCLUDE b)
     int iterations = PG_GETARG_INT32(2);        // Number of iterations for grad_desc algorithm
+    bool shuffle = PG_NARGS() > 6 && PG_GETARG_BOOL(6); // visit the tuples in a new random order every iteration
+    int seed = PG_NARGS() > 7 ? PG_GETARG_INT32(7) : 0;  // seed for shuffling, runs with equal seeds are reproducible
+    GradientOptimizer optimizer;                        // update rule, optional arguments 8-10
+    GradientOptimizerState optimizer_state;
 
     ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
     LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
@@ -365,8 +405,9 @@ Datum gradient_descent_internal_l4(PG_FUNCTION_ARGS)
     ttsIn = ((TypedTuplestore *)PG_GETARG_POINTER(0))->tuplestorestate;
     TupleTableSlot *slot = MakeTupleTableSlot(NULL);
     Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
-    int tupleStoreCount = tuplestore_tuple_count(ttsIn);
-    tuplestore_rescan(ttsIn);
+    GradientDescentInput input;
+    gradient_descent_input_init(&input, ttsIn, slot, shuffle, seed);
+    int tupleStoreCount = input.count;
 
     if (batch_size < 1 || batch_size > tupleStoreCount)
     {
@@ -391,37 +432,31 @@ Datum gradient_descent_internal_l4(PG_FUNCTION_ARGS)
     replVal = (Datum *)palloc((num_atts) * sizeof(Datum));
 
     Datum derivatives[inDesc->natts];                                              /* Returned derivatives from autodiff */
-    Datum coefficients_per_iteration[num_atts];                                /* coefficients of lambda_expr */
+    float8 coefficients_per_iteration[num_atts];                               /* coefficients of lambda_expr */
     float8 *derivatives_tally = (float8 *)palloc((num_atts) * sizeof(float8)); // all derivatives for a single iterations tallied up
 
     for (int i = 0; i < num_atts; i++)
     {
-        coefficients_per_iteration[i] = Float8GetDatum(1.0);
+        coefficients_per_iteration[i] = 1.0;
         derivatives_tally[i] = 0.0;
     }
+    gradient_optimizer_init(&optimizer, fcinfo, 8, learning_rate);
+    gradient_optimizer_state_init(&optimizer, &optimizer_state, num_atts);
 
     for (int i = 0; i < iterations; i++)
     {
         int tuple_counter = 0; // number of already calculated samples in batch
-        while (tuplestore_gettupleslot(ttsIn, true, false, slot))
+        HeapTuple inTuple;
+
+        gradient_descent_input_rescan(&input);
+        while ((inTuple = gradient_descent_input_next(&input)) != NULL)
         {
-            if (batch_size <= tuple_counter)
-            {
-                /* Calculate avg of tally and adjust coefficients */
-                for (int it = 0; it < num_atts; it++)
-                {
-                    float8 tally = (learning_rate * derivatives_tally[it]) / batch_size;
-                    coefficients_per_iteration[it] = Float8GetDatum(DatumGetFloat8(coefficients_per_iteration[it]) - tally);
-                    derivatives_tally[it] = 0.0;
-                }
-                tuple_counter = 0;
-            }
-            heap_deform_tuple(slot->tts_tuple, inDesc, oldVal, oldIsNull);
+            heap_deform_tuple(inTuple, inDesc, oldVal, oldIsNull);
 
             for (int it = 0; it < num_atts; it++)
             {
                 /* Set elements of tuple in slot to the correct cooefficients*/
-                oldVal[it] = coefficients_per_iteration[it];
+                oldVal[it] = Float8GetDatum(coefficients_per_iteration[it]);
             }
 
             for (int it = 0; it < inDesc->natts; it++)
@@ -438,21 +473,25 @@ Datum gradient_descent_internal_l4(PG_FUNCTION_ARGS)
                 derivatives_tally[it] += DatumGetFloat8(derivatives[it]);
             }
             tuple_counter++;
+
+            if (tuple_counter == batch_size)
+            {
+                /* Update after every full batch */
+                gradient_descent_apply(&optimizer, &optimizer_state, coefficients_per_iteration, derivatives_tally, num_atts, tuple_counter);
+                tuple_counter = 0;
+            }
         }
-        tuplestore_rescan(ttsIn);
 
-        /* Calculate avg of tally and adjust coefficients */
-        for (int it = 0; it < num_atts; it++)
+        /* The remaining tuples of the iteration form a smaller batch */
+        if (tuple_counter > 0)
         {
-            float8 tally = (learning_rate * derivatives_tally[it]) / batch_size;
-            coefficients_per_iteration[it] = Float8GetDatum(DatumGetFloat8(coefficients_per_iteration[it]) - tally);
-            derivatives_tally[it] = 0.0;
+            gradient_descent_apply(&optimizer, &optimizer_state, coefficients_per_iteration, derivatives_tally, num_atts, tuple_counter);
         }
     }
 
     for (int i = 0; i < num_atts; i++)
     {
-        replVal[i] = coefficients_per_iteration[i];
+        replVal[i] = Float8GetDatum(coefficients_per_iteration[i]);
         replIsNull[i] = false;
     }
 
@@ -468,13 +507,240 @@ Datum gradient_descent_internal_l4(PG_FUNCTION_ARGS)
     return (Datum)0;
 }
 
+struct GradientDescentWorkerArgs
+{
+    int threadid;
+    Datum (*derivefunc)(Datum **arg, Datum *derivatives);
+    Datum *tuples;        // deformed input, natts values per tuple
+    int *order;           // order in which the tuples are visited
+    int natts;
+    int num_atts;
+    float8 *coefficients; // shared, only read while the workers run
+    int base;             // position in order of the first tuple of the current batch
+    int offset;           // first position in order of this worker
+    int count;            // number of tuples of this worker
+    Datum *values;        // private copy of the current tuple
+    Datum *derivatives;   // private derivatives of the current tuple
+    float8 *tally;        // private gradient accumulator
+};
+
+/*
+ * Sum the gradients of ARGS->COUNT tuples into the private tally of the worker
+ */
+static void *gradient_descent_worker(void *arg)
+{
+    struct GradientDescentWorkerArgs *args = (struct GradientDescentWorkerArgs *)arg;
+
+    for (int x = args->offset; x < args->offset + args->count; x++)
+    {
+        memcpy(args->values, args->tuples + (Size)args->order[x] * args->natts, args->natts * sizeof(Datum));
+
+        for (int it = 0; it < args->num_atts; it++)
+        {
+            args->values[it] = Float8GetDatum(args->coefficients[it]);
+        }
+        for (int it = 0; it < args->natts; it++)
+        {
+            args->derivatives[it] = Float8GetDatum(0.0);
+        }
+
+        args->derivefunc(&args->values, args->derivatives);
+
+        for (int it = 0; it < args->num_atts; it++)
+        {
+            args->tally[it] += DatumGetFloat8(args->derivatives[it]);
+        }
+    }
+
+    return (void *)0;
+}
+
+/*
+ * Derive the tuples [start, start + count) of the current batch, adding to the private tally of the worker
+ */
+static void gradient_descent_range(void *arg, int start, int count)
+{
+    struct GradientDescentWorkerArgs *args = (struct GradientDescentWorkerArgs *)arg;
+
+    args->offset = args->base + start;
+    args->count = count;
+    gradient_descent_worker(arg);
+}
+
+/*
+ * Derive the batch at positions [START, START + LEN) of the visiting order on all threads of POOL, and sum the private
+ * tallies pairwise(tree reduction) into the tally of the first worker
+ */
+static void gradient_descent_batch_threads(WorkerPool *pool, struct GradientDescentWorkerArgs *workerArgs,
+                                           void **poolArgs, int start, int len)
+{
+    int nthreads = pool->nthreads;
+
+    for (int j = 0; j < nthreads; j++)
+    {
+        workerArgs[j].base = start;
+    }
+
+    worker_pool_run(pool, gradient_descent_range, poolArgs, len);
+
+    for (int stride = 1; stride < nthreads; stride *= 2)
+    {
+        for (int j = 0; j + stride < nthreads; j += 2 * stride)
+        {
+            float8 *restrict a = workerArgs[j].tally;
+            const float8 *restrict b = workerArgs[j + stride].tally;
+
+            for (int it = 0; it < workerArgs[j].num_atts; it++)
+            {
+                a[it] += b[it];
+            }
+            MemSet(workerArgs[j + stride].tally, 0, workerArgs[j].num_atts * sizeof(float8));
+        }
+    }
+}
+
+Datum gradient_descent_internal_threads(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum **arg, Datum *derivatives))
+{
+    MemoryContext oldcontext;
+    MemoryContext per_query_ctx;
+    TupleDesc outDesc = NULL;
+    Tuplestorestate *ttsIn;
+    float8 learning_rate = PG_GETARG_FLOAT8(5); // learning rate for gradient desc
+    int batch_size = PG_GETARG_INT32(4);        // amount of tuples to be loaded during grad_desc
+    int num_atts = PG_GETARG_INT32(3);          // number of independent variables per run(DOES NOT INCLUDE b)
+    int iterations = PG_GETARG_INT32(2);        // Number of iterations for grad_desc algorithm
+    int nthreads = PG_GETARG_INT32(6);          // number of worker threads
+    bool shuffle = PG_NARGS() > 7 && PG_GETARG_BOOL(7); // visit the tuples in a new random order every iteration
+    int seed = PG_NARGS() > 8 ? PG_GETARG_INT32(8) : 0;  // seed for shuffling, runs with equal seeds are reproducible
+    GradientOptimizer optimizer;                        // update rule, optional arguments 9-11
+    GradientOptimizerState optimizer_state;
+
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("materialize mode required, but it is not "
+                        "allowed in this context")));
+
+    worker_pool_check_threads(nthreads);
+
+    LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
+    TupleDesc inDesc = (TupleDesc)list_nth(lambda->argtypes, 0);
+    int natts = inDesc->natts;
+
+    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+    oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+    ttsIn = ((TypedTuplestore *)PG_GETARG_POINTER(0))->tuplestorestate;
+    TupleTableSlot *slot = MakeTupleTableSlot(NULL);
+    Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
+    int tupleStoreCount = (int)tuplestore_tuple_count(ttsIn);
+
+    if (batch_size < 1 || batch_size > tupleStoreCount)
+    {
+        batch_size = tupleStoreCount;
+    }
+
+    // the workers cannot touch the tuplestore, so the whole input is deformed once
+    Datum *tuples = (Datum *)palloc_extended((Size)tupleStoreCount * natts * sizeof(Datum), MCXT_ALLOC_HUGE);
+    int *order = (int *)palloc_extended((Size)tupleStoreCount * sizeof(int), MCXT_ALLOC_HUGE);
+    bool *nullvals = (bool *)palloc(natts * sizeof(bool));
+    int x = 0;
+
+    tuplestore_rescan(ttsIn);
+    while (x < tupleStoreCount && tuplestore_gettupleslot(ttsIn, true, false, slot))
+    {
+        heap_deform_tuple(slot->tts_tuple, inDesc, tuples + (Size)x * natts, nullvals);
+        order[x] = x;
+        x++;
+    }
+
+    outDesc = CreateTemplateTupleDesc(num_atts, false);
+    for (int i = 0; i < num_atts; i++)
+    {
+        TupleDescCopyEntry(outDesc, (AttrNumber)(i + 1), inDesc, (AttrNumber)(i + 1));
+    }
+
+    float8 *coefficients_per_iteration = (float8 *)palloc(num_atts * sizeof(float8)); // coefficients of lambda_expr
+    for (int i = 0; i < num_atts; i++)
+    {
+        coefficients_per_iteration[i] = 1.0;
+    }
+    gradient_optimizer_init(&optimizer, fcinfo, 9, learning_rate);
+    gradient_optimizer_state_init(&optimizer, &optimizer_state, num_atts);
+
+    void **poolArgs = (void **)palloc(nthreads * sizeof(void *));
+    struct GradientDescentWorkerArgs *workerArgs =
+        (struct GradientDescentWorkerArgs *)palloc0(nthreads * sizeof(struct GradientDescentWorkerArgs));
+
+    for (int j = 0; j < nthreads; j++)
+    {
+        workerArgs[j].threadid = j;
+        workerArgs[j].derivefunc = derivefunc;
+        workerArgs[j].tuples = tuples;
+        workerArgs[j].order = order;
+        workerArgs[j].natts = natts;
+        workerArgs[j].num_atts = num_atts;
+        workerArgs[j].coefficients = coefficients_per_iteration;
+        workerArgs[j].values = (Datum *)palloc(natts * sizeof(Datum));
+        workerArgs[j].derivatives = (Datum *)palloc(natts * sizeof(Datum));
+        workerArgs[j].tally = (float8 *)palloc0(num_atts * sizeof(float8));
+        poolArgs[j] = workerArgs + j;
+    }
+
+    // all arguments are checked, the threads can be started
+    WorkerPool *pool = worker_pool_get(fcinfo, nthreads);
+
+    unsigned short rng[3] = {0x330E, (unsigned short)seed, (unsigned short)((uint32)seed >> 16)};
+
+    for (int i = 0; i < iterations; i++)
+    {
+        if (shuffle)
+        {
+            gradient_descent_shuffle(rng, order, tupleStoreCount);
+        }
+
+        // the last batch of an iteration may be smaller
+        for (int start = 0; start < tupleStoreCount; start += batch_size)
+        {
+            int len = Min(batch_size, tupleStoreCount - start);
+
+            gradient_descent_batch_threads(pool, workerArgs, poolArgs, start, len);
+            gradient_descent_apply(&optimizer, &optimizer_state, coefficients_per_iteration, workerArgs[0].tally, num_atts, len);
+        }
+    }
+
+    Datum replVal[num_atts];
+    bool replIsNull[num_atts];
+
+    for (int i = 0; i < num_atts; i++)
+    {
+        replVal[i] = Float8GetDatum(coefficients_per_iteration[i]);
+        replIsNull[i] = false;
+    }
+
+    tuplestore_puttuple(tsOut, heap_form_tuple(outDesc, replVal, replIsNull));
+
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tsOut;
+    rsinfo->setDesc = outDesc;
+
+    MemoryContextSwitchTo(oldcontext);
+    return (Datum)0;
+}
+
 Datum gradient_descent_l1_2(PG_FUNCTION_ARGS)
 {
     ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
 
     llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
-    ExecInitLambdaExpr((Node *)lambda, false, true);
+    ExecInitLambdaExprWrt((Node *)lambda, false, true, gradient_descent_wrt(PG_GETARG_INT32(3)));
     llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
 
     return gradient_descent_internal_l1_2(fcinfo);
@@ -486,9 +752,8 @@ Datum gradient_descent_l3(PG_FUNCTION_ARGS)
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
 
     llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
-    LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
 
-    ExecInitLambdaExpr((Node *)lambda, true, true);
+    ExecInitLambdaExprWrt((Node *)lambda, true, true, gradient_descent_wrt(PG_GETARG_INT32(3)));
     Datum (*compiled_func)(Datum **, Datum *);
     compiled_func = llvm_prepare_simple_expression_derivation(castNode(ExprState, lambda->exprstate));
 
@@ -505,11 +770,39 @@ Datum gradient_descent_l4(PG_FUNCTION_ARGS)
     llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
     LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
 
-    ExecInitLambdaExpr((Node *)lambda, true, true);
+    ExecInitLambdaExprWrt((Node *)lambda, true, true, gradient_descent_wrt(PG_GETARG_INT32(3)));
     Datum (*compiled_func)(FunctionCallInfo);
     compiled_func = llvm_prepare_lambda_tablefunc(jitContext, "ext/gradient_desc_ext.bc", "gradient_descent_internal_l4", 1);
 
     llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
 
     return compiled_func(fcinfo);
-}
\ No newline at end of file
+}
+
+Datum gradient_descent_threads(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
+
+    llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
+
+    ExecInitLambdaExprWrt((Node *)lambda, true, true, gradient_descent_wrt(PG_GETARG_INT32(3)));
+    if (castNode(ExprState, lambda->exprstate)->lambdaContainsMatrix)
+    {
+        // every matrix step of the forward and reverse sweep pallocs its result, which is not thread safe, so
+        // preallocated per-thread accumulators would not help.  Matrix lambdas are derived row by row by
+        // gradient_descent_m_l3, whose kernels(products, activations) run on the matrix_parallel_workers threads.
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("gradient_descent_threads only supports lambdas over float8 values"),
+                 errhint("Use gradient_descent_m_l3 for matrices, its matrix kernels run in parallel "
+                         "according to matrix_parallel_workers.")));
+    }
+
+    Datum (*compiled_func)(Datum **, Datum *);
+    compiled_func = llvm_prepare_simple_expression_derivation(castNode(ExprState, lambda->exprstate));
+
+    llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
+
+    return gradient_descent_internal_threads(fcinfo, compiled_func);
+}
@@ -18,6 +18,7 @@
 #include <pthread.h>
 #include "miscadmin.h"
 #include <unistd.h>
+#include "gradient_desc.h"
 
 extern TupleDesc gradient_descent_m_record_type(List *args)
 {
@@ -61,6 +62,7 @@ PG_FUNCTION_INFO_V1_RECTYPE(gradient_descent_m_l3, gradient_descent_m_record_typ
                         "allowed in this context")));
 
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
+    LambdaInstrumentation *instr = castNode(ExprState, lambda->exprstate)->lambda_instr;
     TupleDesc inDesc = (TupleDesc)list_nth(lambda->argtypes, 0);
 
     MemoryContext per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
@@ -143,8 +145,12 @@ PG_FUNCTION_INFO_V1_RECTYPE(gradient_descent_m_l3, gradient_descent_m_record_typ
             HeapTupleHeader newHdr = newTup->t_data;
             heap_deform_tuple(newTup, inDesc, oldVal, oldIsNull);
 
+            if (instr)
+                InstrLambdaStart(instr);
             PG_LAMBDA_SETARG(lambda, 0, HeapTupleHeaderGetDatum(newHdr));
             Datum result = PG_LAMBDA_DERIVE(lambda, &isnull, derivatives);
+            if (instr)
+                InstrLambdaStop(instr, LAMBDA_INSTR_DERIVE, 1);
 
             for (int i = 0; i < num_atts; i++)
             {
@@ -181,12 +187,41 @@ PG_FUNCTION_INFO_V1_RECTYPE(gradient_descent_m_l3, gradient_descent_m_record_typ
     return (Datum)0;
 }*/
 
+/*
+ * Apply the summed gradients of a batch of BATCH_COUNT tuples to the coefficients(inplace), and reset the tally
+ */
+static void gradient_descent_m_apply(GradientOptimizer *opt, GradientOptimizerState *states, Datum *coefficients,
+                                     Datum *derivatives_tally, int num_atts, int batch_count)
+{
+    gradient_optimizer_next_step(opt);
+    for (int i = 0; i < num_atts; i++)
+    {
+        if (opt->kind == GD_OPTIMIZER_SGD)
+        {
+            coefficients[i] = mat_apply_gradient(coefficients[i], derivatives_tally[i], opt->learning_rate, batch_count);
+        }
+        else
+        {
+            // the tally was created with the dimensions of the coefficient, so both hold the same number of elements
+            ArrayType *weights = DatumGetArrayTypeP(coefficients[i]);
+            ArrayType *gradients = DatumGetArrayTypeP(derivatives_tally[i]);
+
+            gradient_optimizer_update(opt, &states[i], (float8 *)ARR_DATA_PTR(weights), (float8 *)ARR_DATA_PTR(gradients),
+                                      ArrayGetNItems(ARR_NDIM(gradients), ARR_DIMS(gradients)), batch_count);
+        }
+        matrixSetValue(derivatives_tally[i], (float8)0.0);
+    }
+}
+
 Datum gradient_descent_m_internal_l3(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum **arg, Datum *derivatives))
 {
     float8 learning_rate = PG_GETARG_FLOAT8(5); // learning rate for gradient desc
     int batch_size = PG_GETARG_INT32(4);        // amount of tuples to be loaded during grad_desc
     int num_atts = PG_GETARG_INT32(3);          // number of independent variables per run
     int iterations = PG_GETARG_INT32(2);        // Number of iterations for grad_desc algorithm
+    bool shuffle = PG_NARGS() > 6 && PG_GETARG_BOOL(6); // visit the tuples in a new random order every iteration
+    int seed = PG_NARGS() > 7 ? PG_GETARG_INT32(7) : 0;  // seed for shuffling, runs with equal seeds are reproducible
+    GradientOptimizer optimizer;                        // update rule, optional arguments 8-10
 
     // printf("Grad_desc_l3_internal begin\n");
 
@@ -204,10 +239,10 @@ Datum gradient_descent_m_internal_l3(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum
                         "allowed in this context")));
 
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
+    LambdaInstrumentation *instr = castNode(ExprState, lambda->exprstate)->lambda_instr;
     TupleDesc inDesc = (TupleDesc)list_nth(lambda->argtypes, 0);
 
     MemoryContext per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
-    MemoryContext per_expr_eval = rsinfo->econtext->ecxt_per_tuple_memory;
     MemoryContext oldcontext = MemoryContextSwitchTo(per_query_ctx);
 
     // printf("Grad_desc_l3_internal switched MCTX\n");
@@ -215,8 +250,9 @@ Datum gradient_descent_m_internal_l3(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum
     Tuplestorestate *ttsIn = ((TypedTuplestore *)PG_GETARG_POINTER(0))->tuplestorestate;
     TupleTableSlot *slot = MakeTupleTableSlot(NULL);
     Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
-    int tupleStoreCount = (int)tuplestore_tuple_count(ttsIn);
-    tuplestore_rescan(ttsIn);
+    GradientDescentInput input;
+    gradient_descent_input_init(&input, ttsIn, slot, shuffle, seed);
+    int tupleStoreCount = input.count;
 
     if (batch_size < 1 || batch_size > tupleStoreCount)
     {
@@ -269,59 +305,92 @@ Datum gradient_descent_m_internal_l3(PG_FUNCTION_ARGS, Datum (*derivefunc)(Datum
         derivatives_tally[i] = PointerGetDatum(initResult(ndim, dims, lbs));
     }
 
-    // printf("Grad_desc_l3_internal copied first tuples\n");
+    // moment buffers live in the per query context, next to the coefficients they belong to
+    gradient_optimizer_init(&optimizer, fcinfo, 8, learning_rate);
+    GradientOptimizerState *optimizer_states = (GradientOptimizerState *)palloc(num_atts * sizeof(GradientOptimizerState));
+    for (int i = 0; i < num_atts; i++)
+    {
+        ArrayType *tally = DatumGetArrayTypeP(derivatives_tally[i]);
+        gradient_optimizer_state_init(&optimizer, &optimizer_states[i], ArrayGetNItems(ARR_NDIM(tally), ARR_DIMS(tally)));
+    }
 
-    MemoryContextSwitchTo(per_expr_eval);
+    // The derivatives of the coefficients are accumulated directly into the tally, when both have the same shape(the
+    // derivation adds inplace to a non-scalar target), all other derivatives start from a shared zero scalar, which is
+    // never modified inplace
+    Datum zero = createScalar(0.0);
+    bool *tally_inplace = (bool *)palloc(num_atts * sizeof(bool));
+    for (int i = 0; i < num_atts; i++)
+    {
+        tally_inplace[i] = !isScalar(DatumGetArrayTypeP(derivatives_tally[i]));
+    }
 
-    // printf("Grad_desc_l3_internal switched MCTX to per_tuple\n");
+    // per row scratch(detoasted inputs, intermediate matrices, derivatives of the data columns), freed after every row
+    MemoryContext per_row_ctx = AllocSetContextCreate(per_query_ctx, "gradient descent per row", ALLOCSET_DEFAULT_SIZES);
+
+    // printf("Grad_desc_l3_internal copied first tuples\n");
 
     for (int it = 0; it < iterations; it++)
     {
-        while (tuplestore_gettupleslot(ttsIn, true, false, slot))
+        int tuple_counter = 0; // number of already calculated samples in batch
+        HeapTuple inTuple;
+
+        gradient_descent_input_rescan(&input);
+        while ((inTuple = gradient_descent_input_next(&input)) != NULL)
         {
-            heap_deform_tuple(slot->tts_tuple, inDesc, oldVal, oldIsNull);
+            MemoryContextSwitchTo(per_row_ctx);
+            heap_deform_tuple(inTuple, inDesc, oldVal, oldIsNull);
             // printf("Grad_desc_l3_internal tuple deform done\n");
 
             for (int i = 0; i < num_atts; i++)
             {
-                oldVal[i] = PointerGetDatum(copyArray(coefficients_per_iteration[i]));
+                // bound by reference, the lambda only reads its arguments
+                oldVal[i] = coefficients_per_iteration[i];
             }
 
             // printf("Grad_desc_l3_internal oldVal filed with coefficients\n");
 
             for (int i = 0; i < inDesc->natts; i++)
             {
-                derivatives[i] = createScalar(0.0);
+                derivatives[i] = (i < num_atts && tally_inplace[i]) ? derivatives_tally[i] : zero;
             }
 
             // printf("Grad_desc_l3_internal created scalars\n");
 
+            if (instr)
+                InstrLambdaStart(instr);
             Datum result = derivefunc(&oldVal, derivatives);
+            if (instr)
+                InstrLambdaStop(instr, LAMBDA_INSTR_DERIVE, 1);
 
             // printf("Grad_desc_l3_internal calculated lambda and derivs\n");
 
+            MemoryContextSwitchTo(per_query_ctx);
             for (int i = 0; i < num_atts; i++)
             {
-                derivatives_tally[i] = matrix_add_inplace(derivatives_tally[i], derivatives[i]);
+                if (!tally_inplace[i])
+                    derivatives_tally[i] = matrix_add_inplace(derivatives_tally[i], derivatives[i]);
             }
             // printf("Grad_desc_l3_internal derive_tally add in place\n");
 
-            MemoryContextResetAndDeleteChildren(per_expr_eval);
+            MemoryContextReset(per_row_ctx);
             // printf("Grad_desc_l3_internal reset MCTX\n");
-        }
-        tuplestore_rescan(ttsIn);
 
-        // printf("Grad_desc_l3_internal finished all tuples for this iteration\n");
+            if (++tuple_counter == batch_size)
+            {
+                // update after every full batch, instead of once per iteration
+                gradient_descent_m_apply(&optimizer, optimizer_states, coefficients_per_iteration, derivatives_tally, num_atts, tuple_counter);
+                tuple_counter = 0;
+            }
+        }
 
-        for (int i = 0; i < num_atts; i++)
+        // the remaining tuples of the iteration form a smaller batch
+        if (tuple_counter > 0)
         {
-            coefficients_per_iteration[i] = mat_apply_gradient(coefficients_per_iteration[i], derivatives_tally[i], learning_rate, batch_size);
-            matrixSetValue(derivatives_tally[i], (float8)0.0);
+            gradient_descent_m_apply(&optimizer, optimizer_states, coefficients_per_iteration, derivatives_tally, num_atts, tuple_counter);
         }
         // printf("Grad_desc_l3_internal mat_apply gradients for this iteration done\n");
     }
-    // MemoryContextResetAndDeleteChildren(per_expr_eval);
-    MemoryContextSwitchTo(per_query_ctx);
+    MemoryContextDelete(per_row_ctx);
     // printf("Grad_desc_l3_internal switched back to MCTX per query\n");
 
     for (int i = 0; i < num_atts; i++)
@@ -497,7 +566,7 @@ Datum gradient_descent_m_l1_2(PG_FUNCTION_ARGS)
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
 
     llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
-    ExecInitLambdaExpr((Node *)lambda, false, true);
+    ExecInitLambdaExprWrt((Node *)lambda, false, true, gradient_descent_wrt(PG_GETARG_INT32(3)));
     llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
 
     return gradient_descent_m_internal_l1_2(fcinfo);
@@ -513,7 +582,7 @@ Datum gradient_descent_m_l3(PG_FUNCTION_ARGS)
     llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
     LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
 
-    ExecInitLambdaExpr((Node *)lambda, true, true);
+    ExecInitLambdaExprWrt((Node *)lambda, true, true, gradient_descent_wrt(PG_GETARG_INT32(3)));
     printf("Grad_desc_l3 lambda was initiated\n");
 
     Datum (*compiled_func)(Datum **, Datum *);
@@ -12,11 +12,14 @@
 #include "nodes/print.h"
 #include "portability/instr_time.h"
 #include "utils/lsyscache.h"
+#include "utils/fmgroids.h"
+#include "nodes/nodeFuncs.h"
 #include "utils/hsearch.h"
 #include "common/config_info.h"
 #include <math.h>
 #include <pthread.h>
 #include "miscadmin.h"
+#include "worker_pool.h"
 
 
 
@@ -39,35 +42,86 @@ extern TupleDesc kmeans_threads_record_type(List *args)
 }
 
 
+/*
+ * The centroid columns followed by the cluster id
+ */
+static TupleDesc kmeans_centroid_desc(TupleDesc clusterDesc)
+{
+    TupleDesc outDesc;
+    outDesc = CreateTemplateTupleDesc(clusterDesc->natts + 1, false);
+
+    for (int i = 0; i < clusterDesc->natts; i++)
+    {
+        TupleDescCopyEntry(outDesc, (AttrNumber) (i+1), clusterDesc, (AttrNumber) (i+1));
+    }
+
+    TupleDescInitEntry(outDesc, clusterDesc->natts + 1, "cluster",
+               INT4OID, -1, 0);
+
+    return outDesc;
+}
+
+extern TupleDesc kmeans_minibatch_record_type(List *args)
+{
+    LambdaExpr *lambda = (LambdaExpr *) list_nth(args, 2);
+
+    return kmeans_centroid_desc((TupleDesc) list_nth(lambda->argtypes, 0));
+}
+
+
 PG_MODULE_MAGIC;
 PG_FUNCTION_INFO_V1_RECTYPE(kmeans, kmeans_threads_record_type);
 PG_FUNCTION_INFO_V1_RECTYPE(kmeans_threads, kmeans_threads_record_type);
+PG_FUNCTION_INFO_V1_RECTYPE(kmeans_minibatch, kmeans_minibatch_record_type);
 
 
 
-struct KMeansNode
-{
-    float8 x;
-    float8 y;
-    struct KMeansCentroid *centroid;
-};
+/* points per block of the squared euclidean fast path */
+#define KMEANS_BLOCK 64
 
-struct KMeansCentroid
+/*
+ * Points and centroids of a d-dimensional kmeans
+ * The points are stored column-major(structure of arrays), so one dimension of consecutive points is contiguous and
+ * the distance loops vectorize over the points.  Dimension j of the points is attribute pointAttrs[j] of the point
+ * tuples and clusterAttrs[j] of the centroid tuples.
+ *
+ * The euclidean fast path prunes with Hamerly's bounds: every point keeps an upper bound of the distance to its
+ * centroid and a lower bound of the distance to all other centroids.  After an update the bounds are loosened by
+ * how far the centroids moved.  A point whose upper bound is below both its lower bound and half the distance from
+ * its centroid to the next one cannot change its assignment, so no distance is computed for it.
+ */
+struct KMeansData
 {
-    int id;
-    float8 x;
-    float8 y;
-    float8 avgXAgg;
-    float8 avgYAgg;
-    int numAssignments;
+    int dims;
+    int pointCount;
+    int clusterCount;
+    float8 *points;             /* dims x pointCount, points[j * pointCount + i] */
+    float8 *centroids;          /* clusterCount x dims, the dimensions of a centroid are contiguous */
+    int *assignment;            /* centroid of every point, -1 before the first iteration */
+    AttrNumber *pointAttrs;     /* 0-based */
+    AttrNumber *clusterAttrs;   /* 0-based */
+
+    /* bounds of the euclidean fast path, only valid after its first iteration */
+    bool boundsValid;
+    float8 *upper;              /* per point, >= distance to its centroid */
+    float8 *lower;              /* per point, <= distance to every other centroid */
+    float8 *halfGap;            /* per centroid, half the distance to the closest other centroid */
+    float8 *moved;              /* per centroid, distance moved by the last update */
+    int farthestMover;          /* centroid that moved the most */
+    float8 maxMoved;            /* its distance */
+    float8 secondMoved;         /* largest distance moved by any other centroid */
+
+    /* k-means++ seeding, while set the workers only compute distances to centroid seedCluster */
+    bool seeding;
+    int seedCluster;
+    float8 *seedDist;           /* per point, distance to the closest centroid seeded so far */
 };
 
 
 struct KMeansWorkerArgs
 {
     int threadid;
-    struct KMeansNode *nodeStates;
-    struct KMeansCentroid *clusterStates;
+    struct KMeansData *data;
     TupleDesc nodeDesc;
     TupleDesc clusterDesc;
     LambdaExpr *distFunc;
@@ -76,289 +130,666 @@ struct KMeansWorkerArgs
     Datum *tuples;
     int count;
     int offset;
-    int clusterCount;
     bool changesMade;
-    float8 *avgXAgg;
-    float8 *avgYAgg;
-    int *clusterAssignCount;
+    float8 *sums;               /* clusterCount x dims, change of the coordinate sums by moved points */
+    int *clusterAssignCount;    /* change of the number of assigned points */
+    float8 *point;              /* dims, coordinates of the current point of the fast path */
+    void *(*workerFunc)(void *arg);
 };
 
+/*
+ * Move the point X to centroid C, the aggregates only record what changed, so points that keep their centroid cost
+ * nothing
+ */
+static inline void kmeans_assign(struct KMeansWorkerArgs *args, int x, int c)
+{
+    struct KMeansData *data = args->data;
+    const int old = data->assignment[x];
+    float8 *sums = args->sums + (size_t) c * data->dims;
+    float8 *oldSums = args->sums + (size_t) old * data->dims;
+
+    if (old == c)
+        return;
+
+    args->changesMade = true;
+    data->assignment[x] = c;
+
+    args->clusterAssignCount[c]++;
+    if (old >= 0)
+        args->clusterAssignCount[old]--;
+    for (int j = 0; j < data->dims; j++)
+    {
+        const float8 coord = data->points[(size_t) j * data->pointCount + x];
+
+        sums[j] += coord;
+        if (old >= 0)
+            oldSums[j] -= coord;
+    }
+}
+
+/*
+ * Assign the points of the range to the closest centroid according to the distance lambda
+ * While seeding, only the distances to the newest centroid are computed.  The lambda need not be a metric, so
+ * nothing is pruned.
+ */
 void *kmeans_worker(void *arg)
 {
     struct KMeansWorkerArgs *args = (struct KMeansWorkerArgs *) arg;
-    struct KMeansCentroid *cluster;
+    struct KMeansData *data = args->data;
+    const int clusterCount = data->clusterCount;
+
+    if (data->seeding)
+    {
+        args->lambdaArgs[0] = args->clusters + data->seedCluster * args->clusterDesc->natts;
+        for (int x = args->offset; x < args->offset + args->count; x++)
+        {
+            args->lambdaArgs[1] = args->tuples + x * args->nodeDesc->natts;
+            float8 dist = DatumGetFloat8(PG_SIMPLE_LAMBDA_INJECT(args->lambdaArgs, 0));
+
+            if (dist < data->seedDist[x])
+                data->seedDist[x] = dist;
+        }
+        return (void *) 0;
+    }
 
     for(int x = args->offset; x < args->offset + args->count; x++)
     {
-        int c = 0;
-        bool isnull;
         float8 minDist = 0.0;
-        struct KMeansCentroid *clusterMin = NULL;
-        struct KMeansNode *node = args->nodeStates + x;
+        int clusterMin = -1;
 
         args->lambdaArgs[1] = args->tuples + x * args->nodeDesc->natts;
-        clusterMin = NULL;
-
-        for(cluster = args->clusterStates; cluster < args->clusterStates + args->clusterCount; cluster++)
-        {      
-            args->lambdaArgs[0] = args->clusters + c * args->clusterDesc->natts;           
-            /*float8 dist = DatumGetFloat8(castNode(ExprState,
-                args->distFunc->exprstate)->evalfunc_simple(args->lambdaArgs));*/
-            //float8 dist = pow(node->x - cluster->x, 2) + pow(node->y - cluster->y, 2);
+
+        for(int c = 0; c < clusterCount; c++)
+        {
+            args->lambdaArgs[0] = args->clusters + c * args->clusterDesc->natts;
             float8 dist = DatumGetFloat8(PG_SIMPLE_LAMBDA_INJECT(args->lambdaArgs, 0));
             
-            if (clusterMin == NULL || isnan(minDist) && !isnan(dist) || !isnan(dist) && minDist > dist)
+            if (clusterMin < 0 || (isnan(minDist) && !isnan(dist)) || (!isnan(dist) && minDist > dist))
             {
                 minDist = dist;
-                clusterMin = cluster;
+                clusterMin = c;
+            }
+        }
+
+        kmeans_assign(args, x, clusterMin);
+    }
+
+    return (void *) 0;
+}
+
+/*
+ * Squared euclidean distances of the LEN points starting at BLOCK to centroid C
+ * The loop runs over the contiguous columns of the points, so it vectorizes over the block.
+ */
+static inline void kmeans_block_distances(const struct KMeansData *data, int block, int len, int c, float8 *dist)
+{
+    const float8 *centroid = data->centroids + (size_t) c * data->dims;
+
+    for (int i = 0; i < len; i++)
+    {
+        dist[i] = 0.0;
+    }
+    for (int j = 0; j < data->dims; j++)
+    {
+        const float8 *col = data->points + (size_t) j * data->pointCount + block;
+        const float8 cj = centroid[j];
+
+        for (int i = 0; i < len; i++)
+        {
+            const float8 diff = col[i] - cj;
+            dist[i] += diff * diff;
+        }
+    }
+}
+
+/*
+ * Squared euclidean distance of the gathered POINT to centroid C, summed in the same order as
+ * kmeans_block_distances()
+ */
+static inline float8 kmeans_point_distance(const struct KMeansData *data, const float8 *point, int c)
+{
+    const float8 *centroid = data->centroids + (size_t) c * data->dims;
+    float8 dist = 0.0;
+
+    for (int j = 0; j < data->dims; j++)
+    {
+        const float8 diff = point[j] - centroid[j];
+        dist += diff * diff;
+    }
+    return dist;
+}
+
+/*
+ * Full scan of the first iteration: assign the points to their closest centroid a block at a time and initialize
+ * their bounds from the closest and second closest distance
+ */
+static void kmeans_l2_full_scan(struct KMeansWorkerArgs *args)
+{
+    struct KMeansData *data = args->data;
+    float8 dist[KMEANS_BLOCK];
+    float8 minDist[KMEANS_BLOCK];
+    float8 secondDist[KMEANS_BLOCK];
+    int clusterMin[KMEANS_BLOCK];
+
+    for (int block = args->offset; block < args->offset + args->count; block += KMEANS_BLOCK)
+    {
+        const int len = Min(KMEANS_BLOCK, args->offset + args->count - block);
+
+        for (int c = 0; c < data->clusterCount; c++)
+        {
+            kmeans_block_distances(data, block, len, c, dist);
+            for (int i = 0; i < len; i++)
+            {
+                if (c == 0 || (isnan(minDist[i]) && !isnan(dist[i])) || (!isnan(dist[i]) && minDist[i] > dist[i]))
+                {
+                    secondDist[i] = (c == 0) ? HUGE_VAL : minDist[i];
+                    minDist[i] = dist[i];
+                    clusterMin[i] = c;
+                }
+                else if (dist[i] < secondDist[i])
+                {
+                    secondDist[i] = dist[i];
+                }
             }
+        }
 
-            c++;
+        for (int i = 0; i < len; i++)
+        {
+            data->upper[block + i] = sqrt(minDist[i]);
+            data->lower[block + i] = sqrt(secondDist[i]);
+            kmeans_assign(args, block + i, clusterMin[i]);
         }
+    }
+}
+
+/*
+ * Assignment for lambdas recognized as (squared) euclidean distance, see kmeans_l2_dims()
+ * After the first iteration only points whose bounds do not prove their assignment are looked at: first the distance
+ * to their own centroid is recomputed, and only if that does not suffice all centroids are scanned.
+ */
+static void *kmeans_worker_l2(void *arg)
+{
+    struct KMeansWorkerArgs *args = (struct KMeansWorkerArgs *) arg;
+    struct KMeansData *data = args->data;
+    const int dims = data->dims;
+    float8 *point = args->point;
+
+    if (data->seeding)
+    {
+        float8 dist[KMEANS_BLOCK];
 
-        args->changesMade |= node->centroid != clusterMin; 
-        node->centroid = clusterMin;
+        for (int block = args->offset; block < args->offset + args->count; block += KMEANS_BLOCK)
+        {
+            const int len = Min(KMEANS_BLOCK, args->offset + args->count - block);
 
-        args->clusterAssignCount[clusterMin->id]++;
-        args->avgXAgg[clusterMin->id] += node->x;
-        args->avgYAgg[clusterMin->id] += node->y;
+            kmeans_block_distances(data, block, len, data->seedCluster, dist);
+            for (int i = 0; i < len; i++)
+            {
+                if (dist[i] < data->seedDist[block + i])
+                    data->seedDist[block + i] = dist[i];
+            }
+        }
+        return (void *) 0;
+    }
+
+    if (!data->boundsValid)
+    {
+        kmeans_l2_full_scan(args);
+        return (void *) 0;
+    }
+
+    for (int x = args->offset; x < args->offset + args->count; x++)
+    {
+        const int a = data->assignment[x];
+        float8 upper = data->upper[x] + data->moved[a];
+        float8 lower = data->lower[x] - ((a == data->farthestMover) ? data->secondMoved : data->maxMoved);
+        float8 bound = Max(data->halfGap[a], lower);
+        float8 minDist, secondDist;
+        int clusterMin;
+
+        // strict comparisons, so ties are resolved by the full scan like in the first iteration
+        if (upper < bound)
+        {
+            data->upper[x] = upper;
+            data->lower[x] = lower;
+            continue;
+        }
+
+        for (int j = 0; j < dims; j++)
+        {
+            point[j] = data->points[(size_t) j * data->pointCount + x];
+        }
+        upper = sqrt(kmeans_point_distance(data, point, a));
+        if (upper < bound)
+        {
+            data->upper[x] = upper;
+            data->lower[x] = lower;
+            continue;
+        }
+
+        minDist = 0.0;
+        secondDist = HUGE_VAL;
+        clusterMin = -1;
+        for (int c = 0; c < data->clusterCount; c++)
+        {
+            float8 dist = kmeans_point_distance(data, point, c);
+
+            if (clusterMin < 0 || (isnan(minDist) && !isnan(dist)) || (!isnan(dist) && minDist > dist))
+            {
+                if (clusterMin >= 0)
+                    secondDist = minDist;
+                minDist = dist;
+                clusterMin = c;
+            }
+            else if (dist < secondDist)
+            {
+                secondDist = dist;
+            }
+        }
+
+        data->upper[x] = sqrt(minDist);
+        data->lower[x] = sqrt(secondDist);
+        kmeans_assign(args, x, clusterMin);
     }
 
     return (void *) 0;
 }
 
-
-Datum
-kmeans_internal2(PG_FUNCTION_ARGS, int nthreads, void* (*worker_func) (void *arg))
+/*
+ * Assign the nodes [start, start + count) with the (compiled) worker function, the aggregates of the worker are
+ * only added to, so a thread can process any number of ranges per iteration
+ */
+static void kmeans_range(void *arg, int start, int count)
 {
-    MemoryContext oldcontext;
-    ParamListInfo paramListInfo;
-    FuncCallContext  *funcctx;
-    MemoryContext per_query_ctx;
-    int clusterCount = 0, tupleCount = 0;
-    TupleDesc outDesc = NULL;
-    HASHCTL ctl;
-    HTAB *mapping;
-    Datum *clusters, *tuples;
-    Datum **lambdaArgs = (Datum **) palloc(2 * sizeof(Datum *));    
-    LambdaExpr* lambda = PG_GETARG_LAMBDA(2);
-    bool isnull;
-    double dampingFactor;
-    double threshold;
-    int maxit = fcinfo->nargs == 6 ? PG_GETARG_INT32(5) : 500;
-    int iterations;
-    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    struct KMeansWorkerArgs *args = (struct KMeansWorkerArgs *) arg;
 
-    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("set-valued function called in context that cannot accept a set")));
-    if (!(rsinfo->allowedModes & SFRM_Materialize))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("materialize mode required, but it is not " \
-                        "allowed in this context")));
+    args->offset = start;
+    args->count = count;
+    args->workerFunc(arg);
+}
 
-    
+/*
+ * If NODE is a lambda field of type float8, return its 0-based attribute and lambda argument
+ */
+static bool kmeans_lambda_field(Node *node, int *argno, AttrNumber *attno)
+{
+    FieldSelect *fs;
+    Param *param;
+
+    if (!IsA(node, FieldSelect))
+        return false;
+    fs = (FieldSelect *) node;
+    if (fs->resulttype != FLOAT8OID || !IsA(fs->arg, Param))
+        return false;
+    param = (Param *) fs->arg;
+    if (!param->lambda)
+        return false;
+
+    *argno = param->paramid - 1;
+    *attno = fs->fieldnum - 1;
+    return true;
+}
 
-    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
-    oldcontext = MemoryContextSwitchTo(per_query_ctx);
+/*
+ * Return the arguments of NODE if it calls FUNCID with 2 arguments
+ */
+static bool kmeans_binary_call(Node *node, Oid funcid, Node **left, Node **right)
+{
+    List *args;
 
-    //llvm_prepare_simple_expression(castNode(ExprState, lambda->exprstate));
+    if (IsA(node, OpExpr))
+    {
+        set_opfuncid((OpExpr *) node);
+        if (((OpExpr *) node)->opfuncid != funcid)
+            return false;
+        args = ((OpExpr *) node)->args;
+    }
+    else if (IsA(node, FuncExpr))
+    {
+        if (((FuncExpr *) node)->funcid != funcid)
+            return false;
+        args = ((FuncExpr *) node)->args;
+    }
+    else
+        return false;
+
+    if (list_length(args) != 2)
+        return false;
+    *left = (Node *) linitial(args);
+    *right = (Node *) lsecond(args);
+    return true;
+}
 
-    HeapTuple   tuple;
-    struct KMeansCentroid *clusterStates;
-    struct KMeansNode *nodeStates;
-    bool *nullvals;
-    pthread_t workers[nthreads];
-    TupleDesc clusterDesc = (TupleDesc) list_nth(lambda->argtypes, 0);
-    TupleDesc nodeDesc = (TupleDesc) list_nth(lambda->argtypes, 1);
+/*
+ * Match one term (a.f - b.g)^2, pow(a.f - b.g, 2) or (a.f - b.g) * (a.f - b.g) of a squared euclidean distance
+ */
+static bool kmeans_l2_term(Node *node, List **clusterAttrs, List **pointAttrs)
+{
+    Node *base, *other, *left, *right;
+    int argLeft, argRight;
+    AttrNumber attLeft, attRight;
 
-    struct KMeansWorkerArgs *workerArgs = (struct KMeansWorkerArgs *) 
-        palloc0(nthreads * sizeof(struct KMeansWorkerArgs));
-    instr_time  starttime;
-    instr_time  endtime;
-    instr_time  ctr;
+    if (kmeans_binary_call(node, F_DPOW, &base, &other))
+    {
+        if (!IsA(other, Const) || ((Const *) other)->constisnull ||
+            ((Const *) other)->consttype != FLOAT8OID ||
+            DatumGetFloat8(((Const *) other)->constvalue) != 2.0)
+            return false;
+    }
+    else if (kmeans_binary_call(node, F_FLOAT8MUL, &base, &other))
+    {
+        if (!equal(base, other))
+            return false;
+    }
+    else
+        return false;
+
+    if (!kmeans_binary_call(base, F_FLOAT8MI, &left, &right) ||
+        !kmeans_lambda_field(left, &argLeft, &attLeft) ||
+        !kmeans_lambda_field(right, &argRight, &attRight) ||
+        argLeft == argRight)
+        return false;
+
+    // the lambda is called as (centroid, point)
+    *clusterAttrs = lappend_int(*clusterAttrs, argLeft == 0 ? attLeft : attRight);
+    *pointAttrs = lappend_int(*pointAttrs, argLeft == 0 ? attRight : attLeft);
+    return true;
+}
 
-    TupleTableSlot *slot = MakeTupleTableSlot(NULL);
-    Tuplestorestate *ttsClusters = ((TypedTuplestore *) PG_GETARG_POINTER(0))->tuplestorestate;
-    Tuplestorestate *ttsPoints = ((TypedTuplestore *) PG_GETARG_POINTER(1))->tuplestorestate;
+static bool kmeans_l2_sum(Node *node, List **clusterAttrs, List **pointAttrs)
+{
+    Node *left, *right;
 
-    /*PlanState *planStateC = (PlanState *) PG_GETARG_POINTER(0);
-    PlanState *planStateN = (PlanState *) PG_GETARG_POINTER(1);*/
+    if (kmeans_binary_call(node, F_FLOAT8PL, &left, &right))
+        return kmeans_l2_sum(left, clusterAttrs, pointAttrs) && kmeans_l2_sum(right, clusterAttrs, pointAttrs);
+    return kmeans_l2_term(node, clusterAttrs, pointAttrs);
+}
 
-    Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
-    clusterCount = tuplestore_tuple_count(ttsClusters);
-    tupleCount = tuplestore_tuple_count(ttsPoints);
+/*
+ * Recognize distance lambdas of the form [sqrt](sum of (a.f - b.g)^2), which order the centroids like the squared
+ * euclidean distance of the referenced attributes.  Returns the number of dimensions and fills in their attributes,
+ * or 0 if the lambda has a different form.
+ */
+static int kmeans_l2_dims(LambdaExpr *lambda, AttrNumber **clusterAttrs, AttrNumber **pointAttrs)
+{
+    Node *expr = (Node *) lambda->expr;
+    List *clusterList = NIL, *pointList = NIL;
+    ListCell *lc1, *lc2;
+    int dims = 0;
+
+    if (IsA(expr, FuncExpr) && ((FuncExpr *) expr)->funcid == F_DSQRT &&
+        list_length(((FuncExpr *) expr)->args) == 1)
+        expr = (Node *) linitial(((FuncExpr *) expr)->args);
+    else if (IsA(expr, OpExpr) && list_length(((OpExpr *) expr)->args) == 1)
+    {
+        set_opfuncid((OpExpr *) expr);
+        if (((OpExpr *) expr)->opfuncid == F_DSQRT)
+            expr = (Node *) linitial(((OpExpr *) expr)->args);
+    }
 
-    outDesc = CreateTemplateTupleDesc(nodeDesc->natts + 1, false);
+    if (!kmeans_l2_sum(expr, &clusterList, &pointList))
+        return 0;
 
-    for (int i = 0; i < nodeDesc->natts; i++)
+    *clusterAttrs = (AttrNumber *) palloc(list_length(clusterList) * sizeof(AttrNumber));
+    *pointAttrs = (AttrNumber *) palloc(list_length(pointList) * sizeof(AttrNumber));
+    forboth(lc1, clusterList, lc2, pointList)
     {
-        TupleDescCopyEntry(outDesc, (AttrNumber) (i+1), nodeDesc, (AttrNumber) (i+1));
+        (*clusterAttrs)[dims] = (AttrNumber) lfirst_int(lc1);
+        (*pointAttrs)[dims] = (AttrNumber) lfirst_int(lc2);
+        dims++;
     }
+    return dims;
+}
 
-    TupleDescInitEntry(outDesc, nodeDesc->natts + 1, "cluster",
-               INT4OID, -1, 0);
+/*
+ * The dimensions of an arbitrary distance lambda: every float8 column of the points, for which the centroids have a
+ * float8 column of the same name
+ */
+static int kmeans_feature_dims(TupleDesc clusterDesc, TupleDesc nodeDesc, AttrNumber **clusterAttrs,
+                               AttrNumber **pointAttrs)
+{
+    int dims = 0;
 
-    clusters = (Datum *) palloc0(clusterCount * clusterDesc->natts * sizeof(Datum));
-    tuples = (Datum *) palloc0(tupleCount * nodeDesc->natts * sizeof(Datum));
-    nullvals = (bool *) palloc0(Max(nodeDesc->natts, clusterDesc->natts) * sizeof(bool));
-    clusterStates = (struct KMeansCentroid *) palloc0(clusterCount * sizeof(struct KMeansCentroid));
-    nodeStates = (struct KMeansNode *) palloc0(tupleCount * sizeof(struct KMeansNode));
-    castNode(ExprState, lambda->exprstate)->tupleDatumArray = true;
+    *clusterAttrs = (AttrNumber *) palloc(nodeDesc->natts * sizeof(AttrNumber));
+    *pointAttrs = (AttrNumber *) palloc(nodeDesc->natts * sizeof(AttrNumber));
+    for (int i = 0; i < nodeDesc->natts; i++)
+    {
+        Form_pg_attribute nodeAttr = TupleDescAttr(nodeDesc, i);
 
-    int x = 0;
+        if (nodeAttr->attisdropped || nodeAttr->atttypid != FLOAT8OID)
+            continue;
+        for (int j = 0; j < clusterDesc->natts; j++)
+        {
+            Form_pg_attribute clusterAttr = TupleDescAttr(clusterDesc, j);
 
-    while (tuplestore_gettupleslot(ttsClusters, true, false, slot))
-    {     
-        heap_deform_tuple(slot->tts_tuple, clusterDesc, clusters + x * clusterDesc->natts, nullvals);
-        
-        (clusterStates + x)->x = DatumGetFloat8(clusters[x * clusterDesc->natts]);
-        (clusterStates + x)->y = DatumGetFloat8(clusters[x * clusterDesc->natts + 1]);
-        (clusterStates + x)->id = x;
+            if (!clusterAttr->attisdropped && clusterAttr->atttypid == FLOAT8OID &&
+                strcmp(NameStr(nodeAttr->attname), NameStr(clusterAttr->attname)) == 0)
+            {
+                (*clusterAttrs)[dims] = j;
+                (*pointAttrs)[dims] = i;
+                dims++;
+                break;
+            }
+        }
+    }
 
-        x++;
+    if (dims == 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("kmeans needs at least one float8 column present in both the centroids and the points")));
+    return dims;
+}
+
+/*
+ * Copy the coordinates of a deformed tuple
+ */
+static void kmeans_load_coords(const Datum *values, const bool *nulls, const AttrNumber *attrs, int dims,
+                               float8 *out, size_t stride)
+{
+    for (int j = 0; j < dims; j++)
+    {
+        if (nulls[attrs[j]])
+            ereport(ERROR,
+                    (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                     errmsg("kmeans does not support NULL coordinates")));
+        out[j * stride] = DatumGetFloat8(values[attrs[j]]);
     }
+}
 
-    x = 0;
 
-    while (tuplestore_gettupleslot(ttsPoints, true, false, slot))
-    {     
-        heap_deform_tuple(slot->tts_tuple, nodeDesc, tuples + x * nodeDesc->natts, nullvals);
-       
-        (nodeStates + x)->x = DatumGetFloat8(tuples[x * nodeDesc->natts]);
-        (nodeStates + x)->y = DatumGetFloat8(tuples[x * nodeDesc->natts + 1]);
+/*
+ * Make point X the position of centroid C
+ */
+static void kmeans_set_centroid(struct KMeansData *data, Datum *clusters, TupleDesc clusterDesc, int c, int x)
+{
+    for (int j = 0; j < data->dims; j++)
+    {
+        float8 coord = data->points[(size_t) j * data->pointCount + x];
 
-        x++;
+        data->centroids[(size_t) c * data->dims + j] = coord;
+        clusters[c * clusterDesc->natts + data->clusterAttrs[j]] = Float8GetDatum(coord);
     }
+}
 
-    float8 clusterDiff;
+/*
+ * k-means++ seeding: the first centroid is a random point, every further one a point drawn with probability
+ * proportional to its squared distance to the closest centroid chosen so far.  The distance passes run on the worker
+ * threads, SQUARED tells whether the workers already compute squared distances(the euclidean fast path).  Only the
+ * first N points are drawn from.
+ */
+static void kmeans_seed(struct KMeansData *data, WorkerPool *pool, void **poolArgs, Datum *clusters,
+                        TupleDesc clusterDesc, bool squared, int seed, int n)
+{
+    unsigned short rng[3];
 
-    int batchSize = ceil(tupleCount / nthreads);
-    bool changesMade = false;
+    // same seeding as srand48()
+    rng[0] = 0x330E;
+    rng[1] = (unsigned short) seed;
+    rng[2] = (unsigned short) ((uint32) seed >> 16);
 
-    for (int j = 0; j < nthreads; j++)
+    data->seedDist = (float8 *) palloc_extended((size_t) n * sizeof(float8), MCXT_ALLOC_HUGE);
+    for (int x = 0; x < n; x++)
     {
-        workerArgs[j].threadid = j;
-        workerArgs[j].nodeStates = nodeStates;
-        workerArgs[j].clusterStates = clusterStates;
-        workerArgs[j].nodeDesc = nodeDesc;
-        workerArgs[j].clusterDesc = clusterDesc;
-        workerArgs[j].distFunc = lambda;
-        workerArgs[j].lambdaArgs = (Datum **) palloc(2 * sizeof(Datum *));
-        workerArgs[j].clusters = clusters;
-        workerArgs[j].tuples = tuples;
-        workerArgs[j].count = (j == nthreads - 1 && nthreads > 1)
-            ? (tupleCount - j * batchSize) : batchSize;
-        workerArgs[j].offset = j * batchSize;
-        workerArgs[j].clusterCount = clusterCount;
-        workerArgs[j].avgXAgg = (float8 *) palloc(clusterCount * sizeof(float8));
-        workerArgs[j].avgYAgg = (float8 *) palloc(clusterCount * sizeof(float8));
-        workerArgs[j].clusterAssignCount = (int *) palloc(clusterCount * sizeof(int));
+        data->seedDist[x] = HUGE_VAL;
     }
 
-    do
+    kmeans_set_centroid(data, clusters, clusterDesc, 0, Min((int) (pg_erand48(rng) * n), n - 1));
+    data->seeding = true;
+    for (int c = 1; c < data->clusterCount; c++)
     {
-        struct KMeansCentroid *cluster;
-        clusterDiff = 0.0;
-        changesMade = false;
+        float8 total = 0.0, target;
+        int chosen = n - 1;
 
-        for (int j = 0; j < nthreads; j++)
+        data->seedCluster = c - 1;
+        worker_pool_run(pool, kmeans_range, poolArgs, n);
+
+        for (int x = 0; x < n; x++)
         {
-            MemSet(workerArgs[j].avgXAgg, 0, clusterCount * sizeof(float8));
-            MemSet(workerArgs[j].avgYAgg, 0, clusterCount * sizeof(float8));
-            MemSet(workerArgs[j].clusterAssignCount, 0, clusterCount * sizeof(int));
-            
-            workerArgs[j].changesMade = false;
-            pthread_create(&workers[j], NULL, worker_func, (void *) (workerArgs + j));
-        }
+            float8 d = data->seedDist[x];
 
-        for (int j = 0; j < nthreads; j++)
+            // NaN and infinite distances are never drawn
+            if (isfinite(d) && d > 0.0)
+                total += squared ? d : d * d;
+        }
+        if (total == 0.0 || !isfinite(total))
         {
-            pthread_join(workers[j], NULL);
+            // all points coincide with the centroids so far
+            kmeans_set_centroid(data, clusters, clusterDesc, c, Min((int) (pg_erand48(rng) * n), n - 1));
+            continue;
         }
 
-        for(cluster = clusterStates; cluster < clusterStates + clusterCount; cluster++)
+        target = pg_erand48(rng) * total;
+        for (int x = 0; x < n; x++)
         {
-            for (int j = 0; j < nthreads; j++)
+            float8 d = data->seedDist[x];
+
+            if (isfinite(d) && d > 0.0)
             {
-                cluster->numAssignments += workerArgs[j].clusterAssignCount[cluster->id];
-                cluster->avgXAgg += workerArgs[j].avgXAgg[cluster->id];
-                cluster->avgYAgg += workerArgs[j].avgYAgg[cluster->id];
-                changesMade |= workerArgs[j].changesMade;
+                target -= squared ? d : d * d;
+                if (target < 0.0)
+                {
+                    chosen = x;
+                    break;
+                }
             }
+        }
+        kmeans_set_centroid(data, clusters, clusterDesc, c, chosen);
+    }
+    data->seeding = false;
 
-            if (cluster->numAssignments > 0)
-            {
-                float8 newX = cluster->avgXAgg / cluster->numAssignments;
-                float8 newY = cluster->avgYAgg / cluster->numAssignments;
+    pfree(data->seedDist);
+    data->seedDist = NULL;
+}
 
-                clusterDiff += fabs(newX - cluster->x) + fabs(newY - cluster->y);
+/*
+ * Loosen the bounds of the fast path after the centroids moved from OLD to their current position, and recompute
+ * the half distances between the centroids
+ */
+static void kmeans_update_bounds(struct KMeansData *data, const float8 *old)
+{
+    const int dims = data->dims;
 
-                cluster->x = newX;
-                cluster->y = newY;
+    data->farthestMover = -1;
+    data->maxMoved = 0.0;
+    data->secondMoved = 0.0;
+    for (int c = 0; c < data->clusterCount; c++)
+    {
+        float8 moved = sqrt(kmeans_point_distance(data, old + (size_t) c * dims, c));
 
-                clusters[cluster->id * clusterDesc->natts] = Float8GetDatum(newX);
-                clusters[cluster->id * clusterDesc->natts + 1] = Float8GetDatum(newY);
-            }
-            
-            cluster->numAssignments = 0;
-            cluster->avgXAgg = 0;
-            cluster->avgYAgg = 0;
+        data->moved[c] = moved;
+        if (data->farthestMover < 0 || moved > data->maxMoved)
+        {
+            data->secondMoved = data->maxMoved;
+            data->maxMoved = moved;
+            data->farthestMover = c;
         }
-    } while (changesMade && --maxit > 0);
-        
-
-    bool replIsNull[outDesc->natts];
-    Datum replVal[outDesc->natts];
+        else if (moved > data->secondMoved)
+        {
+            data->secondMoved = moved;
+        }
+        data->halfGap[c] = HUGE_VAL;
+    }
 
-    for(int i = 0; i < outDesc->natts; i++)
+    for (int c = 0; c < data->clusterCount; c++)
     {
-        replIsNull[i] = false;
+        const float8 *centroid = data->centroids + (size_t) c * dims;
+
+        for (int o = c + 1; o < data->clusterCount; o++)
+        {
+            float8 half = 0.5 * sqrt(kmeans_point_distance(data, centroid, o));
+
+            data->halfGap[c] = Min(data->halfGap[c], half);
+            data->halfGap[o] = Min(data->halfGap[o], half);
+        }
     }
+    data->boundsValid = true;
+}
 
+/*
+ * The initialization(arg 6), true for k-means++, false to start from the centroid relation
+ */
+static bool kmeans_plusplus(FunctionCallInfo fcinfo)
+{
+    char *init;
 
-    Datum *it;
-    int i = 0;
+    if (fcinfo->nargs < 7)
+        return false;
 
-    for(it = tuples; it < tuples + tupleCount * nodeDesc->natts; it += nodeDesc->natts)
+    init = text_to_cstring(PG_GETARG_TEXT_PP(6));
+    if (pg_strcasecmp(init, "kmeans++") == 0)
+        return true;
+    if (pg_strcasecmp(init, "given") != 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("unknown kmeans initialization \"%s\"", init),
+                 errhint("Use \"given\" to start from the centroid relation or \"kmeans++\".")));
+    return false;
+}
+
+/*
+ * Set up the per thread state of the workers
+ */
+static void kmeans_init_workers(struct KMeansWorkerArgs *workerArgs, void **poolArgs, int nthreads,
+                                struct KMeansData *data, TupleDesc nodeDesc, TupleDesc clusterDesc,
+                                LambdaExpr *lambda, Datum *clusters, Datum *tuples, void *(*worker_func)(void *arg))
+{
+    for (int j = 0; j < nthreads; j++)
     {
-        memcpy(&replVal, it, nodeDesc->natts * sizeof(Datum));
-        replVal[outDesc->natts - 1] = nodeStates[i].centroid->id;
-        tuple = heap_form_tuple(outDesc, replVal, replIsNull);
-        tuplestore_puttuple(tsOut, tuple);
-        i++;
+        workerArgs[j].threadid = j;
+        workerArgs[j].data = data;
+        workerArgs[j].nodeDesc = nodeDesc;
+        workerArgs[j].clusterDesc = clusterDesc;
+        workerArgs[j].distFunc = lambda;
+        workerArgs[j].lambdaArgs = (Datum **) palloc(2 * sizeof(Datum *));
+        workerArgs[j].clusters = clusters;
+        workerArgs[j].tuples = tuples;
+        workerArgs[j].sums = (float8 *) palloc((size_t) data->clusterCount * data->dims * sizeof(float8));
+        workerArgs[j].clusterAssignCount = (int *) palloc(data->clusterCount * sizeof(int));
+        workerArgs[j].point = (float8 *) palloc(data->dims * sizeof(float8));
+        workerArgs[j].workerFunc = worker_func;
+        poolArgs[j] = workerArgs + j;
     }
-        
-
-    rsinfo->returnMode = SFRM_Materialize;
-    rsinfo->setResult = tsOut;
-    rsinfo->setDesc = outDesc;
-
-    MemoryContextSwitchTo(oldcontext);
-    return (Datum) 0;
 }
 
+/*
+ * d-dimensional kmeans over the centroids(arg 0) and points(arg 1)
+ * worker_func assigns a range of points, either the compiled kmeans_worker or kmeans_worker_l2.  The Datum arrays of
+ * the tuples are only kept for the lambda, the fast path reads nothing but the SoA coordinates.
+ */
 Datum
-kmeans_internal(PG_FUNCTION_ARGS, int nthreads, void* (*worker_func) (void *arg))
+kmeans_internal2(PG_FUNCTION_ARGS, int nthreads, void* (*worker_func) (void *arg), int dims,
+                 AttrNumber *clusterAttrs, AttrNumber *pointAttrs)
 {
     MemoryContext oldcontext;
-    ParamListInfo paramListInfo;
-    FuncCallContext  *funcctx;
     MemoryContext per_query_ctx;
     int clusterCount = 0, tupleCount = 0;
     TupleDesc outDesc = NULL;
-    HASHCTL ctl;
-    HTAB *mapping;
-    Datum *clusters, *tuples;
-    Datum **lambdaArgs = (Datum **) palloc(2 * sizeof(Datum *));    
+    Datum *clusters = NULL, *tuples = NULL;
     LambdaExpr* lambda = PG_GETARG_LAMBDA(2);
-    bool isnull;
-    double dampingFactor;
-    double threshold;
-    int maxit = fcinfo->nargs == 6 ? PG_GETARG_INT32(5) : 500;
-    int iterations;
+    int maxit = fcinfo->nargs >= 6 ? PG_GETARG_INT32(5) : 500;
+    bool useLambda = worker_func != kmeans_worker_l2;
+    bool plusplus;
+    int seed = fcinfo->nargs >= 8 ? PG_GETARG_INT32(7) : 0;
     ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
 
     if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
@@ -371,37 +802,42 @@ kmeans_internal(PG_FUNCTION_ARGS, int nthreads, void* (*worker_func) (void *arg)
                  errmsg("materialize mode required, but it is not " \
                         "allowed in this context")));
 
-    
+    plusplus = kmeans_plusplus(fcinfo);
 
     per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
     oldcontext = MemoryContextSwitchTo(per_query_ctx);
 
-    //llvm_prepare_simple_expression(castNode(ExprState, lambda->exprstate));
-
     HeapTuple   tuple;
-    struct KMeansCentroid *clusterStates;
-    struct KMeansNode *nodeStates;
+    struct KMeansData data;
+    float8 *sums, *oldCentroids = NULL;
+    int *counts;
+    Datum *values;
     bool *nullvals;
-    pthread_t workers[nthreads];
+    WorkerPool *pool;
+    void **poolArgs;
     TupleDesc clusterDesc = (TupleDesc) list_nth(lambda->argtypes, 0);
     TupleDesc nodeDesc = (TupleDesc) list_nth(lambda->argtypes, 1);
 
+    worker_pool_check_threads(nthreads);
+    poolArgs = (void **) palloc(nthreads * sizeof(void *));
     struct KMeansWorkerArgs *workerArgs = (struct KMeansWorkerArgs *) 
-    palloc0(nthreads * sizeof(struct KMeansWorkerArgs));
-    instr_time  starttime;
-    instr_time  endtime;
-    instr_time  ctr;
+        palloc0(nthreads * sizeof(struct KMeansWorkerArgs));
 
     TupleTableSlot *slot = MakeTupleTableSlot(NULL);
-    /*Tuplestorestate *ttsClusters = ((TypedTuplestore *) PG_GETARG_POINTER(0))->tuplestorestate;
-    Tuplestorestate *ttsPoints = ((TypedTuplestore *) PG_GETARG_POINTER(1))->tuplestorestate;*/
-
-    PlanState *planStateC = (PlanState *) PG_GETARG_POINTER(0);
-    PlanState *planStateN = (PlanState *) PG_GETARG_POINTER(1);
+    Tuplestorestate *ttsClusters = ((TypedTuplestore *) PG_GETARG_POINTER(0))->tuplestorestate;
+    Tuplestorestate *ttsPoints = ((TypedTuplestore *) PG_GETARG_POINTER(1))->tuplestorestate;
 
     Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
-    clusterCount = /*tuplestore_tuple_count(ttsClusters)*/5;
-    tupleCount = /*tuplestore_tuple_count(ttsPoints)*/20000000;
+    clusterCount = tuplestore_tuple_count(ttsClusters);
+    tupleCount = tuplestore_tuple_count(ttsPoints);
+
+    if (clusterCount == 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("kmeans needs at least one centroid")));
+
+    // all arguments are checked, the threads can be started
+    pool = worker_pool_get(fcinfo, nthreads);
 
     outDesc = CreateTemplateTupleDesc(nodeDesc->natts + 1, false);
 
@@ -413,159 +849,137 @@ kmeans_internal(PG_FUNCTION_ARGS, int nthreads, void* (*worker_func) (void *arg)
     TupleDescInitEntry(outDesc, nodeDesc->natts + 1, "cluster",
                INT4OID, -1, 0);
 
+    data.dims = dims;
+    data.pointCount = tupleCount;
+    data.clusterCount = clusterCount;
+    data.points = (float8 *) palloc_extended((size_t) dims * Max(tupleCount, 1) * sizeof(float8), MCXT_ALLOC_HUGE);
+    data.centroids = (float8 *) palloc((size_t) clusterCount * dims * sizeof(float8));
+    data.assignment = (int *) palloc_extended(Max(tupleCount, 1) * sizeof(int), MCXT_ALLOC_HUGE);
+    data.clusterAttrs = clusterAttrs;
+    data.pointAttrs = pointAttrs;
+    memset(data.assignment, -1, tupleCount * sizeof(int));
+    data.boundsValid = false;
+    data.seeding = false;
+    data.seedDist = NULL;
+    if (!useLambda)
+    {
+        data.upper = (float8 *) palloc_extended(Max(tupleCount, 1) * sizeof(float8), MCXT_ALLOC_HUGE);
+        data.lower = (float8 *) palloc_extended(Max(tupleCount, 1) * sizeof(float8), MCXT_ALLOC_HUGE);
+        data.halfGap = (float8 *) palloc(clusterCount * sizeof(float8));
+        data.moved = (float8 *) palloc(clusterCount * sizeof(float8));
+        oldCentroids = (float8 *) palloc((size_t) clusterCount * dims * sizeof(float8));
+    }
+    sums = (float8 *) palloc0((size_t) clusterCount * dims * sizeof(float8));
+    counts = (int *) palloc0(clusterCount * sizeof(int));
+
     clusters = (Datum *) palloc0(clusterCount * clusterDesc->natts * sizeof(Datum));
-    tuples = (Datum *) palloc0(tupleCount * nodeDesc->natts * sizeof(Datum));
+    values = (Datum *) palloc(Max(nodeDesc->natts, clusterDesc->natts) * sizeof(Datum));
     nullvals = (bool *) palloc0(Max(nodeDesc->natts, clusterDesc->natts) * sizeof(bool));
-    clusterStates = (struct KMeansCentroid *) palloc0(clusterCount * sizeof(struct KMeansCentroid));
-    nodeStates = (struct KMeansNode *) palloc0(tupleCount * sizeof(struct KMeansNode));
-    castNode(ExprState, lambda->exprstate)->tupleDatumArray = true;
-
-    int x = 0;
-
-
-
-    for (slot = ExecProcNode(planStateC); !TupIsNull(slot); slot = ExecProcNode(planStateC))
+    if (useLambda)
     {
-        if (slot->tts_mintuple)
-        {
-            heap_deform_tuple(slot->tts_tuple, clusterDesc, clusters + x * clusterDesc->natts, nullvals);
-        }
-        else
-        {
-            slot_getallattrs(slot);
-            memcpy(clusters + x * clusterDesc->natts, slot->tts_values, clusterDesc->natts * sizeof(Datum));
-        }
+        tuples = (Datum *) palloc_extended((size_t) Max(tupleCount, 1) * nodeDesc->natts * sizeof(Datum),
+                                           MCXT_ALLOC_HUGE);
+        castNode(ExprState, lambda->exprstate)->tupleDatumArray = true;
+    }
 
-        (clusterStates + x)->x = DatumGetFloat8(clusters[x * clusterDesc->natts]);
-        (clusterStates + x)->y = DatumGetFloat8(clusters[x * clusterDesc->natts + 1]);
-        (clusterStates + x)->id = x;
+    int x = 0;
 
+    while (tuplestore_gettupleslot(ttsClusters, true, false, slot))
+    {     
+        heap_deform_tuple(slot->tts_tuple, clusterDesc, clusters + x * clusterDesc->natts, nullvals);
+        kmeans_load_coords(clusters + x * clusterDesc->natts, nullvals, clusterAttrs, dims,
+                           data.centroids + (size_t) x * dims, 1);
         x++;
     }
 
     x = 0;
-    
-    clock_t start = clock();
-    for (slot = ExecProcNode(planStateN); !TupIsNull(slot); slot = ExecProcNode(planStateN))
-    {     
-        if (slot->tts_mintuple)
-        {
-            heap_deform_tuple(slot->tts_tuple, nodeDesc, tuples + x * nodeDesc->natts, nullvals);
-        }
-        else
-        {
-            slot_getallattrs(slot);
-            memcpy(tuples + x * nodeDesc->natts, slot->tts_values, nodeDesc->natts * sizeof(Datum));
-        }
 
+    while (tuplestore_gettupleslot(ttsPoints, true, false, slot))
+    {     
+        Datum *row = useLambda ? tuples + (size_t) x * nodeDesc->natts : values;
 
-        (nodeStates + x)->x = DatumGetFloat8(tuples[x * nodeDesc->natts]);
-        (nodeStates + x)->y = DatumGetFloat8(tuples[x * nodeDesc->natts + 1]);
-
+        heap_deform_tuple(slot->tts_tuple, nodeDesc, row, nullvals);
+        kmeans_load_coords(row, nullvals, pointAttrs, dims, data.points + x, tupleCount);
         x++;
     }
 
-    clock_t stop = clock() - start;
-    printf("Time to read: %lu\n", stop);
-    float8 clusterDiff;
-
-    int batchSize = ceil(tupleCount / nthreads);
     bool changesMade = false;
 
-    for (int j = 0; j < nthreads; j++)
+    kmeans_init_workers(workerArgs, poolArgs, nthreads, &data, nodeDesc, clusterDesc, lambda, clusters, tuples,
+                        worker_func);
+
+    if (plusplus && tupleCount > 0)
     {
-        workerArgs[j].threadid = j;
-        workerArgs[j].nodeStates = nodeStates;
-        workerArgs[j].clusterStates = clusterStates;
-        workerArgs[j].nodeDesc = nodeDesc;
-        workerArgs[j].clusterDesc = clusterDesc;
-        workerArgs[j].distFunc = lambda;
-        workerArgs[j].lambdaArgs = (Datum **) palloc(2 * sizeof(Datum *));
-        workerArgs[j].clusters = clusters;
-        workerArgs[j].tuples = tuples;
-        workerArgs[j].count = (j == nthreads - 1 && nthreads > 1)
-            ? (tupleCount - j * batchSize) : batchSize;
-        workerArgs[j].offset = j * batchSize;
-        workerArgs[j].clusterCount = clusterCount;
-        workerArgs[j].avgXAgg = (float8 *) palloc(clusterCount * sizeof(float8));
-        workerArgs[j].avgYAgg = (float8 *) palloc(clusterCount * sizeof(float8));
-        workerArgs[j].clusterAssignCount = (int *) palloc(clusterCount * sizeof(int));
+        kmeans_seed(&data, pool, poolArgs, clusters, clusterDesc, !useLambda, seed, tupleCount);
     }
 
-
-
     do
     {
-        struct KMeansCentroid *cluster;
-        clusterDiff = 0.0;
         changesMade = false;
 
         for (int j = 0; j < nthreads; j++)
         {
-            MemSet(workerArgs[j].avgXAgg, 0, clusterCount * sizeof(float8));
-            MemSet(workerArgs[j].avgYAgg, 0, clusterCount * sizeof(float8));
+            MemSet(workerArgs[j].sums, 0, (size_t) clusterCount * dims * sizeof(float8));
             MemSet(workerArgs[j].clusterAssignCount, 0, clusterCount * sizeof(int));
             
             workerArgs[j].changesMade = false;
-            pthread_create(&workers[j], NULL, worker_func, (void *) (workerArgs + j));
         }
 
+        worker_pool_run(pool, kmeans_range, poolArgs, tupleCount);
+
         for (int j = 0; j < nthreads; j++)
         {
-            pthread_join(workers[j], NULL);
+            changesMade |= workerArgs[j].changesMade;
         }
+        if (!changesMade)
+            break;
 
-        for(cluster = clusterStates; cluster < clusterStates + clusterCount; cluster++)
+        if (oldCentroids != NULL)
+            memcpy(oldCentroids, data.centroids, (size_t) clusterCount * dims * sizeof(float8));
+
+        for (int c = 0; c < clusterCount; c++)
         {
+            float8 *centroid = data.centroids + (size_t) c * dims;
+
             for (int j = 0; j < nthreads; j++)
             {
-                cluster->numAssignments += workerArgs[j].clusterAssignCount[cluster->id];
-                cluster->avgXAgg += workerArgs[j].avgXAgg[cluster->id];
-                cluster->avgYAgg += workerArgs[j].avgYAgg[cluster->id];
-                changesMade |= workerArgs[j].changesMade;
+                counts[c] += workerArgs[j].clusterAssignCount[c];
+                for (int d = 0; d < dims; d++)
+                {
+                    sums[(size_t) c * dims + d] += workerArgs[j].sums[(size_t) c * dims + d];
+                }
             }
+            if (counts[c] == 0)
+                continue;
 
-            if (cluster->numAssignments > 0)
+            for (int d = 0; d < dims; d++)
             {
-                float8 newX = cluster->avgXAgg / cluster->numAssignments;
-                float8 newY = cluster->avgYAgg / cluster->numAssignments;
-
-                clusterDiff += fabs(newX - cluster->x) + fabs(newY - cluster->y);
-
-                cluster->x = newX;
-                cluster->y = newY;
-
-                clusters[cluster->id * clusterDesc->natts] = Float8GetDatum(newX);
-                clusters[cluster->id * clusterDesc->natts + 1] = Float8GetDatum(newY);
+                centroid[d] = sums[(size_t) c * dims + d] / counts[c];
+                clusters[c * clusterDesc->natts + clusterAttrs[d]] = Float8GetDatum(centroid[d]);
             }
-            
-            cluster->numAssignments = 0;
-            cluster->avgXAgg = 0;
-            cluster->avgYAgg = 0;
         }
-    } while (changesMade && --maxit > 0);
+
+        if (oldCentroids != NULL)
+            kmeans_update_bounds(&data, oldCentroids);
+    } while (--maxit > 0);
         
 
     bool replIsNull[outDesc->natts];
     Datum replVal[outDesc->natts];
 
-    for(int i = 0; i < outDesc->natts; i++)
-    {
-        replIsNull[i] = false;
-    }
-
-    printf("Func end\n");
+    replIsNull[outDesc->natts - 1] = false;
 
-    Datum *it;
-    int i = 0;
-
-    for(it = tuples; it < tuples + tupleCount * nodeDesc->natts; it += nodeDesc->natts)
+    // the input tuples are not kept by the fast path, so form the output from a second pass over the points
+    tuplestore_rescan(ttsPoints);
+    x = 0;
+    while (tuplestore_gettupleslot(ttsPoints, true, false, slot))
     {
-        memcpy(&replVal, it, nodeDesc->natts * sizeof(Datum));
-        replVal[outDesc->natts - 1] = nodeStates[i].centroid->id;
+        heap_deform_tuple(slot->tts_tuple, nodeDesc, replVal, replIsNull);
+        replVal[outDesc->natts - 1] = Int32GetDatum(data.assignment[x]);
         tuple = heap_form_tuple(outDesc, replVal, replIsNull);
         tuplestore_puttuple(tsOut, tuple);
-        i++;
+        heap_freetuple(tuple);
+        x++;
     }
         
 
@@ -577,10 +991,12 @@ kmeans_internal(PG_FUNCTION_ARGS, int nthreads, void* (*worker_func) (void *arg)
     return (Datum) 0;
 }
 
-
-
-Datum
-kmeans(PG_FUNCTION_ARGS)
+/*
+ * Check the distance lambda and choose the worker: the vectorized fast path for euclidean distances, the compiled
+ * lambda otherwise.  Returns the worker and fills in the dimensions.
+ */
+static void *(*kmeans_prepare(FunctionCallInfo fcinfo, int *dims, AttrNumber **clusterAttrs,
+                              AttrNumber **pointAttrs))(void *arg)
 {
     ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
     LambdaExpr* lambda = PG_GETARG_LAMBDA(2);
@@ -599,6 +1015,15 @@ kmeans(PG_FUNCTION_ARGS)
              errmsg("lambda function must take exactly 2 arguments.")));
     }
 
+    *dims = kmeans_l2_dims(lambda, clusterAttrs, pointAttrs);
+    if (*dims > 0)
+    {
+        return kmeans_worker_l2;
+    }
+
+    *dims = kmeans_feature_dims((TupleDesc) list_nth(lambda->argtypes, 0), (TupleDesc) list_nth(lambda->argtypes, 1),
+                                clusterAttrs, pointAttrs);
+
     llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
 
     ExecInitLambdaExpr((Node *) lambda, true, false);
@@ -609,39 +1034,270 @@ kmeans(PG_FUNCTION_ARGS)
     compiled_func = llvm_prepare_lambda_tablefunc(jitContext, "ext/kmeans_ext.bc", "kmeans_worker", 1);
     llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
 
-    return kmeans_internal2(fcinfo, 16, (void* (*) (void *arg)) compiled_func);
+    return (void* (*) (void *arg)) compiled_func;
 }
 
-Datum
-kmeans_threads(PG_FUNCTION_ARGS)
+static Datum
+kmeans_run(FunctionCallInfo fcinfo, int nthreads)
+{
+    AttrNumber *clusterAttrs, *pointAttrs;
+    int dims;
+    void *(*worker_func)(void *arg) = kmeans_prepare(fcinfo, &dims, &clusterAttrs, &pointAttrs);
+
+    return kmeans_internal2(fcinfo, nthreads, worker_func, dims, clusterAttrs, pointAttrs);
+}
+
+/*
+ * One mini-batch step over the first LEN points of the batch buffer
+ * Every point is assigned to its closest centroid, then every centroid moves towards the mean of its points with the
+ * per centroid learning rate m / (points seen so far), m being its share of the batch.  This equals updating it
+ * point by point with rate 1 / count, so a centroid always is the mean of all points ever assigned to it.
+ */
+static void kmeans_minibatch_step(struct KMeansData *data, struct KMeansWorkerArgs *workerArgs, void **poolArgs,
+                                  WorkerPool *pool, int nthreads, int len, int64 *seen, Datum *clusters,
+                                  TupleDesc clusterDesc)
+{
+    const int dims = data->dims;
+
+    // every point counts as newly assigned, so the worker aggregates are the plain sums of the batch
+    memset(data->assignment, -1, len * sizeof(int));
+    for (int j = 0; j < nthreads; j++)
+    {
+        MemSet(workerArgs[j].sums, 0, (size_t) data->clusterCount * dims * sizeof(float8));
+        MemSet(workerArgs[j].clusterAssignCount, 0, data->clusterCount * sizeof(int));
+    }
+
+    worker_pool_run(pool, kmeans_range, poolArgs, len);
+
+    for (int c = 0; c < data->clusterCount; c++)
+    {
+        float8 *centroid = data->centroids + (size_t) c * dims;
+        int m = 0;
+
+        for (int j = 0; j < nthreads; j++)
+        {
+            m += workerArgs[j].clusterAssignCount[c];
+        }
+        if (m == 0)
+            continue;
+        seen[c] += m;
+
+        for (int d = 0; d < dims; d++)
+        {
+            float8 sum = 0.0;
+
+            for (int j = 0; j < nthreads; j++)
+            {
+                sum += workerArgs[j].sums[(size_t) c * dims + d];
+            }
+            centroid[d] += (sum - m * centroid[d]) / seen[c];
+            clusters[c * clusterDesc->natts + data->clusterAttrs[d]] = Float8GetDatum(centroid[d]);
+        }
+    }
+}
+
+/*
+ * Streaming mini-batch kmeans over the centroids(arg 0, lambdatable) and points(arg 1, lambdacursor)
+ * The points are pulled from the plan in batches of batch_size(arg 3), only one batch is held in memory, so the
+ * memory use is O(k * d + batch_size) however large the input is.  passes(arg 5) scans the input that many times.
+ * Returns the final centroids with their cluster id, with 'kmeans++'(arg 6) they are seeded from the first batch.
+ */
+static Datum
+kmeans_minibatch_internal(FunctionCallInfo fcinfo, void *(*worker_func)(void *arg), int dims,
+                          AttrNumber *clusterAttrs, AttrNumber *pointAttrs)
 {
+    MemoryContext oldcontext;
+    MemoryContext per_query_ctx;
+    MemoryContext batch_ctx;
     ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
-    LambdaExpr* lambda = PG_GETARG_LAMBDA(2);
+    LambdaExpr *lambda = PG_GETARG_LAMBDA(2);
+    PlanState *planState = (PlanState *) PG_GETARG_POINTER(1);
+    int batchSize = PG_GETARG_INT32(3);
     int nthreads = PG_GETARG_INT32(4);
-    LLVMJitContext* jitContext;
+    int passes = fcinfo->nargs >= 6 ? PG_GETARG_INT32(5) : 1;
+    int seed = fcinfo->nargs >= 8 ? PG_GETARG_INT32(7) : 0;
+    bool useLambda = worker_func != kmeans_worker_l2;
+    bool seeded;
+    TupleDesc clusterDesc = (TupleDesc) list_nth(lambda->argtypes, 0);
+    TupleDesc nodeDesc = (TupleDesc) list_nth(lambda->argtypes, 1);
+    TupleDesc outDesc;
+    Tuplestorestate *ttsClusters = ((TypedTuplestore *) PG_GETARG_POINTER(0))->tuplestorestate;
+    Tuplestorestate *tsOut;
+    TupleTableSlot *slot;
+    struct KMeansData data;
+    struct KMeansWorkerArgs *workerArgs;
+    void **poolArgs;
+    WorkerPool *pool;
+    Datum *clusters, *tuples = NULL;
+    bool *nullvals, *pointNulls;
+    int64 *seen;
+    int clusterCount;
 
-    if (lambda->rettype != FLOAT8OID)
-    {
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
         ereport(ERROR,
-            (errcode(ERRCODE_INTERNAL_ERROR),
-             errmsg("lambda function must return a float8 value.")));
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("materialize mode required, but it is not " \
+                        "allowed in this context")));
+    if (batchSize < 1)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("batch size must be at least 1")));
+    if (passes < 1)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("number of passes must be at least 1")));
+    seeded = !kmeans_plusplus(fcinfo);
+    worker_pool_check_threads(nthreads);
+
+    clusterCount = tuplestore_tuple_count(ttsClusters);
+    if (clusterCount == 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("kmeans needs at least one centroid")));
+
+    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+    oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+    poolArgs = (void **) palloc(nthreads * sizeof(void *));
+    workerArgs = (struct KMeansWorkerArgs *) palloc0(nthreads * sizeof(struct KMeansWorkerArgs));
+    batch_ctx = AllocSetContextCreate(per_query_ctx, "kmeans batch", ALLOCSET_DEFAULT_SIZES);
+    pool = worker_pool_get(fcinfo, nthreads);
+
+    data.dims = dims;
+    data.pointCount = batchSize;
+    data.clusterCount = clusterCount;
+    data.points = (float8 *) palloc_extended((size_t) dims * batchSize * sizeof(float8), MCXT_ALLOC_HUGE);
+    data.centroids = (float8 *) palloc((size_t) clusterCount * dims * sizeof(float8));
+    data.assignment = (int *) palloc(batchSize * sizeof(int));
+    data.clusterAttrs = clusterAttrs;
+    data.pointAttrs = pointAttrs;
+    data.boundsValid = false;
+    data.seeding = false;
+    data.seedDist = NULL;
+    if (!useLambda)
+    {
+        data.upper = (float8 *) palloc(batchSize * sizeof(float8));
+        data.lower = (float8 *) palloc(batchSize * sizeof(float8));
     }
-    else if (list_length(lambda->argtypes) != 2)
+    else
     {
-        ereport(ERROR,
-            (errcode(ERRCODE_INTERNAL_ERROR),
-             errmsg("lambda function must take exactly 2 arguments.")));
+        tuples = (Datum *) palloc_extended((size_t) batchSize * nodeDesc->natts * sizeof(Datum), MCXT_ALLOC_HUGE);
+        castNode(ExprState, lambda->exprstate)->tupleDatumArray = true;
     }
+    seen = (int64 *) palloc0(clusterCount * sizeof(int64));
 
-    llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
+    // the centroid tuples are copied, their values stay referenced until the output is formed
+    clusters = (Datum *) palloc0(clusterCount * clusterDesc->natts * sizeof(Datum));
+    nullvals = (bool *) palloc0(clusterDesc->natts * sizeof(bool));
+    pointNulls = (bool *) palloc(nodeDesc->natts * sizeof(bool));
+    slot = MakeTupleTableSlot(NULL);
+    tuplestore_rescan(ttsClusters);
+    for (int c = 0; c < clusterCount && tuplestore_gettupleslot(ttsClusters, true, false, slot); c++)
+    {
+        heap_deform_tuple(ExecCopySlotTuple(slot), clusterDesc, clusters + c * clusterDesc->natts, nullvals);
+        kmeans_load_coords(clusters + c * clusterDesc->natts, nullvals, clusterAttrs, dims,
+                           data.centroids + (size_t) c * dims, 1);
+    }
 
-    ExecInitLambdaExpr((Node *) lambda, true, false);
-    jitContext = (LLVMJitContext *) (rsinfo->econtext->ecxt_estate->es_jit);
+    kmeans_init_workers(workerArgs, poolArgs, nthreads, &data, nodeDesc, clusterDesc, lambda, clusters, tuples,
+                        worker_func);
 
-    Datum (*compiled_func)(FunctionCallInfo);
+    for (int pass = 0; pass < passes; pass++)
+    {
+        int len;
 
-    compiled_func = llvm_prepare_lambda_tablefunc(jitContext, "ext/kmeans_ext.bc", "kmeans_worker", 1);
-    llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
+        if (pass > 0)
+            ExecReScan(planState);
+
+        do
+        {
+            CHECK_FOR_INTERRUPTS();
+            MemoryContextReset(batch_ctx);
+
+            for (len = 0; len < batchSize; len++)
+            {
+                TupleTableSlot *in = ExecProcNode(planState);
+
+                if (TupIsNull(in))
+                    break;
+
+                if (useLambda)
+                {
+                    // the lambda may read by-reference columns, keep them alive until the end of the batch
+                    Datum *row = tuples + (size_t) len * nodeDesc->natts;
+                    MemoryContext old = MemoryContextSwitchTo(batch_ctx);
+                    HeapTuple copy = ExecCopySlotTuple(in);
+
+                    MemoryContextSwitchTo(old);
+                    heap_deform_tuple(copy, nodeDesc, row, pointNulls);
+                    kmeans_load_coords(row, pointNulls, pointAttrs, dims, data.points + len, batchSize);
+                }
+                else
+                {
+                    slot_getallattrs(in);
+                    kmeans_load_coords(in->tts_values, in->tts_isnull, pointAttrs, dims, data.points + len,
+                                       batchSize);
+                }
+            }
+
+            if (len == 0)
+                break;
+            if (!seeded)
+            {
+                kmeans_seed(&data, pool, poolArgs, clusters, clusterDesc, !useLambda, seed, len);
+                seeded = true;
+            }
+            kmeans_minibatch_step(&data, workerArgs, poolArgs, pool, nthreads, len, seen, clusters, clusterDesc);
+        } while (len == batchSize);
+    }
+
+    outDesc = kmeans_centroid_desc(clusterDesc);
+    tsOut = tuplestore_begin_heap(true, false, work_mem);
+    for (int c = 0; c < clusterCount; c++)
+    {
+        Datum replVal[clusterDesc->natts + 1];
+        bool replIsNull[clusterDesc->natts + 1];
+        HeapTuple tuple;
 
-    return kmeans_internal2(fcinfo, nthreads, (void* (*) (void *arg)) compiled_func);
-}
\ No newline at end of file
+        memcpy(replVal, clusters + c * clusterDesc->natts, clusterDesc->natts * sizeof(Datum));
+        memset(replIsNull, false, sizeof(replIsNull));
+        replVal[clusterDesc->natts] = Int32GetDatum(c);
+        tuple = heap_form_tuple(outDesc, replVal, replIsNull);
+        tuplestore_puttuple(tsOut, tuple);
+    }
+
+    MemoryContextDelete(batch_ctx);
+
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tsOut;
+    rsinfo->setDesc = outDesc;
+
+    MemoryContextSwitchTo(oldcontext);
+    return (Datum) 0;
+}
+
+Datum
+kmeans(PG_FUNCTION_ARGS)
+{
+    return kmeans_run(fcinfo, 16);
+}
+
+Datum
+kmeans_threads(PG_FUNCTION_ARGS)
+{
+    return kmeans_run(fcinfo, PG_GETARG_INT32(4));
+}
+
+Datum
+kmeans_minibatch(PG_FUNCTION_ARGS)
+{
+    AttrNumber *clusterAttrs, *pointAttrs;
+    int dims;
+    void *(*worker_func)(void *arg) = kmeans_prepare(fcinfo, &dims, &clusterAttrs, &pointAttrs);
+
+    return kmeans_minibatch_internal(fcinfo, worker_func, dims, clusterAttrs, pointAttrs);
+}
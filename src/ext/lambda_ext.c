@@ -17,6 +17,7 @@
 #include <math.h>
 #include <pthread.h>
 #include "miscadmin.h"
+#include "lambda_srf.h"
 
 extern TupleDesc label_record_type(List *args)
 {
@@ -37,241 +38,198 @@ extern TupleDesc label_record_type(List *args)
 }
 
 PG_MODULE_MAGIC;
-PG_FUNCTION_INFO_V1_RECTYPE(label, label_record_type);
-PG_FUNCTION_INFO_V1_RECTYPE(label_fast, label_record_type);
+PG_FUNCTION_INFO_V1_STREAMING(label, label_record_type);
+PG_FUNCTION_INFO_V1_STREAMING(label_fast, label_record_type);
 
-Datum
-    label_internal(PG_FUNCTION_ARGS)
+/*
+ * State of a labeling scan between the calls(see lambda_srf.h)
+ */
+typedef struct LabelRowState
 {
-    MemoryContext oldcontext;
-    FuncCallContext *funcctx;
-    MemoryContext per_query_ctx;
-    int tupleCount;
-    TupleDesc outDesc = NULL;
-    Datum *replVal;
+    PlanState *planState;       /* the input cursor, or NULL */
+    Tuplestorestate *ttsIn;     /* the materialized input, if not a cursor */
+    TupleTableSlot *slot;       /* slot to read ttsIn */
+    LambdaExpr *lambda;
+    TupleDesc inDesc;
+    TupleDesc outDesc;          /* input columns and the label */
+    Tuplestorestate *tsOut;     /* NULL when returning a row per call */
+    MemoryContext rowContext;   /* everything derived from one input row, reset for the next one */
     Datum *oldVal;
-    bool *replIsNull;
     bool *oldIsNull;
+    Datum *replVal;
+    bool *replIsNull;
+    void *func;                 /* the compiled lambda, if any */
+} LabelRowState;
+
+/*
+ * The state of the current scan, set up on the first call, CURSOR tells whether the input(arg 0) is a lambdacursor
+ * or a lambdatable
+ */
+static LabelRowState *label_row_state(FunctionCallInfo fcinfo, bool cursor)
+{
+    FuncCallContext *funcctx;
+    LabelRowState *st;
+    MemoryContext oldcontext;
+    Tuplestorestate *tsOut;
 
-    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
-    LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
-
-    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("set-valued function called in context that cannot accept a set")));
-    if (!(rsinfo->allowedModes & SFRM_Materialize))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("materialize mode required, but it is not "
-                        "allowed in this context")));
-
-    LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
-    TupleDesc inDesc = (TupleDesc)list_nth(lambda->argtypes, 0);
-
-    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
-    oldcontext = MemoryContextSwitchTo(per_query_ctx);
-    PlanState *planState = (PlanState *)PG_GETARG_POINTER(0);
-    TupleTableSlot *slot = MakeTupleTableSlot(NULL);
-    Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
-
-    HeapTuple tuple;
-
-    outDesc = CreateTupleDescCopy(inDesc);
-    oldIsNull = (bool *)palloc(inDesc->natts * sizeof(bool));
-    oldVal = (Datum *)palloc(outDesc->natts * sizeof(Datum));
+    if (!SRF_IS_FIRSTCALL())
+        return (LabelRowState *) SRF_PERCALL_SETUP()->user_fctx;
 
-    outDesc = CreateTemplateTupleDesc(inDesc->natts + 1, false);
+    funcctx = lambda_srf_first_call(fcinfo, &tsOut);
+    oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
 
-    for (int i = 0; i < inDesc->natts; i++)
+    st = (LabelRowState *) palloc0(sizeof(LabelRowState));
+    if (cursor)
     {
-        TupleDescCopyEntry(outDesc, (AttrNumber)(i + 1), inDesc, (AttrNumber)(i + 1));
+        st->planState = (PlanState *) PG_GETARG_POINTER(0);
     }
-
-    TupleDescInitEntry(outDesc, (AttrNumber)(outDesc->natts), "label",
-                       lambda->rettype, lambda->rettypmod, 0);
-
-    replIsNull = (bool *)palloc(outDesc->natts * sizeof(bool));
-    replVal = (Datum *)palloc(outDesc->natts * sizeof(Datum));
-
-    replIsNull[outDesc->natts - 1] = false;
-    ExprStateEvalFunc evalfunc = castNode(ExprState, lambda->exprstate)->evalfunc;
-
-    for (slot = ExecProcNode(planState); !TupIsNull(slot); slot = ExecProcNode(planState))
+    else
     {
-
-        bool isnull;
-        Datum *val_ptr = oldVal;
-        bool *null_ptr = oldIsNull;
-
-        HeapTuple t;
-        HeapTupleHeader hdr;
-
-        if (slot->tts_mintuple)
-        {
-            hdr = slot->tts_tuple->t_data;
-            heap_deform_tuple(slot->tts_tuple, inDesc, val_ptr, null_ptr);
-        }
-        else
-        {
-            slot_getallattrs(slot);
-            t = heap_form_tuple(inDesc, slot->tts_values, slot->tts_isnull);
-            val_ptr = slot->tts_values;
-            null_ptr = slot->tts_isnull;
-            hdr = t->t_data;
-        }
-
-        PG_LAMBDA_SETARG(lambda, 0, HeapTupleHeaderGetDatum(hdr));
-        Datum result = PG_LAMBDA_EVAL(lambda, 0, &isnull);
-
-        for (int i = 0; i < outDesc->natts - 1; i++)
-        {
-            replVal[i] = val_ptr[i];
-            replIsNull[i] = null_ptr[i];
-        }
-
-        replVal[outDesc->natts - 1] = result;
-        tuple = heap_form_tuple(outDesc, replVal, replIsNull);
-
-        tuplestore_puttuple(tsOut, tuple);
+        st->ttsIn = ((TypedTuplestore *) PG_GETARG_POINTER(0))->tuplestorestate;
+        st->slot = MakeTupleTableSlot(NULL);
     }
-
-    rsinfo->returnMode = SFRM_Materialize;
-    rsinfo->setResult = tsOut;
-    rsinfo->setDesc = outDesc;
+    st->lambda = PG_GETARG_LAMBDA(1);
+    st->inDesc = (TupleDesc) list_nth(st->lambda->argtypes, 0);
+    st->tsOut = tsOut;
+    st->rowContext = AllocSetContextCreate(funcctx->multi_call_memory_ctx, "label row", ALLOCSET_DEFAULT_SIZES);
+    st->oldVal = (Datum *) palloc(st->inDesc->natts * sizeof(Datum));
+    st->oldIsNull = (bool *) palloc(st->inDesc->natts * sizeof(bool));
+    st->replVal = (Datum *) palloc((st->inDesc->natts + 1) * sizeof(Datum));
+    st->replIsNull = (bool *) palloc((st->inDesc->natts + 1) * sizeof(bool));
+    st->replIsNull[st->inDesc->natts] = false;
+
+    // the descriptor outlives the multi call context in materialize mode
+    MemoryContextSwitchTo(((ReturnSetInfo *) fcinfo->resultinfo)->econtext->ecxt_per_query_memory);
+    st->outDesc = BlessTupleDesc(label_record_type(list_make2(NULL, st->lambda)));
 
     MemoryContextSwitchTo(oldcontext);
-
-    return (Datum)0;
+    funcctx->user_fctx = st;
+    return st;
 }
 
-Datum label_fast_internal(PG_FUNCTION_ARGS, Datum (*evalfunc)(Datum **arg), bool cursor)
+/*
+ * Read the next input row, returns false at the end of the input
+ * The values are either deformed into the state or taken from the slot.  With HDR, the row is also provided as a
+ * heap tuple header, for lambdas taking the row as a parameter.  The row context is reset here.
+ */
+static bool label_fetch_row(LabelRowState *st, Datum **val_ptr, bool **null_ptr, HeapTupleHeader *hdr)
 {
-    MemoryContext oldcontext;
-    FuncCallContext *funcctx;
-    MemoryContext per_query_ctx;
-    int tupleCount;
-    TupleDesc outDesc = NULL;
-    Datum *replVal;
-    Datum *oldVal;
-    bool *replIsNull;
-    bool *oldIsNull;
-    Tuplestorestate *ttsIn;
+    TupleTableSlot *slot;
 
-    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
-    LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
-
-    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("set-valued function called in context that cannot accept a set")));
-    if (!(rsinfo->allowedModes & SFRM_Materialize))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("materialize mode required, but it is not "
-                        "allowed in this context")));
-
-    LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
-    TupleDesc inDesc = (TupleDesc)list_nth(lambda->argtypes, 0);
-
-    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
-    oldcontext = MemoryContextSwitchTo(per_query_ctx);
-    PlanState *planState = (PlanState *)PG_GETARG_POINTER(0);
+    // the previous row has been handed out or copied into the tuplestore by now
+    MemoryContextReset(st->rowContext);
 
-    if (!cursor)
+    if (st->planState == NULL)
     {
-        ttsIn = ((TypedTuplestore *)PG_GETARG_POINTER(0))->tuplestorestate;
+        if (!tuplestore_gettupleslot(st->ttsIn, true, false, st->slot))
+            return false;
+
+        *val_ptr = st->oldVal;
+        *null_ptr = st->oldIsNull;
+        heap_deform_tuple(st->slot->tts_tuple, st->inDesc, *val_ptr, *null_ptr);
+        if (hdr != NULL)
+            *hdr = st->slot->tts_tuple->t_data;
+        return true;
     }
 
-    TupleTableSlot *slot = MakeTupleTableSlot(NULL);
-    Tuplestorestate *tsOut = tuplestore_begin_heap(true, false, work_mem);
-
-    HeapTuple tuple;
-
-    outDesc = CreateTupleDescCopy(inDesc);
-    oldIsNull = (bool *)palloc(inDesc->natts * sizeof(bool));
-    oldVal = (Datum *)palloc(outDesc->natts * sizeof(Datum));
+    slot = ExecProcNode(st->planState);
+    if (TupIsNull(slot))
+        return false;
 
-    outDesc = CreateTemplateTupleDesc(inDesc->natts + 1, false);
-
-    for (int i = 0; i < inDesc->natts; i++)
+    if (slot->tts_mintuple)
     {
-        TupleDescCopyEntry(outDesc, (AttrNumber)(i + 1), inDesc, (AttrNumber)(i + 1));
+        *val_ptr = st->oldVal;
+        *null_ptr = st->oldIsNull;
+        heap_deform_tuple(slot->tts_tuple, st->inDesc, *val_ptr, *null_ptr);
+        if (hdr != NULL)
+            *hdr = slot->tts_tuple->t_data;
     }
-
-    TupleDescInitEntry(outDesc, (AttrNumber)(outDesc->natts), "label",
-                       lambda->rettype, lambda->rettypmod, 0);
-
-    replIsNull = (bool *)palloc(outDesc->natts * sizeof(bool));
-    replVal = (Datum *)palloc(outDesc->natts * sizeof(Datum));
-
-    replIsNull[outDesc->natts - 1] = false;
-    bool isnull;
-
-    if (!cursor)
+    else
     {
-        while (tuplestore_gettupleslot(ttsIn, true, false, slot))
+        slot_getallattrs(slot);
+        *val_ptr = slot->tts_values;
+        *null_ptr = slot->tts_isnull;
+        if (hdr != NULL)
         {
-            heap_deform_tuple(slot->tts_tuple, inDesc, oldVal, oldIsNull);
-            Datum result = evalfunc(&oldVal);
-
-            for (int i = 0; i < outDesc->natts - 1; i++)
-            {
-                replVal[i] = oldVal[i];
-                replIsNull[i] = oldIsNull[i];
-            }
+            MemoryContext oldcontext = MemoryContextSwitchTo(st->rowContext);
 
-            replVal[outDesc->natts - 1] = result;
-            tuple = heap_form_tuple(outDesc, replVal, replIsNull);
-
-            tuplestore_puttuple(tsOut, tuple);
+            *hdr = heap_form_tuple(st->inDesc, slot->tts_values, slot->tts_isnull)->t_data;
+            MemoryContextSwitchTo(oldcontext);
         }
     }
-    else
-    {
-        for (slot = ExecProcNode(planState); !TupIsNull(slot); slot = ExecProcNode(planState))
-        {
-            Datum *val_ptr = oldVal;
-            bool *null_ptr = oldIsNull;
-
-            HeapTupleHeader hdr;
 
-            if (slot->tts_mintuple)
-            {
-                hdr = slot->tts_tuple->t_data;
-                heap_deform_tuple(slot->tts_tuple, inDesc, val_ptr, null_ptr);
-            }
-            else
-            {
-                slot_getallattrs(slot);
+    return true;
+}
 
-                val_ptr = slot->tts_values;
-                null_ptr = slot->tts_isnull;
-                hdr = slot->tts_tuple->t_data;
-            }
+/*
+ * The output row: the input columns and the label
+ */
+static HeapTuple label_form_row(LabelRowState *st, Datum *val_ptr, bool *null_ptr, Datum result)
+{
+    for (int i = 0; i < st->inDesc->natts; i++)
+    {
+        st->replVal[i] = val_ptr[i];
+        st->replIsNull[i] = null_ptr[i];
+    }
 
-            Datum result = evalfunc(&val_ptr);
+    st->replVal[st->inDesc->natts] = result;
+    return heap_form_tuple(st->outDesc, st->replVal, st->replIsNull);
+}
 
-            for (int i = 0; i < outDesc->natts - 1; i++)
-            {
-                replVal[i] = val_ptr[i];
-                replIsNull[i] = null_ptr[i];
-            }
+Datum
+    label_internal(PG_FUNCTION_ARGS)
+{
+    LabelRowState *st = label_row_state(fcinfo, true);
+    Datum *val_ptr;
+    bool *null_ptr;
+    HeapTupleHeader hdr;
+    LambdaInstrumentation *instr = lambda_srf_instr(st->lambda);
 
-            replVal[outDesc->natts - 1] = result;
-            tuple = heap_form_tuple(outDesc, replVal, replIsNull);
+    while (label_fetch_row(st, &val_ptr, &null_ptr, &hdr))
+    {
+        MemoryContext oldcontext = MemoryContextSwitchTo(st->rowContext);
+        bool isnull;
 
-            tuplestore_puttuple(tsOut, tuple);
-        }
+        if (instr)
+            InstrLambdaStart(instr);
+        PG_LAMBDA_SETARG(st->lambda, 0, HeapTupleHeaderGetDatum(hdr));
+        Datum result = PG_LAMBDA_EVAL(st->lambda, 0, &isnull);
+        if (instr)
+            InstrLambdaStop(instr, LAMBDA_INSTR_EVAL, 1);
+        HeapTuple tuple = label_form_row(st, val_ptr, null_ptr, result);
+
+        MemoryContextSwitchTo(oldcontext);
+        if (lambda_srf_next(fcinfo, st->tsOut, tuple))
+            return HeapTupleGetDatum(tuple);
     }
 
-    rsinfo->returnMode = SFRM_Materialize;
-    rsinfo->setResult = tsOut;
-    rsinfo->setDesc = outDesc;
+    return lambda_srf_done(fcinfo, st->tsOut, st->outDesc);
+}
 
-    MemoryContextSwitchTo(oldcontext);
+Datum label_fast_internal(PG_FUNCTION_ARGS, Datum (*evalfunc)(Datum **arg), bool cursor)
+{
+    LabelRowState *st = label_row_state(fcinfo, cursor);
+    Datum *val_ptr;
+    bool *null_ptr;
+    LambdaInstrumentation *instr = lambda_srf_instr(st->lambda);
+
+    while (label_fetch_row(st, &val_ptr, &null_ptr, NULL))
+    {
+        MemoryContext oldcontext = MemoryContextSwitchTo(st->rowContext);
+
+        if (instr)
+            InstrLambdaStart(instr);
+        Datum result = evalfunc(&val_ptr);
+        if (instr)
+            InstrLambdaStop(instr, LAMBDA_INSTR_EVAL, 1);
+        HeapTuple tuple = label_form_row(st, val_ptr, null_ptr, result);
+
+        MemoryContextSwitchTo(oldcontext);
+        if (lambda_srf_next(fcinfo, st->tsOut, tuple))
+            return HeapTupleGetDatum(tuple);
+    }
 
-    return (Datum)0;
+    return lambda_srf_done(fcinfo, st->tsOut, st->outDesc);
 }
 
 Datum
@@ -282,11 +240,15 @@ Datum
 
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
 
-    llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
+    // with a row per call, the lambda is set up once per scan
+    if (SRF_IS_FIRSTCALL())
+    {
+        llvm_enter_tmp_context(rsinfo->econtext->ecxt_estate);
 
-    ExecInitLambdaExpr((Node *)lambda, false, false);
+        ExecInitLambdaExpr((Node *)lambda, false, false);
 
-    llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
+        llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
+    }
 
     if (fcinfo->nargs == 3)
     {
@@ -302,6 +264,14 @@ Datum
     ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
 
     LambdaExpr *lambda = PG_GETARG_LAMBDA(1);
+    bool cursor = fcinfo->nargs == 3 && PG_GETARG_BOOL(2);
+    Datum (*compiled_func)(Datum **);
+
+    if (!SRF_IS_FIRSTCALL())
+    {
+        compiled_func = (Datum (*)(Datum **)) label_row_state(fcinfo, cursor)->func;
+        return label_fast_internal(fcinfo, compiled_func, cursor);
+    }
 
     if (lambda->rettype != FLOAT8OID && lambda->rettype != FLOAT4OID &&
         lambda->rettype != INT4OID && lambda->rettype != INT8OID)
@@ -321,10 +291,10 @@ Datum
     LLVMJitContext *jitContext = (LLVMJitContext *)(rsinfo->econtext->ecxt_estate->es_jit);
 
     ExecInitLambdaExpr((Node *)lambda, true, false);
-    Datum (*compiled_func)(Datum **);
     compiled_func = llvm_prepare_simple_expression(castNode(ExprState, lambda->exprstate));
 
     llvm_leave_tmp_context(rsinfo->econtext->ecxt_estate);
 
-    return label_fast_internal(fcinfo, compiled_func, fcinfo->nargs == 3 && PG_GETARG_BOOL(2));
+    label_row_state(fcinfo, cursor)->func = (void *) compiled_func;
+    return label_fast_internal(fcinfo, compiled_func, cursor);
 }
@@ -0,0 +1,107 @@
+/*
+ * lambda_srf.h
+ *    Result handling shared by the row-wise lambda table functions(autodiff_ext.c, lambda_ext.c)
+ *
+ * When the caller allows it, the rows are returned one per call(value per call), so the input cursor is only read as
+ * far as the consumer asks for rows, and a LIMIT stops the derivation early.  Otherwise every row is appended to a
+ * tuplestore, which is returned once the input is exhausted(materialize mode).  A function scan only streams functions
+ * declared with PG_FUNCTION_INFO_V1_STREAMING, and calls them again from the start when it is rescanned.
+ *
+ * The per query state of a function lives in the multi call context of funcapi.h.  Its setup runs on the first call
+ * only, so lambdas are initialized and compiled once per scan instead of once per row.  Everything computed for one
+ * input row(the lambda's intermediates, the derivatives, the output tuple) is allocated in a row context of the
+ * state, which is reset before the next row is read, so the memory use does not grow with the number of rows.
+ */
+#ifndef LAMBDA_SRF_H
+#define LAMBDA_SRF_H
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "nodes/execnodes.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+
+/*
+ * The first call of a row-wise function: checks the calling context and starts the multi call state
+ * Allocations for the state belong into funcctx->multi_call_memory_ctx.  *TSOUT is set to the tuplestore to fill if
+ * the caller only accepts a materialized result, NULL otherwise.
+ */
+static inline FuncCallContext *lambda_srf_first_call(FunctionCallInfo fcinfo, Tuplestorestate **tsOut)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    FuncCallContext *funcctx;
+    MemoryContext oldcontext;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & (SFRM_ValuePerCall | SFRM_Materialize)))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("value per call or materialize mode required, but neither is "
+                        "allowed in this context")));
+
+    funcctx = SRF_FIRSTCALL_INIT();
+    *tsOut = NULL;
+    if (!(rsinfo->allowedModes & SFRM_ValuePerCall))
+    {
+        oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+        *tsOut = tuplestore_begin_heap(true, false, work_mem);
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    return funcctx;
+}
+
+/*
+ * The instrumentation of LAMBDA(see execLambdaInstr.c), NULL unless EXPLAIN ANALYZE or track_lambdas asks for it
+ * The calls of the lambda are timed with InstrLambdaStart() and InstrLambdaStop().
+ */
+static inline LambdaInstrumentation *lambda_srf_instr(LambdaExpr *lambda)
+{
+    return castNode(ExprState, lambda->exprstate)->lambda_instr;
+}
+
+/*
+ * Hand out TUPLE: returns true if it is the result of this call(value per call), false if it was appended to TSOUT
+ * and the function continues with the next row
+ */
+static inline bool lambda_srf_next(FunctionCallInfo fcinfo, Tuplestorestate *tsOut, HeapTuple tuple)
+{
+    if (tsOut != NULL)
+    {
+        tuplestore_puttuple(tsOut, tuple);
+        heap_freetuple(tuple);
+        return false;
+    }
+
+    ((ReturnSetInfo *) fcinfo->resultinfo)->isDone = ExprMultipleResult;
+    SRF_PERCALL_SETUP()->call_cntr++;
+    return true;
+}
+
+/*
+ * The input is exhausted, returns the result of the last call
+ * OUTDESC must be allocated in the per query memory, as the multi call context is gone afterwards.
+ */
+static inline Datum lambda_srf_done(FunctionCallInfo fcinfo, Tuplestorestate *tsOut, TupleDesc outDesc)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+
+    end_MultiFuncCall(fcinfo, SRF_PERCALL_SETUP());
+    if (tsOut != NULL)
+    {
+        rsinfo->returnMode = SFRM_Materialize;
+        rsinfo->setResult = tsOut;
+        rsinfo->setDesc = outDesc;
+        return (Datum) 0;
+    }
+
+    rsinfo->isDone = ExprEndResult;
+    PG_RETURN_NULL();
+}
+
+#endif
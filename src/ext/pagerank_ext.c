@@ -12,11 +12,11 @@
 #include "nodes/print.h"
 #include "portability/instr_time.h"
 #include "utils/lsyscache.h"
-#include "utils/hsearch.h"
 #include "common/config_info.h"
 #include <math.h>
 #include <pthread.h>
 #include "miscadmin.h"
+#include "worker_pool.h"
 
 extern TupleDesc pagerank_threads_record_type(List *args)
 {
@@ -38,88 +38,409 @@ PG_FUNCTION_INFO_V1_RECTYPE(pagerank, pagerank_threads_record_type);
 PG_FUNCTION_INFO_V1_RECTYPE(pagerank_threads, pagerank_threads_record_type);
 
 
-struct PageRankNode
+/*
+ * An endpoint of an edge while the graph is loaded, POS is its index in the endpoint array(2 * edge + 0 for the
+ * source, 2 * edge + 1 for the destination)
+ */
+struct PageRankKey
 {
-    double pageRank1;
-    double pageRank2;
     Datum origKey;
-    int aliasKey;
-    int numLinks;
-    int csrOffset;
+    uint64 pos;
 };
 
-struct PageRankHash
+/*
+ * The graph in CSR form, the vertices are numbered densely in the order of their keys.  The lists hold the in-links:
+ * the sources of the edges into vertex v are csrValues[csrOffsets[v] .. csrOffsets[v + 1]), in ascending order.
+ * The vertex ids are 32 bit, the offsets 64 bit so the number of edges is not limited.
+ */
+struct PageRankGraph
 {
-    Datum origKey;
-    struct PageRankNode *node;
+    int vertexCount;
+    Datum *origKeys;
+    uint64 *csrOffsets;
+    uint32 *csrValues;
+    uint32 *outDegree;
 };
 
+/* destinations updated together, their sums and list cursors live on the stack */
+#define PAGERANK_TILE 1024
+/* sources per cache block(2MB of contributions), larger graphs read the contributions one block at a time */
+#define PAGERANK_BLOCK (1 << 18)
+
 struct PageRankWorkerArgs
 {
-    struct PageRankNode *prData;
+    const struct PageRankGraph *graph;
+    double *rank;
+    const double *contribIn;     /* rank / out degree of the previous iteration */
+    double *contribOut;          /* the same array as contribIn for Gauss-Seidel */
     int count;
     int start;
-    int totalCount;
-    bool even;
     double dampingFactor;
-    double delta;
-    int64 *csrValues;
-    int64 *csrOffsets;
+    double base;                 /* teleport and dangling share every vertex gets */
+    double delta;                /* maximum change of a rank */
+    double residual;             /* sum of the changes */
+    double dangling;             /* new rank of the vertices without out-links */
 };
 
-
-struct Edge 
+/*
+ * Store the new rank of V from the sum SUM of the contributions of its in-neighbours
+ * Gauss-Seidel also uses the new dangling ranks right away, as far as this thread updated them, by shifting the
+ * base of the following vertices.
+ */
+static inline void pagerank_update(struct PageRankWorkerArgs *args, int v, double sum, double *danglingShift,
+                                   bool gaussSeidel)
 {
-    int64 src;
-    int64 dst;
-};
+    const struct PageRankGraph *graph = args->graph;
+    double prNew = args->base + *danglingShift + args->dampingFactor * sum;
+    double change = fabs(args->rank[v] - prNew);
+
+    args->delta = fmax(change, args->delta);
+    args->residual += change;
+    if (graph->outDegree[v] == 0)
+    {
+        if (gaussSeidel)
+            *danglingShift += args->dampingFactor * (prNew - args->rank[v]) / graph->vertexCount;
+        args->dangling += prNew;
+        args->contribOut[v] = 0.0;
+    }
+    else
+    {
+        args->contribOut[v] = prNew / graph->outDegree[v];
+    }
+    args->rank[v] = prNew;
+}
 
+/*
+ * Pull the ranks of the nodes [start, start + count) from the contributions of their in-neighbours
+ * Graphs too large for the cache are handled in tiles of destinations, whose in-lists are walked one block of
+ * sources at a time, so the contributions read stay in the cache.  Inside a tile Gauss-Seidel sees the
+ * contributions as of the start of the tile.
+ */
 void *pagerank_worker(void *arg)
 {
     struct PageRankWorkerArgs *args = (struct PageRankWorkerArgs *) arg;
-    struct PageRankNode *it;
-    args->delta = 0;
+    const struct PageRankGraph *graph = args->graph;
+    const uint64 *offsets = graph->csrOffsets;
+    const uint32 *values = graph->csrValues;
+    const double *contribIn = args->contribIn;
+    const int end = args->start + args->count;
+    const bool gaussSeidel = args->contribIn == args->contribOut;
+    double danglingShift = 0.0;
+    double sums[PAGERANK_TILE];
+    uint64 cursors[PAGERANK_TILE];
+
+    if (graph->vertexCount <= PAGERANK_BLOCK)
+    {
+        for (int v = args->start; v < end; v++)
+        {
+            double sum = 0.0;
 
-    for(it = args->prData + args->start; it < args->prData + args->start + args->count; it++)
+            for (uint64 in = offsets[v]; in < offsets[v + 1]; in++)
+            {
+                sum += contribIn[values[in]];
+            }
+            pagerank_update(args, v, sum, &danglingShift, gaussSeidel);
+        }
+        return (void *) 0;
+    }
+
+    for (int tile = args->start; tile < end; tile += PAGERANK_TILE)
     {
-        double prNew = (1.0 - args->dampingFactor) / args->totalCount;
-        for (int in = 0; in < it->numLinks; in++)
+        const int n = Min(PAGERANK_TILE, end - tile);
+
+        for (int i = 0; i < n; i++)
+        {
+            sums[i] = 0.0;
+            cursors[i] = offsets[tile + i];
+        }
+        for (uint32 blockEnd = PAGERANK_BLOCK; ; blockEnd += PAGERANK_BLOCK)
         {
-            struct PageRankNode *inNode = args->prData
-                + args->csrValues[args->csrOffsets[it->aliasKey] + in];
+            for (int i = 0; i < n; i++)
+            {
+                const uint64 listEnd = offsets[tile + i + 1];
+                uint64 in = cursors[i];
+                double sum = sums[i];
+
+                for (; in < listEnd && values[in] < blockEnd; in++)
+                {
+                    sum += contribIn[values[in]];
+                }
+                sums[i] = sum;
+                cursors[i] = in;
+            }
+            if (blockEnd >= (uint32) graph->vertexCount)
+                break;
+        }
 
-            prNew += args->dampingFactor * (args->even ? inNode->pageRank1 : inNode->pageRank2) / inNode->numLinks;
+        for (int i = 0; i < n; i++)
+        {
+            pagerank_update(args, tile + i, sums[i], &danglingShift, gaussSeidel);
+        }
+    }
 
+    return (void *) 0;
+}
+
+/*
+ * Update the nodes [start, start + count), the delta of the worker is the maximum over all its ranges
+ */
+static void pagerank_range(void *arg, int start, int count)
+{
+    struct PageRankWorkerArgs *args = (struct PageRankWorkerArgs *) arg;
+
+    args->start = start;
+    args->count = count;
+    pagerank_worker(arg);
+}
+
+/*
+ * LSD radix sort of the N keys in KEYS by their Datum, a byte at a time.  TMP is scratch space of the same size.
+ * Returns the buffer holding the result, either KEYS or TMP.  Passes over bytes that are the same in all keys(the
+ * high bytes of small integer ids) are skipped.
+ */
+static struct PageRankKey *pagerank_radix_sort(struct PageRankKey *keys, struct PageRankKey *tmp, size_t n)
+{
+    size_t (*counts)[256] = (size_t (*)[256]) palloc0(sizeof(Datum) * 256 * sizeof(size_t));
+
+    // all histograms in a single pass
+    for (size_t i = 0; i < n; i++)
+    {
+        Datum key = keys[i].origKey;
+
+        for (int b = 0; b < (int) sizeof(Datum); b++)
+        {
+            counts[b][(key >> (b * 8)) & 0xFF]++;
         }
+    }
+
+    for (int b = 0; b < (int) sizeof(Datum); b++)
+    {
+        size_t sum = 0;
+        struct PageRankKey *swap;
 
-        if (args->even)
+        if (n == 0 || counts[b][(keys[0].origKey >> (b * 8)) & 0xFF] == n)
+            continue;
+
+        for (int d = 0; d < 256; d++)
         {
-            args->delta = fmax(fabs(it->pageRank1 - prNew), args->delta);
-            it->pageRank2 = prNew;
+            size_t c = counts[b][d];
+
+            counts[b][d] = sum;
+            sum += c;
         }
-        else
+        for (size_t i = 0; i < n; i++)
         {
-            args->delta = fmax(fabs(it->pageRank2 - prNew), args->delta);
-            it->pageRank1 = prNew;
+            tmp[counts[b][(keys[i].origKey >> (b * 8)) & 0xFF]++] = keys[i];
         }
 
+        swap = keys;
+        keys = tmp;
+        tmp = swap;
     }
 
-    return (void *) 0;
+    pfree(counts);
+    return keys;
+}
+
+/*
+ * The start of every list from the list lengths, the start of the list after the last one at index COUNT
+ */
+static uint64 *pagerank_list_offsets(const uint32 *lengths, uint64 count)
+{
+    uint64 *offsets = (uint64 *) palloc_extended((count + 1) * sizeof(uint64), MCXT_ALLOC_HUGE);
+    uint64 sum = 0;
+
+    for (uint64 v = 0; v < count; v++)
+    {
+        offsets[v] = sum;
+        sum += lengths[v];
+    }
+    offsets[count] = sum;
+    return offsets;
+}
+
+/*
+ * Build the graph from the ENDPOINTCOUNT edge endpoints(source, destination, source, ...), which are consumed
+ * The endpoints are sorted by key, every run of equal keys becomes one vertex.  Afterwards the out-lists are filled
+ * from the dense ids with a counting pass, and from them the in-lists the iteration pulls from.  Filling also moves
+ * each offset to the start of the next list, hence the shift at the end.
+ */
+static void pagerank_build_graph(struct PageRankGraph *graph, struct PageRankKey *endpoints, uint64 endpointCount)
+{
+    struct PageRankKey *tmp, *sorted;
+    uint32 *ends, *outValues, *inDegree;
+    uint64 *offsets;
+    uint64 vertexCount = 0;
+
+    tmp = (struct PageRankKey *) palloc_extended(Max(endpointCount, 1) * sizeof(struct PageRankKey),
+                                                 MCXT_ALLOC_HUGE);
+    sorted = pagerank_radix_sort(endpoints, tmp, endpointCount);
+
+    // dense ids, the distinct keys are collected in place at the front of the sorted array
+    ends = (uint32 *) palloc_extended(Max(endpointCount, 1) * sizeof(uint32), MCXT_ALLOC_HUGE);
+    for (uint64 i = 0; i < endpointCount; i++)
+    {
+        if (i == 0 || sorted[i].origKey != sorted[vertexCount - 1].origKey)
+        {
+            if (vertexCount == INT_MAX)
+                ereport(ERROR,
+                        (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                         errmsg("pagerank supports at most %d vertices", INT_MAX)));
+            sorted[vertexCount++].origKey = sorted[i].origKey;
+        }
+        ends[sorted[i].pos] = (uint32) (vertexCount - 1);
+    }
+
+    graph->vertexCount = (int) vertexCount;
+    graph->origKeys = (Datum *) palloc_extended(Max(vertexCount, 1) * sizeof(Datum), MCXT_ALLOC_HUGE);
+    for (uint64 v = 0; v < vertexCount; v++)
+    {
+        graph->origKeys[v] = sorted[v].origKey;
+    }
+    pfree(tmp);
+    pfree(endpoints);
+
+    // the out-lists first, by counting the out degrees
+    graph->outDegree = (uint32 *) palloc_extended(Max(vertexCount, 1) * sizeof(uint32),
+                                                  MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+    for (uint64 i = 0; i < endpointCount; i += 2)
+    {
+        graph->outDegree[ends[i]]++;
+    }
+    offsets = pagerank_list_offsets(graph->outDegree, vertexCount);
+    outValues = (uint32 *) palloc_extended(Max(endpointCount / 2, 1) * sizeof(uint32), MCXT_ALLOC_HUGE);
+    for (uint64 i = 0; i < endpointCount; i += 2)
+    {
+        outValues[offsets[ends[i]]++] = ends[i + 1];
+    }
+    pfree(ends);
+
+    // walking the out-lists by source fills every in-list in ascending order of the sources
+    inDegree = (uint32 *) palloc_extended(Max(vertexCount, 1) * sizeof(uint32), MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+    for (uint64 i = 0; i < endpointCount / 2; i++)
+    {
+        inDegree[outValues[i]]++;
+    }
+    graph->csrOffsets = pagerank_list_offsets(inDegree, vertexCount);
+    graph->csrValues = (uint32 *) palloc_extended(Max(endpointCount / 2, 1) * sizeof(uint32), MCXT_ALLOC_HUGE);
+    // the fill left offsets[u] at the end of the out-list of u
+    for (uint64 u = 0, e = 0; u < vertexCount; u++)
+    {
+        for (; e < offsets[u]; e++)
+        {
+            graph->csrValues[graph->csrOffsets[outValues[e]]++] = (uint32) u;
+        }
+    }
+    memmove(graph->csrOffsets + 1, graph->csrOffsets, vertexCount * sizeof(uint64));
+    graph->csrOffsets[0] = 0;
+
+    pfree(inDegree);
+    pfree(outValues);
+    pfree(offsets);
+}
+
+/*
+ * The mode(arg 7), true for Gauss-Seidel, false for Jacobi iterations
+ */
+static bool pagerank_gauss_seidel(FunctionCallInfo fcinfo)
+{
+    char *mode;
+
+    if (fcinfo->nargs < 8)
+        return false;
+
+    mode = text_to_cstring(PG_GETARG_TEXT_PP(7));
+    if (pg_strcasecmp(mode, "gauss-seidel") == 0)
+        return true;
+    if (pg_strcasecmp(mode, "jacobi") != 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("unknown pagerank mode \"%s\"", mode),
+                 errhint("Use \"jacobi\" or \"gauss-seidel\".")));
+    return false;
+}
+
+/*
+ * Start from the ranks of a previous result(arg 8), its first column are the nodes, the second their pagerank
+ * The rows are radix sorted like the edge endpoints and merged with the vertices, which are in the same order.
+ * Vertices without a previous rank start from 1 / vertexCount, afterwards the ranks are scaled to sum up to 1, as
+ * vertices that are gone took their rank with them.
+ */
+static void pagerank_warm_start(const struct PageRankGraph *graph, double *rank, TypedTuplestore *previous,
+                                Oid keyType)
+{
+    TupleDesc desc = previous->tupledesc;
+    TupleTableSlot *slot = MakeTupleTableSlot(NULL);
+    struct PageRankKey *keys, *tmp, *sorted;
+    double *ranks;
+    double sum = 0.0;
+    uint64 rowCount = tuplestore_tuple_count(previous->tuplestorestate);
+    uint64 count = 0, matched = 0;
+
+    if (desc->natts < 2 || TupleDescAttr(desc, 0)->atttypid != keyType ||
+        TupleDescAttr(desc, 1)->atttypid != FLOAT8OID)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATATYPE_MISMATCH),
+                 errmsg("previous pagerank result must have the node as first and a float8 rank as second column")));
+
+    keys = (struct PageRankKey *) palloc_extended(Max(rowCount, 1) * sizeof(struct PageRankKey), MCXT_ALLOC_HUGE);
+    tmp = (struct PageRankKey *) palloc_extended(Max(rowCount, 1) * sizeof(struct PageRankKey), MCXT_ALLOC_HUGE);
+    ranks = (double *) palloc_extended(Max(rowCount, 1) * sizeof(double), MCXT_ALLOC_HUGE);
+
+    tuplestore_rescan(previous->tuplestorestate);
+    while (count < rowCount && tuplestore_gettupleslot(previous->tuplestorestate, true, false, slot))
+    {
+        bool keyNull, rankNull;
+        Datum key = heap_getattr(slot->tts_tuple, 1, desc, &keyNull);
+        double r = DatumGetFloat8(heap_getattr(slot->tts_tuple, 2, desc, &rankNull));
+
+        if (keyNull || rankNull || !isfinite(r) || r < 0.0)
+            continue;
+        keys[count].origKey = key;
+        keys[count].pos = count;
+        ranks[count] = r;
+        count++;
+    }
+    sorted = pagerank_radix_sort(keys, tmp, count);
+
+    for (uint64 v = 0, i = 0; v < (uint64) graph->vertexCount; v++)
+    {
+        rank[v] = 1.0 / graph->vertexCount;
+        while (i < count && sorted[i].origKey < graph->origKeys[v])
+        {
+            i++;
+        }
+        if (i < count && sorted[i].origKey == graph->origKeys[v])
+        {
+            rank[v] = ranks[sorted[i].pos];
+            matched++;
+        }
+        sum += rank[v];
+    }
+    if (sum > 0.0)
+    {
+        for (int v = 0; v < graph->vertexCount; v++)
+        {
+            rank[v] /= sum;
+        }
+    }
+
+    ereport(DEBUG1,
+            (errmsg("pagerank warm start: %lu of %d vertices had a previous rank",
+                    (unsigned long) matched, graph->vertexCount)));
+
+    pfree(keys);
+    pfree(tmp);
+    pfree(ranks);
 }
 
 Datum
 pagerank_internal(PG_FUNCTION_ARGS, int nthreads)
 {
     MemoryContext oldcontext;
-    ParamListInfo paramListInfo;
-    FuncCallContext  *funcctx;
     MemoryContext per_query_ctx;
-    int tupleCount;
+    uint64 tupleCount;
     TupleDesc outDesc = NULL;
-    HASHCTL ctl;
-    HTAB *mapping;
-    Datum *keys;
     bool isnull;
     double dampingFactor;
     double threshold;
@@ -130,21 +451,17 @@ pagerank_internal(PG_FUNCTION_ARGS, int nthreads)
     threshold = PG_GETARG_FLOAT8(4);
     iterations = PG_GETARG_INT32(5);
     HeapTuple   tuple;
-    struct PageRankNode* prData;
-    int64 *csrValues;
-    int64 *csrOffsets;
-    struct PageRankHash* hashLookup;
-    struct PageRankNode* it;
-    int dataCursor = 0, csrCursor = 0;
+    struct PageRankGraph graph;
+    struct PageRankKey *endpoints;
+    double *rank, *contrib1, *contrib2;
+    double dangling = 0;
+    bool gaussSeidel = pagerank_gauss_seidel(fcinfo);
+    uint64 x = 0;
     bool replIsNull[2];
     Datum replVal[2];
-    pthread_t workers[nthreads];
-    struct PageRankWorkerArgs *workerArgs = (struct PageRankWorkerArgs *) 
-        palloc0(nthreads * sizeof(struct PageRankWorkerArgs));
-    instr_time  starttime;
-    instr_time  endtime;
-    instr_time  ctr;
-    struct Edge *edges;
+    WorkerPool *pool;
+    void **poolArgs;
+    struct PageRankWorkerArgs *workerArgs;
 
     ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
 
@@ -166,14 +483,17 @@ pagerank_internal(PG_FUNCTION_ARGS, int nthreads)
             (errcode(ERRCODE_INTERNAL_ERROR),
              errmsg("src and dst lambda return types must be the same")));
     }
-    else if (lambdaSrc->rettypmod != -1 || lambdaDst->rettypmod != -1)
+    else if (lambdaSrc->rettypmod != -1 || lambdaDst->rettypmod != -1 || !get_typbyval(lambdaSrc->rettype))
     {
         ereport(ERROR,
             (errcode(ERRCODE_INTERNAL_ERROR),
              errmsg("Only base types can be used as keys.")));
     }
+    worker_pool_check_threads(nthreads);
 
     oldcontext = MemoryContextSwitchTo(per_query_ctx);
+    poolArgs = (void **) palloc(nthreads * sizeof(void *));
+    workerArgs = (struct PageRankWorkerArgs *) palloc0(nthreads * sizeof(struct PageRankWorkerArgs));
     TupleTableSlot *slot = MakeTupleTableSlot(NULL);
     TypedTuplestore *tts = (TypedTuplestore *) PG_GETARG_POINTER(0);
     Tuplestorestate *tsIn = tts->tuplestorestate;
@@ -188,144 +508,100 @@ pagerank_internal(PG_FUNCTION_ARGS, int nthreads)
     TupleDescInitEntry(outDesc, 2, "pagerank",
                FLOAT8OID, -1, 0);
 
-    ctl.keysize = get_typlen(lambdaSrc->rettype);
-    ctl.entrysize = sizeof(struct PageRankHash);
-
-    mapping = hash_create("pagerank_mapping",
-       tupleCount * 2,
-       &ctl,
-       HASH_ELEM | HASH_BLOBS );
-
-    prData = (struct PageRankNode *) palloc0(tupleCount * 2 * sizeof(struct PageRankNode));
-    edges = (struct Edge *) palloc0(tupleCount * sizeof(struct Edge));
-
-    int x = 0;
+    endpoints = (struct PageRankKey *) palloc_extended(Max(tupleCount * 2, 1) * sizeof(struct PageRankKey),
+                                                       MCXT_ALLOC_HUGE);
 
     while (tuplestore_gettupleslot(tsIn, true, false, slot))
     {     
-        bool found;
         HeapTupleHeader hdr = slot->tts_tuple->t_data;
         PG_LAMBDA_SETARG(lambdaSrc, 0, HeapTupleHeaderGetDatum(hdr));
         PG_LAMBDA_SETARG(lambdaDst, 0, HeapTupleHeaderGetDatum(hdr));
         Datum srcId = PG_LAMBDA_EVAL(lambdaSrc, 0, &isnull);
         Datum dstId = PG_LAMBDA_EVAL(lambdaDst, 1, &isnull);
 
-        struct PageRankHash hash;
-        hash.origKey = srcId;
-        hashLookup = (struct PageRankHash *) hash_search(mapping, &srcId, HASH_ENTER, &found);
-
-        if (!found)
-        {
-            hashLookup->node = prData + dataCursor;
-            hashLookup->node->origKey = srcId;
-            hashLookup->node->numLinks = 0;
-            hashLookup->node->csrOffset = -1;
-            hashLookup->node->aliasKey = dataCursor;
-            dataCursor++;
-        }
-
-        hashLookup->origKey = srcId;
-        hashLookup->node->numLinks++;
-
-        (edges + x)->src = hashLookup->node->aliasKey;
+        endpoints[2 * x].origKey = srcId;
+        endpoints[2 * x].pos = 2 * x;
+        endpoints[2 * x + 1].origKey = dstId;
+        endpoints[2 * x + 1].pos = 2 * x + 1;
+        x++;
+    }
 
-        hash.origKey = dstId;
-        hashLookup = (struct PageRankHash *) hash_search(mapping, &dstId, HASH_ENTER, &found);
+    pagerank_build_graph(&graph, endpoints, 2 * x);
 
-        if (!found)
+    rank = (double *) palloc_extended(Max(graph.vertexCount, 1) * sizeof(double), MCXT_ALLOC_HUGE);
+    contrib1 = (double *) palloc_extended(Max(graph.vertexCount, 1) * sizeof(double), MCXT_ALLOC_HUGE);
+    contrib2 = gaussSeidel ? contrib1 :
+        (double *) palloc_extended(Max(graph.vertexCount, 1) * sizeof(double), MCXT_ALLOC_HUGE);
+    if (fcinfo->nargs >= 9)
+    {
+        pagerank_warm_start(&graph, rank, (TypedTuplestore *) PG_GETARG_POINTER(8), lambdaSrc->rettype);
+    }
+    else
+    {
+        for (int v = 0; v < graph.vertexCount; v++)
         {
-            hashLookup->node = prData + dataCursor;   
-            hashLookup->node->numLinks = 0;
-            hashLookup->node->origKey = dstId; 
-            hashLookup->node->csrOffset = -1;      
-            hashLookup->node->aliasKey = dataCursor;   
-            dataCursor++;
+            rank[v] = 1.0 / graph.vertexCount;
         }
-
-        hashLookup->origKey = dstId;
-        (edges + x)->dst = hashLookup->node->aliasKey;
-        hashLookup->node->numLinks++;
-
-
-        x++;
     }
-
-    csrOffsets = (int64 *) palloc0(dataCursor * sizeof(int64));
-    csrValues = (int64 *) palloc0(tupleCount * 2 * sizeof(int64));
-
-    //tuplestore_end(tsIn);
-
-
-    INSTR_TIME_SET_CURRENT(starttime);
-
-    double invc = 1.0 / dataCursor;
-
-    for(int x = 0; x < tupleCount; x++)
-    {     
-        int64 srcAlias;
-        int64 srcId = (edges + x)->src;
-        int64 dstId = (edges + x)->dst;
-
-
-        int dstOffset;
-        int dstAlias;
-        it = (struct PageRankNode *) (prData + srcId);
-
-        if (it->csrOffset == -1) 
+    for (int v = 0; v < graph.vertexCount; v++)
+    {
+        if (graph.outDegree[v] == 0)
         {
-            it->csrOffset = 0;
-            it->pageRank1 = invc;
-            csrOffsets[srcId] = csrCursor;
-            csrCursor += it->numLinks;
+            dangling += rank[v];
+            contrib1[v] = 0.0;
         }
-
-
-        csrValues[csrOffsets[srcId] + it->csrOffset++] = dstId;
-
-        it = (struct PageRankNode *) (prData + dstId);
-
-        if (it->csrOffset == -1) 
+        else
         {
-            it->csrOffset = 0;
-            it->pageRank1 = invc;
-            csrOffsets[dstId] = csrCursor;
-            csrCursor += it->numLinks;
+            contrib1[v] = rank[v] / graph.outDegree[v];
         }
-
-        csrValues[csrOffsets[dstId] + it->csrOffset++] = srcId;
     }
 
-
-    int batchSize = ceil(dataCursor / nthreads);
-
+    // the graph is built and the previous ranks are read, the threads can be started
+    pool = worker_pool_get(fcinfo, nthreads);
 
     for (int j = 0; j < nthreads; j++)
     {
         workerArgs[j].dampingFactor = dampingFactor;
-        workerArgs[j].count = (j == nthreads - 1 && nthreads > 1) ? (dataCursor - batchSize * j) : batchSize;
-        workerArgs[j].totalCount = dataCursor;
-        workerArgs[j].prData = prData;
-        workerArgs[j].start = j * batchSize;
-        workerArgs[j].csrOffsets = csrOffsets;
-        workerArgs[j].csrValues = csrValues;
+        workerArgs[j].graph = &graph;
+        workerArgs[j].rank = rank;
+        poolArgs[j] = workerArgs + j;
     }
 
     for(int i = 0; i < iterations; i++)
     {
+        double *swap;
+        double delta = 0, residual = 0;
+
+        // the rank of the vertices without out-links is spread over all vertices, like the teleports
         for (int j = 0; j < nthreads; j++)
         {
-            workerArgs[j].even = i % 2 == 0;
-            pthread_create(&workers[j], NULL, &pagerank_worker, (void *) (workerArgs + j));
+            workerArgs[j].contribIn = contrib1;
+            workerArgs[j].contribOut = contrib2;
+            workerArgs[j].base = ((1.0 - dampingFactor) + dampingFactor * dangling) / graph.vertexCount;
+            workerArgs[j].delta = 0;
+            workerArgs[j].residual = 0;
+            workerArgs[j].dangling = 0;
         }
 
-        double delta = 0;
+        worker_pool_run(pool, pagerank_range, poolArgs, graph.vertexCount);
 
+        // contrib1 always holds the latest contributions
+        swap = contrib1;
+        contrib1 = contrib2;
+        contrib2 = swap;
+
+        // the ranges of a thread vary between runs, so only the maximum over all threads is meaningful
+        dangling = 0;
         for (int j = 0; j < nthreads; j++)
         {
-            pthread_join(workers[j], NULL);
-            delta += workerArgs[j].delta;
+            delta = fmax(delta, workerArgs[j].delta);
+            residual += workerArgs[j].residual;
+            dangling += workerArgs[j].dangling;
         }
 
+        ereport(DEBUG1,
+                (errmsg("pagerank iteration %d: residual %g, max change %g", i + 1, residual, delta)));
+
         if (delta < threshold)
         {
             break;
@@ -336,10 +612,10 @@ pagerank_internal(PG_FUNCTION_ARGS, int nthreads)
     replIsNull[0] = false;
     replIsNull[1] = false;
 
-    for(it = prData; it < prData + dataCursor; it++)
+    for (int v = 0; v < graph.vertexCount; v++)
     {
-        replVal[0] = it->origKey;
-        replVal[1] = Float8GetDatum(it->pageRank1);
+        replVal[0] = graph.origKeys[v];
+        replVal[1] = Float8GetDatum(rank[v]);
         tuple = heap_form_tuple(outDesc, replVal, replIsNull);
         tuplestore_puttuple(tsOut, tuple);
     }
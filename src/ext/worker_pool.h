@@ -0,0 +1,276 @@
+/*
+ * worker_pool.h
+ *    Persistent worker threads shared by the multithreaded table functions(kmeans_ext.c, pagerank_ext.c)
+ *
+ * The threads are started on the first call and live for the rest of the query, every iteration of an algorithm is
+ * a round between two barriers, instead of a pthread_create/pthread_join per thread.  The index range of a round is
+ * split into one contiguous part per thread, which it consumes in chunks.  Threads that finish early steal chunks from
+ * the parts of the others, so stragglers do not hold up the round.  The calling backend takes part as thread 0.
+ *
+ * The workers must not call into the backend(palloc, ereport, ...), which is not thread safe.
+ *
+ * The pool lives in its own memory context below the function's fn_mcxt.  Deleting that context stops and joins the
+ * threads, which happens at the end of the scan through an ExprContext callback, and with the query's memory when the
+ * query is aborted.  Errors are only raised by the calling backend between two rounds, when the workers wait at the
+ * start barrier, so they can always be stopped.
+ */
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "postgres.h"
+#include <pthread.h>
+#include <signal.h>
+#include "fmgr.h"
+#include "executor/executor.h"
+#include "nodes/execnodes.h"
+#include "port/atomics.h"
+#include "utils/memutils.h"
+
+/* upper bound of the threads of a pool, including the calling backend */
+#define WORKER_POOL_MAX_THREADS 1024
+
+/*
+ * Processes the indexes [START, START + COUNT) with the per thread state ARG
+ */
+typedef void (*WorkerPoolRangeFunc)(void *arg, int start, int count);
+
+/* the part of the index range owned by one thread, padded to avoid false sharing of the counters */
+typedef union WorkerPoolRange
+{
+    struct
+    {
+        pg_atomic_uint32 next; /* first index not yet handed out */
+        uint32 end;            /* end of the part */
+    } r;
+    char pad[PG_CACHE_LINE_SIZE];
+} WorkerPoolRange;
+
+typedef struct WorkerPool
+{
+    int nthreads;               /* including the calling backend */
+    pthread_t *threads;         /* nthreads - 1 threads */
+    int started;                /* number of threads started */
+    pthread_mutex_t startLock;  /* held while the threads are started */
+    pthread_barrier_t start;    /* all threads wait here for the next round */
+    pthread_barrier_t done;     /* all threads wait here at the end of a round */
+    bool shutdown;              /* set before the last start barrier */
+    FmgrInfo *flinfo;           /* the pool is cached in flinfo->fn_extra */
+    MemoryContext cxt;          /* holds the pool, deleting it stops the threads */
+    MemoryContextCallback stopCallback;
+
+    /* the current round */
+    WorkerPoolRangeFunc func;
+    void **args;
+    uint32 chunk;
+    WorkerPoolRange *ranges;
+} WorkerPool;
+
+typedef struct WorkerPoolThreadArgs
+{
+    WorkerPool *pool;
+    int id;
+} WorkerPoolThreadArgs;
+
+/*
+ * Work on the part of thread ID, then steal from the parts of the following threads
+ */
+static inline void worker_pool_work(WorkerPool *pool, int id)
+{
+    for (int v = 0; v < pool->nthreads; v++)
+    {
+        WorkerPoolRange *range = &pool->ranges[(id + v) % pool->nthreads];
+
+        for (;;)
+        {
+            uint32 start = pg_atomic_fetch_add_u32(&range->r.next, pool->chunk);
+
+            if (start >= range->r.end)
+                break;
+            pool->func(pool->args[id], (int)start, (int)Min(pool->chunk, range->r.end - start));
+        }
+    }
+}
+
+static void *worker_pool_thread(void *arg)
+{
+    WorkerPoolThreadArgs *targs = (WorkerPoolThreadArgs *)arg;
+    WorkerPool *pool = targs->pool;
+
+    // wait until every thread is started, if one could not be the pool is shut down right away
+    pthread_mutex_lock(&pool->startLock);
+    pthread_mutex_unlock(&pool->startLock);
+    if (pool->shutdown)
+        return (void *)0;
+
+    for (;;)
+    {
+        pthread_barrier_wait(&pool->start);
+        if (pool->shutdown)
+            break;
+        worker_pool_work(pool, targs->id);
+        pthread_barrier_wait(&pool->done);
+    }
+
+    return (void *)0;
+}
+
+/*
+ * Stop and join the threads, the reset callback of the pool's memory context
+ */
+static void worker_pool_stop(void *arg)
+{
+    WorkerPool *pool = (WorkerPool *)arg;
+
+    pool->shutdown = true;
+    pthread_barrier_wait(&pool->start);
+    for (int i = 0; i < pool->started; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_barrier_destroy(&pool->start);
+    pthread_barrier_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->startLock);
+
+    if (pool->flinfo->fn_extra == pool)
+        pool->flinfo->fn_extra = NULL;
+}
+
+/*
+ * End the pool at the end of the scan, registered as callback of the ExprContext of the calling table function
+ */
+static void worker_pool_end(Datum arg)
+{
+    WorkerPool *pool = (WorkerPool *)DatumGetPointer(arg);
+
+    MemoryContextDelete(pool->cxt);
+}
+
+/*
+ * Raise an error unless a pool can have NTHREADS threads
+ * Callers check this before they allocate anything per thread.
+ */
+static inline void worker_pool_check_threads(int nthreads)
+{
+    if (nthreads < 1 || nthreads > WORKER_POOL_MAX_THREADS)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("number of threads must be between 1 and %d", WORKER_POOL_MAX_THREADS)));
+}
+
+/*
+ * Return the pool of NTHREADS threads of the current function call, starting it on first use
+ * The arguments of the function should be validated before, so no error leaves the threads of a new pool unused.
+ */
+static inline WorkerPool *worker_pool_get(FunctionCallInfo fcinfo, int nthreads)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    WorkerPool *pool = (WorkerPool *)fcinfo->flinfo->fn_extra;
+    MemoryContext cxt;
+    MemoryContext oldcontext;
+    WorkerPoolThreadArgs *targs;
+    sigset_t all, old;
+
+    worker_pool_check_threads(nthreads);
+
+    if (pool != NULL && pool->nthreads == nthreads)
+        return pool;
+    if (pool != NULL)
+    {
+        UnregisterExprContextCallback(rsinfo->econtext, worker_pool_end, PointerGetDatum(pool));
+        worker_pool_end(PointerGetDatum(pool));
+    }
+
+    cxt = AllocSetContextCreate(fcinfo->flinfo->fn_mcxt, "worker pool", ALLOCSET_SMALL_SIZES);
+    oldcontext = MemoryContextSwitchTo(cxt);
+
+    pool = (WorkerPool *)palloc0(sizeof(WorkerPool));
+    pool->nthreads = nthreads;
+    pool->flinfo = fcinfo->flinfo;
+    pool->cxt = cxt;
+    pool->threads = (pthread_t *)palloc0(Max(nthreads - 1, 1) * sizeof(pthread_t));
+    pool->ranges = (WorkerPoolRange *)palloc0(nthreads * sizeof(WorkerPoolRange));
+    for (int i = 0; i < nthreads; i++)
+    {
+        pg_atomic_init_u32(&pool->ranges[i].r.next, 0);
+    }
+
+    targs = (WorkerPoolThreadArgs *)palloc(Max(nthreads - 1, 1) * sizeof(WorkerPoolThreadArgs));
+
+    pthread_mutex_init(&pool->startLock, NULL);
+    pthread_barrier_init(&pool->start, NULL, nthreads);
+    pthread_barrier_init(&pool->done, NULL, nthreads);
+
+    // the workers inherit a signal mask blocking everything, so the backend's handlers only run in the backend
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_mutex_lock(&pool->startLock);
+    for (int i = 0; i < nthreads - 1; i++)
+    {
+        targs[i].pool = pool;
+        targs[i].id = i + 1;
+        if (pthread_create(&pool->threads[i], NULL, worker_pool_thread, &targs[i]) != 0)
+            break;
+        pool->started++;
+    }
+    pool->shutdown = pool->started < nthreads - 1;
+    pthread_mutex_unlock(&pool->startLock);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    MemoryContextSwitchTo(oldcontext);
+
+    if (pool->shutdown)
+    {
+        // the started threads return without touching the barriers
+        int failed = pool->started + 1;
+
+        for (int i = 0; i < pool->started; i++)
+        {
+            pthread_join(pool->threads[i], NULL);
+        }
+        pthread_barrier_destroy(&pool->start);
+        pthread_barrier_destroy(&pool->done);
+        pthread_mutex_destroy(&pool->startLock);
+        MemoryContextDelete(cxt);
+        ereport(ERROR,
+                (errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+                 errmsg("could not start worker thread %d of %d", failed, nthreads)));
+    }
+
+    pool->stopCallback.func = worker_pool_stop;
+    pool->stopCallback.arg = pool;
+    MemoryContextRegisterResetCallback(cxt, &pool->stopCallback);
+
+    fcinfo->flinfo->fn_extra = pool;
+    RegisterExprContextCallback(rsinfo->econtext, worker_pool_end, PointerGetDatum(pool));
+
+    return pool;
+}
+
+/*
+ * Run FUNC over the indexes [0, TOTAL) on all threads, ARGS holds one state per thread
+ * Returns once every index has been processed.
+ */
+static inline void worker_pool_run(WorkerPool *pool, WorkerPoolRangeFunc func, void **args, int total)
+{
+    uint32 part = (uint32)(total + pool->nthreads - 1) / pool->nthreads;
+
+    pool->func = func;
+    pool->args = args;
+    // several chunks per part, so there is something left to steal
+    pool->chunk = Max(part / 16, 1);
+    for (int i = 0; i < pool->nthreads; i++)
+    {
+        uint32 begin = Min((uint32)i * part, (uint32)total);
+
+        pg_atomic_write_u32(&pool->ranges[i].r.next, begin);
+        pool->ranges[i].r.end = Min(begin + part, (uint32)total);
+    }
+
+    if (pool->nthreads > 1)
+        pthread_barrier_wait(&pool->start);
+    worker_pool_work(pool, 0);
+    if (pool->nthreads > 1)
+        pthread_barrier_wait(&pool->done);
+}
+
+#endif /* WORKER_POOL_H */
@@ -677,6 +677,62 @@ typedef struct ArrayRefState
 	bool		prevnull;
 } ArrayRefState; 
 
+/*
+ * Reverse-mode tape of a differentiable lambda expression
+ *
+ * The step list of a lambda is in postfix order and therefore already a
+ * Wengert list: the forward pass leaves every intermediate value in the
+ * fcinfo argument slots of the step consuming it. The tape adds the argument
+ * structure of each step and maps structurally identical, non-volatile
+ * subexpressions onto the step computing them first, so the reverse sweep
+ * visits every distinct op once, with its adjoint summed over all uses.
+ *
+ * A step is active, if its value depends on one of the inputs the lambda is
+ * derived for(see ExecInitLambdaExprWrt). Inactive steps, e.g. the labels
+ * or the features of a training row, get no adjoint and are never derived.
+ */
+typedef struct LambdaDeriveTape
+{
+	int			nsteps;			/* number of steps covered by the tape */
+	int		   *canonical;		/* first structurally equal step, per step */
+	int		   *nargs;			/* number of argument steps, per step */
+	int		   *argoffset;		/* start of a step's entries in args[] */
+	int		   *args;			/* steps producing the arguments, in order */
+	Datum	   *adjoints;		/* adjoint slot, per canonical step */
+	bool	   *hasadjoint;		/* adjoint slot written in current sweep? */
+	bool	   *active;			/* step depends on a derived input, per step */
+} LambdaDeriveTape;
+
+/* step index producing argument ARGNO of step STEP */
+#define LAMBDA_TAPE_ARG(tape, step, argno) \
+	((tape)->args[(tape)->argoffset[(step)] + (argno)])
+
+/* does argument ARGNO of step STEP need an adjoint? */
+#define LAMBDA_TAPE_ARG_ACTIVE(tape, step, argno) \
+	((tape)->active[LAMBDA_TAPE_ARG(tape, step, argno)])
+
+/*
+ * State to derive a scalar(float8 only) lambda for a batch of rows at once.
+ *
+ * Every canonical step of the tape owns a column of maxrows values and
+ * adjoints, the forward pass and the reverse sweep each walk the steps once
+ * and apply the operation element-wise on whole columns, instead of
+ * interpreting the steps once per row.  See execLambdaBatch.c.
+ */
+typedef struct LambdaBatch
+{
+	ExprState  *state;			/* lambda, with derivTape built */
+	int			maxrows;		/* capacity of every column */
+	float8	   *values;			/* forward values, nsteps columns */
+	float8	   *adjoints;		/* adjoints, nsteps columns */
+	bool	   *hasadjoint;		/* adjoint column written in current sweep? */
+	float8	   *scratch;		/* one column for partial derivatives */
+} LambdaBatch;
+
+/* column of step STEP in VALUES or ADJOINTS of a LambdaBatch */
+#define LAMBDA_BATCH_COLUMN(batch, columns, step) \
+	((batch)->columns + (Size) (batch)->state->derivTape->canonical[(step)] * (batch)->maxrows)
+
 
 
 /* functions in execExpr.c */
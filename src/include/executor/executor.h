@@ -248,16 +248,33 @@ ExecProcNode(PlanState *node)
 }
 #endif
 
+/*
+ * How a lambda expression is executed, see ExecInitLambdaExprTier()
+ */
+typedef enum LambdaTier
+{
+	LAMBDA_TIER_INTERPRETED,	/* interpreted, nothing is compiled */
+	LAMBDA_TIER_BASELINE,		/* JIT-compiled without -O3 and inlining */
+	LAMBDA_TIER_OPTIMIZED		/* JIT-compiled with -O3 and inlining */
+} LambdaTier;
+
 /*
  * prototypes from functions in execExpr.c
  */
 extern ExprState *ExecInitExpr(Expr *node, PlanState *parent);
 extern ExprState *ExecInitLambdaExpr(Node *node, bool fastLambda, bool buildDiff);
+extern ExprState *ExecInitLambdaExprWrt(Node *node, bool fastLambda, bool buildDiff, Bitmapset *wrt);
+extern ExprState *ExecInitLambdaExprTier(Node *node, bool fastLambda, bool buildDiff, Bitmapset *wrt,
+					   LambdaTier tier);
 extern Datum ExecDeriveLambdaExpr(ExprState *expression, ExprContext *econtext, bool *isNull, Datum *derivatives);
 extern void ExecCheckLambdaForMatrix(ExprState *expression);
+extern void ExecCheckLambdaDerivable(LambdaExpr *expr);
 extern int *ExecGenerateIndexArray(LambdaExpr *lambda);
+extern char *ExecLambdaCacheKey(LambdaExpr *lambda, Bitmapset *wrt);
+extern uint64 ExecLambdaFingerprint(LambdaExpr *lambda);
 extern int ExecGetLambdaDerivativesLength(LambdaExpr *expr);
-extern int ExecLambdaDeriveSubtree(ExprState *state, int fetchIndex, Datum seed, Datum *derivatives);
+extern void ExecBuildLambdaDeriveTape(ExprState *state, Bitmapset *wrt);
+extern void ExecLambdaDeriveStep(ExprState *state, int fetchIndex, Datum seed, Datum *derivatives);
 extern ExprState *ExecInitExprWithParams(Expr *node, ParamListInfo ext_params);
 extern ExprState *ExecInitQual(List *qual, PlanState *parent);
 extern ExprState *ExecInitCheck(List *qual, PlanState *parent);
@@ -412,6 +429,22 @@ ExecQualAndReset(ExprState *state, ExprContext *econtext)
 
 extern bool ExecCheck(ExprState *state, ExprContext *context);
 
+/*
+ * prototypes from functions in execLambdaBatch.c
+ */
+struct LambdaBatch;
+extern bool ExecLambdaBatchSupported(ExprState *state);
+extern struct LambdaBatch *ExecInitLambdaBatch(ExprState *state, int maxrows);
+extern void ExecDeriveLambdaBatch(struct LambdaBatch *batch, int nrows, float8 **columns,
+								  float8 *results, float8 **derivatives);
+
+/*
+ * prototypes from functions in execLambdaInstr.c
+ */
+extern bool track_lambdas;
+extern LambdaInstrumentation *ExecLambdaInstrumentation(LambdaExpr *lambda);
+extern void ExecReportLambdaInstrumentation(PlanState *node);
+
 /*
  * prototypes from functions in execSRF.c
  */
@@ -422,6 +455,12 @@ extern Tuplestorestate *ExecMakeTableFunctionResult(SetExprState *setexpr,
 							MemoryContext argContext,
 							TupleDesc expectedDesc,
 							bool randomAccess);
+extern TupleTableSlot *ExecNextTableFunctionResult(SetExprState *setexpr,
+							ExprContext *econtext,
+							MemoryContext argContext,
+							TupleDesc expectedDesc,
+							TableFunctionStream *stream,
+							TupleTableSlot *slot);
 extern SetExprState *ExecInitFunctionResultSet(Expr *expr,
 						  ExprContext *econtext, PlanState *parent);
 extern Datum ExecMakeFunctionResultSet(SetExprState *fcache,
@@ -64,6 +64,38 @@ typedef struct Instrumentation
 	BufferUsage bufusage;		/* Total buffer usage */
 } Instrumentation;
 
+/* What a timed call of a lambda expression did, see InstrLambdaStop */
+typedef enum LambdaInstrCall
+{
+	LAMBDA_INSTR_COMPILE,		/* initialized or compiled the lambda */
+	LAMBDA_INSTR_EVAL,			/* evaluated the lambda */
+	LAMBDA_INSTR_DERIVE			/* derived the lambda */
+} LambdaInstrCall;
+
+/*
+ * Per lambda expression statistics of a plan node, see execLambdaInstr.c
+ */
+typedef struct LambdaInstrumentation
+{
+	struct LambdaExpr *lambda;	/* the instrumented lambda */
+	uint64		fingerprint;	/* hash of the lambda, see ExecLambdaFingerprint */
+	int			tier;			/* LambdaTier of the current code */
+	/* Info about the current call: */
+	instr_time	starttime;		/* start time of the call */
+	instr_time	kernel_start;	/* matrix kernel time at the start */
+	uint64		bytes_start;	/* matrix bytes allocated at the start */
+	/* Accumulated statistics: */
+	int64		ncompiles;		/* # of initializations */
+	instr_time	compile_time[3];	/* initialization and compile time per tier */
+	int64		nevals;			/* # of evaluations */
+	instr_time	eval_time;		/* time spent evaluating */
+	int64		nderives;		/* # of derivations */
+	instr_time	derive_time;	/* time spent deriving */
+	instr_time	kernel_time;	/* part of eval_time and derive_time spent in
+								 * matrix kernels */
+	uint64		kernel_bytes;	/* bytes of matrices allocated by the calls */
+} LambdaInstrumentation;
+
 typedef struct WorkerInstrumentation
 {
 	int			num_workers;	/* # of structures that follow */
@@ -81,5 +113,7 @@ extern void InstrAggNode(Instrumentation *dst, Instrumentation *add);
 extern void InstrStartParallelQuery(void);
 extern void InstrEndParallelQuery(BufferUsage *result);
 extern void InstrAccumParallelQuery(BufferUsage *result);
+extern void InstrLambdaStart(LambdaInstrumentation *instr);
+extern void InstrLambdaStop(LambdaInstrumentation *instr, LambdaInstrCall call, int64 ncalls);
 
 #endif							/* INSTRUMENT_H */
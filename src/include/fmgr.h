@@ -380,6 +380,7 @@ typedef struct
 {
 	int					 api_version;	/* specifies call convention version number */
 	fmRecordTypeFunction rectype_func;	/* callback for retrieving the RECORD type */
+	bool				 streaming;		/* set-returning function may be streamed */
 
 	/* More fields may be added later, for version numbers > 1. */
 } Pg_finfo_record;
@@ -422,6 +423,25 @@ CppConcat(pg_finfo_,funcname) (void) \
 } \
 extern int no_such_variable
 
+/*
+ * As PG_FUNCTION_INFO_V1_RECTYPE, for a set-returning function that opts in
+ * to being called one row at a time by a function scan, instead of having
+ * its whole result materialized before the first row is returned (see
+ * ExecNextTableFunctionResult).  The function must return its rows in
+ * value-per-call mode when the caller allows it, and it may be called again
+ * from the start on every rescan with changed parameters.
+ */
+#define PG_FUNCTION_INFO_V1_STREAMING(funcname, rectypeFunc) \
+extern Datum funcname(PG_FUNCTION_ARGS); \
+extern PGDLLEXPORT const Pg_finfo_record * CppConcat(pg_finfo_,funcname)(void); \
+const Pg_finfo_record * \
+CppConcat(pg_finfo_,funcname) (void) \
+{ \
+	static const Pg_finfo_record my_finfo = { 1, rectypeFunc, true }; \
+	return &my_finfo; \
+} \
+extern int no_such_variable
+
 
 /*-------------------------------------------------------------------------
  *		Support for verifying backend compatibility of loaded modules
@@ -699,6 +719,7 @@ extern bytea *OidSendFunctionCall(Oid functionId, Datum val);
  * Routines in fmgr.c
  */
 extern const Pg_finfo_record *fetch_finfo_record(void *filehandle, const char *funcname);
+extern bool fmgr_streams_result(Oid functionId);
 extern void clear_external_function_hash(void *filehandle);
 extern Oid	fmgr_internal_function(const char *proname);
 extern Oid	get_fn_expr_rettype(FmgrInfo *flinfo);
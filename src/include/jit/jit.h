@@ -95,6 +95,9 @@ extern bool jit_tuple_deforming;
 extern double jit_above_cost;
 extern double jit_inline_above_cost;
 extern double jit_optimize_above_cost;
+extern int	jit_lambda_cache_size;
+extern int	jit_lambda_tier_rows;
+extern bool jit_lambda_tier_baseline;
 
 
 extern void jit_reset_after_error(void);
@@ -74,6 +74,9 @@ typedef struct LLVMJitContext
 
 	/* list of simple eval func names */
 	List 	   *simpleFuncnames;
+
+	/* cache keys of the simple lambdas, in the order of simpleFuncnames */
+	List	   *lambdaKeys;
 } LLVMJitContext;
 
 
@@ -130,6 +133,13 @@ extern void llvm_enter_tmp_context(EState *state);
 extern void llvm_leave_tmp_context(EState *state);
 extern char *llvm_expand_funcname(LLVMJitContext *context, const char *basename, bool simple);
 extern void *llvm_get_function(LLVMJitContext *context, const char *funcname);
+extern void *llvm_get_cached_function(LLVMJitContext *context, const char *funcname,
+						 const char *lambda_key, const char *target);
+extern void *llvm_lambda_cache_lookup(const char *key);
+extern void llvm_lambda_cache_store(LLVMJitContext *context, const char *key, void *func, int first_handle);
+extern bool llvm_lambda_cache_has_derivation(LambdaExpr *lambda);
+extern char *llvm_lambda_cache_tablefunc_key(LLVMJitContext *context, const char *bcModule,
+								const char *funcName, int numLambdas);
 extern void llvm_split_symbol_name(const char *name, char **modname, char **funcname);
 extern LLVMValueRef llvm_get_decl(LLVMModuleRef mod, LLVMValueRef f);
 extern void llvm_copy_attributes(LLVMValueRef from, LLVMValueRef to);
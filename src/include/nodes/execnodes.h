@@ -143,6 +143,22 @@ typedef struct ExprState
 	 * Indicates, where a certain variable lies inside derivatives-array
 	 */
 	int 	    *indexArray;
+
+	/*
+	 * Key of a fast lambda in the cache of compiled lambdas(see
+	 * ExecLambdaCacheKey), NULL if its code must not be cached
+	 */
+	char       *lambda_cache_key;
+
+	/*
+	 * Reverse-mode tape for derivations, see LambdaDeriveTape in execExpr.h
+	 */
+	struct LambdaDeriveTape *derivTape;
+
+	/*
+	 * Statistics of a lambda, if instrumented(see ExecLambdaInstrumentation)
+	 */
+	struct LambdaInstrumentation *lambda_instr;
 } ExprState;
 
 
@@ -853,6 +869,24 @@ typedef struct SetExprState
 	FunctionCallInfoData fcinfo_data;
 } SetExprState;
 
+/* ----------------
+ *		TableFunctionStream
+ *
+ * State of a table function whose rows are fetched one call at a time by
+ * ExecNextTableFunctionResult, instead of being materialized up front.
+ * ----------------
+ */
+typedef struct TableFunctionStream
+{
+	FunctionCallInfoData fcinfo;	/* arguments, valid once started */
+	ReturnSetInfo rsinfo;
+	bool		started;		/* arguments evaluated */
+	bool		done;			/* function returned its last row */
+	TupleDesc	tupdesc;		/* row type of the composite results */
+	HeapTupleData tuple;		/* the current composite result */
+	Tuplestorestate *tstore;	/* result of a function that materialized */
+} TableFunctionStream;
+
 /* ----------------
  *		SubPlanState node
  * ----------------
@@ -969,6 +1003,9 @@ typedef struct PlanState
 	/* Per-worker JIT instrumentation */
 	struct SharedJitInstrumentation *worker_jit_instrument;
 
+	/* LambdaInstrumentation of the lambdas passed to this node's functions */
+	List	   *lambda_instrument;
+
 	/*
 	 * Common structural data for all Plan types.  These links to subsidiary
 	 * state trees parallel links in the associated plan tree (except for the
@@ -62,6 +62,7 @@
 #define ARRAY_H
 
 #include "fmgr.h"
+#include "portability/instr_time.h"
 #include "utils/expandeddatum.h"
 
 /* avoid including execnodes.h here */
@@ -471,18 +472,26 @@ extern Datum softmax(PG_FUNCTION_ARGS);
 extern Datum softmax_cce(PG_FUNCTION_ARGS);
 extern Datum softmax_cce_internal(Datum inputs_in, Datum labels_in);
 extern Datum softmax_cce_derive(Datum inputs_in, Datum labels_in);
+extern Datum softmax_cce_backward(Datum seed, Datum inputs_in, Datum labels_in);
+extern Datum softmax_cce_class(PG_FUNCTION_ARGS);
+extern Datum softmax_cce_class_internal(Datum inputs_in, Datum class_in);
+extern Datum softmax_cce_class_backward(Datum seed, Datum inputs_in, Datum class_in);
 extern Datum silu_m(PG_FUNCTION_ARGS);
 extern Datum silu_m_internal(Datum input);
 extern Datum silu_m_derive(Datum input);
+extern Datum silu_m_backward(Datum seed, Datum input);
 extern Datum sigmoid_m(PG_FUNCTION_ARGS);
 extern Datum sigmoid_m_internal(Datum input);
 extern Datum sigmoid_m_derive(Datum input);
+extern Datum sigmoid_m_backward(Datum seed, Datum input);
 extern Datum tanh_m(PG_FUNCTION_ARGS);
 extern Datum tanh_m_internal(Datum input);
 extern Datum tanh_m_derive(Datum input);
+extern Datum tanh_m_backward(Datum seed, Datum input);
 extern Datum relu_m(PG_FUNCTION_ARGS);
 extern Datum relu_m_internal(Datum input);
 extern Datum relu_m_derive(Datum input);
+extern Datum relu_m_backward(Datum seed, Datum input);
 extern ArrayType *initResult(int ndims, int *dims, int *lbs);
 extern ArrayType *copyArray(Datum orgArray);
 extern Datum createArray(int *dims, float8 value, bool identityMatrix);
@@ -493,4 +502,64 @@ extern Datum index_max(PG_FUNCTION_ARGS);
 extern void matrixPrint(ArrayType *in);
 extern void matrixSetValue(Datum in, float8 value);
 
+/*
+ * prototypes for functions defined in matrix_vecmath.c
+ */
+typedef enum MatrixActivation
+{
+	MATRIX_ACT_SILU,
+	MATRIX_ACT_SIGMOID,
+	MATRIX_ACT_TANH,
+	MATRIX_ACT_RELU
+} MatrixActivation;
+
+extern void matrix_activation_forward(MatrixActivation act, const float8 *in, float8 *out, Size n);
+extern void matrix_activation_backward(MatrixActivation act, const float8 *seed, bool seedIsScalar,
+                                       const float8 *in, float8 *out, Size n);
+
+/*
+ * prototypes for functions defined in matrix_gemm.c
+ */
+extern void matrix_gemm(const float8 *A, const float8 *B, float8 *C, int m, int k, int n,
+                        bool transA, bool transB);
+
+/*
+ * prototypes for functions defined in matrix_parallel.c
+ */
+typedef void (*MatrixParallelFunc) (void *arg, int start, int end);
+
+/* work(about one unit per floating point operation) below which another thread does not pay off */
+#define MATRIX_PARALLEL_MIN_WORK (1 << 16)
+
+typedef enum MatrixElemOp
+{
+	MATRIX_ELEM_ADD,			/* out = a + b */
+	MATRIX_ELEM_SUB,			/* out = a - b */
+	MATRIX_ELEM_MUL,			/* out = a * b */
+	MATRIX_ELEM_ADD_SCALAR,		/* out = a + s */
+	MATRIX_ELEM_MUL_SCALAR		/* out = a * s */
+} MatrixElemOp;
+
+extern int matrix_parallel_workers;
+
+/*
+ * Time spent in the matrix kernels and bytes of matrices allocated, counted
+ * during the calls of instrumented lambdas(see InstrLambdaStart)
+ */
+typedef struct MatrixInstrumentation
+{
+	bool		enabled;		/* true while an instrumented call runs */
+	int			depth;			/* nesting of kernels, only the outermost is timed */
+	instr_time	kernel_time;
+	uint64		bytes;
+} MatrixInstrumentation;
+
+extern MatrixInstrumentation matrix_instrument;
+
+extern void matrix_kernel_begin(instr_time *start);
+extern void matrix_kernel_end(const instr_time *start);
+extern void matrix_parallel_for(int n, double work_per_item, MatrixParallelFunc func, void *arg);
+extern void matrix_elementwise(MatrixElemOp op, const float8 *a, const float8 *b, float8 s,
+                               float8 *out, Size n);
+
 #endif							/* ARRAY_H */
@@ -0,0 +1,74 @@
+/*-------------------------------------------------------------------------
+ *
+ * matrix.h
+ *	  Declarations for the native dense matrix type.
+ *
+ * A matrix is a varlena object with a fixed header, followed by the
+ * elements as contiguous float8 values in row-major order:
+ *	  <vl_len_>		- standard varlena header word
+ *	  <rows>		- number of rows
+ *	  <cols>		- number of columns
+ *	  <flags>		- MATRIX_IS_SCALAR, MATRIX_IS_VECTOR
+ *	  <actual data> - rows * cols float8 values, never null
+ *
+ * The header is 16 bytes, so the data starts on a MAXALIGN boundary.
+ *
+ * In contrast to float8[] there is no null bitmap, no lower bounds and no
+ * element type to check, so kernels can work directly on the float8 data.
+ * Scalars(results of the automatic differentiation) are flagged, instead of
+ * marked with a lower bound of -1.  Vectors are Nx1 matrices, which are
+ * converted from and to one dimensional float8 arrays.
+ * A matrix has at least one element, scalars are 1x1.
+ *
+ * The matrix type is a storage type: lambdas over matrix values can be
+ * evaluated, but not derived, as the automatic differentiation only knows the
+ * float8[] versions of the matrix functions.  Inputs to derive have to be cast
+ * to float8[](see ExecCheckLambdaDerivable).
+ *
+ * src/include/utils/matrix.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include "fmgr.h"
+#include "utils/array.h"
+
+typedef struct Matrix
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	int32		rows;			/* number of rows */
+	int32		cols;			/* number of columns */
+	int32		flags;			/* see below */
+	/* float8 data follows, starting at MATRIX_HDRSZ */
+} Matrix;
+
+/* flags */
+#define MATRIX_IS_SCALAR	0x0001	/* single value, result of a derivation */
+#define MATRIX_IS_VECTOR	0x0002	/* created from a one dimensional array */
+
+#define MATRIX_HDRSZ		MAXALIGN(sizeof(Matrix))
+
+#define MATRIX_NELEMS(m)	((Size) (m)->rows * (Size) (m)->cols)
+#define MATRIX_SIZE(rows, cols) \
+	(MATRIX_HDRSZ + (Size) (rows) * (Size) (cols) * sizeof(float8))
+#define MATRIX_DATA(m)		((float8 *) (((char *) (m)) + MATRIX_HDRSZ))
+#define MATRIX_ISSCALAR(m)	(((m)->flags & MATRIX_IS_SCALAR) != 0)
+
+#define DatumGetMatrixP(X)		((Matrix *) PG_DETOAST_DATUM(X))
+#define DatumGetMatrixPCopy(X)	((Matrix *) PG_DETOAST_DATUM_COPY(X))
+#define MatrixPGetDatum(X)		PointerGetDatum(X)
+#define PG_GETARG_MATRIX_P(n)	DatumGetMatrixP(PG_GETARG_DATUM(n))
+#define PG_GETARG_MATRIX_P_COPY(n) DatumGetMatrixPCopy(PG_GETARG_DATUM(n))
+#define PG_RETURN_MATRIX_P(x)	PG_RETURN_POINTER(x)
+
+/*
+ * prototypes for functions defined in matrix.c
+ */
+extern Matrix *matrix_create(int rows, int cols, int flags);
+extern Matrix *matrix_copy(Matrix *in);
+extern Matrix *matrix_from_array(ArrayType *in);
+extern ArrayType *matrix_to_array(Matrix *in);
+
+#endif							/* MATRIX_H */
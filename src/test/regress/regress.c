@@ -29,6 +29,7 @@
 #include "commands/trigger.h"
 #include "executor/executor.h"
 #include "executor/spi.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "port/atomics.h"
 #include "utils/builtins.h"
@@ -859,3 +860,43 @@ test_fdw_handler(PG_FUNCTION_ARGS)
 	elog(ERROR, "test_fdw_handler is not implemented");
 	PG_RETURN_NULL();
 }
+
+/*
+ * regress_stream_series(start int4, stop int4) returns setof int4
+ *
+ * Like generate_series, but opts in to being streamed by a function scan,
+ * and reports every row it produces, so the tests can tell how far a scan
+ * ran the function.
+ */
+PG_FUNCTION_INFO_V1_STREAMING(regress_stream_series, NULL);
+Datum
+regress_stream_series(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	int64	   *current;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+		current = (int64 *) palloc(sizeof(int64));
+		*current = PG_GETARG_INT32(0);
+		funcctx->user_fctx = current;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	current = (int64 *) funcctx->user_fctx;
+
+	if (*current <= PG_GETARG_INT32(1))
+	{
+		int32		result = (int32) (*current)++;
+
+		elog(NOTICE, "producing %d", result);
+		SRF_RETURN_NEXT(funcctx, Int32GetDatum(result));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
@@ -0,0 +1,48 @@
+--
+-- MATRIX
+--
+-- text I/O is the one of float8[], vectors stay one dimensional
+SELECT '{{1,2},{3,4}}'::matrix;
+SELECT '{1.5,-2,3}'::matrix;
+-- scalars are marked with a lower bound of -1
+SELECT '[-1:-1]={5}'::matrix;
+-- bad input
+SELECT '{}'::matrix;
+SELECT '{1,NULL}'::matrix;
+SELECT '{{{1}}}'::matrix;
+-- casts from and to float8[]
+SELECT '{{1,2},{3,4}}'::float8[]::matrix::float8[];
+SELECT array_dims('{1,2,3}'::matrix::float8[]);
+-- binary output: rows, cols, flags, then the elements
+SELECT matrix_send('{{1,2}}'::matrix);
+SELECT matrix_send('{1,2}'::matrix);
+-- operators
+SELECT '{{1,2},{3,4}}'::matrix + '{{10,20},{30,40}}'::matrix;
+SELECT '{{1,2},{3,4}}'::matrix - '{{1,1},{1,1}}'::matrix;
+SELECT '{{1,2},{3,4}}'::matrix * '{{1,2},{3,4}}'::matrix;
+SELECT '{{1,2},{3,4}}'::matrix ** '{{5,6},{7,8}}'::matrix;
+SELECT '{{1,2},{3,4}}'::matrix ** '{1,1}'::matrix;
+SELECT '{{1,2}}'::matrix ** '{3,4}'::matrix;
+SELECT '{{1,2}}'::matrix ** '{{1,2}}'::matrix;
+SELECT '{{1,2}}'::matrix + '{{1,2},{3,4}}'::matrix;
+SELECT '{{1,2}}'::matrix - '{{1,2},{3,4}}'::matrix;
+-- scalars are broadcast to every element
+SELECT '{{1,2},{3,4}}'::matrix + '[-1:-1]={10}'::matrix;
+SELECT '[-1:-1]={10}'::matrix + '{{1,2},{3,4}}'::matrix;
+SELECT '{{1,2},{3,4}}'::matrix - '[-1:-1]={1}'::matrix;
+SELECT '[-1:-1]={10}'::matrix - '{{1,2},{3,4}}'::matrix;
+SELECT '{{1,2},{3,4}}'::matrix * '[-1:-1]={2}'::matrix;
+-- functions
+SELECT transpose('{{1,2,3},{4,5,6}}'::matrix);
+SELECT transpose('{{1,2,3}}'::matrix);
+SELECT index_max('{{1,5},{3,2}}'::matrix);
+SELECT relu_m('{{-1,2},{3,-4}}'::matrix);
+SELECT sigmoid_m('{{0,0}}'::matrix), tanh_m('{{0,0}}'::matrix), silu_m('{{0,0}}'::matrix);
+SELECT softmax('{{0,0}}'::matrix);
+SELECT softmax_cce('{{0,0}}'::matrix, '{{1,0}}'::matrix);
+SELECT softmax_cce('{{0,0}}'::matrix, '{{1,0,0}}'::matrix);
+-- storage
+CREATE TABLE matrix_tbl (m matrix);
+INSERT INTO matrix_tbl VALUES ('{{1,2},{3,4}}'), ('{5,6}'), ('[-1:-1]={7}');
+SELECT m, transpose(m) FROM matrix_tbl;
+DROP TABLE matrix_tbl;
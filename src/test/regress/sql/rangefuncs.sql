@@ -641,3 +641,15 @@ select *, row_to_json(u) from unnest(array[null::rngfunc2, (1,'foo')::rngfunc2,
 select *, row_to_json(u) from unnest(array[]::rngfunc2[]) u;
 
 drop type rngfunc2;
+
+--
+-- Streamed set-returning functions (regress_stream_series reports each row
+-- it produces)
+--
+
+-- a LIMIT stops the function early
+select * from regress_stream_series(1, 10) s(v) limit 3;
+-- a parameterized rescan calls the function again with the new arguments
+select t.a, s.v from (values (1), (2)) t(a), lateral regress_stream_series(t.a, t.a + 1) s(v);
+-- WITH ORDINALITY materializes the whole result
+select * from regress_stream_series(1, 10) with ordinality as s(v, n) limit 3;